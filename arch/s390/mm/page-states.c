@@ -93,22 +93,26 @@ void arch_set_page_states(int make_stable)
 	struct list_head *l;
 	struct page *page;
 	struct zone *zone;
+	struct zone_shard *shard;
 
 	if (!cmma_flag)
 		return;
 	if (make_stable)
 		drain_local_pages(NULL);
 	for_each_populated_zone(zone) {
-		spin_lock_irqsave(&zone->lock, flags);
-		for_each_migratetype_order(order, t) {
-			list_for_each(l, &zone->free_area[order].free_list[t]) {
-				page = list_entry(l, struct page, lru);
-				if (make_stable)
-					set_page_stable(page, order);
-				else
-					set_page_unstable(page, order);
+		zone_lock_shards_irqsave(zone, flags);
+		for_each_zone_shard(shard, zone) {
+			for_each_migratetype_order(order, t) {
+				list_for_each(l,
+				    &shard->free_area[order].free_list[t]) {
+					page = list_entry(l, struct page, lru);
+					if (make_stable)
+						set_page_stable(page, order);
+					else
+						set_page_unstable(page, order);
+				}
 			}
 		}
-		spin_unlock_irqrestore(&zone->lock, flags);
+		zone_unlock_shards_irqrestore(zone, flags);
 	}
 }
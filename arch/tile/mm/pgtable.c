@@ -69,14 +69,14 @@ void show_mem(unsigned int filter)
 		if (!populated_zone(zone))
 			continue;
 
-		spin_lock_irqsave(&zone->lock, flags);
+		zone_lock_shards_irqsave(zone, flags);
 		for (order = 0; order < MAX_ORDER; order++) {
-			int nr = zone->free_area[order].nr_free;
+			int nr = zone_free_area_nr(zone, order);
 			total += nr << order;
 			if (nr)
 				largest_order = order;
 		}
-		spin_unlock_irqrestore(&zone->lock, flags);
+		zone_unlock_shards_irqrestore(zone, flags);
 		pr_err("Node %d %7s: %lukB (largest %luKb)\n",
 		       zone_to_nid(zone), zone->name,
 		       K(total), largest_order ? K(1UL) << largest_order : 0);
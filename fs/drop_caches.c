@@ -44,8 +44,9 @@ static void drop_slab(void)
 		.gfp_mask = GFP_KERNEL,
 	};
 
+	nodes_setall(shrink.nodes_to_scan);
 	do {
-		nr_objects = shrink_slab(&shrink, 1000, 1000);
+		nr_objects = shrink_slab_memcg(&shrink, NULL, 1000, 1000);
 	} while (nr_objects > 10);
 }
 
@@ -42,6 +42,10 @@ enum bdi_stat_item {
 	BDI_WRITEBACK,
 	BDI_DIRTIED,
 	BDI_WRITTEN,
+	BDI_READ_HIT,
+	BDI_READ_MISS,
+	BDI_READAHEAD,
+	BDI_READAHEAD_STRIDE,
 	NR_BDI_STAT_ITEMS
 };
 
@@ -0,0 +1,103 @@
+/*
+ * MCS lock defines
+ *
+ * This file contains the main data structure and API definitions of MCS lock.
+ *
+ * The MCS lock (proposed by Mellor-Crummey and Scott) is a simple spin-lock
+ * with the desirable properties of being fair, and with each cpu trying
+ * to acquire the lock spinning on a local variable.
+ * It avoids expensive cache bouncings that common test-and-set spin-lock
+ * implementations incur.
+ *
+ * The sleeping locks use it to queue their optimistic spinners, so that
+ * only the spinner at the head of the queue polls the lock word and the
+ * owner while the others spin on their own node.  The caller provides
+ * the node's storage, on its stack or in a per-cpu variable, and must not
+ * be preempted while the node is queued.
+ */
+#ifndef __LINUX_MCS_SPINLOCK_H
+#define __LINUX_MCS_SPINLOCK_H
+
+#include <linux/compiler.h>
+#include <linux/atomic.h>
+#include <asm/processor.h>
+#include <asm/barrier.h>
+
+struct mcs_spinlock {
+	struct mcs_spinlock *next;
+	int locked; /* 1 if lock acquired */
+	int count;  /* nesting count, see qspinlock.c */
+};
+
+/*
+ * Spin until the previous lock holder passes the lock down by setting
+ * *l, which must then be seen before anything done under the lock.
+ */
+#define arch_mcs_spin_lock_contended(l)				\
+do {								\
+	while (!ACCESS_ONCE(*(l)))				\
+		cpu_relax();					\
+	smp_mb();						\
+} while (0)
+
+/*
+ * Pass the lock down to the next waiter, once everything done under
+ * the lock is visible.
+ */
+#define arch_mcs_spin_unlock_contended(l)			\
+do {								\
+	smp_mb();						\
+	ACCESS_ONCE(*(l)) = 1;					\
+} while (0)
+
+/*
+ * In order to acquire the lock, the caller should declare a local node and
+ * pass a reference of the node to this function in addition to the lock.
+ * If the lock has already been acquired, then this will proceed to spin
+ * on this node->locked until the previous lock holder sets the node->locked
+ * in mcs_spin_unlock().
+ */
+static inline
+void mcs_spin_lock(struct mcs_spinlock **lock, struct mcs_spinlock *node)
+{
+	struct mcs_spinlock *prev;
+
+	/* Init node */
+	node->locked = 0;
+	node->next   = NULL;
+
+	prev = xchg(lock, node);
+	if (likely(prev == NULL)) {
+		/* Lock acquired, the xchg is a full barrier */
+		node->locked = 1;
+		return;
+	}
+	ACCESS_ONCE(prev->next) = node;
+
+	/* Wait until the lock holder passes the lock down */
+	arch_mcs_spin_lock_contended(&node->locked);
+}
+
+/*
+ * Releases the lock. The caller should pass in the corresponding node that
+ * was used to acquire the lock.
+ */
+static inline
+void mcs_spin_unlock(struct mcs_spinlock **lock, struct mcs_spinlock *node)
+{
+	struct mcs_spinlock *next = ACCESS_ONCE(node->next);
+
+	if (likely(!next)) {
+		/* Release the lock by setting it to NULL */
+		if (likely(cmpxchg(lock, node, NULL) == node))
+			return;
+		/* Wait until the next pointer is set */
+		while (!(next = ACCESS_ONCE(node->next)))
+			cpu_relax();
+	}
+
+	/* Pass lock to next waiter */
+	arch_mcs_spin_unlock_contended(&next->locked);
+}
+
+#endif /* __LINUX_MCS_SPINLOCK_H */
@@ -21,6 +21,7 @@
 #define _LINUX_MEMCONTROL_H
 #include <linux/cgroup.h>
 #include <linux/vm_event_item.h>
+#include <linux/jump_label.h>
 
 struct mem_cgroup;
 struct page_cgroup;
@@ -114,6 +115,9 @@ void mem_cgroup_iter_break(struct mem_cgroup *, struct mem_cgroup *);
 /*
  * For memory reclaim.
  */
+bool mem_cgroup_low(struct mem_cgroup *root, struct mem_cgroup *memcg);
+void mem_cgroup_count_reclaim(struct mem_cgroup *memcg, unsigned long scanned,
+			      unsigned long reclaimed, bool low);
 int mem_cgroup_inactive_anon_is_low(struct mem_cgroup *memcg,
 				    struct zone *zone);
 int mem_cgroup_inactive_file_is_low(struct mem_cgroup *memcg,
@@ -327,6 +331,18 @@ static inline void mem_cgroup_iter_break(struct mem_cgroup *root,
 {
 }
 
+static inline bool mem_cgroup_low(struct mem_cgroup *root,
+				  struct mem_cgroup *memcg)
+{
+	return false;
+}
+
+static inline void mem_cgroup_count_reclaim(struct mem_cgroup *memcg,
+					    unsigned long scanned,
+					    unsigned long reclaimed, bool low)
+{
+}
+
 static inline bool mem_cgroup_disabled(void)
 {
 	return true;
@@ -440,6 +456,92 @@ struct sock;
 #ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
 void sock_update_memcg(struct sock *sk);
 void sock_release_memcg(struct sock *sk);
+
+extern struct static_key memcg_kmem_enabled_key;
+
+static inline bool memcg_kmem_enabled(void)
+{
+	return static_key_false(&memcg_kmem_enabled_key);
+}
+
+bool __memcg_kmem_newpage_charge(gfp_t gfp, struct mem_cgroup **memcg,
+				 int order);
+void __memcg_kmem_commit_charge(struct page *page, struct mem_cgroup *memcg,
+				int order);
+void __memcg_kmem_uncharge_pages(struct page *page, int order);
+
+/**
+ * memcg_kmem_newpage_charge: verify if a new kmem allocation is allowed.
+ * @gfp: the gfp allocation flags.
+ * @memcg: a pointer to the memcg this was charged against.
+ * @order: allocation order.
+ *
+ * Returns true if the allocation may proceed. *@memcg is set to the memcg
+ * that was charged, or NULL if the allocation is not accounted; it must be
+ * passed to memcg_kmem_commit_charge() once the page is allocated.
+ */
+static inline bool
+memcg_kmem_newpage_charge(gfp_t gfp, struct mem_cgroup **memcg, int order)
+{
+	*memcg = NULL;
+	if (!memcg_kmem_enabled())
+		return true;
+	if (!(gfp & __GFP_KMEMCG) || (gfp & __GFP_NOFAIL))
+		return true;
+	return __memcg_kmem_newpage_charge(gfp, memcg, order);
+}
+
+/**
+ * memcg_kmem_commit_charge: embeds correct memcg in a page
+ * @page: pointer to struct page recently allocated, or NULL on failure
+ * @memcg: the memcg structure we charged against
+ * @order: allocation order.
+ */
+static inline void
+memcg_kmem_commit_charge(struct page *page, struct mem_cgroup *memcg, int order)
+{
+	if (memcg_kmem_enabled() && memcg)
+		__memcg_kmem_commit_charge(page, memcg, order);
+}
+
+/**
+ * memcg_kmem_uncharge_pages: uncharge pages from memcg
+ * @page: pointer to struct page being freed
+ * @order: allocation order.
+ */
+static inline void memcg_kmem_uncharge_pages(struct page *page, int order)
+{
+	if (memcg_kmem_enabled())
+		__memcg_kmem_uncharge_pages(page, order);
+}
+
+#ifdef CONFIG_SLUB
+struct kmem_cache *__memcg_kmem_get_cache(struct kmem_cache *cachep,
+					  gfp_t gfp);
+int memcg_charge_slab(struct kmem_cache *s, gfp_t gfp, int order);
+void memcg_uncharge_slab(struct kmem_cache *s, int order);
+int memcg_register_cache(struct kmem_cache *s);
+void memcg_release_cache(struct kmem_cache *s);
+
+/**
+ * memcg_kmem_get_cache: selects the correct per-memcg cache for allocation
+ * @cachep: the original global kmem cache, created with SLAB_ACCOUNT
+ * @gfp: allocation flags.
+ *
+ * Returns the cache to allocate from: the per-memcg copy of @cachep for
+ * the current task's memcg, or @cachep itself when the allocation is not
+ * accounted or the copy is still being created.
+ */
+static __always_inline struct kmem_cache *
+memcg_kmem_get_cache(struct kmem_cache *cachep, gfp_t gfp)
+{
+	if (!memcg_kmem_enabled())
+		return cachep;
+	if (gfp & __GFP_NOFAIL)
+		return cachep;
+	return __memcg_kmem_get_cache(cachep, gfp);
+}
+#endif /* CONFIG_SLUB */
 #else
 static inline void sock_update_memcg(struct sock *sk)
 {
@@ -447,6 +549,93 @@ static inline void sock_update_memcg(struct sock *sk)
 static inline void sock_release_memcg(struct sock *sk)
 {
 }
+
+static inline bool memcg_kmem_enabled(void)
+{
+	return false;
+}
+
+static inline bool
+memcg_kmem_newpage_charge(gfp_t gfp, struct mem_cgroup **memcg, int order)
+{
+	return true;
+}
+
+static inline void memcg_kmem_uncharge_pages(struct page *page, int order)
+{
+}
+
+static inline void
+memcg_kmem_commit_charge(struct page *page, struct mem_cgroup *memcg, int order)
+{
+}
+
+static inline struct kmem_cache *
+memcg_kmem_get_cache(struct kmem_cache *cachep, gfp_t gfp)
+{
+	return cachep;
+}
+
+static inline int memcg_charge_slab(struct kmem_cache *s, gfp_t gfp, int order)
+{
+	return 0;
+}
+
+static inline void memcg_uncharge_slab(struct kmem_cache *s, int order)
+{
+}
+
+static inline int memcg_register_cache(struct kmem_cache *s)
+{
+	return 0;
+}
+
+static inline void memcg_release_cache(struct kmem_cache *s)
+{
+}
 #endif /* CONFIG_CGROUP_MEM_RES_CTLR_KMEM */
+
+#if defined(CONFIG_CGROUP_MEM_RES_CTLR_KMEM) && defined(CONFIG_SLUB)
+/*
+ * Every memcg with kmem accounting active has an index (its "cache id")
+ * into the per-memcg arrays of root caches and cgroup aware list_lrus.
+ */
+struct mem_cgroup *mem_cgroup_from_kmem(void *ptr);
+int memcg_cache_id(struct mem_cgroup *memcg);
+int memcg_nr_cache_ids(void);
+void memcg_get_cache_ids(void);
+void memcg_put_cache_ids(void);
+bool memcg_kmem_is_active(struct mem_cgroup *memcg);
+unsigned long mem_cgroup_usage_pages(struct mem_cgroup *memcg);
+
+#define for_each_memcg_cache_index(_idx)	\
+	for ((_idx) = 0; (_idx) < memcg_nr_cache_ids(); (_idx)++)
+#else
+static inline int memcg_cache_id(struct mem_cgroup *memcg)
+{
+	return -1;
+}
+
+static inline void memcg_get_cache_ids(void)
+{
+}
+
+static inline void memcg_put_cache_ids(void)
+{
+}
+
+static inline bool memcg_kmem_is_active(struct mem_cgroup *memcg)
+{
+	return false;
+}
+
+static inline unsigned long mem_cgroup_usage_pages(struct mem_cgroup *memcg)
+{
+	return 0;
+}
+
+#define for_each_memcg_cache_index(_idx)	\
+	for ((_idx) = 0; (_idx) < 0; (_idx)++)
+#endif
 #endif /* _LINUX_MEMCONTROL_H */
 
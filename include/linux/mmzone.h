@@ -62,7 +62,29 @@ struct free_area {
 struct pglist_data;
 
 /*
- * zone->lock and zone->lru_lock are two of the hottest locks in the kernel.
+ * The free lists of a large zone are split into independently locked
+ * shards.  Pages are assigned to a shard by MAX_ORDER aligned block, so a
+ * buddy pair and a pageblock always live in the same shard, and the
+ * blocks of a zone are interleaved across all of its shards.
+ */
+#if defined(CONFIG_SMP) && defined(CONFIG_64BIT)
+#define ZONE_MAX_SHARDS_SHIFT	3
+#else
+#define ZONE_MAX_SHARDS_SHIFT	0
+#endif
+#define ZONE_MAX_SHARDS		(1 << ZONE_MAX_SHARDS_SHIFT)
+
+/* A zone gets one free list shard per this many pages, up to the maximum */
+#define ZONE_SHARD_PAGES	(1UL << (31 - PAGE_SHIFT))
+
+struct zone_shard {
+	spinlock_t		lock;
+	struct free_area	free_area[MAX_ORDER];
+} ____cacheline_internodealigned_in_smp;
+
+/*
+ * The shard locks and zone->lru_lock are two of the hottest locks in the
+ * kernel.
  * So add a wild amount of padding here to ensure that they fall into separate
  * cachelines.  There are very few zone structures in the machine, so space
  * consumption is not a concern here.
@@ -115,6 +137,9 @@ enum zone_stat_item {
 	NUMA_LOCAL,		/* allocation from local node */
 	NUMA_OTHER,		/* allocation from other node */
 #endif
+	WORKINGSET_REFAULT,
+	WORKINGSET_ACTIVATE,
+	WORKINGSET_NODERECLAIM,
 	NR_ANON_TRANSPARENT_HUGEPAGES,
 	NR_VM_ZONE_STAT_ITEMS };
 
@@ -194,13 +219,21 @@ enum zone_watermarks {
 #define low_wmark_pages(z) (z->watermark[WMARK_LOW])
 #define high_wmark_pages(z) (z->watermark[WMARK_HIGH])
 
+/*
+ * The pcp lists cache pages up to PAGE_ALLOC_COSTLY_ORDER, with one list
+ * per order and migrate type.
+ */
+#define NR_PCP_LISTS	(MIGRATE_PCPTYPES * (PAGE_ALLOC_COSTLY_ORDER + 1))
+
 struct per_cpu_pages {
-	int count;		/* number of pages in the list */
+	int count;		/* number of base pages in the lists */
 	int high;		/* high watermark, emptying needed */
 	int batch;		/* chunk size for buddy add/remove */
+	int high_min;		/* high decays back to this when idle */
+	int high_max;		/* high grows up to this under refill pressure */
 
-	/* Lists of pages, one per migrate type stored on the pcp-lists */
-	struct list_head lists[MIGRATE_PCPTYPES];
+	/* Lists of pages, one per order and migrate type */
+	struct list_head lists[NR_PCP_LISTS];
 };
 
 struct per_cpu_pageset {
@@ -338,16 +371,17 @@ struct zone {
 	unsigned long		min_slab_pages;
 #endif
 	struct per_cpu_pageset __percpu *pageset;
-	/*
-	 * free areas of different sizes
-	 */
-	spinlock_t		lock;
 	int                     all_unreclaimable; /* All pages pinned */
 #ifdef CONFIG_MEMORY_HOTPLUG
 	/* see spanned/present_pages for more description */
 	seqlock_t		span_seqlock;
 #endif
-	struct free_area	free_area[MAX_ORDER];
+	/*
+	 * free areas of different sizes, split into nr_shards (a power of
+	 * two) independently locked shards
+	 */
+	unsigned int		nr_shards;
+	struct zone_shard	shards[ZONE_MAX_SHARDS];
 
 #ifndef CONFIG_SPARSEMEM
 	/*
@@ -379,6 +413,9 @@ struct zone {
 	unsigned long		pages_scanned;	   /* since last reclaim */
 	unsigned long		flags;		   /* zone flags, see below */
 
+	/* Evictions & activations on the inactive file list */
+	atomic_long_t		inactive_age;
+
 	/* Zone statistics */
 	atomic_long_t		vm_stat[NR_VM_ZONE_STAT_ITEMS];
 
@@ -430,12 +467,8 @@ struct zone {
 	/*
 	 * zone_start_pfn, spanned_pages and present_pages are all
 	 * protected by span_seqlock.  It is a seqlock because it has
-	 * to be read outside of zone->lock, and it is done in the main
+	 * to be read outside of the shard locks, and it is done in the main
 	 * allocator path.  But, it is written quite infrequently.
-	 *
-	 * The lock is declared along with zone->lock because it is
-	 * frequently read in proximity to zone->lock.  It's good to
-	 * give them a chance of being in the same cacheline.
 	 */
 	unsigned long		spanned_pages;	/* total size, including holes */
 	unsigned long		present_pages;	/* amount of memory (excluding holes) */
@@ -653,7 +686,7 @@ typedef struct pglist_data {
 	 * or node_spanned_pages stay constant.  Holding this will also
 	 * guarantee that any pfn_valid() stays that way.
 	 *
-	 * Nests above zone->lock and zone->size_seqlock.
+	 * Nests above the zone shard locks and zone->size_seqlock.
 	 */
 	spinlock_t node_size_lock;
 #endif
@@ -727,6 +760,60 @@ static inline int populated_zone(struct zone *zone)
 	return (!!zone->present_pages);
 }
 
+/* The free list shard that owns @pfn */
+static inline struct zone_shard *zone_pfn_shard(struct zone *zone,
+						unsigned long pfn)
+{
+	return &zone->shards[(pfn >> (MAX_ORDER - 1)) & (zone->nr_shards - 1)];
+}
+
+#define for_each_zone_shard(shard, zone)				\
+	for (shard = (zone)->shards;					\
+	     shard < (zone)->shards + (zone)->nr_shards; shard++)
+
+/* Number of free blocks of @order in @zone, summed over all shards */
+static inline unsigned long zone_free_area_nr(struct zone *zone, int order)
+{
+	struct zone_shard *shard;
+	unsigned long nr = 0;
+
+	for_each_zone_shard(shard, zone)
+		nr += shard->free_area[order].nr_free;
+	return nr;
+}
+
+/*
+ * Take every shard lock of @zone, for the rare operations that need a
+ * stable view of the whole zone.  Interrupts must be disabled.
+ */
+static inline void zone_lock_shards(struct zone *zone)
+{
+	int i;
+
+	for (i = 0; i < zone->nr_shards; i++)
+		spin_lock_nested(&zone->shards[i].lock, i);
+}
+
+static inline void zone_unlock_shards(struct zone *zone)
+{
+	int i;
+
+	for (i = zone->nr_shards - 1; i >= 0; i--)
+		spin_unlock(&zone->shards[i].lock);
+}
+
+#define zone_lock_shards_irqsave(zone, flags)				\
+	do {								\
+		local_irq_save(flags);					\
+		zone_lock_shards(zone);					\
+	} while (0)
+
+#define zone_unlock_shards_irqrestore(zone, flags)			\
+	do {								\
+		zone_unlock_shards(zone);				\
+		local_irq_restore(flags);				\
+	} while (0)
+
 extern int movable_zone;
 
 static inline int zone_movable_is_highmem(void)
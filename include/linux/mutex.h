@@ -17,6 +17,8 @@
 
 #include <linux/atomic.h>
 
+struct mcs_spinlock;
+
 /*
  * Simple, straightforward mutexes with strict semantics:
  *
@@ -53,6 +55,9 @@ struct mutex {
 #if defined(CONFIG_DEBUG_MUTEXES) || defined(CONFIG_SMP)
 	struct task_struct	*owner;
 #endif
+#ifdef CONFIG_MUTEX_SPIN_ON_OWNER
+	struct mcs_spinlock	*spin_mlock;	/* Spinner MCS lock */
+#endif
 #ifdef CONFIG_DEBUG_MUTEXES
 	const char 		*name;
 	void			*magic;
@@ -1,6 +1,10 @@
 #ifndef _LINUX_SHRINKER_H
 #define _LINUX_SHRINKER_H
 
+#include <linux/nodemask.h>
+
+struct mem_cgroup;
+
 /*
  * This struct is used to pass information from page reclaim to the shrinkers.
  * We consolidate the values for easier extention later.
@@ -10,6 +14,17 @@ struct shrink_control {
 
 	/* How many slab objects shrinker() should scan and try to reclaim */
 	unsigned long nr_to_scan;
+
+	/* shrink from these nodes */
+	nodemask_t nodes_to_scan;
+	/* current node being shrunk (for NUMA aware shrinkers) */
+	int nid;
+
+	/*
+	 * The memory cgroup whose objects are being reclaimed, for memcg
+	 * aware shrinkers. NULL when reclaiming the global lists.
+	 */
+	struct mem_cgroup *memcg;
 };
 
 /*
@@ -27,17 +42,34 @@ struct shrink_control {
  *
  * Note that 'shrink' will be passed nr_to_scan == 0 when the VM is
  * querying the cache size, so a fastpath for that case is appropriate.
+ *
+ * If the shrinker is flagged SHRINKER_NUMA_AWARE, it is called once for
+ * each node in 'nodes_to_scan', with 'nid' set, and should only count and
+ * scan objects on that node. Otherwise 'nid' is 0 and the shrinker is
+ * called once for all nodes.
+ *
+ * If the shrinker is flagged SHRINKER_MEMCG_AWARE, it is also called for
+ * memcg reclaim and for each memcg with kernel memory accounting active
+ * during global reclaim, with 'memcg' set, and should only count and scan
+ * objects charged to that memcg. Shrinkers without the flag are only
+ * called with 'memcg' == NULL.
  */
 struct shrinker {
 	int (*shrink)(struct shrinker *, struct shrink_control *sc);
 	int seeks;	/* seeks to recreate an obj */
 	long batch;	/* reclaim batch size, 0 = default */
+	unsigned long flags;
 
 	/* These are for internal use */
 	struct list_head list;
 	atomic_long_t nr_in_batch; /* objs pending delete */
 };
 #define DEFAULT_SEEKS 2 /* A good number if you don't know better. */
+
+/* Flags */
+#define SHRINKER_NUMA_AWARE	(1 << 0)
+#define SHRINKER_MEMCG_AWARE	(1 << 1)
+
 extern void register_shrinker(struct shrinker *);
 extern void unregister_shrinker(struct shrinker *);
 #endif
@@ -76,6 +76,13 @@
 # define SLAB_FAILSLAB		0x00000000UL
 #endif
 
+/* Account objects to the allocating task's memory cgroup */
+#if defined(CONFIG_CGROUP_MEM_RES_CTLR_KMEM) && defined(CONFIG_SLUB)
+# define SLAB_ACCOUNT		0x04000000UL
+#else
+# define SLAB_ACCOUNT		0x00000000UL
+#endif
+
 /* The following flags affect the page allocator grouping pages by mobility */
 #define SLAB_RECLAIM_ACCOUNT	0x00020000UL		/* Objects are reclaimable */
 #define SLAB_TEMPORARY		SLAB_RECLAIM_ACCOUNT	/* Objects are short-lived */
@@ -106,6 +113,56 @@ int kmem_cache_shrink(struct kmem_cache *);
 void kmem_cache_free(struct kmem_cache *, void *);
 unsigned int kmem_cache_size(struct kmem_cache *);
 
+/*
+ * Bulk allocation and freeing operations. An allocator can satisfy these
+ * with far fewer atomic operations and lock round trips than the same
+ * number of single object calls.
+ *
+ * kmem_cache_alloc_bulk() returns the number of objects placed in the
+ * array, which is either all of them or 0 on failure. Both must be called
+ * with interrupts enabled.
+ */
+void kmem_cache_free_bulk(struct kmem_cache *, size_t, void **);
+int kmem_cache_alloc_bulk(struct kmem_cache *, gfp_t, size_t, void **);
+
+#if defined(CONFIG_CGROUP_MEM_RES_CTLR_KMEM) && defined(CONFIG_SLUB)
+#include <linux/workqueue.h>
+
+struct mem_cgroup;
+/*
+ * Bookkeeping for caches created with SLAB_ACCOUNT.
+ *
+ * A root cache (the one returned by kmem_cache_create()) carries an
+ * RCU-protected array of per-memcg child caches, indexed by the memcg's
+ * kmem cache id. A child cache holds the objects of a single memcg, so
+ * its slab pages can be charged to that memcg as a whole.
+ */
+struct memcg_cache_params {
+	bool is_root_cache;
+	struct kmem_cache *cachep;	/* the cache owning these params */
+	struct list_head list;	/* root: all root caches; child: siblings */
+	union {
+		struct {
+			struct rcu_head rcu_head;
+			struct list_head children;
+			struct kmem_cache *memcg_caches[0];
+		};
+		struct {
+			struct mem_cgroup *memcg;
+			struct kmem_cache *root_cache;
+			struct list_head memcg_list;
+			bool dead;
+			atomic_t nr_pages;
+			struct work_struct destroy;
+		};
+	};
+};
+
+struct kmem_cache *kmem_cache_create_memcg(struct mem_cgroup *memcg,
+					   struct kmem_cache *root, int id);
+void kmem_cache_mark_dead(struct kmem_cache *s);
+#endif
+
 /*
  * Please use this macro to create slab caches. Simply specify the
  * name of the structure and maybe some flags that are listed above.
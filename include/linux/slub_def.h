@@ -41,14 +41,24 @@ enum stat_item {
 	CPU_PARTIAL_FREE,	/* Refill cpu partial on free */
 	CPU_PARTIAL_NODE,	/* Refill cpu partial from node partial */
 	CPU_PARTIAL_DRAIN,	/* Drain cpu partial to node partial */
+	FREE_REMOTE_BATCH,	/* Free to another slab deferred to batch */
+	FREE_REMOTE_FLUSH,	/* Batch of deferred frees handed back */
 	NR_SLUB_STAT_ITEMS };
 
+/*
+ * Number of objects freed to slabs other than the cpu slab that are
+ * collected per cpu before they are returned to their slabs in one go.
+ */
+#define SLUB_REMOTE_BATCH	16
+
 struct kmem_cache_cpu {
 	void **freelist;	/* Pointer to next available object */
 	unsigned long tid;	/* Globally unique transaction id */
 	struct page *page;	/* The slab from which we are allocating */
 	struct page *partial;	/* Partially allocated frozen slabs */
 	int node;		/* The node of the page (or -1 for debug) */
+	unsigned int remote_nr;	/* Number of objects in remote[] */
+	void *remote[SLUB_REMOTE_BATCH]; /* Frees to other slabs */
 #ifdef CONFIG_SLUB_STATS
 	unsigned stat[NR_SLUB_STAT_ITEMS];
 #endif
@@ -102,6 +112,9 @@ struct kmem_cache {
 #ifdef CONFIG_SYSFS
 	struct kobject kobj;	/* For sysfs */
 #endif
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+	struct memcg_cache_params *memcg_params;
+#endif
 
 #ifdef CONFIG_NUMA
 	/*
@@ -36,6 +36,18 @@ enum vm_event_item { PGPGIN, PGPGOUT, PSWPIN, PSWPOUT,
 		KSWAPD_LOW_WMARK_HIT_QUICKLY, KSWAPD_HIGH_WMARK_HIT_QUICKLY,
 		KSWAPD_SKIP_CONGESTION_WAIT,
 		PAGEOUTRUN, ALLOCSTALL, PGROTATED,
+		PGLAZYFREE,	/* pages marked by MADV_FREE */
+		PGLAZYFREED,	/* and discarded by reclaim */
+#ifdef CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH
+		TLB_UNMAP_DEFERRED,	/* PTE flushes deferred by reclaim */
+		TLB_UNMAP_BATCH_FLUSH,	/* batched flushes actually issued */
+#endif
+#ifdef CONFIG_SWAP
+		SWAP_ALLOC_LOCK,	/* swap_lock taken to allocate slots */
+		SWAP_ALLOC_LOCK_NS,	/* and nanoseconds it was held */
+		SWAP_FREE_LOCK,		/* swap_lock taken to free slots */
+		SWAP_FREE_LOCK_NS,	/* and nanoseconds it was held */
+#endif
 #ifdef CONFIG_COMPACTION
 		COMPACTBLOCKS, COMPACTPAGES, COMPACTPAGEFAILED,
 		COMPACTSTALL, COMPACTFAIL, COMPACTSUCCESS,
@@ -11,6 +11,7 @@
 #include <linux/lockdep.h>
 #include <linux/threads.h>
 #include <linux/atomic.h>
+#include <linux/cpumask.h>
 
 struct workqueue_struct;
 
@@ -92,6 +93,9 @@ struct work_struct {
 struct delayed_work {
 	struct work_struct work;
 	struct timer_list timer;
+
+	/* target workqueue while the timer is pending */
+	struct workqueue_struct *wq;
 };
 
 static inline struct delayed_work *to_delayed_work(struct work_struct *work)
@@ -257,6 +261,8 @@ enum {
 
 	WQ_DRAINING		= 1 << 6, /* internal: workqueue is draining */
 	WQ_RESCUER		= 1 << 7, /* internal: workqueue has rescuer */
+	WQ_SYSFS		= 1 << 8, /* visible under /sys/kernel/workqueue */
+	WQ_ORDERED		= 1 << 9, /* internal: unbound, one at a time */
 
 	WQ_MAX_ACTIVE		= 512,	  /* I like 512, better ideas? */
 	WQ_MAX_UNBOUND_PER_CPU	= 4,	  /* 4 * #cpus for unbound wq */
@@ -267,6 +273,16 @@ enum {
 #define WQ_UNBOUND_MAX_ACTIVE	\
 	max_t(int, WQ_MAX_ACTIVE, num_possible_cpus() * WQ_MAX_UNBOUND_PER_CPU)
 
+/*
+ * Attributes of the workers serving an unbound workqueue.  Unbound
+ * workqueues with identical attributes share their worker pools, one
+ * per NUMA node the cpumask spans.
+ */
+struct workqueue_attrs {
+	int			nice;		/* nice level of the workers */
+	cpumask_var_t		cpumask;	/* cpus the workers may run on */
+};
+
 /*
  * System-wide workqueues which are always present.
  *
@@ -354,7 +370,7 @@ __alloc_workqueue_key(const char *fmt, unsigned int flags, int max_active,
  * Pointer to the allocated workqueue on success, %NULL on failure.
  */
 #define alloc_ordered_workqueue(fmt, flags, args...)		\
-	alloc_workqueue(fmt, WQ_UNBOUND | (flags), 1, ##args)
+	alloc_workqueue(fmt, WQ_UNBOUND | WQ_ORDERED | (flags), 1, ##args)
 
 #define create_workqueue(name)					\
 	alloc_workqueue((name), WQ_MEM_RECLAIM, 1)
@@ -397,6 +413,10 @@ extern bool cancel_delayed_work_sync(struct delayed_work *dwork);
 
 extern void workqueue_set_max_active(struct workqueue_struct *wq,
 				     int max_active);
+extern struct workqueue_attrs *alloc_workqueue_attrs(gfp_t gfp_mask);
+extern void free_workqueue_attrs(struct workqueue_attrs *attrs);
+extern int apply_workqueue_attrs(struct workqueue_struct *wq,
+				 const struct workqueue_attrs *attrs);
 extern bool workqueue_congested(unsigned int cpu, struct workqueue_struct *wq);
 extern unsigned int work_cpu(struct work_struct *work);
 extern unsigned int work_busy(struct work_struct *work);
@@ -21,6 +21,7 @@
 #include <linux/sysfs.h>
 #include <linux/dcache.h>
 #include <linux/percpu.h>
+#include <linux/tick.h>
 #include <linux/ptrace.h>
 #include <linux/reboot.h>
 #include <linux/vmstat.h>
@@ -648,8 +649,20 @@ static void perf_pmu_rotate_start(struct pmu *pmu)
 
 	WARN_ON(!irqs_disabled());
 
-	if (list_empty(&cpuctx->rotation_list))
+	if (list_empty(&cpuctx->rotation_list)) {
 		list_add(&cpuctx->rotation_list, head);
+		/* Rotation is driven by the tick */
+		tick_nohz_full_kick();
+	}
+}
+
+/*
+ * Multiplexed events are rotated from the tick, which a full dynticks
+ * cpu must keep while it has any.
+ */
+bool perf_event_can_stop_tick(void)
+{
+	return list_empty(&__get_cpu_var(rotation_list));
 }
 
 static void get_ctx(struct perf_event_context *ctx)
@@ -23,6 +23,7 @@
 #include <linux/spinlock.h>
 #include <linux/interrupt.h>
 #include <linux/debug_locks.h>
+#include <linux/mcs_spinlock.h>
 
 /*
  * In the DEBUG case we are using the "NULL fastpath" for mutexes,
@@ -43,6 +44,9 @@ __mutex_init(struct mutex *lock, const char *name, struct lock_class_key *key)
 	spin_lock_init(&lock->wait_lock);
 	INIT_LIST_HEAD(&lock->wait_list);
 	mutex_clear_owner(lock);
+#ifdef CONFIG_MUTEX_SPIN_ON_OWNER
+	lock->spin_mlock = NULL;
+#endif
 
 	debug_mutex_init(lock, name, key);
 }
@@ -126,6 +130,37 @@ void __sched mutex_unlock(struct mutex *lock)
 
 EXPORT_SYMBOL(mutex_unlock);
 
+#ifdef CONFIG_MUTEX_SPIN_ON_OWNER
+/*
+ * Optimistic spinning is done with preemption disabled and never nests,
+ * so one MCS node per cpu is enough for all the mutexes.  Being per-cpu,
+ * each node also sits in memory local to the cpu spinning on it.
+ */
+static DEFINE_PER_CPU(struct mcs_spinlock, mutex_spin_node);
+
+/*
+ * Initial check for entering the spin loop: only queue up when the owner
+ * is running.  With no owner, the mutex may have just been acquired and
+ * the owner not set yet, or it may have been released: try it as well.
+ */
+static inline int mutex_can_spin_on_owner(struct mutex *lock)
+{
+	struct task_struct *owner;
+	int retval = 1;
+
+	if (need_resched())
+		return 0;
+
+	rcu_read_lock();
+	owner = ACCESS_ONCE(lock->owner);
+	if (owner)
+		retval = owner->on_cpu;
+	rcu_read_unlock();
+
+	return retval;
+}
+#endif
+
 /*
  * Lock a mutex (possibly interruptible), slowpath:
  */
@@ -136,6 +171,9 @@ __mutex_lock_common(struct mutex *lock, long state, unsigned int subclass,
 	struct task_struct *task = current;
 	struct mutex_waiter waiter;
 	unsigned long flags;
+#ifdef CONFIG_MUTEX_SPIN_ON_OWNER
+	struct mcs_spinlock *node;
+#endif
 
 	preempt_disable();
 	mutex_acquire_nest(&lock->dep_map, subclass, 0, nest_lock, ip);
@@ -157,7 +195,19 @@ __mutex_lock_common(struct mutex *lock, long state, unsigned int subclass,
 	 *
 	 * We can't do this for DEBUG_MUTEXES because that relies on wait_lock
 	 * to serialize everything.
+	 *
+	 * The spinners are queued on an MCS lock, so that they do not all
+	 * bounce the cacheline of the mutex between their cpus.
+	 */
+	if (!mutex_can_spin_on_owner(lock))
+		goto slowpath;
+
+	/*
+	 * Only the spinner at the head of the MCS queue polls the owner
+	 * and the count, the others spin on their own per-cpu node.
 	 */
+	node = &__get_cpu_var(mutex_spin_node);
+	mcs_spin_lock(&lock->spin_mlock, node);
 
 	for (;;) {
 		struct task_struct *owner;
@@ -170,9 +220,12 @@ __mutex_lock_common(struct mutex *lock, long state, unsigned int subclass,
 		if (owner && !mutex_spin_on_owner(lock, owner))
 			break;
 
-		if (atomic_cmpxchg(&lock->count, 1, 0) == 1) {
+		/* Only try the atomic when the mutex looks free */
+		if (atomic_read(&lock->count) == 1 &&
+		    atomic_cmpxchg(&lock->count, 1, 0) == 1) {
 			lock_acquired(&lock->dep_map, ip);
 			mutex_set_owner(lock);
+			mcs_spin_unlock(&lock->spin_mlock, node);
 			preempt_enable();
 			return 0;
 		}
@@ -194,6 +247,8 @@ __mutex_lock_common(struct mutex *lock, long state, unsigned int subclass,
 		 */
 		arch_mutex_cpu_relax();
 	}
+	mcs_spin_unlock(&lock->spin_mlock, node);
+slowpath:
 #endif
 	spin_lock_mutex(&lock->wait_lock, flags);
 
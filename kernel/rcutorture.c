@@ -72,6 +72,7 @@ static int stall_cpu_holdoff = 10; /* Time to wait until stall (s).  */
 static int test_boost = 1;	/* Test RCU prio boost: 0=no, 1=maybe, 2=yes. */
 static int test_boost_interval = 7; /* Interval between boost tests, seconds. */
 static int test_boost_duration = 4; /* Duration of each boost test, seconds. */
+static int n_cpu_cbs = 100;	/* Callbacks per CPU and pass, 0 to disable. */
 static char *torture_type = "rcu"; /* What RCU implementation to torture. */
 
 module_param(nreaders, int, 0444);
@@ -112,6 +113,8 @@ module_param(test_boost_interval, int, 0444);
 MODULE_PARM_DESC(test_boost_interval, "Interval between boost tests, seconds.");
 module_param(test_boost_duration, int, 0444);
 MODULE_PARM_DESC(test_boost_duration, "Duration of each boost test, seconds.");
+module_param(n_cpu_cbs, int, 0444);
+MODULE_PARM_DESC(n_cpu_cbs, "# of callbacks per CPU to check, 0=disable");
 module_param(torture_type, charp, 0444);
 MODULE_PARM_DESC(torture_type, "Type of RCU to torture (rcu, rcu_bh, srcu)");
 
@@ -139,6 +142,7 @@ static struct task_struct *shutdown_task;
 static struct task_struct *onoff_task;
 #endif /* #ifdef CONFIG_HOTPLUG_CPU */
 static struct task_struct *stall_task;
+static struct task_struct *cbs_task;
 
 #define RCU_TORTURE_PIPE_LEN 10
 
@@ -164,6 +168,7 @@ static atomic_t n_rcu_torture_alloc_fail;
 static atomic_t n_rcu_torture_free;
 static atomic_t n_rcu_torture_mberror;
 static atomic_t n_rcu_torture_error;
+static atomic_t n_rcu_torture_cb_error;
 static long n_rcu_torture_boost_ktrerror;
 static long n_rcu_torture_boost_rterror;
 static long n_rcu_torture_boost_failure;
@@ -327,6 +332,7 @@ struct rcu_torture_ops {
 	int (*completed)(void);
 	void (*deferred_free)(struct rcu_torture *p);
 	void (*sync)(void);
+	void (*call)(struct rcu_head *head, void (*func)(struct rcu_head *head));
 	void (*cb_barrier)(void);
 	void (*fqs)(void);
 	int (*stats)(char *page);
@@ -417,6 +423,7 @@ static struct rcu_torture_ops rcu_ops = {
 	.completed	= rcu_torture_completed,
 	.deferred_free	= rcu_torture_deferred_free,
 	.sync		= synchronize_rcu,
+	.call		= call_rcu,
 	.cb_barrier	= rcu_barrier,
 	.fqs		= rcu_force_quiescent_state,
 	.stats		= NULL,
@@ -519,6 +526,7 @@ static struct rcu_torture_ops rcu_bh_ops = {
 	.completed	= rcu_bh_torture_completed,
 	.deferred_free	= rcu_bh_torture_deferred_free,
 	.sync		= synchronize_rcu_bh,
+	.call		= call_rcu_bh,
 	.cb_barrier	= rcu_barrier_bh,
 	.fqs		= rcu_bh_force_quiescent_state,
 	.stats		= NULL,
@@ -714,6 +722,7 @@ static struct rcu_torture_ops sched_ops = {
 	.completed	= rcu_no_completed,
 	.deferred_free	= rcu_sched_torture_deferred_free,
 	.sync		= synchronize_sched,
+	.call		= call_rcu_sched,
 	.cb_barrier	= rcu_barrier_sched,
 	.fqs		= rcu_sched_force_quiescent_state,
 	.stats		= NULL,
@@ -1129,7 +1138,7 @@ rcu_torture_printk(char *page)
 		       "rtc: %p ver: %lu tfle: %d rta: %d rtaf: %d rtf: %d "
 		       "rtmbe: %d rtbke: %ld rtbre: %ld "
 		       "rtbf: %ld rtb: %ld nt: %ld "
-		       "onoff: %ld/%ld:%ld/%ld",
+		       "onoff: %ld/%ld:%ld/%ld cbe: %d",
 		       rcu_torture_current,
 		       rcu_torture_current_version,
 		       list_empty(&rcu_torture_freelist),
@@ -1145,8 +1154,10 @@ rcu_torture_printk(char *page)
 		       n_online_successes,
 		       n_online_attempts,
 		       n_offline_successes,
-		       n_offline_attempts);
+		       n_offline_attempts,
+		       atomic_read(&n_rcu_torture_cb_error));
 	if (atomic_read(&n_rcu_torture_mberror) != 0 ||
+	    atomic_read(&n_rcu_torture_cb_error) != 0 ||
 	    n_rcu_torture_boost_ktrerror != 0 ||
 	    n_rcu_torture_boost_rterror != 0 ||
 	    n_rcu_torture_boost_failure != 0)
@@ -1310,13 +1321,13 @@ rcu_torture_print_module_parms(struct rcu_torture_ops *cur_ops, char *tag)
 		"fqs_duration=%d fqs_holdoff=%d fqs_stutter=%d "
 		"test_boost=%d/%d test_boost_interval=%d "
 		"test_boost_duration=%d shutdown_secs=%d "
-		"onoff_interval=%d onoff_holdoff=%d\n",
+		"onoff_interval=%d onoff_holdoff=%d n_cpu_cbs=%d\n",
 		torture_type, tag, nrealreaders, nfakewriters,
 		stat_interval, verbose, test_no_idle_hz, shuffle_interval,
 		stutter, irqreader, fqs_duration, fqs_holdoff, fqs_stutter,
 		test_boost, cur_ops->can_boost,
 		test_boost_interval, test_boost_duration, shutdown_secs,
-		onoff_interval, onoff_holdoff);
+		onoff_interval, onoff_holdoff, n_cpu_cbs);
 }
 
 static struct notifier_block rcutorture_shutdown_nb = {
@@ -1556,6 +1567,120 @@ static void rcu_torture_stall_cleanup(void)
 	kthread_stop(stall_task);
 }
 
+/*
+ * Per-CPU callback test.  Each pass queues n_cpu_cbs callbacks on each
+ * online CPU in turn, each from within a reader that must end before the
+ * callback runs, and then waits for them with the barrier primitive.  The
+ * callbacks of a given CPU must be invoked in order, which holds both for
+ * CPUs invoking their own callbacks and for those whose callbacks are
+ * offloaded to kthreads.
+ */
+struct rcu_torture_cpu_cb {
+	struct rcu_head rh;
+	int seq;		/* Position in this CPU's batch. */
+	int done_reading;	/* Reader around the call has ended. */
+};
+
+static struct rcu_torture_cpu_cb *rcu_torture_cpu_cbs;
+static int rcu_torture_cpu_cb_next;	/* Next seq expected, 0 = none yet. */
+
+static void rcu_torture_cpu_cb_func(struct rcu_head *rhp)
+{
+	struct rcu_torture_cpu_cb *cb =
+		container_of(rhp, struct rcu_torture_cpu_cb, rh);
+
+	if (!ACCESS_ONCE(cb->done_reading))
+		atomic_inc(&n_rcu_torture_cb_error);  /* Grace period too short. */
+	if (cb->seq != rcu_torture_cpu_cb_next)
+		atomic_inc(&n_rcu_torture_cb_error);  /* Invoked out of order. */
+	rcu_torture_cpu_cb_next = cb->seq + 1;
+}
+
+/* Queue one batch of callbacks on the specified CPU and wait for them. */
+static void rcu_torture_cpu_cbs_one(int cpu)
+{
+	struct rcu_torture_cpu_cb *cb;
+	int i;
+	int idx;
+
+	if (set_cpus_allowed_ptr(current, cpumask_of(cpu)) != 0)
+		return;  /* CPU went offline. */
+	rcu_torture_cpu_cb_next = 0;
+	preempt_disable();  /* All on this CPU's list, in order. */
+	for (i = 0; i < n_cpu_cbs; i++) {
+		cb = &rcu_torture_cpu_cbs[i];
+		cb->seq = i;
+		cb->done_reading = 0;
+		idx = cur_ops->readlock();
+		cur_ops->call(&cb->rh, rcu_torture_cpu_cb_func);
+		udelay(1);
+		ACCESS_ONCE(cb->done_reading) = 1;
+		cur_ops->readunlock(idx);
+	}
+	preempt_enable();
+	cur_ops->cb_barrier();
+	if (rcu_torture_cpu_cb_next != n_cpu_cbs)
+		atomic_inc(&n_rcu_torture_cb_error);  /* Barrier missed some. */
+}
+
+static int rcu_torture_cpu_cbs_kthread(void *arg)
+{
+	int cpu;
+
+	VERBOSE_PRINTK_STRING("rcu_torture_cpu_cbs task started");
+	do {
+		for_each_online_cpu(cpu) {
+			if (kthread_should_stop() || fullstop != FULLSTOP_DONTSTOP)
+				break;
+			rcu_torture_cpu_cbs_one(cpu);
+		}
+		set_cpus_allowed_ptr(current, cpu_online_mask);
+		schedule_timeout_interruptible(HZ);
+		rcu_stutter_wait("rcu_torture_cpu_cbs");
+	} while (!kthread_should_stop() && fullstop == FULLSTOP_DONTSTOP);
+	VERBOSE_PRINTK_STRING("rcu_torture_cpu_cbs task stopping");
+	rcutorture_shutdown_absorb("rcu_torture_cpu_cbs");
+	while (!kthread_should_stop())
+		schedule_timeout_interruptible(1);
+	return 0;
+}
+
+/* Spawn the per-CPU callback kthread, if the flavor can support it. */
+static int __init rcu_torture_cpu_cbs_init(void)
+{
+	int ret;
+
+	if (n_cpu_cbs <= 0 || cur_ops->call == NULL ||
+	    cur_ops->cb_barrier == NULL)
+		return 0;
+	rcu_torture_cpu_cbs = kcalloc(n_cpu_cbs, sizeof(*rcu_torture_cpu_cbs),
+				      GFP_KERNEL);
+	if (rcu_torture_cpu_cbs == NULL)
+		return -ENOMEM;
+	cbs_task = kthread_run(rcu_torture_cpu_cbs_kthread, NULL,
+			       "rcu_torture_cpu_cbs");
+	if (IS_ERR(cbs_task)) {
+		ret = PTR_ERR(cbs_task);
+		cbs_task = NULL;
+		kfree(rcu_torture_cpu_cbs);
+		rcu_torture_cpu_cbs = NULL;
+		return ret;
+	}
+	return 0;
+}
+
+/* Clean up after the per-CPU callback kthread, if one was spawned. */
+static void rcu_torture_cpu_cbs_cleanup(void)
+{
+	if (cbs_task == NULL)
+		return;
+	VERBOSE_PRINTK_STRING("Stopping rcu_torture_cpu_cbs task");
+	kthread_stop(cbs_task);
+	cbs_task = NULL;
+	kfree(rcu_torture_cpu_cbs);
+	rcu_torture_cpu_cbs = NULL;
+}
+
 static int rcutorture_cpu_notify(struct notifier_block *self,
 				 unsigned long action, void *hcpu)
 {
@@ -1599,6 +1724,7 @@ rcu_torture_cleanup(void)
 	mutex_unlock(&fullstop_mutex);
 	unregister_reboot_notifier(&rcutorture_shutdown_nb);
 	rcu_torture_stall_cleanup();
+	rcu_torture_cpu_cbs_cleanup();
 	if (stutter_task) {
 		VERBOSE_PRINTK_STRING("Stopping rcu_torture_stutter task");
 		kthread_stop(stutter_task);
@@ -1676,7 +1802,8 @@ rcu_torture_cleanup(void)
 
 	if (cur_ops->cleanup)
 		cur_ops->cleanup();
-	if (atomic_read(&n_rcu_torture_error))
+	if (atomic_read(&n_rcu_torture_error) ||
+	    atomic_read(&n_rcu_torture_cb_error))
 		rcu_torture_print_module_parms(cur_ops, "End of test: FAILURE");
 	else if (n_online_successes != n_online_attempts ||
 		 n_offline_successes != n_offline_attempts)
@@ -1749,6 +1876,7 @@ rcu_torture_init(void)
 	atomic_set(&n_rcu_torture_free, 0);
 	atomic_set(&n_rcu_torture_mberror, 0);
 	atomic_set(&n_rcu_torture_error, 0);
+	atomic_set(&n_rcu_torture_cb_error, 0);
 	n_rcu_torture_boost_ktrerror = 0;
 	n_rcu_torture_boost_rterror = 0;
 	n_rcu_torture_boost_failure = 0;
@@ -1900,6 +2028,12 @@ rcu_torture_init(void)
 	rcu_torture_onoff_init();
 	register_reboot_notifier(&rcutorture_shutdown_nb);
 	rcu_torture_stall_init();
+	i = rcu_torture_cpu_cbs_init();
+	if (i < 0) {
+		firsterr = i;
+		VERBOSE_PRINTK_ERRSTRING("Failed to create cpu_cbs");
+		goto unwind;
+	}
 	rcutorture_record_test_transition();
 	mutex_unlock(&fullstop_mutex);
 	return 0;
@@ -70,11 +70,15 @@ static void __init rcu_bootup_announce_oddness(void)
 #if NUM_RCU_LVL_4 != 0
 	printk(KERN_INFO "\tExperimental four-level hierarchy is enabled.\n");
 #endif
+#ifdef CONFIG_RCU_NOCB_CPU
+	printk(KERN_INFO "\tRCU callback offloading is enabled.\n");
+#endif
 }
 
 #ifdef CONFIG_TREE_PREEMPT_RCU
 
-struct rcu_state rcu_preempt_state = RCU_STATE_INITIALIZER(rcu_preempt);
+struct rcu_state rcu_preempt_state =
+	RCU_STATE_INITIALIZER(rcu_preempt, 'p', call_rcu);
 DEFINE_PER_CPU(struct rcu_data, rcu_preempt_data);
 static struct rcu_state *rcu_state = &rcu_preempt_state;
 
@@ -2299,3 +2303,326 @@ static void increment_cpu_stall_ticks(void)
 }
 
 #endif /* #else #ifdef CONFIG_RCU_CPU_STALL_INFO */
+
+#ifdef CONFIG_RCU_NOCB_CPU
+
+/*
+ * Offload callback processing from the CPUs listed by rcu_nocbs=, the
+ * no-CBs CPUs.  Each of their rcu_data structures gets a kthread, and
+ * call_rcu() on one of these CPUs appends the callback to a list that
+ * only that kthread consumes, without locks and without involving the
+ * RCU core on that CPU.  The kthread detaches the list, waits for a
+ * grace period, which it gets by posting a callback from a CPU that
+ * still handles its own, and then invokes the callbacks in order.
+ * Nothing pins the kthreads, so they can be placed on housekeeping
+ * CPUs.
+ */
+static cpumask_var_t rcu_nocb_mask;	/* CPUs to have callbacks offloaded. */
+static bool have_rcu_nocb_mask;		/* Was rcu_nocb_mask allocated? */
+static bool rcu_nocb_poll;		/* Offload kthreads are to poll. */
+module_param(rcu_nocb_poll, bool, 0444);
+static char __initdata nocb_buf[NR_CPUS * 5];
+
+/* Parse the boot-time rcu_nocbs= CPU list from the kernel parameters. */
+static int __init rcu_nocb_setup(char *str)
+{
+	int cpu;
+
+	alloc_bootmem_cpumask_var(&rcu_nocb_mask);
+	have_rcu_nocb_mask = true;
+	cpulist_parse(str, rcu_nocb_mask);
+	cpumask_and(rcu_nocb_mask, rcu_nocb_mask, cpu_possible_mask);
+
+	/* Someone has to post the callbacks the kthreads wait on. */
+	cpu = smp_processor_id();
+	if (cpumask_test_cpu(cpu, rcu_nocb_mask)) {
+		printk(KERN_INFO "\tBoot CPU %d keeps its RCU callbacks.\n",
+		       cpu);
+		cpumask_clear_cpu(cpu, rcu_nocb_mask);
+	}
+	cpulist_scnprintf(nocb_buf, sizeof(nocb_buf), rcu_nocb_mask);
+	printk(KERN_INFO "\tOffload RCU callbacks from CPUs: %s.\n", nocb_buf);
+	return 1;
+}
+__setup("rcu_nocbs=", rcu_nocb_setup);
+
+/* Is the specified CPU a no-CBs CPU? */
+static bool rcu_is_nocb_cpu(int cpu)
+{
+	if (have_rcu_nocb_mask)
+		return cpumask_test_cpu(cpu, rcu_nocb_mask);
+	return false;
+}
+
+/*
+ * Enqueue the specified string of rcu_head structures onto the specified
+ * CPU's no-CBs lists.  The CPU is specified by rdp, the head of the
+ * string by rhp, and the tail of the string by rhtp.  The non-lazy/lazy
+ * counts are supplied by rhcount and rhcount_lazy.
+ *
+ * Any number of CPUs may enqueue concurrently: the xchg() of the tail
+ * pointer serializes them, and rcu_nocb_kthread() waits for the link
+ * from the previous element to appear if it is not there yet.  The
+ * kthread is only awakened when the list was empty, as otherwise it
+ * is already going to look at the list again.
+ */
+static void __call_rcu_nocb_enqueue(struct rcu_data *rdp,
+				    struct rcu_head *rhp,
+				    struct rcu_head **rhtp,
+				    int rhcount, int rhcount_lazy)
+{
+	struct rcu_head **old_rhpp;
+	struct task_struct *t;
+
+	/* Enqueue the callback on the nocb list and update counts. */
+	old_rhpp = xchg(&rdp->nocb_tail, rhtp);
+	ACCESS_ONCE(*old_rhpp) = rhp;
+	atomic_long_add(rhcount, &rdp->nocb_q_count);
+	atomic_long_add(rhcount_lazy, &rdp->nocb_q_count_lazy);
+
+	/* If we are not being polled and there is a kthread, awaken it. */
+	t = ACCESS_ONCE(rdp->nocb_kthread);
+	if (rcu_nocb_poll || !t || old_rhpp != &rdp->nocb_head)
+		return;
+	smp_mb(); /* Enqueue before the kthread's check of ->nocb_head. */
+	wake_up_process(t);
+}
+
+/*
+ * This is a helper for __call_rcu(), which invokes this when the normal
+ * callback queue is not to be used.  Returns true if the callback was
+ * queued for the no-CBs kthread, false if the CPU handles its own.
+ */
+static bool __call_rcu_nocb(struct rcu_data *rdp, struct rcu_head *rhp,
+			    bool lazy)
+{
+	if (!rcu_is_nocb_cpu(rdp->cpu))
+		return false;
+	__call_rcu_nocb_enqueue(rdp, rhp, &rhp->next, 1, lazy);
+	if (__is_kfree_rcu_offset((unsigned long)rhp->func))
+		trace_rcu_kfree_callback(rdp->rsp->name, rhp,
+					 (unsigned long)rhp->func,
+					 atomic_long_read(&rdp->nocb_q_count_lazy),
+					 atomic_long_read(&rdp->nocb_q_count));
+	else
+		trace_rcu_callback(rdp->rsp->name, rhp,
+				   atomic_long_read(&rdp->nocb_q_count_lazy),
+				   atomic_long_read(&rdp->nocb_q_count));
+	return true;
+}
+
+/*
+ * Queue an rcu_barrier() callback behind the offloaded callbacks of
+ * every no-CBs CPU, online or not, rather than from rcu_barrier_func():
+ * the kthreads invoke the callbacks in order, and those of an offline
+ * CPU still have to be waited for.
+ */
+static void rcu_nocb_barrier(struct rcu_state *rsp)
+{
+	int cpu;
+	struct rcu_head *head;
+
+	if (!have_rcu_nocb_mask)
+		return;
+	for_each_cpu(cpu, rcu_nocb_mask) {
+		head = &per_cpu(rcu_barrier_head, cpu);
+		head->func = rcu_barrier_callback;
+		head->next = NULL;
+		debug_rcu_head_queue(head);
+		atomic_inc(&rcu_barrier_cpu_count);
+		__call_rcu_nocb_enqueue(per_cpu_ptr(rsp->rda, cpu),
+					head, &head->next, 1, 0);
+	}
+}
+
+/*
+ * The no-CBs kthreads rely on the other CPUs for their grace periods,
+ * so do not let the last online one of those go away.
+ */
+static bool rcu_nocb_cpu_can_offline(int cpu)
+{
+	int i;
+
+	if (!have_rcu_nocb_mask || rcu_is_nocb_cpu(cpu))
+		return true;
+	for_each_online_cpu(i)
+		if (i != cpu && !rcu_is_nocb_cpu(i))
+			return true;
+	return false;
+}
+
+/* Grace-period wait posted by rcu_nocb_wait_gp() on another CPU. */
+struct rcu_nocb_gp {
+	struct rcu_head head;
+	struct completion completion;
+	call_rcu_func_t *call;
+};
+
+static void rcu_nocb_gp_done(struct rcu_head *head)
+{
+	struct rcu_nocb_gp *gp = container_of(head, struct rcu_nocb_gp, head);
+
+	complete(&gp->completion);
+}
+
+/* Invoked in IPI context on a CPU that handles its own callbacks. */
+static void rcu_nocb_gp_post(void *arg)
+{
+	struct rcu_nocb_gp *gp = arg;
+
+	gp->call(&gp->head, rcu_nocb_gp_done);
+}
+
+/*
+ * Wait for a grace period of the flavor of the specified rcu_data.
+ * synchronize_rcu() and friends would queue their callback on the
+ * current CPU, which may well be a no-CBs CPU, possibly even the one
+ * this kthread serves, so the callback is posted on the first online
+ * CPU that still handles its own callbacks instead.
+ */
+static void rcu_nocb_wait_gp(struct rcu_data *rdp)
+{
+	struct rcu_nocb_gp gp;
+	int cpu;
+
+	init_rcu_head_on_stack(&gp.head);
+	init_completion(&gp.completion);
+	gp.call = rdp->rsp->call;
+	for (;;) {
+		for_each_online_cpu(cpu)
+			if (!rcu_is_nocb_cpu(cpu))
+				break;
+		if (WARN_ON_ONCE(cpu >= nr_cpu_ids))
+			cpu = cpumask_first(cpu_online_mask);
+		/* Fails only if that CPU went offline meanwhile. */
+		if (!smp_call_function_single(cpu, rcu_nocb_gp_post, &gp, 1))
+			break;
+	}
+	wait_for_completion(&gp.completion);
+	destroy_rcu_head_on_stack(&gp.head);
+}
+
+/*
+ * Per-rcu_data kthread, but only for no-CBs CPUs.  Each kthread invokes
+ * callbacks posted to its no-CBs list, after waiting for a grace period.
+ */
+static int rcu_nocb_kthread(void *arg)
+{
+	int c, cl;
+	struct rcu_head *list;
+	struct rcu_head *next;
+	struct rcu_head **tail;
+	struct rcu_data *rdp = arg;
+
+	/* Each pass through this loop invokes one batch of callbacks */
+	for (;;) {
+		/* If not polling, wait for next batch of callbacks. */
+		if (!rcu_nocb_poll)
+			rcu_wait(ACCESS_ONCE(rdp->nocb_head));
+		list = ACCESS_ONCE(rdp->nocb_head);
+		if (!list) {
+			schedule_timeout_interruptible(1);
+			continue;
+		}
+
+		/*
+		 * Extract queued callbacks, update counts, and wait
+		 * for a grace period to elapse.
+		 */
+		ACCESS_ONCE(rdp->nocb_head) = NULL;
+		tail = xchg(&rdp->nocb_tail, &rdp->nocb_head);
+		c = atomic_long_xchg(&rdp->nocb_q_count, 0);
+		cl = atomic_long_xchg(&rdp->nocb_q_count_lazy, 0);
+		ACCESS_ONCE(rdp->nocb_p_count) += c;
+		ACCESS_ONCE(rdp->nocb_p_count_lazy) += cl;
+		rcu_nocb_wait_gp(rdp);
+
+		/* Each pass through the following loop invokes a callback. */
+		trace_rcu_batch_start(rdp->rsp->name, cl, c, -1);
+		c = cl = 0;
+		while (list) {
+			next = list->next;
+			/* Wait for enqueuing to complete, if needed. */
+			while (next == NULL && &list->next != tail) {
+				schedule_timeout_interruptible(1);
+				next = list->next;
+			}
+			debug_rcu_head_unqueue(list);
+			local_bh_disable();
+			if (__rcu_reclaim(rdp->rsp->name, list))
+				cl++;
+			c++;
+			local_bh_enable();
+			list = next;
+		}
+		trace_rcu_batch_end(rdp->rsp->name, c, !!list, 0, 0, 1);
+		ACCESS_ONCE(rdp->nocb_p_count) -= c;
+		ACCESS_ONCE(rdp->nocb_p_count_lazy) -= cl;
+		rdp->n_cbs_invoked += c;
+		cond_resched();
+	}
+	return 0;
+}
+
+/* Initialize per-rcu_data variables for no-CBs CPUs. */
+static void __init rcu_boot_init_nocb_percpu_data(struct rcu_data *rdp)
+{
+	rdp->nocb_tail = &rdp->nocb_head;
+}
+
+/* Create a kthread for each RCU flavor for each no-CBs CPU. */
+static void __init rcu_spawn_nocb_kthreads_one(struct rcu_state *rsp)
+{
+	int cpu;
+	struct rcu_data *rdp;
+	struct task_struct *t;
+
+	for_each_cpu(cpu, rcu_nocb_mask) {
+		rdp = per_cpu_ptr(rsp->rda, cpu);
+		t = kthread_run(rcu_nocb_kthread, rdp,
+				"rcuo%c/%d", rsp->abbr, cpu);
+		BUG_ON(IS_ERR(t));
+		ACCESS_ONCE(rdp->nocb_kthread) = t;
+	}
+}
+
+static int __init rcu_spawn_nocb_kthreads(void)
+{
+	if (!have_rcu_nocb_mask)
+		return 0;
+	rcu_spawn_nocb_kthreads_one(&rcu_sched_state);
+	rcu_spawn_nocb_kthreads_one(&rcu_bh_state);
+#ifdef CONFIG_TREE_PREEMPT_RCU
+	rcu_spawn_nocb_kthreads_one(&rcu_preempt_state);
+#endif /* #ifdef CONFIG_TREE_PREEMPT_RCU */
+	return 0;
+}
+early_initcall(rcu_spawn_nocb_kthreads);
+
+#else /* #ifdef CONFIG_RCU_NOCB_CPU */
+
+static bool rcu_is_nocb_cpu(int cpu)
+{
+	return false;
+}
+
+static bool __call_rcu_nocb(struct rcu_data *rdp, struct rcu_head *rhp,
+			    bool lazy)
+{
+	return false;
+}
+
+static void rcu_nocb_barrier(struct rcu_state *rsp)
+{
+}
+
+static bool rcu_nocb_cpu_can_offline(int cpu)
+{
+	return true;
+}
+
+static void __init rcu_boot_init_nocb_percpu_data(struct rcu_data *rdp)
+{
+}
+
+#endif /* #else #ifdef CONFIG_RCU_NOCB_CPU */
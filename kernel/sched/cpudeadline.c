@@ -0,0 +1,257 @@
+/*
+ *  kernel/sched/cpudeadline.c
+ *
+ *  Global CPU deadline management
+ *
+ *  This code tracks the deadline of the earliest -deadline task of each
+ *  CPU, so that the push logic can quickly find the CPU whose current
+ *  deadline is the latest one, i.e. the best candidate to be preempted
+ *  by a task being pushed.  CPUs with no -deadline task at all are kept
+ *  in a separate mask, as they are better candidates than any other.
+ *
+ *  The deadlines are kept in a max-heap indexed by CPU, so the latest
+ *  one can be read in O(1) and updated in O(log(nr_cpus)).
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; version 2
+ *  of the License.
+ */
+
+#include <linux/gfp.h>
+#include <linux/slab.h>
+#include "sched.h"
+
+static inline int parent(int i)
+{
+	return (i - 1) >> 1;
+}
+
+static inline int left_child(int i)
+{
+	return (i << 1) + 1;
+}
+
+static inline int right_child(int i)
+{
+	return (i << 1) + 2;
+}
+
+static void cpudl_exchange(struct cpudl *cp, int a, int b)
+{
+	int cpu_a = cp->elements[a].cpu, cpu_b = cp->elements[b].cpu;
+
+	swap(cp->elements[a], cp->elements[b]);
+	swap(cp->cpu_to_idx[cpu_a], cp->cpu_to_idx[cpu_b]);
+}
+
+/* Move the element at @idx down until both its children are earlier */
+static void cpudl_heapify_down(struct cpudl *cp, int idx)
+{
+	int l, r, largest;
+
+	for (;;) {
+		l = left_child(idx);
+		r = right_child(idx);
+		largest = idx;
+
+		if (l < cp->size && dl_time_before(cp->elements[idx].dl,
+						   cp->elements[l].dl))
+			largest = l;
+		if (r < cp->size && dl_time_before(cp->elements[largest].dl,
+						   cp->elements[r].dl))
+			largest = r;
+		if (largest == idx)
+			break;
+
+		cpudl_exchange(cp, largest, idx);
+		idx = largest;
+	}
+}
+
+/* Move the element at @idx up until its parent is later */
+static void cpudl_heapify_up(struct cpudl *cp, int idx)
+{
+	while (idx > 0 && dl_time_before(cp->elements[parent(idx)].dl,
+					 cp->elements[idx].dl)) {
+		cpudl_exchange(cp, idx, parent(idx));
+		idx = parent(idx);
+	}
+}
+
+static void cpudl_change_key(struct cpudl *cp, int idx, u64 new_dl)
+{
+	WARN_ON(idx == IDX_INVALID || idx >= cp->size);
+
+	if (dl_time_before(new_dl, cp->elements[idx].dl)) {
+		cp->elements[idx].dl = new_dl;
+		cpudl_heapify_down(cp, idx);
+	} else {
+		cp->elements[idx].dl = new_dl;
+		cpudl_heapify_up(cp, idx);
+	}
+}
+
+/**
+ * cpudl_find - find the best (later-dl) CPU in the system
+ * @cp: the cpudl max-heap context
+ * @p: the task
+ * @later_mask: a mask to fill in with the selected CPUs (or NULL)
+ *
+ * Like cpupri_find(), this reads a state that may change as soon as it
+ * has been looked at; the callers check the result again under the
+ * runqueue locks.
+ *
+ * Returns: int - best CPU (heap maximum if suitable), or -1
+ */
+int cpudl_find(struct cpudl *cp, struct task_struct *p,
+	       struct cpumask *later_mask)
+{
+	const struct sched_dl_entity *dl_se = &p->dl;
+	int best_cpu = -1;
+
+	if (later_mask && cpumask_and(later_mask, cp->free_cpus,
+				      &p->cpus_allowed)) {
+		best_cpu = cpumask_any(later_mask);
+	} else if (ACCESS_ONCE(cp->size) > 0) {
+		int cpu = ACCESS_ONCE(cp->elements[0].cpu);
+
+		if (cpumask_test_cpu(cpu, &p->cpus_allowed) &&
+		    dl_time_before(dl_se->deadline, cp->elements[0].dl)) {
+			best_cpu = cpu;
+			if (later_mask) {
+				cpumask_clear(later_mask);
+				cpumask_set_cpu(best_cpu, later_mask);
+			}
+		}
+	}
+
+	return best_cpu;
+}
+
+/**
+ * cpudl_set - update the cpudl max-heap
+ * @cp: the cpudl max-heap context
+ * @cpu: the target cpu
+ * @dl: the new earliest deadline for this cpu
+ * @is_valid: a bool, false to remove @cpu from the heap
+ *
+ * Notes: assumes cpu_rq(cpu)->lock is locked
+ *
+ * Returns: (void)
+ */
+void cpudl_set(struct cpudl *cp, int cpu, u64 dl, int is_valid)
+{
+	int old_idx, new_cpu;
+	unsigned long flags;
+
+	WARN_ON(!cpu_present(cpu));
+
+	raw_spin_lock_irqsave(&cp->lock, flags);
+	old_idx = cp->cpu_to_idx[cpu];
+	if (!is_valid) {
+		/*
+		 * Nothing to remove if the cpu was not in the heap, as
+		 * happens when rq_offline_dl() is called for a cpu that
+		 * never had -deadline tasks.
+		 */
+		if (old_idx == IDX_INVALID)
+			goto out;
+
+		/* Fill the hole with the last element and fix it up */
+		cp->size--;
+		cp->cpu_to_idx[cpu] = IDX_INVALID;
+		if (old_idx != cp->size) {
+			new_cpu = cp->elements[cp->size].cpu;
+			cp->elements[old_idx] = cp->elements[cp->size];
+			cp->cpu_to_idx[new_cpu] = old_idx;
+			cpudl_heapify_up(cp, old_idx);
+			cpudl_heapify_down(cp, cp->cpu_to_idx[new_cpu]);
+		}
+		cpumask_set_cpu(cpu, cp->free_cpus);
+		goto out;
+	}
+
+	if (old_idx == IDX_INVALID) {
+		int new_idx = cp->size++;
+
+		cp->elements[new_idx].dl = dl;
+		cp->elements[new_idx].cpu = cpu;
+		cp->cpu_to_idx[cpu] = new_idx;
+		cpudl_heapify_up(cp, new_idx);
+		cpumask_clear_cpu(cpu, cp->free_cpus);
+	} else {
+		cpudl_change_key(cp, old_idx, dl);
+	}
+
+out:
+	raw_spin_unlock_irqrestore(&cp->lock, flags);
+}
+
+/**
+ * cpudl_set_freecpu - set the cpudl.free_cpus
+ * @cp: the cpudl max-heap context
+ * @cpu: rd attached cpu
+ */
+void cpudl_set_freecpu(struct cpudl *cp, int cpu)
+{
+	cpumask_set_cpu(cpu, cp->free_cpus);
+}
+
+/**
+ * cpudl_clear_freecpu - clear the cpudl.free_cpus
+ * @cp: the cpudl max-heap context
+ * @cpu: rd attached cpu
+ */
+void cpudl_clear_freecpu(struct cpudl *cp, int cpu)
+{
+	cpumask_clear_cpu(cpu, cp->free_cpus);
+}
+
+/**
+ * cpudl_init - initialize the cpudl structure
+ * @cp: the cpudl max-heap context
+ *
+ * Returns: -ENOMEM if memory fails.
+ */
+int cpudl_init(struct cpudl *cp)
+{
+	int i;
+
+	memset(cp, 0, sizeof(*cp));
+	raw_spin_lock_init(&cp->lock);
+
+	cp->elements = kcalloc(nr_cpu_ids, sizeof(struct cpudl_item),
+			       GFP_KERNEL);
+	if (!cp->elements)
+		return -ENOMEM;
+
+	cp->cpu_to_idx = kcalloc(nr_cpu_ids, sizeof(int), GFP_KERNEL);
+	if (!cp->cpu_to_idx)
+		goto free_elements;
+
+	if (!zalloc_cpumask_var(&cp->free_cpus, GFP_KERNEL))
+		goto free_cpu_to_idx;
+
+	for_each_possible_cpu(i)
+		cp->cpu_to_idx[i] = IDX_INVALID;
+
+	return 0;
+
+free_cpu_to_idx:
+	kfree(cp->cpu_to_idx);
+free_elements:
+	kfree(cp->elements);
+	return -ENOMEM;
+}
+
+/**
+ * cpudl_cleanup - clean up the cpudl structure
+ * @cp: the cpudl max-heap context
+ */
+void cpudl_cleanup(struct cpudl *cp)
+{
+	free_cpumask_var(cp->free_cpus);
+	kfree(cp->cpu_to_idx);
+	kfree(cp->elements);
+}
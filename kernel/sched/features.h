@@ -49,9 +49,9 @@ SCHED_FEAT(DOUBLE_TICK, false)
 SCHED_FEAT(LB_BIAS, true)
 
 /*
- * Spin-wait on mutex acquisition when the mutex owner is running on
- * another cpu -- assumes that when the owner is running, it will soon
- * release the lock. Decreases scheduling overhead.
+ * Spin-wait on mutex and rwsem write acquisition when the owner is
+ * running on another cpu -- assumes that when the owner is running, it
+ * will soon release the lock. Decreases scheduling overhead.
  */
 SCHED_FEAT(OWNER_SPIN, true)
 
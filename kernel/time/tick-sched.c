@@ -20,6 +20,10 @@
 #include <linux/profile.h>
 #include <linux/sched.h>
 #include <linux/module.h>
+#include <linux/irq_work.h>
+#include <linux/perf_event.h>
+#include <linux/posix-timers.h>
+#include <linux/bootmem.h>
 
 #include <asm/irq_regs.h>
 
@@ -271,49 +275,32 @@ u64 get_cpu_iowait_time_us(int cpu, u64 *last_update_time)
 }
 EXPORT_SYMBOL_GPL(get_cpu_iowait_time_us);
 
-static void tick_nohz_stop_sched_tick(struct tick_sched *ts)
+#ifdef CONFIG_NO_HZ_FULL
+/*
+ * The timekeeper keeps jiffies going for the full dynticks cpus and
+ * therefore never stops its own tick.
+ */
+static inline bool tick_nohz_full_timekeeper(int cpu)
+{
+	return tick_nohz_full_running && cpu == tick_do_timer_cpu;
+}
+#else
+static inline bool tick_nohz_full_timekeeper(int cpu) { return false; }
+#endif
+
+/*
+ * Stop the tick, or reprogram it if it is already stopped, until the next
+ * timer event of this cpu.  Used both by an idle cpu and by a full
+ * dynticks cpu running a single task.
+ */
+static void tick_nohz_stop_sched_tick(struct tick_sched *ts, ktime_t now,
+				      int cpu)
 {
 	unsigned long seq, last_jiffies, next_jiffies, delta_jiffies;
-	ktime_t last_update, expires, now;
+	ktime_t last_update, expires;
 	struct clock_event_device *dev = __get_cpu_var(tick_cpu_device).evtdev;
 	u64 time_delta;
-	int cpu;
 
-	cpu = smp_processor_id();
-	ts = &per_cpu(tick_cpu_sched, cpu);
-
-	now = tick_nohz_start_idle(cpu, ts);
-
-	/*
-	 * If this cpu is offline and it is the one which updates
-	 * jiffies, then give up the assignment and let it be taken by
-	 * the cpu which runs the tick timer next. If we don't drop
-	 * this here the jiffies might be stale and do_timer() never
-	 * invoked.
-	 */
-	if (unlikely(!cpu_online(cpu))) {
-		if (cpu == tick_do_timer_cpu)
-			tick_do_timer_cpu = TICK_DO_TIMER_NONE;
-	}
-
-	if (unlikely(ts->nohz_mode == NOHZ_MODE_INACTIVE))
-		return;
-
-	if (need_resched())
-		return;
-
-	if (unlikely(local_softirq_pending() && cpu_online(cpu))) {
-		static int ratelimit;
-
-		if (ratelimit < 10) {
-			printk(KERN_ERR "NOHZ: local_softirq_pending %02x\n",
-			       (unsigned int) local_softirq_pending());
-			ratelimit++;
-		}
-		return;
-	}
-
-	ts->idle_calls++;
 	/* Read jiffies and the time when jiffies were updated last */
 	do {
 		seq = read_seqbegin(&xtime_lock);
@@ -333,9 +320,11 @@ static void tick_nohz_stop_sched_tick(struct tick_sched *ts)
 	}
 	/*
 	 * Do not stop the tick, if we are only one off
-	 * or if the cpu is required for rcu
+	 * or if the cpu is required for rcu or keeps the
+	 * jiffies for full dynticks cpus
 	 */
-	if (!ts->tick_stopped && delta_jiffies == 1)
+	if (!ts->tick_stopped &&
+	    (delta_jiffies == 1 || tick_nohz_full_timekeeper(cpu)))
 		goto out;
 
 	/* Schedule the tick, if we are at least one jiffie off */
@@ -400,14 +389,18 @@ static void tick_nohz_stop_sched_tick(struct tick_sched *ts)
 		 * the scheduler tick in nohz_restart_sched_tick.
 		 */
 		if (!ts->tick_stopped) {
-			select_nohz_load_balancer(1);
+			if (ts->inidle)
+				select_nohz_load_balancer(1);
+			else
+				calc_load_account_nohz_full();
 
 			ts->idle_tick = hrtimer_get_expires(&ts->sched_timer);
 			ts->tick_stopped = 1;
 			ts->idle_jiffies = last_jiffies;
 		}
 
-		ts->idle_sleeps++;
+		if (ts->inidle)
+			ts->idle_sleeps++;
 
 		/* Mark expires */
 		ts->idle_expires = expires;
@@ -444,6 +437,251 @@ out:
 	ts->sleep_length = ktime_sub(dev->next_event, now);
 }
 
+static void __tick_nohz_idle_enter(struct tick_sched *ts)
+{
+	int cpu = smp_processor_id();
+	ktime_t now;
+
+	now = tick_nohz_start_idle(cpu, ts);
+
+	/*
+	 * If this cpu is offline and it is the one which updates
+	 * jiffies, then give up the assignment and let it be taken by
+	 * the cpu which runs the tick timer next. If we don't drop
+	 * this here the jiffies might be stale and do_timer() never
+	 * invoked.
+	 */
+	if (unlikely(!cpu_online(cpu))) {
+		if (cpu == tick_do_timer_cpu)
+			tick_do_timer_cpu = TICK_DO_TIMER_NONE;
+	}
+
+	if (unlikely(ts->nohz_mode == NOHZ_MODE_INACTIVE))
+		return;
+
+	if (need_resched())
+		return;
+
+	if (unlikely(local_softirq_pending() && cpu_online(cpu))) {
+		static int ratelimit;
+
+		if (ratelimit < 10) {
+			printk(KERN_ERR "NOHZ: local_softirq_pending %02x\n",
+			       (unsigned int) local_softirq_pending());
+			ratelimit++;
+		}
+		return;
+	}
+
+	ts->idle_calls++;
+	tick_nohz_stop_sched_tick(ts, now, cpu);
+}
+
+/*
+ * The tick charges the jiffy it interrupts to the current task, so once
+ * it is back the jiffies a full dynticks cpu ran through without it are
+ * charged to the task that ran, as user time since that is what this
+ * mode is for.  Idle time is accounted separately by the idle exit path.
+ */
+static void tick_nohz_account_busy_ticks(struct tick_sched *ts)
+{
+#ifndef CONFIG_VIRT_CPU_ACCOUNTING
+	unsigned long ticks = jiffies - ts->idle_jiffies;
+
+	/*
+	 * We might be one off. Do not randomly account a huge number of ticks!
+	 */
+	if (ticks && ticks < LONG_MAX) {
+		cputime_t delta = jiffies_to_cputime(ticks);
+
+		account_user_time(current, delta, cputime_to_scaled(delta));
+	}
+#endif
+	ts->idle_jiffies = jiffies;
+}
+
+#ifdef CONFIG_NO_HZ_FULL
+bool tick_nohz_full_running;
+cpumask_var_t tick_nohz_full_mask;
+
+static void tick_nohz_restart(struct tick_sched *ts, ktime_t now);
+
+/*
+ * Everything the tick does for a running task that cannot be done, or
+ * noticed, without it.
+ */
+static bool can_stop_full_tick(int cpu)
+{
+	WARN_ON_ONCE(!irqs_disabled());
+
+	if (!sched_can_stop_tick())
+		return false;
+
+	if (!posix_cpu_timers_can_stop_tick(current))
+		return false;
+
+	if (!perf_event_can_stop_tick())
+		return false;
+
+	/* Quiescent states are only reported from the tick */
+	if (rcu_needs_tick(cpu))
+		return false;
+
+#ifdef CONFIG_HAVE_UNSTABLE_SCHED_CLOCK
+	/* sched_clock_tick() keeps an unstable sched_clock() in check */
+	if (!sched_clock_stable)
+		return false;
+#endif
+
+	return true;
+}
+
+static void tick_nohz_full_stop_tick(struct tick_sched *ts)
+{
+	int cpu = smp_processor_id();
+
+	if (!tick_nohz_full_cpu(cpu) || is_idle_task(current))
+		return;
+
+	if (unlikely(ts->nohz_mode == NOHZ_MODE_INACTIVE))
+		return;
+
+	if (!can_stop_full_tick(cpu)) {
+		if (ts->tick_stopped) {
+			tick_nohz_account_busy_ticks(ts);
+			ts->tick_stopped = 0;
+			tick_nohz_restart(ts, ktime_get());
+		}
+		return;
+	}
+
+	tick_nohz_stop_sched_tick(ts, ktime_get(), cpu);
+}
+
+/*
+ * Nothing to do here: the point is to go through irq_exit(), which
+ * reevaluates the tick of a full dynticks cpu.
+ */
+static void nohz_full_kick_work_func(struct irq_work *work)
+{
+}
+
+static DEFINE_PER_CPU(struct irq_work, nohz_full_kick_work) = {
+	.func = nohz_full_kick_work_func,
+};
+
+/**
+ * tick_nohz_full_kick - have the tick of this cpu reevaluated
+ *
+ * For state changes made outside of interrupt context that a full
+ * dynticks cpu with its tick stopped would not notice otherwise.  Safe
+ * to call with interrupts disabled.
+ */
+void tick_nohz_full_kick(void)
+{
+	if (tick_nohz_full_cpu(smp_processor_id()))
+		irq_work_queue(&__get_cpu_var(nohz_full_kick_work));
+}
+
+/**
+ * tick_nohz_full_kick_cpu - have the tick of a cpu reevaluated
+ * @cpu: the cpu, does nothing unless it is a full dynticks one
+ *
+ * Must be called with preemption disabled.
+ */
+void tick_nohz_full_kick_cpu(int cpu)
+{
+	if (!tick_nohz_full_cpu(cpu))
+		return;
+
+	if (cpu == smp_processor_id())
+		irq_work_queue(&__get_cpu_var(nohz_full_kick_work));
+	else
+		smp_send_reschedule(cpu);
+}
+
+/**
+ * tick_nohz_full_kick_all - have the tick of all full dynticks cpus
+ * reevaluated
+ */
+void tick_nohz_full_kick_all(void)
+{
+	int cpu;
+
+	if (!tick_nohz_full_running)
+		return;
+
+	preempt_disable();
+	for_each_cpu_and(cpu, tick_nohz_full_mask, cpu_online_mask)
+		tick_nohz_full_kick_cpu(cpu);
+	preempt_enable();
+}
+
+/*
+ * Parse nohz_full=<cpu list>.  The boot cpu takes the timekeeping duty
+ * and is kept out of the list.
+ */
+static int __init tick_nohz_full_setup(char *str)
+{
+	int cpu;
+
+	alloc_bootmem_cpumask_var(&tick_nohz_full_mask);
+	if (cpulist_parse(str, tick_nohz_full_mask) < 0) {
+		printk(KERN_WARNING "NOHZ: Incorrect nohz_full cpu list\n");
+		return 1;
+	}
+
+	cpu = smp_processor_id();
+	if (cpumask_test_cpu(cpu, tick_nohz_full_mask)) {
+		printk(KERN_WARNING "NOHZ: Clearing %d from nohz_full range "
+		       "for timekeeping\n", cpu);
+		cpumask_clear_cpu(cpu, tick_nohz_full_mask);
+	}
+	tick_nohz_full_running = !cpumask_empty(tick_nohz_full_mask);
+
+	return 1;
+}
+__setup("nohz_full=", tick_nohz_full_setup);
+
+static int __cpuinit tick_nohz_cpu_down_callback(struct notifier_block *nfb,
+						 unsigned long action,
+						 void *hcpu)
+{
+	unsigned int cpu = (unsigned long)hcpu;
+
+	switch (action & ~CPU_TASKS_FROZEN) {
+	case CPU_DOWN_PREPARE:
+		/*
+		 * The full dynticks cpus rely on the timekeeper for
+		 * jiffies, which nobody would take over from it.
+		 */
+		if (tick_nohz_full_running && tick_do_timer_cpu == cpu)
+			return NOTIFY_BAD;
+		break;
+	}
+	return NOTIFY_OK;
+}
+
+static char tick_nohz_full_buf[NR_CPUS * 5] __initdata;
+
+static int __init tick_nohz_full_init(void)
+{
+	if (!tick_nohz_full_running)
+		return 0;
+
+	cpu_notifier(tick_nohz_cpu_down_callback, 0);
+	cpulist_scnprintf(tick_nohz_full_buf, sizeof(tick_nohz_full_buf),
+			  tick_nohz_full_mask);
+	printk(KERN_INFO "NOHZ: Full dynticks cpus: %s.\n",
+	       tick_nohz_full_buf);
+
+	return 0;
+}
+early_initcall(tick_nohz_full_init);
+#else
+static inline void tick_nohz_full_stop_tick(struct tick_sched *ts) { }
+#endif /* CONFIG_NO_HZ_FULL */
+
 /**
  * tick_nohz_idle_enter - stop the idle tick from the idle task
  *
@@ -479,7 +717,18 @@ void tick_nohz_idle_enter(void)
 	 * update of the idle time accounting in tick_nohz_start_idle().
 	 */
 	ts->inidle = 1;
-	tick_nohz_stop_sched_tick(ts);
+
+	/*
+	 * A full dynticks cpu may come here with the tick already stopped
+	 * for the task that just blocked: settle the time of that task,
+	 * so that only the time from now on counts as idle.
+	 */
+	if (ts->tick_stopped) {
+		tick_nohz_account_busy_ticks(ts);
+		select_nohz_load_balancer(1);
+	}
+
+	__tick_nohz_idle_enter(ts);
 
 	local_irq_enable();
 }
@@ -491,15 +740,18 @@ void tick_nohz_idle_enter(void)
  * a reschedule, it may still add, modify or delete a timer, enqueue
  * an RCU callback, etc...
  * So we need to re-calculate and reprogram the next tick event.
+ *
+ * On a full dynticks cpu that runs a task, the interrupt may also have
+ * queued a second task or anything else which needs the tick back.
  */
 void tick_nohz_irq_exit(void)
 {
 	struct tick_sched *ts = &__get_cpu_var(tick_cpu_sched);
 
-	if (!ts->inidle)
-		return;
-
-	tick_nohz_stop_sched_tick(ts);
+	if (ts->inidle)
+		__tick_nohz_idle_enter(ts);
+	else
+		tick_nohz_full_stop_tick(ts);
 }
 
 /**
@@ -628,7 +880,8 @@ static void tick_nohz_handler(struct clock_event_device *dev)
 	 * this duty, then the jiffies update is still serialized by
 	 * xtime_lock.
 	 */
-	if (unlikely(tick_do_timer_cpu == TICK_DO_TIMER_NONE))
+	if (unlikely(tick_do_timer_cpu == TICK_DO_TIMER_NONE) &&
+	    !tick_nohz_full_cpu(cpu))
 		tick_do_timer_cpu = cpu;
 
 	/* Check, if the jiffies need an update */
@@ -780,7 +1033,8 @@ static enum hrtimer_restart tick_sched_timer(struct hrtimer *timer)
 	 * this duty, then the jiffies update is still serialized by
 	 * xtime_lock.
 	 */
-	if (unlikely(tick_do_timer_cpu == TICK_DO_TIMER_NONE))
+	if (unlikely(tick_do_timer_cpu == TICK_DO_TIMER_NONE) &&
+	    !tick_nohz_full_cpu(cpu))
 		tick_do_timer_cpu = cpu;
 #endif
 
@@ -17,8 +17,9 @@
  * This is the generic async execution mechanism.  Work items as are
  * executed in process context.  The worker pool is shared and
  * automatically managed.  There is one worker pool for each CPU and
- * one extra for works which are better served by workers which are
- * not bound to any specific CPU.
+ * extra ones for works which are better served by workers which are
+ * not bound to any specific CPU, one per set of worker attributes and
+ * NUMA node.
  *
  * Please read Documentation/workqueue.txt for details.
  */
@@ -41,6 +42,9 @@
 #include <linux/debug_locks.h>
 #include <linux/lockdep.h>
 #include <linux/idr.h>
+#include <linux/rculist.h>
+#include <linux/moduleparam.h>
+#include <linux/kobject.h>
 
 #include "workqueue_sched.h"
 
@@ -91,6 +95,9 @@ enum {
 	 * all cpus.  Give -20.
 	 */
 	RESCUER_NICE_LEVEL	= -20,
+
+	/* work->data ids of unbound gcwqs start right after WORK_CPU_NONE */
+	UNBOUND_GCWQ_ID_BASE	= WORK_CPU_NONE + 1,
 };
 
 /*
@@ -112,6 +119,8 @@ enum {
  * F: wq->flush_mutex protected.
  *
  * W: workqueue_lock protected.
+ *
+ * M: wq_pool_mutex protected.
  */
 
 struct global_cwq;
@@ -167,6 +176,13 @@ struct global_cwq {
 	unsigned int		trustee_state;	/* L: trustee state */
 	wait_queue_head_t	trustee_wait;	/* trustee wait */
 	struct worker		*first_idle;	/* L: first idle worker */
+
+	unsigned int		id;		/* I: id kept in work->data */
+	int			node;		/* I: node to create workers on */
+	struct workqueue_attrs	*attrs;		/* I: unbound worker attrs */
+	int			refcnt;		/* M: cwqs of unbound gcwq */
+	struct list_head	list;		/* M+W: on the gcwqs list */
+	struct rcu_head		rcu;		/* unbound gcwq RCU free */
 } ____cacheline_aligned_in_smp;
 
 /*
@@ -184,6 +200,12 @@ struct cpu_workqueue_struct {
 	int			nr_active;	/* L: nr of active works */
 	int			max_active;	/* L: max active works */
 	struct list_head	delayed_works;	/* L: delayed works */
+	struct list_head	cwqs_node;	/* F+W: on wq->cwqs */
+	int			refcnt;		/* L: reference count */
+
+	/* release of unbound cwqs, see cwq_put() */
+	struct work_struct	release_work;
+	struct rcu_head		rcu;
 };
 
 /*
@@ -222,12 +244,9 @@ typedef unsigned long mayday_mask_t;
  */
 struct workqueue_struct {
 	unsigned int		flags;		/* W: WQ_* flags */
-	union {
-		struct cpu_workqueue_struct __percpu	*pcpu;
-		struct cpu_workqueue_struct		*single;
-		unsigned long				v;
-	} cpu_wq;				/* I: cwq's */
-	struct list_head	list;		/* W: list of all workqueues */
+	struct cpu_workqueue_struct __percpu *cpu_wq; /* I: bound cwqs */
+	struct list_head	cwqs;		/* F+W: all cwqs of the wq */
+	struct list_head	list;		/* M+W: list of all workqueues */
 
 	struct mutex		flush_mutex;	/* protects wq flushing */
 	int			work_color;	/* F: current work color */
@@ -242,6 +261,13 @@ struct workqueue_struct {
 
 	int			nr_drainers;	/* W: drain in progress */
 	int			saved_max_active; /* W: saved cwq max_active */
+
+	struct workqueue_attrs	*unbound_attrs;	/* M: unbound worker attrs */
+	struct cpu_workqueue_struct *dfl_cwq;	/* M: unbound cwq, any node */
+	struct cpu_workqueue_struct **numa_cwq;	/* M: unbound cwqs by node */
+#ifdef CONFIG_SYSFS
+	struct wq_sysfs		*sysfs;		/* M: sysfs directory */
+#endif
 #ifdef CONFIG_LOCKDEP
 	struct lockdep_map	lockdep_map;
 #endif
@@ -268,54 +294,31 @@ EXPORT_SYMBOL_GPL(system_nrt_freezable_wq);
 	for (i = 0; i < BUSY_WORKER_HASH_SIZE; i++)			\
 		hlist_for_each_entry(worker, pos, &gcwq->busy_hash[i], hentry)
 
-static inline int __next_gcwq_cpu(int cpu, const struct cpumask *mask,
-				  unsigned int sw)
-{
-	if (cpu < nr_cpu_ids) {
-		if (sw & 1) {
-			cpu = cpumask_next(cpu, mask);
-			if (cpu < nr_cpu_ids)
-				return cpu;
-		}
-		if (sw & 2)
-			return WORK_CPU_UNBOUND;
-	}
-	return WORK_CPU_NONE;
-}
-
-static inline int __next_wq_cpu(int cpu, const struct cpumask *mask,
-				struct workqueue_struct *wq)
-{
-	return __next_gcwq_cpu(cpu, mask, !(wq->flags & WQ_UNBOUND) ? 1 : 2);
-}
-
 /*
- * CPU iterators
- *
- * An extra gcwq is defined for an invalid cpu number
- * (WORK_CPU_UNBOUND) to host workqueues which are not bound to any
- * specific CPU.  The following iterators are similar to
- * for_each_*_cpu() iterators but also considers the unbound gcwq.
- *
- * for_each_gcwq_cpu()		: possible CPUs + WORK_CPU_UNBOUND
- * for_each_online_gcwq_cpu()	: online CPUs + WORK_CPU_UNBOUND
- * for_each_cwq_cpu()		: possible CPUs for bound workqueues,
- *				  WORK_CPU_UNBOUND for unbound workqueues
+ * gcwq and cwq iterators
+ *
+ * Besides the per-cpu gcwqs, unbound gcwqs are created on demand for
+ * each distinct set of workqueue_attrs and NUMA node, and unbound
+ * workqueues get a cwq for each unbound gcwq they use.  An unbound cwq
+ * is released once it's no longer installed in its workqueue and has
+ * no work left, and an unbound gcwq once its last cwq is gone.  Both
+ * are freed after a sched-RCU grace period.
+ *
+ * The gcwqs list is modified with wq_pool_mutex and workqueue_lock
+ * held, wq->cwqs with wq->flush_mutex and workqueue_lock.  Either lock
+ * or sched-RCU, e.g. disabled irqs, is enough to walk them; sleeping
+ * walkers have to pin the cwq they're at, see wait_on_cpu_work().
+ *
+ * for_each_gcwq()		: per-cpu gcwqs of possible CPUs, then
+ *				  unbound gcwqs
+ * for_each_cwq()		: per-cpu cwqs of possible CPUs for bound
+ *				  workqueues, all cwqs for unbound ones
  */
-#define for_each_gcwq_cpu(cpu)						\
-	for ((cpu) = __next_gcwq_cpu(-1, cpu_possible_mask, 3);		\
-	     (cpu) < WORK_CPU_NONE;					\
-	     (cpu) = __next_gcwq_cpu((cpu), cpu_possible_mask, 3))
+#define for_each_gcwq(gcwq)						\
+	list_for_each_entry_rcu((gcwq), &gcwqs, list)
 
-#define for_each_online_gcwq_cpu(cpu)					\
-	for ((cpu) = __next_gcwq_cpu(-1, cpu_online_mask, 3);		\
-	     (cpu) < WORK_CPU_NONE;					\
-	     (cpu) = __next_gcwq_cpu((cpu), cpu_online_mask, 3))
-
-#define for_each_cwq_cpu(cpu, wq)					\
-	for ((cpu) = __next_wq_cpu(-1, cpu_possible_mask, (wq));	\
-	     (cpu) < WORK_CPU_NONE;					\
-	     (cpu) = __next_wq_cpu((cpu), cpu_possible_mask, (wq)))
+#define for_each_cwq(cwq, wq)						\
+	list_for_each_entry_rcu((cwq), &(wq)->cwqs, cwqs_node)
 
 #ifdef CONFIG_DEBUG_OBJECTS_WORK
 
@@ -438,6 +441,18 @@ static DEFINE_SPINLOCK(workqueue_lock);
 static LIST_HEAD(workqueues);
 static bool workqueue_freezing;		/* W: have wqs started freezing? */
 
+/* Serializes unbound gcwq creation and workqueue attribute changes. */
+static DEFINE_MUTEX(wq_pool_mutex);
+static LIST_HEAD(gcwqs);		/* M+W: all gcwqs, see for_each_gcwq() */
+static DEFINE_IDR(unbound_gcwq_idr);	/* M: unbound gcwqs by id */
+
+/* Unbound workqueues have a cwq for each node unless this is set. */
+static bool wq_disable_numa;
+module_param_named(disable_numa, wq_disable_numa, bool, 0444);
+
+static bool wq_numa_enabled;		/* unbound wqs are split by node */
+static cpumask_var_t *wq_numa_possible_cpumask; /* possible cpus of nodes */
+
 /*
  * The almighty global cpu workqueues.  nr_running is the only field
  * which is expected to be used frequently by other cpus via
@@ -447,21 +462,27 @@ static DEFINE_PER_CPU(struct global_cwq, global_cwq);
 static DEFINE_PER_CPU_SHARED_ALIGNED(atomic_t, gcwq_nr_running);
 
 /*
- * Global cpu workqueue and nr_running counter for unbound gcwq.  The
- * gcwq is always online, has GCWQ_DISASSOCIATED set, and all its
- * workers have WORKER_UNBOUND set.
+ * nr_running counter shared by the unbound gcwqs.  Those are always
+ * online, have GCWQ_DISASSOCIATED set, and all their workers have
+ * WORKER_UNBOUND set.
  */
-static struct global_cwq unbound_global_cwq;
 static atomic_t unbound_gcwq_nr_running = ATOMIC_INIT(0);	/* always 0 */
 
 static int worker_thread(void *__worker);
 
 static struct global_cwq *get_gcwq(unsigned int cpu)
 {
-	if (cpu != WORK_CPU_UNBOUND)
-		return &per_cpu(global_cwq, cpu);
-	else
-		return &unbound_global_cwq;
+	return &per_cpu(global_cwq, cpu);
+}
+
+static struct global_cwq *get_unbound_gcwq(unsigned int id)
+{
+	struct global_cwq *gcwq;
+
+	rcu_read_lock();
+	gcwq = idr_find(&unbound_gcwq_idr, id - UNBOUND_GCWQ_ID_BASE);
+	rcu_read_unlock();
+	return gcwq;
 }
 
 static atomic_t *get_gcwq_nr_running(unsigned int cpu)
@@ -472,17 +493,89 @@ static atomic_t *get_gcwq_nr_running(unsigned int cpu)
 		return &unbound_gcwq_nr_running;
 }
 
+/*
+ * For unbound workqueues, the cwq of the node of @cpu, or of the local
+ * node for WORK_CPU_UNBOUND.  A cwq which has just been replaced by
+ * apply_workqueue_attrs() may be returned.  It stays usable as long as
+ * it has works, __queue_work() picks another one if it's already been
+ * released.  Called with sched-RCU held for unbound workqueues.
+ */
 static struct cpu_workqueue_struct *get_cwq(unsigned int cpu,
 					    struct workqueue_struct *wq)
 {
+	struct cpu_workqueue_struct *cwq;
+
 	if (!(wq->flags & WQ_UNBOUND)) {
 		if (likely(cpu < nr_cpu_ids))
-			return per_cpu_ptr(wq->cpu_wq.pcpu, cpu);
-	} else if (likely(cpu == WORK_CPU_UNBOUND))
-		return wq->cpu_wq.single;
+			return per_cpu_ptr(wq->cpu_wq, cpu);
+		return NULL;
+	}
+
+	if (wq->numa_cwq) {
+		if (cpu >= nr_cpu_ids)
+			cpu = raw_smp_processor_id();
+		cwq = ACCESS_ONCE(wq->numa_cwq[cpu_to_node(cpu)]);
+	} else
+		cwq = ACCESS_ONCE(wq->dfl_cwq);
+	smp_read_barrier_depends();	/* pairs with apply_workqueue_attrs() */
+	return cwq;
+}
+
+/*
+ * Find the cwq installed in unbound @wq which serves @gcwq, NULL if
+ * there's none.  Called with wq_pool_mutex held.
+ */
+static struct cpu_workqueue_struct *
+find_installed_cwq(struct workqueue_struct *wq, struct global_cwq *gcwq)
+{
+	int node;
+
+	if (wq->dfl_cwq && wq->dfl_cwq->gcwq == gcwq)
+		return wq->dfl_cwq;
+	if (wq->numa_cwq)
+		for_each_node(node)
+			if (wq->numa_cwq[node] &&
+			    wq->numa_cwq[node]->gcwq == gcwq)
+				return wq->numa_cwq[node];
 	return NULL;
 }
 
+/*
+ * cwq reference counting.  A cwq holds a reference for each work
+ * queued on it, barriers included, and unbound ones an extra one as
+ * long as they're installed in their workqueue.
+ *
+ * CONTEXT:
+ * spin_lock_irq(gcwq->lock).
+ */
+static void cwq_get(struct cpu_workqueue_struct *cwq)
+{
+	WARN_ON_ONCE(cwq->refcnt <= 0);
+	cwq->refcnt++;
+}
+
+static void cwq_put(struct cpu_workqueue_struct *cwq)
+{
+	if (likely(--cwq->refcnt))
+		return;
+	if (WARN_ON_ONCE(!(cwq->wq->flags & WQ_UNBOUND)))
+		return;
+	/*
+	 * @cwq can't be released under gcwq->lock, bounce to its
+	 * release_work.  This never recurses on the same gcwq->lock as
+	 * only unbound cwqs get here and system_wq is per-cpu.  Unbound
+	 * gcwq->locks have a lockdep subclass of 1 to tell them apart.
+	 */
+	schedule_work(&cwq->release_work);
+}
+
+static void cwq_put_unlocked(struct cpu_workqueue_struct *cwq)
+{
+	spin_lock_irq(&cwq->gcwq->lock);
+	cwq_put(cwq);
+	spin_unlock_irq(&cwq->gcwq->lock);
+}
+
 static unsigned int work_color_to_flags(int color)
 {
 	return color << WORK_STRUCT_COLOR_SHIFT;
@@ -502,16 +595,21 @@ static int work_next_color(int color)
 /*
  * A work's data points to the cwq with WORK_STRUCT_CWQ set while the
  * work is on queue.  Once execution starts, WORK_STRUCT_CWQ is
- * cleared and the work data contains the cpu number it was last on.
+ * cleared and the work data contains the id of the gcwq it was last
+ * on: the cpu number for per-cpu gcwqs and UNBOUND_GCWQ_ID_BASE plus
+ * the index in unbound_gcwq_idr for unbound ones.
  *
- * set_work_{cwq|cpu}() and clear_work_data() can be used to set the
- * cwq, cpu or clear work->data.  These functions should only be
+ * set_work_{cwq|gcwq}() and clear_work_data() can be used to set the
+ * cwq, gcwq or clear work->data.  These functions should only be
  * called while the work is owned - ie. while the PENDING bit is set.
  *
  * get_work_[g]cwq() can be used to obtain the gcwq or cwq
  * corresponding to a work.  gcwq is available once the work has been
  * queued anywhere after initialization.  cwq is available only from
- * queueing until execution starts.
+ * queueing until execution starts.  As an idle work may refer to an
+ * unbound gcwq which has since been freed, get_work_gcwq() must be
+ * called with sched-RCU held, usually by disabling irqs before taking
+ * gcwq->lock, and the id may even match a newer gcwq.
  */
 static inline void set_work_data(struct work_struct *work, unsigned long data,
 				 unsigned long flags)
@@ -528,9 +626,10 @@ static void set_work_cwq(struct work_struct *work,
 		      WORK_STRUCT_PENDING | WORK_STRUCT_CWQ | extra_flags);
 }
 
-static void set_work_cpu(struct work_struct *work, unsigned int cpu)
+static void set_work_gcwq(struct work_struct *work, struct global_cwq *gcwq)
 {
-	set_work_data(work, cpu << WORK_STRUCT_FLAG_BITS, WORK_STRUCT_PENDING);
+	set_work_data(work, (unsigned long)gcwq->id << WORK_STRUCT_FLAG_BITS,
+		      WORK_STRUCT_PENDING);
 }
 
 static void clear_work_data(struct work_struct *work)
@@ -551,18 +650,20 @@ static struct cpu_workqueue_struct *get_work_cwq(struct work_struct *work)
 static struct global_cwq *get_work_gcwq(struct work_struct *work)
 {
 	unsigned long data = atomic_long_read(&work->data);
-	unsigned int cpu;
+	unsigned int id;
 
 	if (data & WORK_STRUCT_CWQ)
 		return ((struct cpu_workqueue_struct *)
 			(data & WORK_STRUCT_WQ_DATA_MASK))->gcwq;
 
-	cpu = data >> WORK_STRUCT_FLAG_BITS;
-	if (cpu == WORK_CPU_NONE)
+	id = data >> WORK_STRUCT_FLAG_BITS;
+	if (id == WORK_CPU_NONE)
 		return NULL;
+	if (id >= UNBOUND_GCWQ_ID_BASE)
+		return get_unbound_gcwq(id);
 
-	BUG_ON(cpu >= nr_cpu_ids && cpu != WORK_CPU_UNBOUND);
-	return get_gcwq(cpu);
+	BUG_ON(id >= nr_cpu_ids);
+	return get_gcwq(id);
 }
 
 /*
@@ -924,6 +1025,7 @@ static void insert_work(struct cpu_workqueue_struct *cwq,
 
 	/* we own @work, set data and link */
 	set_work_cwq(work, cwq, extra_flags);
+	cwq_get(cwq);
 
 	/*
 	 * Ensure that we get the right work->data if we see the
@@ -951,11 +1053,10 @@ static void insert_work(struct cpu_workqueue_struct *cwq,
  */
 static bool is_chained_work(struct workqueue_struct *wq)
 {
+	struct global_cwq *gcwq;
 	unsigned long flags;
-	unsigned int cpu;
 
-	for_each_gcwq_cpu(cpu) {
-		struct global_cwq *gcwq = get_gcwq(cpu);
+	for_each_gcwq(gcwq) {
 		struct worker *worker;
 		struct hlist_node *pos;
 		int i;
@@ -985,51 +1086,72 @@ static void __queue_work(unsigned int cpu, struct workqueue_struct *wq,
 	unsigned int work_flags;
 	unsigned long flags;
 
+	/*
+	 * Disabled irqs keep the gcwqs and cwqs looked up below from
+	 * being freed until we hold their lock.
+	 */
+	local_irq_save(flags);
+
 	debug_work_activate(work);
 
 	/* if dying, only works from the same workqueue are allowed */
 	if (unlikely(wq->flags & WQ_DRAINING) &&
-	    WARN_ON_ONCE(!is_chained_work(wq)))
+	    WARN_ON_ONCE(!is_chained_work(wq))) {
+		local_irq_restore(flags);
 		return;
-
-	/* determine gcwq to use */
+	}
+retry:
+	/* determine cwq to use */
 	if (!(wq->flags & WQ_UNBOUND)) {
-		struct global_cwq *last_gcwq;
-
 		if (unlikely(cpu == WORK_CPU_UNBOUND))
 			cpu = raw_smp_processor_id();
+	}
+	cwq = get_cwq(cpu, wq);
+	gcwq = cwq->gcwq;
 
-		/*
-		 * It's multi cpu.  If @wq is non-reentrant and @work
-		 * was previously on a different cpu, it might still
-		 * be running there, in which case the work needs to
-		 * be queued on that cpu to guarantee non-reentrance.
-		 */
-		gcwq = get_gcwq(cpu);
-		if (wq->flags & WQ_NON_REENTRANT &&
-		    (last_gcwq = get_work_gcwq(work)) && last_gcwq != gcwq) {
+	/*
+	 * If @wq is non-reentrant and @work was previously on a
+	 * different gcwq, it might still be running there, in which case
+	 * the work needs to be queued on that gcwq to guarantee
+	 * non-reentrance.  Unbound workqueues are always non-reentrant,
+	 * they may span several gcwqs when they have per-node cwqs or
+	 * after their attributes changed.
+	 */
+	if (wq->flags & (WQ_NON_REENTRANT | WQ_UNBOUND)) {
+		struct global_cwq *last_gcwq = get_work_gcwq(work);
+
+		if (last_gcwq && last_gcwq != gcwq) {
 			struct worker *worker;
 
-			spin_lock_irqsave(&last_gcwq->lock, flags);
+			spin_lock(&last_gcwq->lock);
 
 			worker = find_worker_executing_work(last_gcwq, work);
 
-			if (worker && worker->current_cwq->wq == wq)
+			if (worker && worker->current_cwq->wq == wq) {
+				cwq = worker->current_cwq;
 				gcwq = last_gcwq;
-			else {
+			} else {
 				/* meh... not running there, queue here */
-				spin_unlock_irqrestore(&last_gcwq->lock, flags);
-				spin_lock_irqsave(&gcwq->lock, flags);
+				spin_unlock(&last_gcwq->lock);
+				spin_lock(&gcwq->lock);
 			}
 		} else
-			spin_lock_irqsave(&gcwq->lock, flags);
-	} else {
-		gcwq = get_gcwq(WORK_CPU_UNBOUND);
-		spin_lock_irqsave(&gcwq->lock, flags);
+			spin_lock(&gcwq->lock);
+	} else
+		spin_lock(&gcwq->lock);
+
+	/*
+	 * An unbound cwq may have been replaced and released since
+	 * get_cwq().  The workqueue has another one installed by then,
+	 * retry with it.  A cwq with an executing work isn't released.
+	 */
+	if (unlikely(!cwq->refcnt)) {
+		spin_unlock(&gcwq->lock);
+		cpu_relax();
+		goto retry;
 	}
 
-	/* gcwq determined, get cwq and queue */
-	cwq = get_cwq(gcwq->cpu, wq);
+	/* cwq determined, queue */
 	trace_workqueue_queue_work(cpu, cwq, work);
 
 	BUG_ON(!list_empty(&work->entry));
@@ -1048,7 +1170,8 @@ static void __queue_work(unsigned int cpu, struct workqueue_struct *wq,
 
 	insert_work(cwq, work, worklist, work_flags);
 
-	spin_unlock_irqrestore(&gcwq->lock, flags);
+	spin_unlock(&gcwq->lock);
+	local_irq_restore(flags);
 }
 
 /**
@@ -1099,9 +1222,8 @@ EXPORT_SYMBOL_GPL(queue_work_on);
 static void delayed_work_timer_fn(unsigned long __data)
 {
 	struct delayed_work *dwork = (struct delayed_work *)__data;
-	struct cpu_workqueue_struct *cwq = get_work_cwq(&dwork->work);
 
-	__queue_work(smp_processor_id(), cwq->wq, &dwork->work);
+	__queue_work(smp_processor_id(), dwork->wq, &dwork->work);
 }
 
 /**
@@ -1139,29 +1261,17 @@ int queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
 	struct work_struct *work = &dwork->work;
 
 	if (!test_and_set_bit(WORK_STRUCT_PENDING_BIT, work_data_bits(work))) {
-		unsigned int lcpu;
-
 		BUG_ON(timer_pending(timer));
 		BUG_ON(!list_empty(&work->entry));
 
 		timer_stats_timer_set_start_info(&dwork->timer);
 
 		/*
-		 * This stores cwq for the moment, for the timer_fn.
-		 * Note that the work's gcwq is preserved to allow
-		 * reentrance detection for delayed works.
+		 * The timer_fn finds @wq in @dwork.  work->data is left
+		 * alone, the work's gcwq is preserved to allow reentrance
+		 * detection for delayed works.
 		 */
-		if (!(wq->flags & WQ_UNBOUND)) {
-			struct global_cwq *gcwq = get_work_gcwq(work);
-
-			if (gcwq && gcwq->cpu != WORK_CPU_UNBOUND)
-				lcpu = gcwq->cpu;
-			else
-				lcpu = raw_smp_processor_id();
-		} else
-			lcpu = WORK_CPU_UNBOUND;
-
-		set_work_cwq(work, get_cwq(lcpu, wq), 0);
+		dwork->wq = wq;
 
 		timer->expires = jiffies + delay;
 		timer->data = (unsigned long)dwork;
@@ -1375,22 +1485,28 @@ static struct worker *create_worker(struct global_cwq *gcwq, bool bind)
 						      cpu_to_node(gcwq->cpu),
 						      "kworker/%u:%d", gcwq->cpu, id);
 	else
-		worker->task = kthread_create(worker_thread, worker,
-					      "kworker/u:%d", id);
+		worker->task = kthread_create_on_node(worker_thread,
+					worker, gcwq->node, "kworker/u%u:%d",
+					gcwq->id - UNBOUND_GCWQ_ID_BASE, id);
 	if (IS_ERR(worker->task))
 		goto fail;
 
 	/*
 	 * A rogue worker will become a regular one if CPU comes
 	 * online later on.  Make sure every worker has
-	 * PF_THREAD_BOUND set.
+	 * PF_THREAD_BOUND set.  Unbound workers get the attributes of
+	 * their gcwq first, their cpumask can't be changed afterwards.
 	 */
 	if (bind && !on_unbound_cpu)
 		kthread_bind(worker->task, gcwq->cpu);
 	else {
-		worker->task->flags |= PF_THREAD_BOUND;
-		if (on_unbound_cpu)
+		if (on_unbound_cpu) {
+			set_user_nice(worker->task, gcwq->attrs->nice);
+			set_cpus_allowed_ptr(worker->task,
+					     gcwq->attrs->cpumask);
 			worker->flags |= WORKER_UNBOUND;
+		}
+		worker->task->flags |= PF_THREAD_BOUND;
 	}
 
 	return worker;
@@ -1493,7 +1609,10 @@ static bool send_mayday(struct work_struct *work)
 
 	/* mayday mayday mayday */
 	cpu = cwq->gcwq->cpu;
-	/* WORK_CPU_UNBOUND can't be set in cpumask, use cpu 0 instead */
+	/*
+	 * WORK_CPU_UNBOUND can't be set in cpumask, use cpu 0 instead.
+	 * The rescuer then looks at all cwqs of the unbound workqueue.
+	 */
 	if (cpu == WORK_CPU_UNBOUND)
 		cpu = 0;
 	if (!mayday_test_and_set_cpu(cpu, wq->mayday_mask))
@@ -1735,7 +1854,8 @@ static void cwq_activate_first_delayed(struct cpu_workqueue_struct *cwq)
  * @delayed: for a delayed work
  *
  * A work either has completed or is removed from pending queue,
- * decrement nr_in_flight of its cwq and handle workqueue flushing.
+ * decrement nr_in_flight of its cwq, handle workqueue flushing and
+ * drop the reference the work held.
  *
  * CONTEXT:
  * spin_lock_irq(gcwq->lock).
@@ -1743,9 +1863,9 @@ static void cwq_activate_first_delayed(struct cpu_workqueue_struct *cwq)
 static void cwq_dec_nr_in_flight(struct cpu_workqueue_struct *cwq, int color,
 				 bool delayed)
 {
-	/* ignore uncolored works */
+	/* uncolored works only hold a reference */
 	if (color == WORK_NO_COLOR)
-		return;
+		goto out_put;
 
 	cwq->nr_in_flight[color]--;
 
@@ -1760,11 +1880,11 @@ static void cwq_dec_nr_in_flight(struct cpu_workqueue_struct *cwq, int color,
 
 	/* is flush in progress and are we at the flushing tip? */
 	if (likely(cwq->flush_color != color))
-		return;
+		goto out_put;
 
 	/* are there still in-flight works? */
 	if (cwq->nr_in_flight[color])
-		return;
+		goto out_put;
 
 	/* this cwq is done, clear flush_color */
 	cwq->flush_color = -1;
@@ -1775,6 +1895,8 @@ static void cwq_dec_nr_in_flight(struct cpu_workqueue_struct *cwq, int color,
 	 */
 	if (atomic_dec_and_test(&cwq->wq->nr_cwqs_to_flush))
 		complete(&cwq->wq->first_flusher->done);
+out_put:
+	cwq_put(cwq);
 }
 
 /**
@@ -1832,7 +1954,7 @@ __acquires(&gcwq->lock)
 	work_color = get_work_color(work);
 
 	/* record the current cpu number in the work data and dequeue */
-	set_work_cpu(work, gcwq->cpu);
+	set_work_gcwq(work, gcwq);
 	list_del_init(&work->entry);
 
 	/*
@@ -2002,6 +2124,74 @@ sleep:
 	goto woke_up;
 }
 
+/*
+ * Process the works of @cwq which are stuck on its gcwq.  Returns with
+ * nothing held.
+ */
+static void rescue_cwq(struct worker *rescuer, struct cpu_workqueue_struct *cwq)
+{
+	struct global_cwq *gcwq = cwq->gcwq;
+	struct list_head *scheduled = &rescuer->scheduled;
+	struct work_struct *work, *n;
+
+	/* migrate to the target cpu if possible */
+	rescuer->gcwq = gcwq;
+	if (gcwq->cpu == WORK_CPU_UNBOUND)
+		set_cpus_allowed_ptr(rescuer->task, gcwq->attrs->cpumask);
+	worker_maybe_bind_and_lock(rescuer);
+
+	/*
+	 * Slurp in all works issued via this workqueue and
+	 * process'em.
+	 */
+	BUG_ON(!list_empty(&rescuer->scheduled));
+	list_for_each_entry_safe(work, n, &gcwq->worklist, entry)
+		if (get_work_cwq(work) == cwq)
+			move_linked_works(work, scheduled, &n);
+
+	process_scheduled_works(rescuer);
+
+	/*
+	 * Leave this gcwq.  If keep_working() is %true, notify a
+	 * regular worker; otherwise, we end up with 0 concurrency
+	 * and stalling the execution.
+	 */
+	if (keep_working(gcwq))
+		wake_up_worker(gcwq);
+
+	spin_unlock_irq(&gcwq->lock);
+}
+
+/*
+ * Rescue all cwqs of the unbound @wq.  Each is pinned while being
+ * rescued so that it stays on wq->cwqs and the walk can go on after
+ * sleeping.
+ */
+static void rescue_unbound_cwqs(struct worker *rescuer,
+				struct workqueue_struct *wq)
+{
+	struct cpu_workqueue_struct *cwq;
+
+	rcu_read_lock_sched();
+	for_each_cwq(cwq, wq) {
+		spin_lock_irq(&cwq->gcwq->lock);
+		/* released ones have no work left */
+		if (!cwq->refcnt) {
+			spin_unlock_irq(&cwq->gcwq->lock);
+			continue;
+		}
+		cwq_get(cwq);
+		spin_unlock_irq(&cwq->gcwq->lock);
+		rcu_read_unlock_sched();
+
+		rescue_cwq(rescuer, cwq);
+
+		rcu_read_lock_sched();
+		cwq_put_unlocked(cwq);
+	}
+	rcu_read_unlock_sched();
+}
+
 /**
  * rescuer_thread - the rescuer thread function
  * @__wq: the associated workqueue
@@ -2025,7 +2215,6 @@ static int rescuer_thread(void *__wq)
 {
 	struct workqueue_struct *wq = __wq;
 	struct worker *rescuer = wq->rescuer;
-	struct list_head *scheduled = &rescuer->scheduled;
 	bool is_unbound = wq->flags & WQ_UNBOUND;
 	unsigned int cpu;
 
@@ -2038,41 +2227,16 @@ repeat:
 
 	/*
 	 * See whether any cpu is asking for help.  Unbounded
-	 * workqueues use cpu 0 in mayday_mask for CPU_UNBOUND.
+	 * workqueues use cpu 0 in mayday_mask for all their cwqs.
 	 */
 	for_each_mayday_cpu(cpu, wq->mayday_mask) {
-		unsigned int tcpu = is_unbound ? WORK_CPU_UNBOUND : cpu;
-		struct cpu_workqueue_struct *cwq = get_cwq(tcpu, wq);
-		struct global_cwq *gcwq = cwq->gcwq;
-		struct work_struct *work, *n;
-
 		__set_current_state(TASK_RUNNING);
 		mayday_clear_cpu(cpu, wq->mayday_mask);
 
-		/* migrate to the target cpu if possible */
-		rescuer->gcwq = gcwq;
-		worker_maybe_bind_and_lock(rescuer);
-
-		/*
-		 * Slurp in all works issued via this workqueue and
-		 * process'em.
-		 */
-		BUG_ON(!list_empty(&rescuer->scheduled));
-		list_for_each_entry_safe(work, n, &gcwq->worklist, entry)
-			if (get_work_cwq(work) == cwq)
-				move_linked_works(work, scheduled, &n);
-
-		process_scheduled_works(rescuer);
-
-		/*
-		 * Leave this gcwq.  If keep_working() is %true, notify a
-		 * regular worker; otherwise, we end up with 0 concurrency
-		 * and stalling the execution.
-		 */
-		if (keep_working(gcwq))
-			wake_up_worker(gcwq);
-
-		spin_unlock_irq(&gcwq->lock);
+		if (is_unbound)
+			rescue_unbound_cwqs(rescuer, wq);
+		else
+			rescue_cwq(rescuer, get_cwq(cpu, wq));
 	}
 
 	schedule();
@@ -2185,16 +2349,15 @@ static void insert_wq_barrier(struct cpu_workqueue_struct *cwq,
 static bool flush_workqueue_prep_cwqs(struct workqueue_struct *wq,
 				      int flush_color, int work_color)
 {
+	struct cpu_workqueue_struct *cwq;
 	bool wait = false;
-	unsigned int cpu;
 
 	if (flush_color >= 0) {
 		BUG_ON(atomic_read(&wq->nr_cwqs_to_flush));
 		atomic_set(&wq->nr_cwqs_to_flush, 1);
 	}
 
-	for_each_cwq_cpu(cpu, wq) {
-		struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
+	for_each_cwq(cwq, wq) {
 		struct global_cwq *gcwq = cwq->gcwq;
 
 		spin_lock_irq(&gcwq->lock);
@@ -2392,8 +2555,8 @@ EXPORT_SYMBOL_GPL(flush_workqueue);
  */
 void drain_workqueue(struct workqueue_struct *wq)
 {
+	struct cpu_workqueue_struct *cwq;
 	unsigned int flush_cnt = 0;
-	unsigned int cpu;
 
 	/*
 	 * __queue_work() needs to test whether there are drainers, is much
@@ -2407,8 +2570,8 @@ void drain_workqueue(struct workqueue_struct *wq)
 reflush:
 	flush_workqueue(wq);
 
-	for_each_cwq_cpu(cpu, wq) {
-		struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
+	mutex_lock(&wq->flush_mutex);
+	for_each_cwq(cwq, wq) {
 		bool drained;
 
 		spin_lock_irq(&cwq->gcwq->lock);
@@ -2418,12 +2581,14 @@ reflush:
 		if (drained)
 			continue;
 
+		mutex_unlock(&wq->flush_mutex);
 		if (++flush_cnt == 10 ||
 		    (flush_cnt % 100 == 0 && flush_cnt <= 1000))
 			pr_warning("workqueue %s: flush on destruction isn't complete after %u tries\n",
 				   wq->name, flush_cnt);
 		goto reflush;
 	}
+	mutex_unlock(&wq->flush_mutex);
 
 	spin_lock(&workqueue_lock);
 	if (!--wq->nr_drainers)
@@ -2438,13 +2603,17 @@ static bool start_flush_work(struct work_struct *work, struct wq_barrier *barr,
 	struct worker *worker = NULL;
 	struct global_cwq *gcwq;
 	struct cpu_workqueue_struct *cwq;
+	struct workqueue_struct *wq;
 
 	might_sleep();
+	local_irq_disable();
 	gcwq = get_work_gcwq(work);
-	if (!gcwq)
+	if (!gcwq) {
+		local_irq_enable();
 		return false;
+	}
 
-	spin_lock_irq(&gcwq->lock);
+	spin_lock(&gcwq->lock);
 	if (!list_empty(&work->entry)) {
 		/*
 		 * See the comment near try_to_grab_pending()->smp_rmb().
@@ -2464,6 +2633,8 @@ static bool start_flush_work(struct work_struct *work, struct wq_barrier *barr,
 		goto already_gone;
 
 	insert_wq_barrier(cwq, barr, work, worker);
+	/* @cwq may be released as soon as the barrier has run */
+	wq = cwq->wq;
 	spin_unlock_irq(&gcwq->lock);
 
 	/*
@@ -2472,11 +2643,11 @@ static bool start_flush_work(struct work_struct *work, struct wq_barrier *barr,
 	 * flusher is not running on the same workqueue by verifying write
 	 * access.
 	 */
-	if (cwq->wq->saved_max_active == 1 || cwq->wq->flags & WQ_RESCUER)
-		lock_map_acquire(&cwq->wq->lockdep_map);
+	if (wq->saved_max_active == 1 || wq->flags & WQ_RESCUER)
+		lock_map_acquire(&wq->lockdep_map);
 	else
-		lock_map_acquire_read(&cwq->wq->lockdep_map);
-	lock_map_release(&cwq->wq->lockdep_map);
+		lock_map_acquire_read(&wq->lockdep_map);
+	lock_map_release(&wq->lockdep_map);
 
 	return true;
 already_gone:
@@ -2515,39 +2686,53 @@ bool flush_work(struct work_struct *work)
 }
 EXPORT_SYMBOL_GPL(flush_work);
 
+/*
+ * Called and returns with sched-RCU held, which is dropped while
+ * waiting.  The cwq the barrier is queued on is pinned meanwhile and
+ * keeps @gcwq alive and on the gcwqs list for the caller's walk.
+ */
 static bool wait_on_cpu_work(struct global_cwq *gcwq, struct work_struct *work)
 {
+	struct cpu_workqueue_struct *cwq = NULL;
 	struct wq_barrier barr;
 	struct worker *worker;
 
 	spin_lock_irq(&gcwq->lock);
 
 	worker = find_worker_executing_work(gcwq, work);
-	if (unlikely(worker))
-		insert_wq_barrier(worker->current_cwq, &barr, work, worker);
+	if (unlikely(worker)) {
+		cwq = worker->current_cwq;
+		insert_wq_barrier(cwq, &barr, work, worker);
+		cwq_get(cwq);
+	}
 
 	spin_unlock_irq(&gcwq->lock);
 
-	if (unlikely(worker)) {
-		wait_for_completion(&barr.done);
-		destroy_work_on_stack(&barr.work);
-		return true;
-	} else
+	if (likely(!cwq))
 		return false;
+
+	rcu_read_unlock_sched();
+	wait_for_completion(&barr.done);
+	destroy_work_on_stack(&barr.work);
+	rcu_read_lock_sched();
+	cwq_put_unlocked(cwq);
+	return true;
 }
 
 static bool wait_on_work(struct work_struct *work)
 {
+	struct global_cwq *gcwq;
 	bool ret = false;
-	int cpu;
 
 	might_sleep();
 
 	lock_map_acquire(&work->lockdep_map);
 	lock_map_release(&work->lockdep_map);
 
-	for_each_gcwq_cpu(cpu)
-		ret |= wait_on_cpu_work(get_gcwq(cpu), work);
+	rcu_read_lock_sched();
+	for_each_gcwq(gcwq)
+		ret |= wait_on_cpu_work(gcwq, work);
+	rcu_read_unlock_sched();
 	return ret;
 }
 
@@ -2602,11 +2787,14 @@ static int try_to_grab_pending(struct work_struct *work)
 	 * The queueing is in progress, or it is already queued. Try to
 	 * steal it from ->worklist without clearing WORK_STRUCT_PENDING.
 	 */
+	local_irq_disable();
 	gcwq = get_work_gcwq(work);
-	if (!gcwq)
+	if (!gcwq) {
+		local_irq_enable();
 		return ret;
+	}
 
-	spin_lock_irq(&gcwq->lock);
+	spin_lock(&gcwq->lock);
 	if (!list_empty(&work->entry)) {
 		/*
 		 * This work is queued, but perhaps we locked the wrong gcwq.
@@ -2683,8 +2871,7 @@ EXPORT_SYMBOL_GPL(cancel_work_sync);
 bool flush_delayed_work(struct delayed_work *dwork)
 {
 	if (del_timer_sync(&dwork->timer))
-		__queue_work(raw_smp_processor_id(),
-			     get_work_cwq(&dwork->work)->wq, &dwork->work);
+		__queue_work(raw_smp_processor_id(), dwork->wq, &dwork->work);
 	return flush_work(&dwork->work);
 }
 EXPORT_SYMBOL(flush_delayed_work);
@@ -2704,8 +2891,7 @@ EXPORT_SYMBOL(flush_delayed_work);
 bool flush_delayed_work_sync(struct delayed_work *dwork)
 {
 	if (del_timer_sync(&dwork->timer))
-		__queue_work(raw_smp_processor_id(),
-			     get_work_cwq(&dwork->work)->wq, &dwork->work);
+		__queue_work(raw_smp_processor_id(), dwork->wq, &dwork->work);
 	return flush_work_sync(&dwork->work);
 }
 EXPORT_SYMBOL(flush_delayed_work_sync);
@@ -2884,83 +3070,846 @@ int keventd_up(void)
 	return system_wq != NULL;
 }
 
-static int alloc_cwqs(struct workqueue_struct *wq)
+/*
+ * cwqs are forced aligned according to WORK_STRUCT_FLAG_BITS.  Make
+ * sure that the alignment isn't lower than that of unsigned long long.
+ */
+#define CWQ_ALIGN	max_t(size_t, 1 << WORK_STRUCT_FLAG_BITS,	\
+			      __alignof__(unsigned long long))
+
+static void init_cwq(struct cpu_workqueue_struct *cwq,
+		     struct workqueue_struct *wq, struct global_cwq *gcwq)
+{
+	BUG_ON((unsigned long)cwq & WORK_STRUCT_FLAG_MASK);
+	cwq->gcwq = gcwq;
+	cwq->wq = wq;
+	cwq->flush_color = -1;
+	cwq->max_active = wq->saved_max_active;
+	INIT_LIST_HEAD(&cwq->delayed_works);
+	cwq->refcnt = 1;
+}
+
+static struct cpu_workqueue_struct *alloc_unbound_cwq(void)
 {
+	const size_t size = sizeof(struct cpu_workqueue_struct);
+	struct cpu_workqueue_struct *cwq;
+	void *ptr;
+
 	/*
-	 * cwqs are forced aligned according to WORK_STRUCT_FLAG_BITS.
-	 * Make sure that the alignment isn't lower than that of
-	 * unsigned long long.
+	 * Allocate enough room to align cwq and put an extra pointer
+	 * at the end pointing back to the originally allocated pointer
+	 * which will be used for free.
 	 */
-	const size_t size = sizeof(struct cpu_workqueue_struct);
-	const size_t align = max_t(size_t, 1 << WORK_STRUCT_FLAG_BITS,
-				   __alignof__(unsigned long long));
+	ptr = kzalloc(size + CWQ_ALIGN + sizeof(void *), GFP_KERNEL);
+	if (!ptr)
+		return NULL;
 
-	if (!(wq->flags & WQ_UNBOUND))
-		wq->cpu_wq.pcpu = __alloc_percpu(size, align);
-	else {
-		void *ptr;
+	cwq = PTR_ALIGN(ptr, CWQ_ALIGN);
+	*(void **)(cwq + 1) = ptr;
+	return cwq;
+}
 
-		/*
-		 * Allocate enough room to align cwq and put an extra
-		 * pointer at the end pointing back to the originally
-		 * allocated pointer which will be used for free.
-		 */
-		ptr = kzalloc(size + align + sizeof(void *), GFP_KERNEL);
-		if (ptr) {
-			wq->cpu_wq.single = PTR_ALIGN(ptr, align);
-			*(void **)(wq->cpu_wq.single + 1) = ptr;
+static void free_unbound_cwq(struct cpu_workqueue_struct *cwq)
+{
+	/* the pointer to free is stored right after the cwq */
+	kfree(*(void **)(cwq + 1));
+}
+
+static void rcu_free_cwq(struct rcu_head *rcu)
+{
+	free_unbound_cwq(container_of(rcu, struct cpu_workqueue_struct, rcu));
+}
+
+static int alloc_cwqs(struct workqueue_struct *wq)
+{
+	unsigned int cpu;
+
+	if (wq->flags & WQ_UNBOUND) {
+		if (wq_numa_enabled && !(wq->flags & WQ_ORDERED)) {
+			wq->numa_cwq = kcalloc(nr_node_ids,
+					       sizeof(wq->numa_cwq[0]),
+					       GFP_KERNEL);
+			if (!wq->numa_cwq)
+				return -ENOMEM;
 		}
+		/* the cwqs are set up by __apply_workqueue_attrs() */
+		return 0;
 	}
 
-	/* just in case, make sure it's actually aligned */
-	BUG_ON(!IS_ALIGNED(wq->cpu_wq.v, align));
-	return wq->cpu_wq.v ? 0 : -ENOMEM;
+	wq->cpu_wq = __alloc_percpu(sizeof(struct cpu_workqueue_struct),
+				    CWQ_ALIGN);
+	if (!wq->cpu_wq)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
+
+		init_cwq(cwq, wq, get_gcwq(cpu));
+		list_add_tail(&cwq->cwqs_node, &wq->cwqs);
+	}
+	return 0;
 }
 
 static void free_cwqs(struct workqueue_struct *wq)
 {
+	/* unbound cwqs go away with their last reference */
 	if (!(wq->flags & WQ_UNBOUND))
-		free_percpu(wq->cpu_wq.pcpu);
-	else if (wq->cpu_wq.single) {
-		/* the pointer to free is stored right after the cwq */
-		kfree(*(void **)(wq->cpu_wq.single + 1));
+		free_percpu(wq->cpu_wq);
+	kfree(wq->numa_cwq);
+}
+
+/**
+ * alloc_workqueue_attrs - allocate a workqueue_attrs
+ * @gfp_mask: allocation mask to use
+ *
+ * Allocate a new workqueue_attrs, initialized to nice level 0 and all
+ * possible cpus.
+ *
+ * RETURNS:
+ * The allocated workqueue_attrs on success, %NULL on failure.
+ */
+struct workqueue_attrs *alloc_workqueue_attrs(gfp_t gfp_mask)
+{
+	struct workqueue_attrs *attrs;
+
+	attrs = kzalloc(sizeof(*attrs), gfp_mask);
+	if (!attrs)
+		return NULL;
+	if (!alloc_cpumask_var(&attrs->cpumask, gfp_mask)) {
+		kfree(attrs);
+		return NULL;
 	}
+
+	cpumask_copy(attrs->cpumask, cpu_possible_mask);
+	return attrs;
 }
+EXPORT_SYMBOL_GPL(alloc_workqueue_attrs);
 
-static int wq_clamp_max_active(int max_active, unsigned int flags,
-			       const char *name)
+/**
+ * free_workqueue_attrs - free a workqueue_attrs
+ * @attrs: workqueue_attrs to free, may be %NULL
+ */
+void free_workqueue_attrs(struct workqueue_attrs *attrs)
 {
-	int lim = flags & WQ_UNBOUND ? WQ_UNBOUND_MAX_ACTIVE : WQ_MAX_ACTIVE;
+	if (attrs) {
+		free_cpumask_var(attrs->cpumask);
+		kfree(attrs);
+	}
+}
+EXPORT_SYMBOL_GPL(free_workqueue_attrs);
 
-	if (max_active < 1 || max_active > lim)
-		printk(KERN_WARNING "workqueue: max_active %d requested for %s "
-		       "is out of range, clamping between %d and %d\n",
-		       max_active, name, 1, lim);
+static void copy_workqueue_attrs(struct workqueue_attrs *to,
+				 const struct workqueue_attrs *from)
+{
+	to->nice = from->nice;
+	cpumask_copy(to->cpumask, from->cpumask);
+}
 
-	return clamp_val(max_active, 1, lim);
+static bool wqattrs_equal(const struct workqueue_attrs *a,
+			  const struct workqueue_attrs *b)
+{
+	return a->nice == b->nice && cpumask_equal(a->cpumask, b->cpumask);
 }
 
-struct workqueue_struct *__alloc_workqueue_key(const char *fmt,
-					       unsigned int flags,
-					       int max_active,
-					       struct lock_class_key *key,
-					       const char *lock_name, ...)
+static void init_gcwq(struct global_cwq *gcwq, unsigned int cpu)
 {
-	va_list args, args1;
-	struct workqueue_struct *wq;
-	unsigned int cpu;
-	size_t namelen;
+	int i;
 
-	/* determine namelen, allocate wq and format name */
-	va_start(args, lock_name);
-	va_copy(args1, args);
-	namelen = vsnprintf(NULL, 0, fmt, args) + 1;
+	spin_lock_init(&gcwq->lock);
+	INIT_LIST_HEAD(&gcwq->worklist);
+	gcwq->cpu = cpu;
+	gcwq->flags |= GCWQ_DISASSOCIATED;
 
-	wq = kzalloc(sizeof(*wq) + namelen, GFP_KERNEL);
-	if (!wq)
-		goto err;
+	INIT_LIST_HEAD(&gcwq->idle_list);
+	for (i = 0; i < BUSY_WORKER_HASH_SIZE; i++)
+		INIT_HLIST_HEAD(&gcwq->busy_hash[i]);
 
-	vsnprintf(wq->name, namelen, fmt, args1);
+	init_timer_deferrable(&gcwq->idle_timer);
+	gcwq->idle_timer.function = idle_worker_timeout;
+	gcwq->idle_timer.data = (unsigned long)gcwq;
+
+	setup_timer(&gcwq->mayday_timer, gcwq_mayday_timeout,
+		    (unsigned long)gcwq);
+
+	ida_init(&gcwq->worker_ida);
+
+	gcwq->trustee_state = TRUSTEE_DONE;
+	init_waitqueue_head(&gcwq->trustee_wait);
+}
+
+/**
+ * get_attrs_gcwq - find or create the unbound gcwq for @attrs
+ * @attrs: worker attributes the gcwq should have
+ *
+ * Return the unbound gcwq whose workers have @attrs, creating it and
+ * its first worker if there's none yet, with a reference held.
+ * Workqueues with identical attributes share the gcwq.  The reference
+ * is dropped with put_unbound_gcwq().
+ *
+ * CONTEXT:
+ * Might sleep.  wq_pool_mutex held.
+ *
+ * RETURNS:
+ * The gcwq on success, %NULL on failure.
+ */
+static struct global_cwq *get_attrs_gcwq(const struct workqueue_attrs *attrs)
+{
+	struct global_cwq *gcwq;
+	struct worker *worker;
+	int node, id, ret;
+
+	lockdep_assert_held(&wq_pool_mutex);
+
+	for_each_gcwq(gcwq) {
+		if (gcwq->attrs && wqattrs_equal(gcwq->attrs, attrs)) {
+			gcwq->refcnt++;
+			return gcwq;
+		}
+	}
+
+	gcwq = kzalloc(sizeof(*gcwq), GFP_KERNEL);
+	if (!gcwq)
+		return NULL;
+	gcwq->attrs = alloc_workqueue_attrs(GFP_KERNEL);
+	if (!gcwq->attrs)
+		goto fail_free;
+	copy_workqueue_attrs(gcwq->attrs, attrs);
+
+	init_gcwq(gcwq, WORK_CPU_UNBOUND);
+	gcwq->refcnt = 1;
+	/* see cwq_put() */
+	lockdep_set_subclass(&gcwq->lock, 1);
+
+	/* create the workers on the node @attrs are confined to, if any */
+	gcwq->node = -1;
+	if (wq_numa_enabled) {
+		for_each_node(node) {
+			if (cpumask_subset(attrs->cpumask,
+					   wq_numa_possible_cpumask[node])) {
+				gcwq->node = node;
+				break;
+			}
+		}
+	}
+
+	do {
+		if (!idr_pre_get(&unbound_gcwq_idr, GFP_KERNEL))
+			goto fail_free;
+		ret = idr_get_new(&unbound_gcwq_idr, gcwq, &id);
+	} while (ret == -EAGAIN);
+	if (ret)
+		goto fail_free;
+	gcwq->id = UNBOUND_GCWQ_ID_BASE + id;
+
+	worker = create_worker(gcwq, true);
+	if (!worker)
+		goto fail_idr;
+
+	spin_lock(&workqueue_lock);
+	spin_lock_irq(&gcwq->lock);
+	if (workqueue_freezing)
+		gcwq->flags |= GCWQ_FREEZING;
+	start_worker(worker);
+	spin_unlock_irq(&gcwq->lock);
+	list_add_tail_rcu(&gcwq->list, &gcwqs);
+	spin_unlock(&workqueue_lock);
+
+	return gcwq;
+fail_idr:
+	idr_remove(&unbound_gcwq_idr, id);
+fail_free:
+	free_workqueue_attrs(gcwq->attrs);
+	kfree(gcwq);
+	return NULL;
+}
+
+static void rcu_free_gcwq(struct rcu_head *rcu)
+{
+	struct global_cwq *gcwq = container_of(rcu, struct global_cwq, rcu);
+
+	ida_destroy(&gcwq->worker_ida);
+	free_workqueue_attrs(gcwq->attrs);
+	kfree(gcwq);
+}
+
+/**
+ * put_unbound_gcwq - drop a reference to an unbound gcwq
+ * @gcwq: the gcwq of interest
+ *
+ * Drop a reference obtained with get_attrs_gcwq().  Once the last cwq
+ * using @gcwq is gone, no work can be queued on it anymore and all its
+ * workers are idle or about to be.  Take over the manager role, destroy
+ * the workers and free @gcwq after a sched-RCU grace period.
+ *
+ * CONTEXT:
+ * Might sleep.  wq_pool_mutex held.
+ */
+static void put_unbound_gcwq(struct global_cwq *gcwq)
+{
+	struct worker *worker;
+
+	lockdep_assert_held(&wq_pool_mutex);
+
+	if (--gcwq->refcnt)
+		return;
+
+	spin_lock(&workqueue_lock);
+	list_del_rcu(&gcwq->list);
+	spin_unlock(&workqueue_lock);
+	idr_remove(&unbound_gcwq_idr, gcwq->id - UNBOUND_GCWQ_ID_BASE);
+
+	/* manage_workers() wakes up trustee_wait while there's a trustee */
+	spin_lock_irq(&gcwq->lock);
+	gcwq->trustee = current;
+	while (gcwq->flags & GCWQ_MANAGING_WORKERS) {
+		spin_unlock_irq(&gcwq->lock);
+		wait_event(gcwq->trustee_wait,
+			   !(gcwq->flags & GCWQ_MANAGING_WORKERS));
+		spin_lock_irq(&gcwq->lock);
+	}
+	gcwq->flags |= GCWQ_MANAGING_WORKERS;
+
+	while ((worker = first_worker(gcwq)))
+		destroy_worker(worker);
+	WARN_ON(gcwq->nr_workers || gcwq->nr_idle);
+	spin_unlock_irq(&gcwq->lock);
+
+	del_timer_sync(&gcwq->idle_timer);
+	del_timer_sync(&gcwq->mayday_timer);
+
+	call_rcu_sched(&gcwq->rcu, rcu_free_gcwq);
+}
+
+/*
+ * Release an unbound cwq whose last reference is gone.  It's neither
+ * installed in its workqueue anymore nor has works or flush colors
+ * left.  The release of the last cwq of a destroyed workqueue also
+ * frees the workqueue.
+ */
+static void cwq_release_workfn(struct work_struct *work)
+{
+	struct cpu_workqueue_struct *cwq = container_of(work,
+			struct cpu_workqueue_struct, release_work);
+	struct workqueue_struct *wq = cwq->wq;
+	struct global_cwq *gcwq = cwq->gcwq;
+	bool is_last;
+
+	mutex_lock(&wq->flush_mutex);
+	spin_lock(&workqueue_lock);
+	list_del_rcu(&cwq->cwqs_node);
+	is_last = list_empty(&wq->cwqs);
+	spin_unlock(&workqueue_lock);
+	mutex_unlock(&wq->flush_mutex);
+
+	mutex_lock(&wq_pool_mutex);
+	put_unbound_gcwq(gcwq);
+	mutex_unlock(&wq_pool_mutex);
+
+	call_rcu_sched(&cwq->rcu, rcu_free_cwq);
+
+	if (is_last) {
+		free_cwqs(wq);
+		free_workqueue_attrs(wq->unbound_attrs);
+		kfree(wq);
+	}
+}
+
+/*
+ * Find the cwq of @wq for the unbound gcwq with @attrs.  The cwqs
+ * installed in @wq are reused, new ones are put on @new_cwqs and hold
+ * a reference to their gcwq.
+ */
+static struct cpu_workqueue_struct *
+get_attrs_cwq(struct workqueue_struct *wq, const struct workqueue_attrs *attrs,
+	      struct list_head *new_cwqs)
+{
+	struct global_cwq *gcwq = get_attrs_gcwq(attrs);
+	struct cpu_workqueue_struct *cwq;
+
+	if (!gcwq)
+		return NULL;
+
+	cwq = find_installed_cwq(wq, gcwq);
+	if (cwq)
+		goto out_put;
+	list_for_each_entry(cwq, new_cwqs, cwqs_node)
+		if (cwq->gcwq == gcwq)
+			goto out_put;
+
+	cwq = alloc_unbound_cwq();
+	if (!cwq) {
+		put_unbound_gcwq(gcwq);
+		return NULL;
+	}
+	init_cwq(cwq, wq, gcwq);
+	INIT_WORK(&cwq->release_work, cwq_release_workfn);
+	list_add_tail(&cwq->cwqs_node, new_cwqs);
+	return cwq;
+out_put:
+	/* @cwq already holds a reference to @gcwq */
+	put_unbound_gcwq(gcwq);
+	return cwq;
+}
+
+/*
+ * Drop the base reference of @cwq unless it's still installed in @wq.
+ * It's released once the works queued on it have finished.
+ */
+static void put_replaced_cwq(struct workqueue_struct *wq,
+			     struct cpu_workqueue_struct *cwq)
+{
+	if (cwq && find_installed_cwq(wq, cwq->gcwq) != cwq)
+		cwq_put_unlocked(cwq);
+}
+
+/*
+ * Drop the base references of the cwqs installed in unbound @wq on its
+ * destruction.  The release of its last cwq frees @wq.
+ */
+static void put_installed_cwqs(struct workqueue_struct *wq)
+{
+	struct cpu_workqueue_struct *dfl_cwq = wq->dfl_cwq;
+	int node;
+
+	if (wq->numa_cwq)
+		for_each_node(node)
+			if (wq->numa_cwq[node] != dfl_cwq)
+				cwq_put_unlocked(wq->numa_cwq[node]);
+	/* @wq may be gone once this one is released */
+	cwq_put_unlocked(dfl_cwq);
+}
+
+/*
+ * Point the unbound @wq to the cwqs serving @attrs: one for the whole
+ * of @attrs->cpumask and, with NUMA enabled, one for the part of it
+ * on each node.  Nodes without any cpu in the mask use the former.
+ *
+ * The cwqs being replaced lose their base reference.  Works already
+ * queued on them are executed as usual and flush_workqueue() keeps
+ * waiting for them; they're released once the last one has finished.
+ */
+static int __apply_workqueue_attrs(struct workqueue_struct *wq,
+				   const struct workqueue_attrs *attrs)
+{
+	struct cpu_workqueue_struct *dfl_cwq, *cwq, *n;
+	struct cpu_workqueue_struct **numa_cwq = NULL;
+	struct workqueue_attrs *new_attrs, *tmp_attrs;
+	LIST_HEAD(new_cwqs);
+	int node, ret = -ENOMEM;
+
+	lockdep_assert_held(&wq_pool_mutex);
+
+	new_attrs = alloc_workqueue_attrs(GFP_KERNEL);
+	tmp_attrs = alloc_workqueue_attrs(GFP_KERNEL);
+	if (!new_attrs || !tmp_attrs)
+		goto out_free;
+
+	copy_workqueue_attrs(new_attrs, attrs);
+	cpumask_and(new_attrs->cpumask, new_attrs->cpumask, cpu_possible_mask);
+	if (cpumask_empty(new_attrs->cpumask)) {
+		ret = -EINVAL;
+		goto out_free;
+	}
+
+	if (wq->numa_cwq) {
+		numa_cwq = kcalloc(nr_node_ids, sizeof(numa_cwq[0]),
+				   GFP_KERNEL);
+		if (!numa_cwq)
+			goto out_free;
+	}
+
+	dfl_cwq = get_attrs_cwq(wq, new_attrs, &new_cwqs);
+	if (!dfl_cwq)
+		goto out_free;
+
+	if (numa_cwq) {
+		copy_workqueue_attrs(tmp_attrs, new_attrs);
+		for_each_node(node) {
+			cpumask_and(tmp_attrs->cpumask, new_attrs->cpumask,
+				    wq_numa_possible_cpumask[node]);
+			if (cpumask_empty(tmp_attrs->cpumask) ||
+			    cpumask_equal(tmp_attrs->cpumask,
+					  new_attrs->cpumask)) {
+				numa_cwq[node] = dfl_cwq;
+				continue;
+			}
+			numa_cwq[node] = get_attrs_cwq(wq, tmp_attrs,
+						       &new_cwqs);
+			if (!numa_cwq[node])
+				goto out_free;
+		}
+	}
+
+	/*
+	 * Link the new cwqs.  Holding flush_mutex keeps flushers from
+	 * advancing the work color under us and workqueue_lock the
+	 * freezer and workqueue_set_max_active() from missing them.
+	 */
+	mutex_lock(&wq->flush_mutex);
+	spin_lock(&workqueue_lock);
+	list_for_each_entry_safe(cwq, n, &new_cwqs, cwqs_node) {
+		cwq->work_color = wq->work_color;
+		if (workqueue_freezing && wq->flags & WQ_FREEZABLE)
+			cwq->max_active = 0;
+		else
+			cwq->max_active = wq->saved_max_active;
+		list_del(&cwq->cwqs_node);
+		list_add_tail_rcu(&cwq->cwqs_node, &wq->cwqs);
+	}
+	spin_unlock(&workqueue_lock);
+	mutex_unlock(&wq->flush_mutex);
+
+	/* publish, pairs with smp_read_barrier_depends() in get_cwq() */
+	smp_wmb();
+	swap(wq->dfl_cwq, dfl_cwq);
+	if (numa_cwq)
+		for_each_node(node)
+			swap(wq->numa_cwq[node], numa_cwq[node]);
+
+	/*
+	 * Put the old cwqs which weren't reused.  A node cwq other than
+	 * the default one serves that node only and is seen once.
+	 */
+	if (numa_cwq)
+		for_each_node(node)
+			if (numa_cwq[node] != dfl_cwq)
+				put_replaced_cwq(wq, numa_cwq[node]);
+	put_replaced_cwq(wq, dfl_cwq);
+
+	copy_workqueue_attrs(wq->unbound_attrs, new_attrs);
+	ret = 0;
+out_free:
+	list_for_each_entry_safe(cwq, n, &new_cwqs, cwqs_node) {
+		put_unbound_gcwq(cwq->gcwq);
+		free_unbound_cwq(cwq);
+	}
+	kfree(numa_cwq);
+	free_workqueue_attrs(tmp_attrs);
+	free_workqueue_attrs(new_attrs);
+	return ret;
+}
+
+/**
+ * apply_workqueue_attrs - apply new workqueue_attrs to an unbound workqueue
+ * @wq: the target workqueue
+ * @attrs: the workqueue_attrs to apply
+ *
+ * Make @wq execute new works on workers with @attrs, sharing the
+ * unbound worker pools of any other workqueue with the same attributes.
+ * @attrs->cpumask is restricted to the possible cpus.  Works queued
+ * before the call may still be executed on the workers they were queued
+ * for.  Ordered workqueues can't be changed.
+ *
+ * CONTEXT:
+ * Might sleep.
+ *
+ * RETURNS:
+ * 0 on success, -EINVAL if @wq is per-cpu or ordered or @attrs are
+ * invalid, -ENOMEM on allocation failure.
+ */
+int apply_workqueue_attrs(struct workqueue_struct *wq,
+			  const struct workqueue_attrs *attrs)
+{
+	int ret;
+
+	if (!(wq->flags & WQ_UNBOUND) || wq->flags & WQ_ORDERED)
+		return -EINVAL;
+	if (attrs->nice < -20 || attrs->nice > 19)
+		return -EINVAL;
+
+	mutex_lock(&wq_pool_mutex);
+	ret = __apply_workqueue_attrs(wq, attrs);
+	mutex_unlock(&wq_pool_mutex);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(apply_workqueue_attrs);
+
+#ifdef CONFIG_SYSFS
+/*
+ * Workqueues created with WQ_SYSFS show up under /sys/kernel/workqueue/
+ * with the following attributes.
+ *
+ *  per_cpu	RO bool	: whether the workqueue is per-cpu or unbound
+ *  max_active	RW int	: maximum number of in-flight works per cwq
+ *
+ * Unbound workqueues additionally have the following.
+ *
+ *  pool_ids	RO	: id of the gcwq serving each node
+ *  nice	RW int	: nice level of the workers
+ *  cpumask	RW mask	: cpus the workers are allowed to run on
+ */
+struct wq_sysfs {
+	struct kobject		kobj;
+	struct workqueue_struct	*wq;
+};
+
+static struct kset *wq_kset;
+
+static struct workqueue_struct *kobj_to_wq(struct kobject *kobj)
+{
+	return container_of(kobj, struct wq_sysfs, kobj)->wq;
+}
+
+static ssize_t wq_per_cpu_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	struct workqueue_struct *wq = kobj_to_wq(kobj);
+
+	return sprintf(buf, "%d\n", !(wq->flags & WQ_UNBOUND));
+}
+
+static ssize_t wq_max_active_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	struct workqueue_struct *wq = kobj_to_wq(kobj);
+
+	return sprintf(buf, "%d\n", wq->saved_max_active);
+}
+
+static ssize_t wq_max_active_store(struct kobject *kobj,
+				   struct kobj_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct workqueue_struct *wq = kobj_to_wq(kobj);
+	int val;
+
+	if (wq->flags & WQ_ORDERED)
+		return -EINVAL;
+	if (kstrtoint(buf, 0, &val) || val <= 0)
+		return -EINVAL;
+
+	workqueue_set_max_active(wq, val);
+	return count;
+}
+
+static ssize_t wq_pool_ids_show(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buf)
+{
+	struct workqueue_struct *wq = kobj_to_wq(kobj);
+	int node, len = 0;
+
+	mutex_lock(&wq_pool_mutex);
+	if (!wq->numa_cwq)
+		len = sprintf(buf, "%u",
+			      wq->dfl_cwq->gcwq->id - UNBOUND_GCWQ_ID_BASE);
+	else
+		for_each_node(node)
+			len += scnprintf(buf + len, PAGE_SIZE - len, "%s%d:%u",
+					 len ? " " : "", node,
+					 wq->numa_cwq[node]->gcwq->id -
+					 UNBOUND_GCWQ_ID_BASE);
+	len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
+	mutex_unlock(&wq_pool_mutex);
+	return len;
+}
+
+static ssize_t wq_nice_show(struct kobject *kobj,
+			    struct kobj_attribute *attr, char *buf)
+{
+	struct workqueue_struct *wq = kobj_to_wq(kobj);
+	int len;
+
+	mutex_lock(&wq_pool_mutex);
+	len = sprintf(buf, "%d\n", wq->unbound_attrs->nice);
+	mutex_unlock(&wq_pool_mutex);
+	return len;
+}
+
+static ssize_t wq_cpumask_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	struct workqueue_struct *wq = kobj_to_wq(kobj);
+	int len;
+
+	mutex_lock(&wq_pool_mutex);
+	len = cpumask_scnprintf(buf, PAGE_SIZE, wq->unbound_attrs->cpumask);
+	len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
+	mutex_unlock(&wq_pool_mutex);
+	return len;
+}
+
+static struct kobj_attribute wq_nice_attr;
+
+/* change the nice level or cpumask of @wq, depending on @attr */
+static ssize_t wq_attrs_store(struct kobject *kobj,
+			      struct kobj_attribute *attr,
+			      const char *buf, size_t count)
+{
+	struct workqueue_struct *wq = kobj_to_wq(kobj);
+	struct workqueue_attrs *attrs;
+	int ret;
+
+	if (wq->flags & WQ_ORDERED)
+		return -EINVAL;
+
+	attrs = alloc_workqueue_attrs(GFP_KERNEL);
+	if (!attrs)
+		return -ENOMEM;
+
+	mutex_lock(&wq_pool_mutex);
+	copy_workqueue_attrs(attrs, wq->unbound_attrs);
+	if (attr == &wq_nice_attr) {
+		ret = kstrtoint(buf, 0, &attrs->nice);
+		if (!ret && (attrs->nice < -20 || attrs->nice > 19))
+			ret = -EINVAL;
+	} else
+		ret = bitmap_parse(buf, count, cpumask_bits(attrs->cpumask),
+				   nr_cpumask_bits);
+	if (!ret)
+		ret = __apply_workqueue_attrs(wq, attrs);
+	mutex_unlock(&wq_pool_mutex);
+
+	free_workqueue_attrs(attrs);
+	return ret ?: count;
+}
+
+static struct kobj_attribute wq_per_cpu_attr =
+	__ATTR(per_cpu, 0444, wq_per_cpu_show, NULL);
+static struct kobj_attribute wq_max_active_attr =
+	__ATTR(max_active, 0644, wq_max_active_show, wq_max_active_store);
+static struct kobj_attribute wq_pool_ids_attr =
+	__ATTR(pool_ids, 0444, wq_pool_ids_show, NULL);
+static struct kobj_attribute wq_nice_attr =
+	__ATTR(nice, 0644, wq_nice_show, wq_attrs_store);
+static struct kobj_attribute wq_cpumask_attr =
+	__ATTR(cpumask, 0644, wq_cpumask_show, wq_attrs_store);
+
+static struct attribute *wq_sysfs_attrs[] = {
+	&wq_per_cpu_attr.attr,
+	&wq_max_active_attr.attr,
+	NULL,
+};
+
+static struct attribute *wq_sysfs_unbound_attrs[] = {
+	&wq_per_cpu_attr.attr,
+	&wq_max_active_attr.attr,
+	&wq_pool_ids_attr.attr,
+	&wq_nice_attr.attr,
+	&wq_cpumask_attr.attr,
+	NULL,
+};
+
+static void wq_sysfs_release(struct kobject *kobj)
+{
+	kfree(container_of(kobj, struct wq_sysfs, kobj));
+}
+
+static struct kobj_type wq_sysfs_ktype = {
+	.release	= wq_sysfs_release,
+	.sysfs_ops	= &kobj_sysfs_ops,
+	.default_attrs	= wq_sysfs_attrs,
+};
+
+static struct kobj_type wq_sysfs_unbound_ktype = {
+	.release	= wq_sysfs_release,
+	.sysfs_ops	= &kobj_sysfs_ops,
+	.default_attrs	= wq_sysfs_unbound_attrs,
+};
+
+/*
+ * Create the sysfs directory of @wq.  Workqueues allocated before the
+ * kset exists are registered by wq_sysfs_init().
+ */
+static int wq_sysfs_register(struct workqueue_struct *wq)
+{
+	struct wq_sysfs *sysfs;
+	int ret;
+
+	lockdep_assert_held(&wq_pool_mutex);
+
+	if (!wq_kset)
+		return 0;
+
+	sysfs = kzalloc(sizeof(*sysfs), GFP_KERNEL);
+	if (!sysfs)
+		return -ENOMEM;
+
+	sysfs->wq = wq;
+	sysfs->kobj.kset = wq_kset;
+	ret = kobject_init_and_add(&sysfs->kobj, wq->flags & WQ_UNBOUND ?
+				   &wq_sysfs_unbound_ktype : &wq_sysfs_ktype,
+				   NULL, "%s", wq->name);
+	if (ret) {
+		kobject_put(&sysfs->kobj);
+		return ret;
+	}
+
+	kobject_uevent(&sysfs->kobj, KOBJ_ADD);
+	wq->sysfs = sysfs;
+	return 0;
+}
+
+/* remove the sysfs directory of @wq, waiting for its users to go away */
+static void wq_sysfs_unregister(struct workqueue_struct *wq)
+{
+	struct wq_sysfs *sysfs;
+
+	mutex_lock(&wq_pool_mutex);
+	sysfs = wq->sysfs;
+	wq->sysfs = NULL;
+	mutex_unlock(&wq_pool_mutex);
+
+	if (sysfs) {
+		kobject_del(&sysfs->kobj);
+		kobject_put(&sysfs->kobj);
+	}
+}
+
+static int __init wq_sysfs_init(void)
+{
+	struct workqueue_struct *wq;
+
+	wq_kset = kset_create_and_add("workqueue", NULL, kernel_kobj);
+	if (!wq_kset)
+		return -ENOMEM;
+
+	mutex_lock(&wq_pool_mutex);
+	list_for_each_entry(wq, &workqueues, list)
+		if (wq->flags & WQ_SYSFS && wq_sysfs_register(wq))
+			pr_warning("workqueue %s: failed to create sysfs directory\n",
+				   wq->name);
+	mutex_unlock(&wq_pool_mutex);
+	return 0;
+}
+postcore_initcall(wq_sysfs_init);
+#else	/* CONFIG_SYSFS */
+static int wq_sysfs_register(struct workqueue_struct *wq)	{ return 0; }
+static void wq_sysfs_unregister(struct workqueue_struct *wq)	{ }
+#endif	/* CONFIG_SYSFS */
+
+static int wq_clamp_max_active(int max_active, unsigned int flags,
+			       const char *name)
+{
+	int lim = flags & WQ_UNBOUND ? WQ_UNBOUND_MAX_ACTIVE : WQ_MAX_ACTIVE;
+
+	if (max_active < 1 || max_active > lim)
+		printk(KERN_WARNING "workqueue: max_active %d requested for %s "
+		       "is out of range, clamping between %d and %d\n",
+		       max_active, name, 1, lim);
+
+	return clamp_val(max_active, 1, lim);
+}
+
+struct workqueue_struct *__alloc_workqueue_key(const char *fmt,
+					       unsigned int flags,
+					       int max_active,
+					       struct lock_class_key *key,
+					       const char *lock_name, ...)
+{
+	va_list args, args1;
+	struct workqueue_struct *wq;
+	size_t namelen;
+
+	/* determine namelen, allocate wq and format name */
+	va_start(args, lock_name);
+	va_copy(args1, args);
+	namelen = vsnprintf(NULL, 0, fmt, args) + 1;
+
+	wq = kzalloc(sizeof(*wq) + namelen, GFP_KERNEL);
+	if (!wq)
+		goto err;
+
+	vsnprintf(wq->name, namelen, fmt, args1);
 	va_end(args);
 	va_end(args1);
 
@@ -2978,6 +3927,13 @@ struct workqueue_struct *__alloc_workqueue_key(const char *fmt,
 	if (flags & WQ_UNBOUND)
 		flags |= WQ_HIGHPRI;
 
+	/*
+	 * An unbound workqueue with max_active of 1 is expected to
+	 * execute its works in queueing order.  Keep it on a single cwq.
+	 */
+	if (flags & WQ_UNBOUND && max_active == 1)
+		flags |= WQ_ORDERED;
+
 	max_active = max_active ?: WQ_DFL_ACTIVE;
 	max_active = wq_clamp_max_active(max_active, flags, wq->name);
 
@@ -2988,6 +3944,7 @@ struct workqueue_struct *__alloc_workqueue_key(const char *fmt,
 	atomic_set(&wq->nr_cwqs_to_flush, 0);
 	INIT_LIST_HEAD(&wq->flusher_queue);
 	INIT_LIST_HEAD(&wq->flusher_overflow);
+	INIT_LIST_HEAD(&wq->cwqs);
 
 	lockdep_init_map(&wq->lockdep_map, lock_name, key, 0);
 	INIT_LIST_HEAD(&wq->list);
@@ -2995,16 +3952,18 @@ struct workqueue_struct *__alloc_workqueue_key(const char *fmt,
 	if (alloc_cwqs(wq) < 0)
 		goto err;
 
-	for_each_cwq_cpu(cpu, wq) {
-		struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
-		struct global_cwq *gcwq = get_gcwq(cpu);
+	if (flags & WQ_UNBOUND) {
+		int ret;
+
+		wq->unbound_attrs = alloc_workqueue_attrs(GFP_KERNEL);
+		if (!wq->unbound_attrs)
+			goto err;
 
-		BUG_ON((unsigned long)cwq & WORK_STRUCT_FLAG_MASK);
-		cwq->gcwq = gcwq;
-		cwq->wq = wq;
-		cwq->flush_color = -1;
-		cwq->max_active = max_active;
-		INIT_LIST_HEAD(&cwq->delayed_works);
+		mutex_lock(&wq_pool_mutex);
+		ret = __apply_workqueue_attrs(wq, wq->unbound_attrs);
+		mutex_unlock(&wq_pool_mutex);
+		if (ret)
+			goto err;
 	}
 
 	if (flags & WQ_RESCUER) {
@@ -3031,22 +3990,37 @@ struct workqueue_struct *__alloc_workqueue_key(const char *fmt,
 	 * list.  Grab it, set max_active accordingly and add the new
 	 * workqueue to workqueues list.
 	 */
+	mutex_lock(&wq_pool_mutex);
 	spin_lock(&workqueue_lock);
 
-	if (workqueue_freezing && wq->flags & WQ_FREEZABLE)
-		for_each_cwq_cpu(cpu, wq)
-			get_cwq(cpu, wq)->max_active = 0;
+	if (workqueue_freezing && wq->flags & WQ_FREEZABLE) {
+		struct cpu_workqueue_struct *cwq;
+
+		for_each_cwq(cwq, wq)
+			cwq->max_active = 0;
+	}
 
 	list_add(&wq->list, &workqueues);
 
 	spin_unlock(&workqueue_lock);
 
+	if (wq->flags & WQ_SYSFS && wq_sysfs_register(wq))
+		pr_warning("workqueue %s: failed to create sysfs directory\n",
+			   wq->name);
+	mutex_unlock(&wq_pool_mutex);
+
 	return wq;
 err:
 	if (wq) {
-		free_cwqs(wq);
 		free_mayday_mask(wq->mayday_mask);
 		kfree(wq->rescuer);
+		if (wq->dfl_cwq) {
+			/* the cwq release takes care of the rest */
+			put_installed_cwqs(wq);
+			return NULL;
+		}
+		free_cwqs(wq);
+		free_workqueue_attrs(wq->unbound_attrs);
 		kfree(wq);
 	}
 	return NULL;
@@ -3061,7 +4035,10 @@ EXPORT_SYMBOL_GPL(__alloc_workqueue_key);
  */
 void destroy_workqueue(struct workqueue_struct *wq)
 {
-	unsigned int cpu;
+	struct cpu_workqueue_struct *cwq;
+
+	/* no more attribute changes from userland */
+	wq_sysfs_unregister(wq);
 
 	/* drain it before proceeding with destruction */
 	drain_workqueue(wq);
@@ -3070,13 +4047,15 @@ void destroy_workqueue(struct workqueue_struct *wq)
 	 * wq list is used to freeze wq, remove from list after
 	 * flushing is complete in case freeze races us.
 	 */
+	mutex_lock(&wq_pool_mutex);
 	spin_lock(&workqueue_lock);
 	list_del(&wq->list);
 	spin_unlock(&workqueue_lock);
+	mutex_unlock(&wq_pool_mutex);
 
 	/* sanity check */
-	for_each_cwq_cpu(cpu, wq) {
-		struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
+	mutex_lock(&wq->flush_mutex);
+	for_each_cwq(cwq, wq) {
 		int i;
 
 		for (i = 0; i < WORK_NR_COLORS; i++)
@@ -3084,6 +4063,7 @@ void destroy_workqueue(struct workqueue_struct *wq)
 		BUG_ON(cwq->nr_active);
 		BUG_ON(!list_empty(&cwq->delayed_works));
 	}
+	mutex_unlock(&wq->flush_mutex);
 
 	if (wq->flags & WQ_RESCUER) {
 		kthread_stop(wq->rescuer->task);
@@ -3091,6 +4071,12 @@ void destroy_workqueue(struct workqueue_struct *wq)
 		kfree(wq->rescuer);
 	}
 
+	/* unbound cwqs are released asynchronously and free @wq last */
+	if (wq->flags & WQ_UNBOUND) {
+		put_installed_cwqs(wq);
+		return;
+	}
+
 	free_cwqs(wq);
 	kfree(wq);
 }
@@ -3108,7 +4094,7 @@ EXPORT_SYMBOL_GPL(destroy_workqueue);
  */
 void workqueue_set_max_active(struct workqueue_struct *wq, int max_active)
 {
-	unsigned int cpu;
+	struct cpu_workqueue_struct *cwq;
 
 	max_active = wq_clamp_max_active(max_active, wq->flags, wq->name);
 
@@ -3116,14 +4102,14 @@ void workqueue_set_max_active(struct workqueue_struct *wq, int max_active)
 
 	wq->saved_max_active = max_active;
 
-	for_each_cwq_cpu(cpu, wq) {
-		struct global_cwq *gcwq = get_gcwq(cpu);
+	for_each_cwq(cwq, wq) {
+		struct global_cwq *gcwq = cwq->gcwq;
 
 		spin_lock_irq(&gcwq->lock);
 
 		if (!(wq->flags & WQ_FREEZABLE) ||
 		    !(gcwq->flags & GCWQ_FREEZING))
-			get_cwq(gcwq->cpu, wq)->max_active = max_active;
+			cwq->max_active = max_active;
 
 		spin_unlock_irq(&gcwq->lock);
 	}
@@ -3146,9 +4132,15 @@ EXPORT_SYMBOL_GPL(workqueue_set_max_active);
  */
 bool workqueue_congested(unsigned int cpu, struct workqueue_struct *wq)
 {
-	struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
+	struct cpu_workqueue_struct *cwq;
+	bool ret;
 
-	return !list_empty(&cwq->delayed_works);
+	rcu_read_lock_sched();
+	cwq = get_cwq(cpu, wq);
+	ret = !list_empty(&cwq->delayed_works);
+	rcu_read_unlock_sched();
+
+	return ret;
 }
 EXPORT_SYMBOL_GPL(workqueue_congested);
 
@@ -3161,9 +4153,15 @@ EXPORT_SYMBOL_GPL(workqueue_congested);
  */
 unsigned int work_cpu(struct work_struct *work)
 {
-	struct global_cwq *gcwq = get_work_gcwq(work);
+	struct global_cwq *gcwq;
+	unsigned int cpu;
+
+	rcu_read_lock_sched();
+	gcwq = get_work_gcwq(work);
+	cpu = gcwq ? gcwq->cpu : WORK_CPU_NONE;
+	rcu_read_unlock_sched();
 
-	return gcwq ? gcwq->cpu : WORK_CPU_NONE;
+	return cpu;
 }
 EXPORT_SYMBOL_GPL(work_cpu);
 
@@ -3182,14 +4180,18 @@ EXPORT_SYMBOL_GPL(work_cpu);
  */
 unsigned int work_busy(struct work_struct *work)
 {
-	struct global_cwq *gcwq = get_work_gcwq(work);
+	struct global_cwq *gcwq;
 	unsigned long flags;
 	unsigned int ret = 0;
 
-	if (!gcwq)
+	local_irq_save(flags);
+	gcwq = get_work_gcwq(work);
+	if (!gcwq) {
+		local_irq_restore(flags);
 		return false;
+	}
 
-	spin_lock_irqsave(&gcwq->lock, flags);
+	spin_lock(&gcwq->lock);
 
 	if (work_pending(work))
 		ret |= WORK_BUSY_PENDING;
@@ -3638,30 +4640,31 @@ EXPORT_SYMBOL_GPL(work_on_cpu);
  */
 void freeze_workqueues_begin(void)
 {
-	unsigned int cpu;
+	struct global_cwq *gcwq;
+	struct workqueue_struct *wq;
+	struct cpu_workqueue_struct *cwq;
 
 	spin_lock(&workqueue_lock);
 
 	BUG_ON(workqueue_freezing);
 	workqueue_freezing = true;
 
-	for_each_gcwq_cpu(cpu) {
-		struct global_cwq *gcwq = get_gcwq(cpu);
-		struct workqueue_struct *wq;
-
+	for_each_gcwq(gcwq) {
 		spin_lock_irq(&gcwq->lock);
-
 		BUG_ON(gcwq->flags & GCWQ_FREEZING);
 		gcwq->flags |= GCWQ_FREEZING;
+		spin_unlock_irq(&gcwq->lock);
+	}
 
-		list_for_each_entry(wq, &workqueues, list) {
-			struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
+	list_for_each_entry(wq, &workqueues, list) {
+		if (!(wq->flags & WQ_FREEZABLE))
+			continue;
 
-			if (cwq && wq->flags & WQ_FREEZABLE)
-				cwq->max_active = 0;
+		for_each_cwq(cwq, wq) {
+			spin_lock_irq(&cwq->gcwq->lock);
+			cwq->max_active = 0;
+			spin_unlock_irq(&cwq->gcwq->lock);
 		}
-
-		spin_unlock_irq(&gcwq->lock);
 	}
 
 	spin_unlock(&workqueue_lock);
@@ -3682,25 +4685,23 @@ void freeze_workqueues_begin(void)
  */
 bool freeze_workqueues_busy(void)
 {
-	unsigned int cpu;
+	struct workqueue_struct *wq;
 	bool busy = false;
 
 	spin_lock(&workqueue_lock);
 
 	BUG_ON(!workqueue_freezing);
 
-	for_each_gcwq_cpu(cpu) {
-		struct workqueue_struct *wq;
+	list_for_each_entry(wq, &workqueues, list) {
+		struct cpu_workqueue_struct *cwq;
+
+		if (!(wq->flags & WQ_FREEZABLE))
+			continue;
 		/*
 		 * nr_active is monotonically decreasing.  It's safe
 		 * to peek without lock.
 		 */
-		list_for_each_entry(wq, &workqueues, list) {
-			struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
-
-			if (!cwq || !(wq->flags & WQ_FREEZABLE))
-				continue;
-
+		for_each_cwq(cwq, wq) {
 			BUG_ON(cwq->nr_active < 0);
 			if (cwq->nr_active) {
 				busy = true;
@@ -3724,27 +4725,28 @@ out_unlock:
  */
 void thaw_workqueues(void)
 {
-	unsigned int cpu;
+	struct global_cwq *gcwq;
+	struct workqueue_struct *wq;
+	struct cpu_workqueue_struct *cwq;
 
 	spin_lock(&workqueue_lock);
 
 	if (!workqueue_freezing)
 		goto out_unlock;
 
-	for_each_gcwq_cpu(cpu) {
-		struct global_cwq *gcwq = get_gcwq(cpu);
-		struct workqueue_struct *wq;
-
+	for_each_gcwq(gcwq) {
 		spin_lock_irq(&gcwq->lock);
-
 		BUG_ON(!(gcwq->flags & GCWQ_FREEZING));
 		gcwq->flags &= ~GCWQ_FREEZING;
+		spin_unlock_irq(&gcwq->lock);
+	}
 
-		list_for_each_entry(wq, &workqueues, list) {
-			struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
+	list_for_each_entry(wq, &workqueues, list) {
+		if (!(wq->flags & WQ_FREEZABLE))
+			continue;
 
-			if (!cwq || !(wq->flags & WQ_FREEZABLE))
-				continue;
+		for_each_cwq(cwq, wq) {
+			spin_lock_irq(&cwq->gcwq->lock);
 
 			/* restore max_active and repopulate worklist */
 			cwq->max_active = wq->saved_max_active;
@@ -3752,10 +4754,14 @@ void thaw_workqueues(void)
 			while (!list_empty(&cwq->delayed_works) &&
 			       cwq->nr_active < cwq->max_active)
 				cwq_activate_first_delayed(cwq);
+
+			spin_unlock_irq(&cwq->gcwq->lock);
 		}
+	}
 
+	for_each_gcwq(gcwq) {
+		spin_lock_irq(&gcwq->lock);
 		wake_up_worker(gcwq);
-
 		spin_unlock_irq(&gcwq->lock);
 	}
 
@@ -3765,46 +4771,71 @@ out_unlock:
 }
 #endif /* CONFIG_FREEZER */
 
-static int __init init_workqueues(void)
+/*
+ * Record the possible cpus of each node so that unbound workqueues
+ * can have a cwq per node.  Skipped on single node machines or if the
+ * node mapping looks unusable.
+ */
+static void __init wq_numa_init(void)
 {
+	cpumask_var_t *masks;
 	unsigned int cpu;
-	int i;
+	int node;
 
-	cpu_notifier(workqueue_cpu_callback, CPU_PRI_WORKQUEUE);
+	if (num_possible_nodes() <= 1)
+		return;
 
-	/* initialize gcwqs */
-	for_each_gcwq_cpu(cpu) {
-		struct global_cwq *gcwq = get_gcwq(cpu);
+	if (wq_disable_numa) {
+		pr_info("workqueue: NUMA affinity support disabled\n");
+		return;
+	}
 
-		spin_lock_init(&gcwq->lock);
-		INIT_LIST_HEAD(&gcwq->worklist);
-		gcwq->cpu = cpu;
-		gcwq->flags |= GCWQ_DISASSOCIATED;
+	masks = kzalloc(nr_node_ids * sizeof(masks[0]), GFP_KERNEL);
+	BUG_ON(!masks);
 
-		INIT_LIST_HEAD(&gcwq->idle_list);
-		for (i = 0; i < BUSY_WORKER_HASH_SIZE; i++)
-			INIT_HLIST_HEAD(&gcwq->busy_hash[i]);
+	for_each_node(node)
+		BUG_ON(!zalloc_cpumask_var_node(&masks[node], GFP_KERNEL,
+				node_online(node) ? node : -1));
 
-		init_timer_deferrable(&gcwq->idle_timer);
-		gcwq->idle_timer.function = idle_worker_timeout;
-		gcwq->idle_timer.data = (unsigned long)gcwq;
+	for_each_possible_cpu(cpu) {
+		node = cpu_to_node(cpu);
+		if (WARN_ON(node < 0 || !node_possible(node))) {
+			pr_warning("workqueue: NUMA node mapping not available for cpu%u, disabling NUMA support\n",
+				   cpu);
+			/* happens iff arch is bonkers, let's just proceed */
+			return;
+		}
+		cpumask_set_cpu(cpu, masks[node]);
+	}
 
-		setup_timer(&gcwq->mayday_timer, gcwq_mayday_timeout,
-			    (unsigned long)gcwq);
+	wq_numa_possible_cpumask = masks;
+	wq_numa_enabled = true;
+}
 
-		ida_init(&gcwq->worker_ida);
+static int __init init_workqueues(void)
+{
+	unsigned int cpu;
+
+	cpu_notifier(workqueue_cpu_callback, CPU_PRI_WORKQUEUE);
+
+	wq_numa_init();
 
-		gcwq->trustee_state = TRUSTEE_DONE;
-		init_waitqueue_head(&gcwq->trustee_wait);
+	/* initialize gcwqs */
+	for_each_possible_cpu(cpu) {
+		struct global_cwq *gcwq = get_gcwq(cpu);
+
+		init_gcwq(gcwq, cpu);
+		gcwq->id = cpu;
+		gcwq->node = cpu_to_node(cpu);
+		list_add_tail(&gcwq->list, &gcwqs);
 	}
 
 	/* create the initial worker */
-	for_each_online_gcwq_cpu(cpu) {
+	for_each_online_cpu(cpu) {
 		struct global_cwq *gcwq = get_gcwq(cpu);
 		struct worker *worker;
 
-		if (cpu != WORK_CPU_UNBOUND)
-			gcwq->flags &= ~GCWQ_DISASSOCIATED;
+		gcwq->flags &= ~GCWQ_DISASSOCIATED;
 		worker = create_worker(gcwq, true);
 		BUG_ON(!worker);
 		spin_lock_irq(&gcwq->lock);
@@ -3815,7 +4846,8 @@ static int __init init_workqueues(void)
 	system_wq = alloc_workqueue("events", 0, 0);
 	system_long_wq = alloc_workqueue("events_long", 0, 0);
 	system_nrt_wq = alloc_workqueue("events_nrt", WQ_NON_REENTRANT, 0);
-	system_unbound_wq = alloc_workqueue("events_unbound", WQ_UNBOUND,
+	system_unbound_wq = alloc_workqueue("events_unbound",
+					    WQ_UNBOUND | WQ_SYSFS,
 					    WQ_UNBOUND_MAX_ACTIVE);
 	system_freezable_wq = alloc_workqueue("events_freezable",
 					      WQ_FREEZABLE, 0);
@@ -34,33 +34,6 @@
 #include <linux/rcupdate.h>
 
 
-#ifdef __KERNEL__
-#define RADIX_TREE_MAP_SHIFT	(CONFIG_BASE_SMALL ? 4 : 6)
-#else
-#define RADIX_TREE_MAP_SHIFT	3	/* For more stressful testing */
-#endif
-
-#define RADIX_TREE_MAP_SIZE	(1UL << RADIX_TREE_MAP_SHIFT)
-#define RADIX_TREE_MAP_MASK	(RADIX_TREE_MAP_SIZE-1)
-
-#define RADIX_TREE_TAG_LONGS	\
-	((RADIX_TREE_MAP_SIZE + BITS_PER_LONG - 1) / BITS_PER_LONG)
-
-struct radix_tree_node {
-	unsigned int	height;		/* Height from the bottom */
-	unsigned int	count;
-	union {
-		struct radix_tree_node *parent;	/* Used when ascending tree */
-		struct rcu_head	rcu_head;	/* Used when freeing node */
-	};
-	void __rcu	*slots[RADIX_TREE_MAP_SIZE];
-	unsigned long	tags[RADIX_TREE_MAX_TAGS][RADIX_TREE_TAG_LONGS];
-};
-
-#define RADIX_TREE_INDEX_BITS  (8 /* CHAR_BIT */ * sizeof(unsigned long))
-#define RADIX_TREE_MAX_PATH (DIV_ROUND_UP(RADIX_TREE_INDEX_BITS, \
-					  RADIX_TREE_MAP_SHIFT))
-
 /*
  * The height_to_maxindex array needs to be one deeper than the maximum
  * path as height 0 holds only 1 entry.
@@ -91,6 +64,46 @@ static inline void *indirect_to_ptr(void *ptr)
 	return (void *)((unsigned long)ptr & ~RADIX_TREE_INDIRECT_PTR);
 }
 
+#ifdef CONFIG_RADIX_TREE_MULTIORDER
+/* Sibling slots point directly to another slot in the same node */
+static inline bool is_sibling_entry(struct radix_tree_node *parent, void *node)
+{
+	void **ptr = indirect_to_ptr(node);
+
+	return radix_tree_is_indirect_ptr(node) &&
+		parent->slots <= ptr && ptr < parent->slots + RADIX_TREE_MAP_SIZE;
+}
+#else
+static inline bool is_sibling_entry(struct radix_tree_node *parent, void *node)
+{
+	return false;
+}
+#endif
+
+/*
+ * Look up the slot of @index in @parent, whose slots each cover
+ * 1 << @shift indices.  A sibling slot is followed to the slot of its
+ * multi-order item.  Returns the offset of the slot, and its content
+ * in *@entryp.
+ */
+static unsigned int radix_tree_descend(struct radix_tree_node *parent,
+				       void **entryp, unsigned long index,
+				       unsigned int shift)
+{
+	unsigned int offset = (index >> shift) & RADIX_TREE_MAP_MASK;
+	void *entry = rcu_dereference_raw(parent->slots[offset]);
+
+	if (is_sibling_entry(parent, entry)) {
+		void **sibentry = indirect_to_ptr(entry);
+
+		offset = sibentry - parent->slots;
+		entry = rcu_dereference_raw(*sibentry);
+	}
+
+	*entryp = entry;
+	return offset;
+}
+
 static inline gfp_t root_gfp_mask(struct radix_tree_root *root)
 {
 	return root->gfp_mask & __GFP_BITS_MASK;
@@ -287,9 +300,11 @@ static inline unsigned long radix_tree_maxindex(unsigned int height)
 }
 
 /*
- *	Extend a radix tree so it can store key @index.
+ *	Extend a radix tree so it can store key @index, and an item of
+ *	@order in a slot of a node.
  */
-static int radix_tree_extend(struct radix_tree_root *root, unsigned long index)
+static int radix_tree_extend(struct radix_tree_root *root, unsigned long index,
+			     unsigned order)
 {
 	struct radix_tree_node *node;
 	struct radix_tree_node *slot;
@@ -298,7 +313,8 @@ static int radix_tree_extend(struct radix_tree_root *root, unsigned long index)
 
 	/* Figure out what the height should be.  */
 	height = root->height + 1;
-	while (index > radix_tree_maxindex(height))
+	while (index > radix_tree_maxindex(height) ||
+	       (order && order >= height * RADIX_TREE_MAP_SHIFT))
 		height++;
 
 	if (root->rnode == NULL) {
@@ -323,10 +339,8 @@ static int radix_tree_extend(struct radix_tree_root *root, unsigned long index)
 		node->count = 1;
 		node->parent = NULL;
 		slot = root->rnode;
-		if (newheight > 1) {
-			slot = indirect_to_ptr(slot);
-			slot->parent = node;
-		}
+		if (radix_tree_is_indirect_ptr(slot))
+			((struct radix_tree_node *)indirect_to_ptr(slot))->parent = node;
 		node->slots[0] = slot;
 		node = ptr_to_indirect(node);
 		rcu_assign_pointer(root->rnode, node);
@@ -337,85 +351,157 @@ out:
 }
 
 /**
- *	radix_tree_insert    -    insert into a radix tree
+ *	__radix_tree_create	-	create a slot in a radix tree
  *	@root:		radix tree root
  *	@index:		index key
- *	@item:		item to insert
+ *	@order:		index occupies 2^order aligned slots
+ *	@nodep:		returns node
+ *	@slotp:		returns slot
+ *
+ *	Create, if necessary, and return the node and slot for an item
+ *	at position @index in the radix tree @root.  An item of @order is
+ *	given the slot of the lowest node whose slots cover no more than
+ *	2^@order indices.
+ *
+ *	Until there is more than one item in the tree, no nodes are
+ *	allocated and @root->rnode is used as a direct slot instead of
+ *	pointing to a node, in which case *@nodep will be NULL.
  *
- *	Insert an item into the radix tree at position @index.
+ *	Returns -ENOMEM, or 0 for success.
  */
-int radix_tree_insert(struct radix_tree_root *root,
-			unsigned long index, void *item)
+int __radix_tree_create(struct radix_tree_root *root, unsigned long index,
+			unsigned order, struct radix_tree_node **nodep,
+			void ***slotp)
 {
-	struct radix_tree_node *node = NULL, *slot;
-	unsigned int height, shift;
-	int offset;
+	struct radix_tree_node *node = NULL, *child;
+	void **slot = (void **)&root->rnode;
+	unsigned long max = index | ((1UL << order) - 1);
+	unsigned int shift, offset = 0;
 	int error;
 
-	BUG_ON(radix_tree_is_indirect_ptr(item));
-
 	/* Make sure the tree is high enough.  */
-	if (index > radix_tree_maxindex(root->height)) {
-		error = radix_tree_extend(root, index);
+	if (max > radix_tree_maxindex(root->height) ||
+	    (order && order >= root->height * RADIX_TREE_MAP_SHIFT)) {
+		error = radix_tree_extend(root, max, order);
 		if (error)
 			return error;
 	}
 
-	slot = indirect_to_ptr(root->rnode);
-
-	height = root->height;
-	shift = (height-1) * RADIX_TREE_MAP_SHIFT;
+	child = root->rnode;
+	shift = root->height * RADIX_TREE_MAP_SHIFT;
 
-	offset = 0;			/* uninitialised var warning */
-	while (height > 0) {
-		if (slot == NULL) {
+	while (shift > order) {
+		if (child == NULL) {
 			/* Have to add a child node.  */
-			if (!(slot = radix_tree_node_alloc(root)))
+			if (!(child = radix_tree_node_alloc(root)))
 				return -ENOMEM;
-			slot->height = height;
-			slot->parent = node;
-			if (node) {
-				rcu_assign_pointer(node->slots[offset], slot);
+			child->height = shift / RADIX_TREE_MAP_SHIFT;
+			child->parent = node;
+			rcu_assign_pointer(*slot, ptr_to_indirect(child));
+			if (node)
 				node->count++;
-			} else
-				rcu_assign_pointer(root->rnode, ptr_to_indirect(slot));
-		}
+		} else if (!radix_tree_is_indirect_ptr(child) ||
+			   (node && is_sibling_entry(node, child)))
+			break;		/* a multi-order item is in the way */
+		else
+			child = indirect_to_ptr(child);
 
 		/* Go a level down */
-		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
-		node = slot;
-		slot = node->slots[offset];
+		node = child;
 		shift -= RADIX_TREE_MAP_SHIFT;
-		height--;
+		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
+		slot = node->slots + offset;
+		child = *slot;
 	}
 
-	if (slot != NULL)
+	if (nodep)
+		*nodep = node;
+	if (slotp)
+		*slotp = slot;
+	return 0;
+}
+
+/**
+ *	__radix_tree_insert    -    insert into a radix tree
+ *	@root:		radix tree root
+ *	@index:		index key
+ *	@order:		key covers the 2^order indices around index
+ *	@item:		item to insert
+ *
+ *	Insert an item into the radix tree at position @index.  With
+ *	CONFIG_RADIX_TREE_MULTIORDER, an item of @order > 0 is found by
+ *	lookups of any of the 2^@order indices from @index, which must be
+ *	aligned to that size.
+ */
+int __radix_tree_insert(struct radix_tree_root *root, unsigned long index,
+			unsigned order, void *item)
+{
+	struct radix_tree_node *node;
+	void **slot;
+	unsigned int offset;
+	int error;
+
+	BUG_ON(radix_tree_is_indirect_ptr(item));
+	BUG_ON(!IS_ENABLED(CONFIG_RADIX_TREE_MULTIORDER) && order);
+	BUG_ON(index & ((1UL << order) - 1));
+
+	error = __radix_tree_create(root, index, order, &node, &slot);
+	if (error)
+		return error;
+	if (*slot != NULL)
 		return -EEXIST;
 
-	if (node) {
-		node->count++;
-		rcu_assign_pointer(node->slots[offset], item);
-		BUG_ON(tag_get(node, 0, offset));
-		BUG_ON(tag_get(node, 1, offset));
-	} else {
-		rcu_assign_pointer(root->rnode, item);
+	if (!node) {
+		rcu_assign_pointer(*slot, item);
 		BUG_ON(root_tag_get(root, 0));
 		BUG_ON(root_tag_get(root, 1));
+		return 0;
 	}
 
+	offset = slot - node->slots;
+#ifdef CONFIG_RADIX_TREE_MULTIORDER
+	if (order > (node->height - 1) * RADIX_TREE_MAP_SHIFT) {
+		unsigned int i, n = 1U << (order -
+				(node->height - 1) * RADIX_TREE_MAP_SHIFT);
+
+		for (i = 1; i < n; i++)
+			if (slot[i])
+				return -EEXIST;
+		for (i = 1; i < n; i++)
+			rcu_assign_pointer(slot[i], ptr_to_indirect(slot));
+		node->count += n - 1;
+	}
+#endif
+	rcu_assign_pointer(*slot, item);
+	node->count++;
+	BUG_ON(tag_get(node, 0, offset));
+	BUG_ON(tag_get(node, 1, offset));
+
 	return 0;
 }
-EXPORT_SYMBOL(radix_tree_insert);
+EXPORT_SYMBOL(__radix_tree_insert);
 
-/*
- * is_slot == 1 : search for the slot.
- * is_slot == 0 : search for the node.
+/**
+ *	__radix_tree_lookup	-	lookup an item in a radix tree
+ *	@root:		radix tree root
+ *	@index:		index key
+ *	@nodep:		returns node
+ *	@slotp:		returns slot
+ *
+ *	Lookup and return the item at position @index in the radix
+ *	tree @root.
+ *
+ *	Until there is more than one item in the tree, no nodes are
+ *	allocated and @root->rnode is used as a direct slot instead of
+ *	pointing to a node, in which case *@nodep will be NULL.
  */
-static void *radix_tree_lookup_element(struct radix_tree_root *root,
-				unsigned long index, int is_slot)
+void *__radix_tree_lookup(struct radix_tree_root *root, unsigned long index,
+			  struct radix_tree_node **nodep, void ***slotp)
 {
-	unsigned int height, shift;
-	struct radix_tree_node *node, **slot;
+	struct radix_tree_node *node, *parent;
+	unsigned int height, shift, offset;
+	void **slot;
+	void *entry;
 
 	node = rcu_dereference_raw(root->rnode);
 	if (node == NULL)
@@ -424,7 +510,12 @@ static void *radix_tree_lookup_element(struct radix_tree_root *root,
 	if (!radix_tree_is_indirect_ptr(node)) {
 		if (index > 0)
 			return NULL;
-		return is_slot ? (void *)&root->rnode : node;
+
+		if (nodep)
+			*nodep = NULL;
+		if (slotp)
+			*slotp = (void **)&root->rnode;
+		return node;
 	}
 	node = indirect_to_ptr(node);
 
@@ -432,20 +523,23 @@ static void *radix_tree_lookup_element(struct radix_tree_root *root,
 	if (index > radix_tree_maxindex(height))
 		return NULL;
 
-	shift = (height-1) * RADIX_TREE_MAP_SHIFT;
+	shift = height * RADIX_TREE_MAP_SHIFT;
 
 	do {
-		slot = (struct radix_tree_node **)
-			(node->slots + ((index>>shift) & RADIX_TREE_MAP_MASK));
-		node = rcu_dereference_raw(*slot);
-		if (node == NULL)
-			return NULL;
-
+		parent = node;
 		shift -= RADIX_TREE_MAP_SHIFT;
-		height--;
-	} while (height > 0);
-
-	return is_slot ? (void *)slot : indirect_to_ptr(node);
+		offset = radix_tree_descend(parent, &entry, index, shift);
+		if (entry == NULL)
+			return NULL;
+		node = indirect_to_ptr(entry);
+	} while (shift && radix_tree_is_indirect_ptr(entry));
+
+	slot = parent->slots + offset;
+	if (nodep)
+		*nodep = parent;
+	if (slotp)
+		*slotp = slot;
+	return node;
 }
 
 /**
@@ -463,7 +557,11 @@ static void *radix_tree_lookup_element(struct radix_tree_root *root,
  */
 void **radix_tree_lookup_slot(struct radix_tree_root *root, unsigned long index)
 {
-	return (void **)radix_tree_lookup_element(root, index, 1);
+	void **slot;
+
+	if (!__radix_tree_lookup(root, index, NULL, &slot))
+		return NULL;
+	return slot;
 }
 EXPORT_SYMBOL(radix_tree_lookup_slot);
 
@@ -481,7 +579,7 @@ EXPORT_SYMBOL(radix_tree_lookup_slot);
  */
 void *radix_tree_lookup(struct radix_tree_root *root, unsigned long index)
 {
-	return radix_tree_lookup_element(root, index, 0);
+	return __radix_tree_lookup(root, index, NULL, NULL);
 }
 EXPORT_SYMBOL(radix_tree_lookup);
 
@@ -501,35 +599,61 @@ EXPORT_SYMBOL(radix_tree_lookup);
 void *radix_tree_tag_set(struct radix_tree_root *root,
 			unsigned long index, unsigned int tag)
 {
-	unsigned int height, shift;
-	struct radix_tree_node *slot;
+	struct radix_tree_node *parent;
+	unsigned int height, shift, offset;
+	void *entry;
 
 	height = root->height;
 	BUG_ON(index > radix_tree_maxindex(height));
 
-	slot = indirect_to_ptr(root->rnode);
-	shift = (height - 1) * RADIX_TREE_MAP_SHIFT;
-
-	while (height > 0) {
-		int offset;
+	entry = root->rnode;
+	shift = height * RADIX_TREE_MAP_SHIFT;
 
-		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
-		if (!tag_get(slot, tag, offset))
-			tag_set(slot, tag, offset);
-		slot = slot->slots[offset];
-		BUG_ON(slot == NULL);
+	while (radix_tree_is_indirect_ptr(entry)) {
+		parent = indirect_to_ptr(entry);
 		shift -= RADIX_TREE_MAP_SHIFT;
-		height--;
+		offset = radix_tree_descend(parent, &entry, index, shift);
+		BUG_ON(entry == NULL);
+
+		if (!tag_get(parent, tag, offset))
+			tag_set(parent, tag, offset);
 	}
 
 	/* set the root's tag bit */
-	if (slot && !root_tag_get(root, tag))
+	if (entry && !root_tag_get(root, tag))
 		root_tag_set(root, tag);
 
-	return slot;
+	return entry;
 }
 EXPORT_SYMBOL(radix_tree_tag_set);
 
+/*
+ * Clear @tag from slot @offset of @node, and from the slots leading to
+ * @node in its ancestors once no slot of @node is left with the tag.
+ */
+static void node_tag_clear(struct radix_tree_root *root,
+			   struct radix_tree_node *node, unsigned long index,
+			   unsigned int tag, unsigned int offset)
+{
+	while (node) {
+		if (!tag_get(node, tag, offset))
+			return;
+		tag_clear(node, tag, offset);
+		if (any_tag_set(node, tag))
+			return;
+
+		node = node->parent;
+		if (node)
+			offset = (index >> ((node->height - 1) *
+					    RADIX_TREE_MAP_SHIFT)) &
+				 RADIX_TREE_MAP_MASK;
+	}
+
+	/* clear the root's tag bit */
+	if (root_tag_get(root, tag))
+		root_tag_clear(root, tag);
+}
+
 /**
  *	radix_tree_tag_clear - clear a tag on a radix tree node
  *	@root:		radix tree root
@@ -547,49 +671,28 @@ EXPORT_SYMBOL(radix_tree_tag_set);
 void *radix_tree_tag_clear(struct radix_tree_root *root,
 			unsigned long index, unsigned int tag)
 {
-	struct radix_tree_node *node = NULL;
-	struct radix_tree_node *slot = NULL;
+	struct radix_tree_node *parent = NULL;
 	unsigned int height, shift;
-	int uninitialized_var(offset);
+	unsigned int uninitialized_var(offset);
+	void *entry;
 
 	height = root->height;
 	if (index > radix_tree_maxindex(height))
-		goto out;
+		return NULL;
 
+	entry = root->rnode;
 	shift = height * RADIX_TREE_MAP_SHIFT;
-	slot = indirect_to_ptr(root->rnode);
-
-	while (shift) {
-		if (slot == NULL)
-			goto out;
 
+	while (radix_tree_is_indirect_ptr(entry)) {
+		parent = indirect_to_ptr(entry);
 		shift -= RADIX_TREE_MAP_SHIFT;
-		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
-		node = slot;
-		slot = slot->slots[offset];
-	}
-
-	if (slot == NULL)
-		goto out;
-
-	while (node) {
-		if (!tag_get(node, tag, offset))
-			goto out;
-		tag_clear(node, tag, offset);
-		if (any_tag_set(node, tag))
-			goto out;
-
-		index >>= RADIX_TREE_MAP_SHIFT;
-		offset = index & RADIX_TREE_MAP_MASK;
-		node = node->parent;
+		offset = radix_tree_descend(parent, &entry, index, shift);
 	}
 
-	/* clear the root's tag bit */
-	if (root_tag_get(root, tag))
-		root_tag_clear(root, tag);
+	if (entry)
+		node_tag_clear(root, parent, index, tag, offset);
 
-out:
-	return slot;
+	return entry;
 }
 EXPORT_SYMBOL(radix_tree_tag_clear);
 
@@ -611,41 +714,38 @@ EXPORT_SYMBOL(radix_tree_tag_clear);
 int radix_tree_tag_get(struct radix_tree_root *root,
 			unsigned long index, unsigned int tag)
 {
-	unsigned int height, shift;
-	struct radix_tree_node *node;
+	struct radix_tree_node *parent;
+	unsigned int height, shift, offset;
+	void *entry;
 
 	/* check the root's tag bit */
 	if (!root_tag_get(root, tag))
 		return 0;
 
-	node = rcu_dereference_raw(root->rnode);
-	if (node == NULL)
+	entry = rcu_dereference_raw(root->rnode);
+	if (entry == NULL)
 		return 0;
 
-	if (!radix_tree_is_indirect_ptr(node))
+	if (!radix_tree_is_indirect_ptr(entry))
 		return (index == 0);
-	node = indirect_to_ptr(node);
 
-	height = node->height;
+	height = ((struct radix_tree_node *)indirect_to_ptr(entry))->height;
 	if (index > radix_tree_maxindex(height))
 		return 0;
 
-	shift = (height - 1) * RADIX_TREE_MAP_SHIFT;
+	shift = height * RADIX_TREE_MAP_SHIFT;
 
 	for ( ; ; ) {
-		int offset;
+		parent = indirect_to_ptr(entry);
+		shift -= RADIX_TREE_MAP_SHIFT;
+		offset = radix_tree_descend(parent, &entry, index, shift);
 
-		if (node == NULL)
+		if (entry == NULL)
 			return 0;
-
-		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
-		if (!tag_get(node, tag, offset))
+		if (!tag_get(parent, tag, offset))
 			return 0;
-		if (height == 1)
+		if (!shift || !radix_tree_is_indirect_ptr(entry))
 			return 1;
-		node = rcu_dereference_raw(node->slots[offset]);
-		shift -= RADIX_TREE_MAP_SHIFT;
-		height--;
 	}
 }
 EXPORT_SYMBOL(radix_tree_tag_get);
@@ -664,6 +764,7 @@ void **radix_tree_next_chunk(struct radix_tree_root *root,
 	unsigned shift, tag = flags & RADIX_TREE_ITER_TAG_MASK;
 	struct radix_tree_node *rnode, *node;
 	unsigned long index, offset;
+	void *entry;
 
 	if ((flags & RADIX_TREE_ITER_TAGGED) && !root_tag_get(root, tag))
 		return NULL;
@@ -686,6 +787,9 @@ void **radix_tree_next_chunk(struct radix_tree_root *root,
 		iter->index = 0;
 		iter->next_index = 1;
 		iter->tags = 1;
+#ifdef CONFIG_RADIX_TREE_MULTIORDER
+		iter->shift = 0;
+#endif
 		return (void **)&root->rnode;
 	} else
 		return NULL;
@@ -700,6 +804,14 @@ restart:
 
 	node = rnode;
 	while (1) {
+		/* Start a multi-order item at its own slot */
+		entry = rcu_dereference_raw(node->slots[offset]);
+		if (is_sibling_entry(node, entry)) {
+			offset = (void **)indirect_to_ptr(entry) - node->slots;
+			index &= ~((RADIX_TREE_MAP_SIZE << shift) - 1);
+			index += offset << shift;
+		}
+
 		if ((flags & RADIX_TREE_ITER_TAGGED) ?
 				!test_bit(offset, node->tags[tag]) :
 				!node->slots[offset]) {
@@ -730,16 +842,35 @@ restart:
 		if (!shift)
 			break;
 
-		node = rcu_dereference_raw(node->slots[offset]);
-		if (node == NULL)
+		entry = rcu_dereference_raw(node->slots[offset]);
+		if (entry == NULL)
 			goto restart;
+		/* A multi-order item in an upper node */
+		if (!radix_tree_is_indirect_ptr(entry))
+			break;
+		node = indirect_to_ptr(entry);
 		shift -= RADIX_TREE_MAP_SHIFT;
 		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
 	}
 
 	/* Update the iterator state */
+	index &= ~((1UL << shift) - 1);
 	iter->index = index;
-	iter->next_index = (index | RADIX_TREE_MAP_MASK) + 1;
+	iter->next_index = (index | ((RADIX_TREE_MAP_SIZE << shift) - 1)) + 1;
+#ifdef CONFIG_RADIX_TREE_MULTIORDER
+	iter->shift = shift;
+	if (shift) {
+		/* The chunk is the item's slot and its siblings */
+		unsigned long end = offset + 1;
+
+		while (end < RADIX_TREE_MAP_SIZE &&
+		       is_sibling_entry(node, node->slots[end]))
+			end++;
+		iter->next_index = index + ((end - offset) << shift);
+		iter->tags = 1;
+		return node->slots + offset;
+	}
+#endif
 
 	/* Construct iter->tags bit-mask from node->tags[tag] array */
 	if (flags & RADIX_TREE_ITER_TAGGED) {
@@ -763,6 +894,54 @@ restart:
 }
 EXPORT_SYMBOL(radix_tree_next_chunk);
 
+/*
+ * Set @settag on the slots from @offset to @end of leaf @node which have
+ * @iftag set, a word of tags at a time, stopping once @nr have been
+ * tagged.  Returns the number of slots tagged, and in *@endp the last
+ * offset scanned.
+ */
+static unsigned long tag_leaf_if_tagged(struct radix_tree_node *node,
+		unsigned int offset, unsigned int *endp, unsigned long nr,
+		unsigned int iftag, unsigned int settag)
+{
+	unsigned int end = *endp;
+	unsigned long tagged = 0;
+
+	for (;;) {
+		unsigned int word = offset / BITS_PER_LONG;
+		unsigned int bit = offset % BITS_PER_LONG;
+		unsigned int last = min_t(unsigned int, end,
+					  (word + 1) * BITS_PER_LONG - 1);
+		unsigned int nbits = last - offset + 1;
+		unsigned long bits = node->tags[iftag][word] >> bit;
+
+		if (nbits < BITS_PER_LONG)
+			bits &= (1UL << nbits) - 1;
+		if (hweight_long(bits) > nr - tagged) {
+			/* Only tag up to the (nr - tagged)th tagged slot */
+			unsigned long tmp = bits;
+			unsigned long i;
+
+			for (i = 1; i < nr - tagged; i++)
+				tmp &= tmp - 1;
+			last = offset + __ffs(tmp);
+			bits &= (2UL << __ffs(tmp)) - 1;
+			end = last;
+		}
+		node->tags[settag][word] |= bits << bit;
+		tagged += hweight_long(bits);
+
+		if (last >= end || tagged >= nr) {
+			end = last;
+			break;
+		}
+		offset = last + 1;
+	}
+
+	*endp = end;
+	return tagged;
+}
+
 /**
  * radix_tree_range_tag_if_tagged - for each item in given range set given
  *				   tag if item has another tag set
@@ -785,6 +964,9 @@ EXPORT_SYMBOL(radix_tree_next_chunk);
  * set is outside the range we are scanning. This reults in dangling tags and
  * can lead to problems with later tag operations (e.g. livelocks on lookups).
  *
+ * Within a leaf, the tags are copied a word at a time, and the path above
+ * it is tagged once for all of them.
+ *
  * The function returns number of leaves where the tag was set and sets
  * *first_indexp to the first unscanned index.
  * WARNING! *first_indexp can wrap if last_index is ULONG_MAX. Caller must
@@ -796,7 +978,7 @@ unsigned long radix_tree_range_tag_if_tagged(struct radix_tree_root *root,
 		unsigned int iftag, unsigned int settag)
 {
 	unsigned int height = root->height;
-	struct radix_tree_node *node = NULL;
+	struct radix_tree_node *node;
 	struct radix_tree_node *slot;
 	unsigned int shift;
 	unsigned long tagged = 0;
@@ -821,29 +1003,42 @@ unsigned long radix_tree_range_tag_if_tagged(struct radix_tree_root *root,
 	slot = indirect_to_ptr(root->rnode);
 
 	for (;;) {
-		unsigned long upindex;
-		int offset;
+		unsigned long upindex, count;
+		unsigned int offset, end;
+		void *entry;
 
 		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
-		if (!slot->slots[offset])
+		entry = slot->slots[offset];
+		if (!entry)
 			goto next;
 		if (!tag_get(slot, iftag, offset))
 			goto next;
-		if (shift) {
+		if (shift && radix_tree_is_indirect_ptr(entry)) {
 			/* Go down one level */
 			shift -= RADIX_TREE_MAP_SHIFT;
-			node = slot;
-			slot = slot->slots[offset];
+			slot = indirect_to_ptr(entry);
 			continue;
 		}
 
-		/* tag the leaf */
-		tagged++;
-		tag_set(slot, settag, offset);
+		if (shift) {
+			/* tag a multi-order item */
+			count = 1;
+			tag_set(slot, settag, offset);
+		} else {
+			/* tag the leaf */
+			end = RADIX_TREE_MAP_MASK;
+			if (last_index - index < RADIX_TREE_MAP_MASK - offset)
+				end = offset + (last_index - index);
+			count = tag_leaf_if_tagged(slot, offset, &end,
+					nr_to_tag - tagged, iftag, settag);
+			index += end - offset;
+		}
+		tagged += count;
 
 		/* walk back up the path tagging interior nodes */
-		upindex = index;
-		while (node) {
+		upindex = index >> shift;
+		node = slot->parent;
+		while (count && node) {
 			upindex >>= RADIX_TREE_MAP_SHIFT;
 			offset = upindex & RADIX_TREE_MAP_MASK;
 
@@ -854,15 +1049,6 @@ unsigned long radix_tree_range_tag_if_tagged(struct radix_tree_root *root,
 			node = node->parent;
 		}
 
-		/*
-		 * Small optimization: now clear that node pointer.
-		 * Since all of this slot's ancestors now have the tag set
-		 * from setting it above, we have no further need to walk
-		 * back up the tree setting tags, until we update slot to
-		 * point to another radix_tree_node.
-		 */
-		node = NULL;
-
 next:
 		/* Go to next item at level determined by 'shift' */
 		index = ((index >> shift) + 1) << shift;
@@ -1157,6 +1343,7 @@ static unsigned long __locate(struct radix_tree_node *slot, void *item,
 		slot = rcu_dereference_raw(slot->slots[i]);
 		if (slot == NULL)
 			goto out;
+		slot = indirect_to_ptr(slot);
 	}
 
 	/* Bottom level: check items */
@@ -1226,7 +1413,7 @@ static inline void radix_tree_shrink(struct radix_tree_root *root)
 	/* try to shrink tree height */
 	while (root->height > 0) {
 		struct radix_tree_node *to_free = root->rnode;
-		struct radix_tree_node *slot;
+		void *slot;
 
 		BUG_ON(!radix_tree_is_indirect_ptr(to_free));
 		to_free = indirect_to_ptr(to_free);
@@ -1237,7 +1424,11 @@ static inline void radix_tree_shrink(struct radix_tree_root *root)
 		 */
 		if (to_free->count != 1)
 			break;
-		if (!to_free->slots[0])
+		slot = to_free->slots[0];
+		if (!slot)
+			break;
+		/* Nor can a multi-order item move up to a smaller node */
+		if (root->height > 1 && !radix_tree_is_indirect_ptr(slot))
 			break;
 
 		/*
@@ -1247,11 +1438,9 @@ static inline void radix_tree_shrink(struct radix_tree_root *root)
 		 * (to_free->slots[0]), it will be safe to dereference the new
 		 * one (root->rnode) as far as dependent read barriers go.
 		 */
-		slot = to_free->slots[0];
-		if (root->height > 1) {
-			slot->parent = NULL;
-			slot = ptr_to_indirect(slot);
-		}
+		if (root->height > 1)
+			((struct radix_tree_node *)indirect_to_ptr(slot))->parent =
+									NULL;
 		root->rnode = slot;
 		root->height--;
 
@@ -1282,92 +1471,157 @@ static inline void radix_tree_shrink(struct radix_tree_root *root)
 }
 
 /**
- *	radix_tree_delete    -    delete an item from a radix tree
+ *	__radix_tree_delete_node    -    try to free node after clearing a slot
  *	@root:		radix tree root
- *	@index:		index key
+ *	@node:		node containing @index
  *
- *	Remove the item at @index from the radix tree rooted at @root.
+ *	After clearing the slot at @index in @node from radix tree
+ *	rooted at @root, call this function to attempt freeing the
+ *	node and shrinking the tree.
  *
- *	Returns the address of the deleted item, or NULL if it was not present.
+ *	Returns %true if @node was freed, %false otherwise.
  */
-void *radix_tree_delete(struct radix_tree_root *root, unsigned long index)
+bool __radix_tree_delete_node(struct radix_tree_root *root,
+			      struct radix_tree_node *node)
 {
-	struct radix_tree_node *node = NULL;
-	struct radix_tree_node *slot = NULL;
-	struct radix_tree_node *to_free;
-	unsigned int height, shift;
-	int tag;
-	int uninitialized_var(offset);
-
-	height = root->height;
-	if (index > radix_tree_maxindex(height))
-		goto out;
-
-	slot = root->rnode;
-	if (height == 0) {
-		root_tag_clear_all(root);
-		root->rnode = NULL;
-		goto out;
-	}
-	slot = indirect_to_ptr(slot);
-	shift = height * RADIX_TREE_MAP_SHIFT;
+	bool deleted = false;
 
 	do {
-		if (slot == NULL)
-			goto out;
+		struct radix_tree_node *parent;
 
-		shift -= RADIX_TREE_MAP_SHIFT;
-		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
-		node = slot;
-		slot = slot->slots[offset];
-	} while (shift);
+		if (node->count) {
+			if (node == indirect_to_ptr(root->rnode)) {
+				radix_tree_shrink(root);
+				if (node != indirect_to_ptr(root->rnode))
+					deleted = true;
+			}
+			return deleted;
+		}
 
-	if (slot == NULL)
-		goto out;
+		parent = node->parent;
+		if (parent) {
+			unsigned int offset;
 
-	/*
-	 * Clear all tags associated with the item to be deleted.
-	 * This way of doing it would be inefficient, but seldom is any set.
-	 */
-	for (tag = 0; tag < RADIX_TREE_MAX_TAGS; tag++) {
-		if (tag_get(node, tag, offset))
-			radix_tree_tag_clear(root, index, tag);
-	}
+			/*
+			 * Nodes do not record their offset in the parent,
+			 * but this is not a hot path: just look it up.
+			 */
+			for (offset = 0; offset < RADIX_TREE_MAP_SIZE; offset++)
+				if (parent->slots[offset] ==
+						ptr_to_indirect(node))
+					break;
+			BUG_ON(offset == RADIX_TREE_MAP_SIZE);
+
+			parent->slots[offset] = NULL;
+			parent->count--;
+		} else {
+			root_tag_clear_all(root);
+			root->height = 0;
+			root->rnode = NULL;
+		}
 
-	to_free = NULL;
-	/* Now free the nodes we do not need anymore */
-	while (node) {
-		node->slots[offset] = NULL;
-		node->count--;
 		/*
 		 * Queue the node for deferred freeing after the
 		 * last reference to it disappears (set NULL, above).
 		 */
-		if (to_free)
-			radix_tree_node_free(to_free);
+		radix_tree_node_free(node);
+		deleted = true;
 
-		if (node->count) {
-			if (node == indirect_to_ptr(root->rnode))
-				radix_tree_shrink(root);
-			goto out;
-		}
+		node = parent;
+	} while (node);
 
-		/* Node with zero slots in use so free it */
-		to_free = node;
+	return deleted;
+}
 
-		index >>= RADIX_TREE_MAP_SHIFT;
-		offset = index & RADIX_TREE_MAP_MASK;
-		node = node->parent;
+/**
+ *	radix_tree_clear_tags    -    clear all tags of a slot
+ *	@root:		radix tree root
+ *	@node:		node containing @slot, NULL for the root
+ *	@slot:		slot of the item, from __radix_tree_lookup()
+ *	@index:		index of the item
+ *
+ *	Clear the tags of an item about to be deleted, walking up from its
+ *	node instead of down from the root once per tag.
+ */
+void radix_tree_clear_tags(struct radix_tree_root *root,
+			   struct radix_tree_node *node, void **slot,
+			   unsigned long index)
+{
+	if (node) {
+		unsigned int tag, offset = slot - node->slots;
+
+		for (tag = 0; tag < RADIX_TREE_MAX_TAGS; tag++)
+			node_tag_clear(root, node, index, tag, offset);
+	} else {
+		root_tag_clear_all(root);
 	}
+}
+EXPORT_SYMBOL(radix_tree_clear_tags);
 
-	root_tag_clear_all(root);
-	root->height = 0;
-	root->rnode = NULL;
-	if (to_free)
-		radix_tree_node_free(to_free);
+/**
+ *	radix_tree_delete_item    -    delete an item from a radix tree
+ *	@root:		radix tree root
+ *	@index:		index key
+ *	@item:		expected item
+ *
+ *	Remove @item at @index from the radix tree rooted at @root.  A
+ *	multi-order item can be deleted through any index it covers.
+ *
+ *	Returns the address of the deleted item, or NULL if it was not present
+ *	or the entry at the given @index was not @item.
+ */
+void *radix_tree_delete_item(struct radix_tree_root *root,
+			     unsigned long index, void *item)
+{
+	struct radix_tree_node *node;
+#ifdef CONFIG_RADIX_TREE_MULTIORDER
+	unsigned int offset;
+#endif
+	void **slot;
+	void *entry;
 
-out:
-	return slot;
+	entry = __radix_tree_lookup(root, index, &node, &slot);
+	if (!entry)
+		return NULL;
+
+	if (item && entry != item)
+		return NULL;
+
+	radix_tree_clear_tags(root, node, slot, index);
+
+	if (!node) {
+		root->rnode = NULL;
+		return entry;
+	}
+
+#ifdef CONFIG_RADIX_TREE_MULTIORDER
+	for (offset = slot - node->slots + 1; offset < RADIX_TREE_MAP_SIZE &&
+	     node->slots[offset] == ptr_to_indirect(slot); offset++) {
+		node->slots[offset] = NULL;
+		node->count--;
+	}
+#endif
+	*slot = NULL;
+	node->count--;
+
+	__radix_tree_delete_node(root, node);
+
+	return entry;
+}
+EXPORT_SYMBOL(radix_tree_delete_item);
+
+/**
+ *	radix_tree_delete    -    delete an item from a radix tree
+ *	@root:		radix tree root
+ *	@index:		index key
+ *
+ *	Remove the item at @index from the radix tree rooted at @root.
+ *
+ *	Returns the address of the deleted item, or NULL if it was not present.
+ */
+void *radix_tree_delete(struct radix_tree_root *root, unsigned long index)
+{
+	return radix_tree_delete_item(root, index, NULL);
 }
 EXPORT_SYMBOL(radix_tree_delete);
 
@@ -1383,9 +1637,12 @@ int radix_tree_tagged(struct radix_tree_root *root, unsigned int tag)
 EXPORT_SYMBOL(radix_tree_tagged);
 
 static void
-radix_tree_node_ctor(void *node)
+radix_tree_node_ctor(void *arg)
 {
-	memset(node, 0, sizeof(struct radix_tree_node));
+	struct radix_tree_node *node = arg;
+
+	memset(node, 0, sizeof(*node));
+	INIT_LIST_HEAD(&node->private_list);
 }
 
 static __init unsigned long __maxindex(unsigned int height)
@@ -0,0 +1,246 @@
+/*
+ * Contention benchmark for mutexes, rw_semaphores and spinlocks
+ *
+ * First times lock and unlock pairs on an uncontended lock, then starts
+ * one thread per online cpu, or nr_tasks of them, all taking the same
+ * lock for a short critical section and then doing some work outside of
+ * it, for the given number of seconds, like many tasks working in one
+ * directory contend on its inode mutex.  With lock_type=rwsem, another
+ * nr_readers threads take the lock for reading.
+ *
+ * The threads holding the lock exclusively check that they are alone in
+ * the critical section, the readers that no writer is in it, and the
+ * writers count their acquisitions in a variable protected by the lock
+ * only, which must match the sum of their own counts at the end.  The
+ * cycles per uncontended lock and unlock, the contended throughput and
+ * that of the slowest thread of each kind, which shows whether any of
+ * them was starved, are reported.
+ *
+ * Optimistic spinning of the sleeping locks can be turned off at runtime
+ * with NO_OWNER_SPIN in /sys/kernel/debug/sched_features to compare the
+ * throughput with and without it.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/module.h>
+#include <linux/kthread.h>
+#include <linux/mutex.h>
+#include <linux/rwsem.h>
+#include <linux/spinlock.h>
+#include <linux/sched.h>
+#include <linux/delay.h>
+#include <linux/slab.h>
+#include <linux/err.h>
+#include <linux/timex.h>
+
+static char *lock_type = "mutex";
+module_param(lock_type, charp, 0444);
+MODULE_PARM_DESC(lock_type, "lock to test: mutex, rwsem or spinlock");
+
+static unsigned int nr_tasks;
+module_param(nr_tasks, uint, 0444);
+MODULE_PARM_DESC(nr_tasks, "number of exclusive threads, default one per cpu");
+
+static unsigned int nr_readers;
+module_param(nr_readers, uint, 0444);
+MODULE_PARM_DESC(nr_readers, "number of reader threads (rwsem only)");
+
+static unsigned int duration = 5;
+module_param(duration, uint, 0444);
+MODULE_PARM_DESC(duration, "length of the contended run in seconds");
+
+static unsigned int hold_loops;
+module_param(hold_loops, uint, 0444);
+MODULE_PARM_DESC(hold_loops, "work done with the lock held");
+
+static unsigned int idle_loops;
+module_param(idle_loops, uint, 0444);
+MODULE_PARM_DESC(idle_loops, "work done between two acquisitions");
+
+static DEFINE_MUTEX(test_mutex);
+static DECLARE_RWSEM(test_rwsem);
+static DEFINE_SPINLOCK(test_spinlock);
+
+static void test_mutex_lock(void)	{ mutex_lock(&test_mutex); }
+static void test_mutex_unlock(void)	{ mutex_unlock(&test_mutex); }
+static void test_rwsem_lock(void)	{ down_write(&test_rwsem); }
+static void test_rwsem_unlock(void)	{ up_write(&test_rwsem); }
+static void test_rwsem_read_lock(void)	{ down_read(&test_rwsem); }
+static void test_rwsem_read_unlock(void) { up_read(&test_rwsem); }
+static void test_spin_lock(void)	{ spin_lock(&test_spinlock); }
+static void test_spin_unlock(void)	{ spin_unlock(&test_spinlock); }
+
+struct test_lock_ops {
+	const char *name;
+	void (*lock)(void);
+	void (*unlock)(void);
+	/* NULL for the locks without a shared mode */
+	void (*lock_shared)(void);
+	void (*unlock_shared)(void);
+	/* defaults for the module parameters */
+	unsigned int hold_loops, idle_loops;
+};
+
+static struct test_lock_ops test_lock_ops[] = {
+	{
+		.name		= "mutex",
+		.lock		= test_mutex_lock,
+		.unlock		= test_mutex_unlock,
+		.hold_loops	= 100,
+		.idle_loops	= 200,
+	},
+	{
+		.name		= "rwsem",
+		.lock		= test_rwsem_lock,
+		.unlock		= test_rwsem_unlock,
+		.lock_shared	= test_rwsem_read_lock,
+		.unlock_shared	= test_rwsem_read_unlock,
+		.hold_loops	= 100,
+		.idle_loops	= 500,
+	},
+	{
+		.name		= "spinlock",
+		.lock		= test_spin_lock,
+		.unlock		= test_spin_unlock,
+		.hold_loops	= 20,
+		.idle_loops	= 50,
+	},
+};
+
+static struct test_lock_ops *ops;
+static unsigned long test_count;
+static int test_inside;
+static atomic_t test_errors;
+
+struct test_lock_thread {
+	struct task_struct *task;
+	unsigned long ops;
+	int reader;
+};
+
+static void test_lock_work(unsigned int loops)
+{
+	unsigned int i;
+
+	for (i = 0; i < loops; i++)
+		cpu_relax();
+}
+
+static int test_lock_fn(void *arg)
+{
+	struct test_lock_thread *t = arg;
+
+	while (!kthread_should_stop()) {
+		if (t->reader) {
+			ops->lock_shared();
+			if (ACCESS_ONCE(test_inside))
+				atomic_inc(&test_errors);
+			test_lock_work(hold_loops);
+			ops->unlock_shared();
+		} else {
+			ops->lock();
+			if (ACCESS_ONCE(test_inside)++)
+				atomic_inc(&test_errors);
+			test_count++;
+			test_lock_work(hold_loops);
+			ACCESS_ONCE(test_inside)--;
+			ops->unlock();
+		}
+		t->ops++;
+		test_lock_work(idle_loops);
+		cond_resched();
+	}
+	return 0;
+}
+
+static void test_lock_uncontended(void)
+{
+	unsigned int i, loops = 1000000;
+	cycles_t t;
+
+	t = get_cycles();
+	for (i = 0; i < loops; i++) {
+		ops->lock();
+		ops->unlock();
+	}
+	t = get_cycles() - t;
+
+	pr_info("%s uncontended: %llu cycles per lock and unlock\n",
+		ops->name, (unsigned long long)div64_u64(t, loops));
+}
+
+static int __init test_lock_init(void)
+{
+	struct test_lock_thread *threads;
+	unsigned long nr_ops[2] = { 0, 0 }, min[2] = { ULONG_MAX, ULONG_MAX };
+	unsigned int i, nr, nr_writers;
+	int ret = 0;
+
+	for (i = 0; i < ARRAY_SIZE(test_lock_ops); i++)
+		if (!strcmp(lock_type, test_lock_ops[i].name))
+			ops = &test_lock_ops[i];
+	if (!ops || !duration || (nr_readers && !ops->lock_shared))
+		return -EINVAL;
+	if (!hold_loops)
+		hold_loops = ops->hold_loops;
+	if (!idle_loops)
+		idle_loops = ops->idle_loops;
+
+	test_lock_uncontended();
+
+	nr_writers = nr_tasks ? nr_tasks : num_online_cpus();
+	nr = nr_writers + nr_readers;
+	threads = kcalloc(nr, sizeof(*threads), GFP_KERNEL);
+	if (!threads)
+		return -ENOMEM;
+
+	for (i = 0; i < nr; i++) {
+		struct task_struct *task;
+
+		threads[i].reader = i >= nr_writers;
+		task = kthread_create(test_lock_fn, &threads[i],
+				      "test-lock/%u", i);
+		if (IS_ERR(task)) {
+			ret = PTR_ERR(task);
+			break;
+		}
+		threads[i].task = task;
+	}
+	nr = i;
+
+	if (!ret) {
+		for (i = 0; i < nr; i++)
+			wake_up_process(threads[i].task);
+		msleep(duration * 1000);
+	}
+
+	for (i = 0; i < nr; i++) {
+		struct test_lock_thread *t = &threads[i];
+
+		/* never woken up if the creation of another one failed */
+		kthread_stop(t->task);
+		nr_ops[t->reader] += t->ops;
+		min[t->reader] = min(min[t->reader], t->ops);
+	}
+	kfree(threads);
+
+	if (ret)
+		return ret;
+
+	pr_info("%s: %u threads: %lu ops/s, slowest %lu ops/s\n", ops->name,
+		nr_writers, nr_ops[0] / duration, min[0] / duration);
+	if (nr_readers)
+		pr_info("%s: %u readers: %lu ops/s, slowest %lu ops/s\n",
+			ops->name, nr_readers, nr_ops[1] / duration,
+			min[1] / duration);
+	if (nr_ops[0] != test_count || atomic_read(&test_errors))
+		pr_err("%s: %lu ops but %lu counted, %d overlaps\n", ops->name,
+		       nr_ops[0], test_count, atomic_read(&test_errors));
+
+	return -EINVAL;
+}
+module_init(test_lock_init);
+
+MODULE_LICENSE("GPL");
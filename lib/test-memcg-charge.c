@@ -0,0 +1,314 @@
+/*
+ * Test module for the lockless page counters and memcg page cache charging
+ *
+ * The page counters that replaced the res_counter on the memcg charge
+ * path charge speculatively and back out, without any lock.  A private
+ * hierarchy of one unlimited root, one limited parent and one child per
+ * cpu is charged and uncharged by threads bound to every online cpu (or
+ * the first nr_cpus of them), all at the same time.  Each thread keeps
+ * charging its child until it holds more pages than the parent allows
+ * on its own, then drops everything, and checks that:
+ *  - the count of its child is exactly what it holds;
+ *  - a failing charge always names the parent as the counter at its
+ *    limit, and leaves the count of the child untouched.
+ * Once all threads are done, every count must be back to zero, the
+ * watermark of the parent must not be above its limit and its failcnt
+ * must have moved.  page_counter_limit() must then refuse a limit below
+ * the current count and accept one at it, after which the next charge
+ * has to fail.
+ *
+ * A tmpfs file is also filled and truncated from the context of the
+ * task loading the module, so that its pages are charged to and
+ * uncharged from that task's memory cgroup, and the cycles per page of
+ * both are reported.  Loading the module from the root cgroup and from
+ * a group nested a few levels deep compares charging with and without
+ * memcg; booting with cgroup_disable=memory gives the baseline without
+ * any memcg hooks.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/mm.h>
+#include <linux/err.h>
+#include <linux/slab.h>
+#include <linux/kthread.h>
+#include <linux/cpu.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/pagemap.h>
+#include <linux/page_counter.h>
+#include <linux/shmem_fs.h>
+#include <linux/timex.h>
+
+static unsigned int nr_pages = 4096;
+module_param(nr_pages, uint, 0444);
+MODULE_PARM_DESC(nr_pages, "size of the file in pages");
+
+static unsigned int loops = 16;
+module_param(loops, uint, 0444);
+MODULE_PARM_DESC(loops, "number of fill and truncate rounds");
+
+static unsigned int rounds = 10000;
+module_param(rounds, uint, 0444);
+MODULE_PARM_DESC(rounds, "page counter charge and drop rounds per cpu");
+
+static unsigned int nr_cpus;
+module_param(nr_cpus, uint, 0444);
+MODULE_PARM_DESC(nr_cpus, "number of cpus to charge from, 0 for all online cpus");
+
+/* pages a thread holds before it drops them: twice the parent's limit */
+#define HOLD_PAGES	512
+#define PARENT_LIMIT	(HOLD_PAGES / 2)
+
+static struct page_counter test_root, test_parent;
+
+struct test_thread {
+	struct task_struct *tsk;
+	unsigned int cpu;
+	struct page_counter counter;
+	unsigned long failed;
+	unsigned int errors;
+};
+
+static DECLARE_COMPLETION(test_start);
+static DECLARE_COMPLETION(test_done);
+static atomic_t test_running;
+
+static void charge_round(struct test_thread *t, unsigned int round)
+{
+	struct page_counter *fail;
+	unsigned long held = 0;
+	/* 1 to 32 pages, so that small and large charges race */
+	unsigned long nr = round % 32 + 1;
+
+	while (held < HOLD_PAGES) {
+		if (page_counter_try_charge(&t->counter, nr, &fail)) {
+			t->failed++;
+			if (fail != &test_parent) {
+				pr_err("cpu %u: charge failed at the wrong counter\n",
+				       t->cpu);
+				t->errors++;
+			}
+			break;
+		}
+		held += nr;
+	}
+	if (page_counter_read(&t->counter) != held) {
+		pr_err("cpu %u: holds %lu pages, counter says %lu\n", t->cpu,
+		       held, page_counter_read(&t->counter));
+		t->errors++;
+	}
+	if (held)
+		page_counter_uncharge(&t->counter, held);
+}
+
+static int test_thread_fn(void *data)
+{
+	struct test_thread *t = data;
+	unsigned int i;
+
+	/* start all cpus together so that they contend for real */
+	wait_for_completion(&test_start);
+	for (i = 0; i < rounds; i++) {
+		charge_round(t, i);
+		cond_resched();
+	}
+	if (atomic_dec_and_test(&test_running))
+		complete(&test_done);
+
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+static unsigned int check_limit(struct page_counter *counter)
+{
+	struct page_counter *fail;
+	unsigned long failcnt;
+	unsigned int errors = 0;
+
+	if (page_counter_try_charge(counter, PARENT_LIMIT / 2, &fail))
+		return 1;
+	if (page_counter_limit(&test_parent, PARENT_LIMIT / 2 - 1) != -EBUSY) {
+		pr_err("limit below the count accepted\n");
+		errors++;
+	}
+	if (page_counter_limit(&test_parent, PARENT_LIMIT / 2)) {
+		pr_err("limit at the count refused\n");
+		errors++;
+	}
+	failcnt = test_parent.failcnt;
+	if (!page_counter_try_charge(counter, 1, &fail)) {
+		pr_err("charge above the new limit succeeded\n");
+		page_counter_uncharge(counter, 1);
+		errors++;
+	} else if (test_parent.failcnt != failcnt + 1) {
+		pr_err("failed charge not counted\n");
+		errors++;
+	}
+	page_counter_uncharge(counter, PARENT_LIMIT / 2);
+	return errors;
+}
+
+static unsigned int test_counters(void)
+{
+	struct test_thread *threads;
+	unsigned int i, cpu, nr = 0, errors = 0;
+	unsigned long failed = 0;
+
+	get_online_cpus();
+	if (!nr_cpus || nr_cpus > num_online_cpus())
+		nr_cpus = num_online_cpus();
+
+	threads = kcalloc(nr_cpus, sizeof(*threads), GFP_KERNEL);
+	if (!threads) {
+		put_online_cpus();
+		return 1;
+	}
+
+	page_counter_init(&test_root, NULL);
+	page_counter_init(&test_parent, &test_root);
+	page_counter_limit(&test_parent, PARENT_LIMIT);
+
+	INIT_COMPLETION(test_start);
+	INIT_COMPLETION(test_done);
+	atomic_set(&test_running, 1);
+
+	for_each_online_cpu(cpu) {
+		struct test_thread *t = &threads[nr];
+
+		if (nr == nr_cpus)
+			break;
+		t->cpu = cpu;
+		page_counter_init(&t->counter, &test_parent);
+		t->tsk = kthread_create(test_thread_fn, t, "test-memcg/%u", cpu);
+		if (IS_ERR(t->tsk)) {
+			t->tsk = NULL;
+			errors++;
+			continue;
+		}
+		kthread_bind(t->tsk, cpu);
+		atomic_inc(&test_running);
+		wake_up_process(t->tsk);
+		nr++;
+	}
+
+	complete_all(&test_start);
+	if (!atomic_dec_and_test(&test_running))
+		wait_for_completion(&test_done);
+
+	for (i = 0; i < nr; i++) {
+		struct test_thread *t = &threads[i];
+
+		kthread_stop(t->tsk);
+		failed += t->failed;
+		errors += t->errors;
+		if (page_counter_read(&t->counter)) {
+			pr_err("cpu %u: %lu pages left charged\n", t->cpu,
+			       page_counter_read(&t->counter));
+			errors++;
+		}
+	}
+	put_online_cpus();
+
+	if (page_counter_read(&test_parent) || page_counter_read(&test_root)) {
+		pr_err("pages left charged: parent %lu root %lu\n",
+		       page_counter_read(&test_parent),
+		       page_counter_read(&test_root));
+		errors++;
+	}
+	if (test_parent.watermark > test_parent.limit) {
+		pr_err("watermark %lu above the limit %lu\n",
+		       test_parent.watermark, test_parent.limit);
+		errors++;
+	}
+	if (nr && (!failed || !test_parent.failcnt)) {
+		pr_err("no charge failed above the limit\n");
+		errors++;
+	}
+	pr_info("page counters on %u cpus: %lu charges failed\n", nr, failed);
+
+	if (nr)
+		errors += check_limit(&threads[0].counter);
+	kfree(threads);
+	return errors;
+}
+
+static int test_fill(void)
+{
+	struct file *file;
+	struct inode *inode;
+	u64 fill = 0, truncate = 0, pages = 0;
+	unsigned int i, n;
+	cycles_t t;
+	int ret = 0;
+
+	file = shmem_file_setup("test-memcg-charge",
+				(loff_t)nr_pages << PAGE_SHIFT, VM_NORESERVE);
+	if (IS_ERR(file))
+		return PTR_ERR(file);
+	inode = file->f_path.dentry->d_inode;
+
+	for (i = 0; i < loops && !ret; i++) {
+		t = get_cycles();
+		for (n = 0; n < nr_pages; n++) {
+			struct page *page;
+
+			page = shmem_read_mapping_page(file->f_mapping, n);
+			if (IS_ERR(page)) {
+				ret = PTR_ERR(page);
+				break;
+			}
+			page_cache_release(page);
+		}
+		fill += get_cycles() - t;
+		pages += n;
+
+		t = get_cycles();
+		shmem_truncate_range(inode, 0, (loff_t)-1);
+		truncate += get_cycles() - t;
+		cond_resched();
+	}
+	fput(file);
+
+	if (pages)
+		pr_info("%llu pages: fill %llu truncate %llu cycles/page\n",
+			(unsigned long long)pages,
+			(unsigned long long)div64_u64(fill, pages),
+			(unsigned long long)div64_u64(truncate, pages));
+	return ret;
+}
+
+static int __init test_memcg_charge_init(void)
+{
+	unsigned int errors;
+	int ret;
+
+	if (!nr_pages || !loops)
+		return -EINVAL;
+
+	errors = test_counters();
+	ret = test_fill();
+	if (ret) {
+		pr_err("fill: %d\n", ret);
+		errors++;
+	}
+
+	if (errors)
+		pr_err("%u errors\n", errors);
+	else
+		pr_info("all tests passed\n");
+
+	return -EINVAL;
+}
+module_init(test_memcg_charge_init);
+
+MODULE_LICENSE("GPL");
@@ -0,0 +1,358 @@
+/*
+ * Test module for the per-cpu page lists and the sharded zone free lists
+ *
+ * One thread bound to each online cpu (or the first nr_cpus of them)
+ * allocates and frees batches of pages, all at the same time, for every
+ * order up to one above PAGE_ALLOC_COSTLY_ORDER.  Each thread checks that:
+ *  - every block is aligned to its order, and is a compound page exactly
+ *    when __GFP_COMP was asked for: compound pages are broken up before
+ *    they are put on the pcp lists, and must be rebuilt on the way out;
+ *  - no block is handed to two threads at once: the first word of each
+ *    base page is stamped by its holder and checked before it is freed;
+ *  - the pcp lists of its cpu only hold aligned blocks of the order of
+ *    their list, adding up to pcp->count, and that pcp->high stays
+ *    between its adaptive bounds.
+ * Once all orders are done, the free lists of every shard of every zone
+ * are checked to only hold buddy pages of their order that belong to
+ * that shard, as many as nr_free says.  This walks the free lists with
+ * the zone locked, so it is meant for test machines.
+ *
+ * The cycles per page of the contended allocations and frees are
+ * reported for every order, to compare runs on one and on many cpus.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/module.h>
+#include <linux/gfp.h>
+#include <linux/mm.h>
+#include <linux/mmzone.h>
+#include <linux/slab.h>
+#include <linux/kthread.h>
+#include <linux/cpu.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/timex.h>
+
+#define MAX_BATCH	256
+
+static unsigned int batch = 64;
+module_param(batch, uint, 0444);
+MODULE_PARM_DESC(batch, "blocks allocated before they are freed again");
+
+static unsigned int loops = 1000;
+module_param(loops, uint, 0444);
+MODULE_PARM_DESC(loops, "number of rounds per order");
+
+static unsigned int nr_cpus;
+module_param(nr_cpus, uint, 0444);
+MODULE_PARM_DESC(nr_cpus, "number of cpus to run on, 0 for all online cpus");
+
+struct test_thread {
+	struct task_struct *tsk;
+	unsigned int cpu;
+	unsigned int order;
+	unsigned long nr_allocs;
+	cycles_t alloc, free;
+	unsigned int errors;
+	struct page *pages[MAX_BATCH];
+};
+
+static DECLARE_COMPLETION(test_start);
+static DECLARE_COMPLETION(test_done);
+static atomic_t test_running;
+
+static bool check_block(struct test_thread *t, struct page *page, gfp_t gfp)
+{
+	unsigned int order = t->order;
+	bool comp = order && (gfp & __GFP_COMP);
+
+	if (page_to_pfn(page) & ((1UL << order) - 1)) {
+		pr_err("cpu %u: order %u block at pfn %lx not aligned\n",
+		       t->cpu, order, page_to_pfn(page));
+		return false;
+	}
+	if (comp ? !PageHead(page) || compound_order(page) != order :
+		   PageCompound(page) || PageCompound(page + (1 << order) - 1)) {
+		pr_err("cpu %u: order %u block at pfn %lx %s compound\n",
+		       t->cpu, order, page_to_pfn(page),
+		       comp ? "not" : "unexpectedly");
+		return false;
+	}
+	return true;
+}
+
+static void stamp_block(struct test_thread *t, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < 1U << t->order; i++)
+		*(unsigned long *)page_address(t->pages[n] + i) =
+			(unsigned long)&t->pages[n];
+}
+
+static bool check_stamp(struct test_thread *t, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < 1U << t->order; i++) {
+		if (*(unsigned long *)page_address(t->pages[n] + i) !=
+		    (unsigned long)&t->pages[n]) {
+			pr_err("cpu %u: pfn %lx handed out twice\n", t->cpu,
+			       page_to_pfn(t->pages[n] + i));
+			return false;
+		}
+	}
+	return true;
+}
+
+static void test_round(struct test_thread *t, gfp_t gfp)
+{
+	unsigned int j, n;
+	cycles_t c;
+
+	c = get_cycles();
+	for (n = 0; n < batch; n++) {
+		t->pages[n] = alloc_pages(gfp, t->order);
+		if (!t->pages[n])
+			break;
+	}
+	t->alloc += get_cycles() - c;
+	t->nr_allocs += n;
+
+	for (j = 0; j < n; j++) {
+		if (!check_block(t, t->pages[j], gfp))
+			t->errors++;
+		stamp_block(t, j);
+	}
+	for (j = 0; j < n; j++)
+		if (!check_stamp(t, j))
+			t->errors++;
+
+	c = get_cycles();
+	for (j = 0; j < n; j++)
+		__free_pages(t->pages[j], t->order);
+	t->free += get_cycles() - c;
+}
+
+/*
+ * Check the pcp lists of the current cpu in every populated zone.
+ * Called from the thread bound to that cpu.
+ */
+static void check_pcp_lists(struct test_thread *t)
+{
+	int nid;
+
+	for_each_online_node(nid) {
+		struct zone *zone = NODE_DATA(nid)->node_zones;
+
+		for (; zone < NODE_DATA(nid)->node_zones + MAX_NR_ZONES;
+		     zone++) {
+			struct per_cpu_pages *pcp;
+			unsigned long flags, bad = 0;
+			int pindex, count = 0, pcp_count, high;
+			bool high_ok;
+
+			if (!populated_zone(zone))
+				continue;
+
+			local_irq_save(flags);
+			pcp = &this_cpu_ptr(zone->pageset)->pcp;
+			for (pindex = 0; pindex < NR_PCP_LISTS; pindex++) {
+				unsigned int order = pindex / MIGRATE_PCPTYPES;
+				struct page *page;
+
+				list_for_each_entry(page, &pcp->lists[pindex],
+						    lru) {
+					if (page->index != order ||
+					    page_zone(page) != zone ||
+					    page_to_pfn(page) &
+					    ((1UL << order) - 1))
+						bad++;
+					count += 1 << order;
+				}
+			}
+			pcp_count = pcp->count;
+			high = pcp->high;
+			high_ok = high >= pcp->high_min && high <= pcp->high_max;
+			local_irq_restore(flags);
+
+			if (bad || count != pcp_count || !high_ok) {
+				pr_err("cpu %u: %s pcp: %lu bad blocks, %d pages but count %d, high %d\n",
+				       t->cpu, zone->name, bad, count,
+				       pcp_count, high);
+				t->errors++;
+			}
+		}
+	}
+}
+
+static int test_thread_fn(void *data)
+{
+	struct test_thread *t = data;
+	unsigned int i;
+
+	/* start all cpus together so that they contend for real */
+	wait_for_completion(&test_start);
+	for (i = 0; i < loops; i++) {
+		test_round(t, i & 1 ? GFP_KERNEL | __GFP_COMP : GFP_KERNEL);
+		cond_resched();
+	}
+	check_pcp_lists(t);
+	if (atomic_dec_and_test(&test_running))
+		complete(&test_done);
+
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+static unsigned int test_order(struct test_thread *threads, unsigned int nr,
+			       unsigned int order)
+{
+	u64 alloc = 0, free = 0, allocs = 0;
+	unsigned int i, started = 0, errors = 0;
+
+	INIT_COMPLETION(test_start);
+	INIT_COMPLETION(test_done);
+	atomic_set(&test_running, 1);
+
+	for (i = 0; i < nr; i++) {
+		struct test_thread *t = &threads[i];
+
+		t->order = order;
+		t->nr_allocs = 0;
+		t->alloc = t->free = 0;
+		t->errors = 0;
+		t->tsk = kthread_create(test_thread_fn, t, "test-page/%u",
+					t->cpu);
+		if (IS_ERR(t->tsk)) {
+			t->tsk = NULL;
+			errors++;
+			continue;
+		}
+		kthread_bind(t->tsk, t->cpu);
+		atomic_inc(&test_running);
+		wake_up_process(t->tsk);
+		started++;
+	}
+
+	complete_all(&test_start);
+	if (!atomic_dec_and_test(&test_running))
+		wait_for_completion(&test_done);
+
+	for (i = 0; i < nr; i++) {
+		struct test_thread *t = &threads[i];
+
+		if (!t->tsk)
+			continue;
+		kthread_stop(t->tsk);
+		alloc += t->alloc;
+		free += t->free;
+		allocs += t->nr_allocs;
+		errors += t->errors;
+	}
+
+	if (allocs)
+		pr_info("order %u on %u cpus: alloc %llu free %llu cycles/block\n",
+			order, started,
+			(unsigned long long)div64_u64(alloc, allocs),
+			(unsigned long long)div64_u64(free, allocs));
+	return errors;
+}
+
+static unsigned int check_zone_shards(struct zone *zone)
+{
+	struct zone_shard *shard;
+	unsigned long flags, bad = 0, miscounted = 0;
+	unsigned int order;
+	int t;
+
+	zone_lock_shards_irqsave(zone, flags);
+	for_each_zone_shard(shard, zone) {
+		for (order = 0; order < MAX_ORDER; order++) {
+			struct free_area *area = &shard->free_area[order];
+			unsigned long nr = 0;
+
+			for (t = 0; t < MIGRATE_TYPES; t++) {
+				struct page *page;
+
+				list_for_each_entry(page, &area->free_list[t],
+						    lru) {
+					unsigned long pfn = page_to_pfn(page);
+
+					if (!PageBuddy(page) ||
+					    page_private(page) != order ||
+					    zone_pfn_shard(zone, pfn) != shard ||
+					    pfn & ((1UL << order) - 1))
+						bad++;
+					nr++;
+				}
+			}
+			if (nr != area->nr_free)
+				miscounted++;
+		}
+	}
+	zone_unlock_shards_irqrestore(zone, flags);
+
+	if (bad || miscounted) {
+		pr_err("%s: %lu bad free blocks, %lu free lists miscounted\n",
+		       zone->name, bad, miscounted);
+		return 1;
+	}
+	return 0;
+}
+
+static int __init test_page_alloc_init(void)
+{
+	struct test_thread *threads;
+	unsigned int order, cpu, nr = 0, errors = 0;
+	int nid;
+
+	if (!batch || batch > MAX_BATCH)
+		return -EINVAL;
+
+	get_online_cpus();
+	if (!nr_cpus || nr_cpus > num_online_cpus())
+		nr_cpus = num_online_cpus();
+
+	threads = kcalloc(nr_cpus, sizeof(*threads), GFP_KERNEL);
+	if (!threads) {
+		put_online_cpus();
+		return -ENOMEM;
+	}
+
+	for_each_online_cpu(cpu) {
+		if (nr == nr_cpus)
+			break;
+		threads[nr++].cpu = cpu;
+	}
+
+	for (order = 0; order <= PAGE_ALLOC_COSTLY_ORDER + 1; order++)
+		errors += test_order(threads, nr, order);
+	put_online_cpus();
+	kfree(threads);
+
+	for_each_online_node(nid) {
+		struct zone *zone = NODE_DATA(nid)->node_zones;
+
+		for (; zone < NODE_DATA(nid)->node_zones + MAX_NR_ZONES; zone++)
+			if (populated_zone(zone))
+				errors += check_zone_shards(zone);
+	}
+
+	if (errors)
+		pr_err("%u errors\n", errors);
+	else
+		pr_info("all tests passed\n");
+
+	return -EINVAL;
+}
+module_init(test_page_alloc_init);
+
+MODULE_LICENSE("GPL");
@@ -0,0 +1,331 @@
+/*
+ * Test module for the radix tree page cache paths and multi-order items
+ *
+ * A private tree is filled with nr items, stride indices apart, and then
+ * checked against what was inserted:
+ *  - lookups of the items and of the indices between them;
+ *  - radix_tree_range_tag_if_tagged(), which copies the tags of a leaf a
+ *    word at a time, driven the way tag_pages_for_writeback() does it,
+ *    against the tags it was asked to copy;
+ *  - contiguous iteration, which must stop at the first hole rather than
+ *    carry on in the next chunk;
+ *  - deletion, which must leave no tag behind, and an empty tree.
+ * With CONFIG_RADIX_TREE_MULTIORDER the tree is then filled with items
+ * covering 1 << order indices each, both below and above the size of a
+ * leaf, and every index they cover must find them, take a tag, be
+ * refused to another insertion and delete them.
+ *
+ * The cycles per item of the tag copy and of the gang lookups are
+ * reported for the order-0 tree.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/module.h>
+#include <linux/radix-tree.h>
+#include <linux/sched.h>
+#include <linux/timex.h>
+
+#define GANG_SIZE	16
+/* indices swept by the lookups, whatever the stride */
+#define MAX_SWEEP	(1UL << 20)
+
+static unsigned int nr = 1 << 16;
+module_param(nr, uint, 0444);
+MODULE_PARM_DESC(nr, "number of items in the tree");
+
+static unsigned int stride = 1;
+module_param(stride, uint, 0444);
+MODULE_PARM_DESC(stride, "distance between the indices of two items");
+
+static unsigned int order = 9;
+module_param(order, uint, 0444);
+MODULE_PARM_DESC(order, "order of the larger multi-order items");
+
+static RADIX_TREE(test_tree, GFP_KERNEL);
+static unsigned int test_errors;
+
+/* Items are never dereferenced: any aligned non-NULL value will do */
+#define TEST_ITEM(index)	((void *)(((index) + 1) << 2))
+#define ITEM_INDEX(item)	(((unsigned long)(item) >> 2) - 1)
+
+#define test_fail(fmt, ...)						\
+do {									\
+	pr_err(fmt "\n", ##__VA_ARGS__);				\
+	test_errors++;							\
+} while (0)
+
+/* the items of tag 0: every third one */
+static bool item_tagged(unsigned long i)
+{
+	return i % 3 == 0;
+}
+
+static unsigned long fill(unsigned long step, unsigned int ord)
+{
+	unsigned long i;
+	int err;
+
+	for (i = 0; i < nr; i++) {
+		err = __radix_tree_insert(&test_tree, i * step, ord,
+					  TEST_ITEM(i * step));
+		if (err) {
+			test_fail("insert at %lu: %d", i * step, err);
+			break;
+		}
+	}
+	return i;
+}
+
+static void check_lookups(unsigned long n)
+{
+	unsigned long index, end = min(n * stride, MAX_SWEEP);
+	void *item;
+
+	rcu_read_lock();
+	for (index = 0; index < end; index++) {
+		item = radix_tree_lookup(&test_tree, index);
+		if (item != (index % stride ? NULL : TEST_ITEM(index))) {
+			test_fail("lookup at %lu found %p", index, item);
+			break;
+		}
+	}
+	rcu_read_unlock();
+}
+
+static void check_tags(unsigned long n)
+{
+	unsigned long i, first = 0, tagged = 0, expected = 0, found = 0;
+	void *items[GANG_SIZE];
+	unsigned int got;
+	cycles_t t;
+
+	for (i = 0; i < n; i++) {
+		if (item_tagged(i)) {
+			radix_tree_tag_set(&test_tree, i * stride, 0);
+			expected++;
+		}
+	}
+
+	/* the way tag_pages_for_writeback() does it */
+	t = get_cycles();
+	for (;;) {
+		unsigned long count;
+
+		count = radix_tree_range_tag_if_tagged(&test_tree, &first,
+					ULONG_MAX, 4096, 0, 1);
+		tagged += count;
+		if (count < 4096 || !first)
+			break;
+		cond_resched();
+	}
+	t = get_cycles() - t;
+	pr_info("range tag: %llu cycles/item\n",
+		(unsigned long long)div64_u64(t, tagged ? : 1));
+	if (tagged != expected)
+		test_fail("range tag: %lu items tagged of %lu", tagged,
+			  expected);
+
+	for (i = 0; i < n; i++) {
+		if (radix_tree_tag_get(&test_tree, i * stride, 1) !=
+		    item_tagged(i)) {
+			test_fail("range tag: wrong tag at %lu", i * stride);
+			break;
+		}
+	}
+
+	t = get_cycles();
+	rcu_read_lock();
+	for (i = 0;; i = ITEM_INDEX(items[got - 1]) + 1) {
+		got = radix_tree_gang_lookup_tag(&test_tree, items, i,
+						 GANG_SIZE, 1);
+		if (!got)
+			break;
+		found += got;
+	}
+	rcu_read_unlock();
+	t = get_cycles() - t;
+	pr_info("gang lookup tag: %llu cycles/item\n",
+		(unsigned long long)div64_u64(t, found ? : 1));
+	if (found != expected)
+		test_fail("gang lookup tag: found %lu of %lu", found, expected);
+}
+
+static void check_gang_lookup(unsigned long n)
+{
+	unsigned long i, found = 0;
+	void *items[GANG_SIZE];
+	unsigned int got, j;
+	cycles_t t;
+
+	t = get_cycles();
+	rcu_read_lock();
+	for (i = 0;; i = ITEM_INDEX(items[got - 1]) + 1) {
+		got = radix_tree_gang_lookup(&test_tree, items, i, GANG_SIZE);
+		if (!got)
+			break;
+		for (j = 0; j < got; j++)
+			if (items[j] != TEST_ITEM((found + j) * stride))
+				break;
+		found += j;
+		if (j < got)
+			break;
+	}
+	rcu_read_unlock();
+	t = get_cycles() - t;
+	pr_info("gang lookup: %llu cycles/item\n",
+		(unsigned long long)div64_u64(t, found ? : 1));
+	if (found != n)
+		test_fail("gang lookup: found %lu of %lu in order", found, n);
+}
+
+/* A contiguous walk from 0 must stop right before the hole at @hole */
+static void check_contig(unsigned long hole)
+{
+	struct radix_tree_iter iter;
+	unsigned long i, last = ULONG_MAX;
+	void **slot;
+
+	for (i = 0; i <= hole + RADIX_TREE_MAP_SIZE; i++)
+		if (i != hole && radix_tree_insert(&test_tree, i, TEST_ITEM(i)))
+			test_fail("contig: insert at %lu failed", i);
+
+	rcu_read_lock();
+	radix_tree_for_each_contig(slot, &test_tree, &iter, 0)
+		last = iter.index;
+	rcu_read_unlock();
+	if (last != hole - 1)
+		test_fail("contig: hole at %lu, walk stopped after %lu", hole,
+			  last);
+
+	for (i = 0; i <= hole + RADIX_TREE_MAP_SIZE; i++)
+		radix_tree_delete(&test_tree, i);
+}
+
+static void empty_tree(unsigned long n, unsigned long step)
+{
+	unsigned long i;
+
+	for (i = 0; i < n; i++) {
+		if (radix_tree_delete(&test_tree, i * step) !=
+		    TEST_ITEM(i * step)) {
+			test_fail("delete at %lu failed", i * step);
+			break;
+		}
+	}
+	if (radix_tree_tagged(&test_tree, 0) ||
+	    radix_tree_tagged(&test_tree, 1))
+		test_fail("tags left after deleting all items");
+	if (test_tree.rnode)
+		test_fail("tree not empty after deleting all items");
+}
+
+#ifdef CONFIG_RADIX_TREE_MULTIORDER
+/*
+ * Items of order @ord, with a hole of the same size after each of them.
+ * Every index an item covers must behave as the item's own index.
+ */
+static void check_multiorder(unsigned int ord)
+{
+	unsigned long size = 1UL << ord, step = 2 * size;
+	unsigned long i, n, index, found = 0;
+	void *items[GANG_SIZE];
+	unsigned int got;
+
+	n = fill(step, ord);
+
+	for (i = 0; i < min(n, 64UL); i++) {
+		unsigned long base = i * step;
+
+		for (index = base; index < base + step; index++) {
+			void *item = radix_tree_lookup(&test_tree, index);
+
+			if (item != (index < base + size ?
+				     TEST_ITEM(base) : NULL)) {
+				test_fail("order %u: lookup at %lu found %p",
+					  ord, index, item);
+				goto out;
+			}
+		}
+		if (radix_tree_insert(&test_tree, base + size - 1,
+				      TEST_ITEM(base + size - 1)) != -EEXIST)
+			test_fail("order %u: insert inside the item at %lu",
+				  ord, base);
+		if (radix_tree_next_hole(&test_tree, base, step) !=
+		    base + size)
+			test_fail("order %u: no hole after the item at %lu",
+				  ord, base);
+
+		/* tag through the last index, find through the first */
+		radix_tree_tag_set(&test_tree, base + size - 1, 0);
+		if (!radix_tree_tag_get(&test_tree, base, 0))
+			test_fail("order %u: tag of the item at %lu not set",
+				  ord, base);
+	}
+
+	/* each item once, tagged or not */
+	for (index = 0;; index = ITEM_INDEX(items[got - 1]) + size) {
+		got = radix_tree_gang_lookup(&test_tree, items, index,
+					     GANG_SIZE);
+		if (!got)
+			break;
+		found += got;
+	}
+	if (found != n)
+		test_fail("order %u: gang lookup found %lu of %lu", ord,
+			  found, n);
+	got = radix_tree_gang_lookup_tag(&test_tree, items, 0, GANG_SIZE, 0);
+	if (got != min(n, (unsigned long)GANG_SIZE))
+		test_fail("order %u: tagged gang lookup found %u", ord, got);
+
+out:
+	/* delete through the last index of each item */
+	for (i = 0; i < n; i++) {
+		index = i * step + size - 1;
+		if (radix_tree_delete(&test_tree, index) != TEST_ITEM(i * step))
+			test_fail("order %u: delete at %lu failed", ord, index);
+		if (radix_tree_lookup(&test_tree, i * step))
+			test_fail("order %u: item at %lu left after delete",
+				  ord, i * step);
+	}
+	if (radix_tree_tagged(&test_tree, 0))
+		test_fail("order %u: tags left after deleting all items", ord);
+	if (test_tree.rnode)
+		test_fail("order %u: tree not empty after deleting all items",
+			  ord);
+}
+#endif
+
+static int __init test_radix_tree_init(void)
+{
+	unsigned long n;
+
+	if (!nr || !stride || order >= BITS_PER_LONG - 1 ||
+	    (unsigned long)nr << (order + 1) >> (order + 1) != nr)
+		return -EINVAL;
+
+	n = fill(stride, 0);
+	check_lookups(n);
+	check_gang_lookup(n);
+	check_tags(n);
+	empty_tree(n, stride);
+
+	check_contig(RADIX_TREE_MAP_SIZE / 2);
+	check_contig(RADIX_TREE_MAP_SIZE);
+
+#ifdef CONFIG_RADIX_TREE_MULTIORDER
+	check_multiorder(2);
+	check_multiorder(order);
+#endif
+
+	if (test_errors)
+		pr_err("%u errors\n", test_errors);
+	else
+		pr_info("all tests passed\n");
+
+	return -EINVAL;
+}
+module_init(test_radix_tree_init);
+
+MODULE_LICENSE("GPL");
@@ -0,0 +1,265 @@
+/*
+ * Test module for slab bulk operations and batched cross-cpu frees
+ *
+ * Every object a round gets from the allocator is stamped with a value
+ * unique to the round and its slot, and all stamps are checked before the
+ * round frees anything: an object handed out twice, by a bulk allocation
+ * or after a flush of remotely freed objects chained up the wrong way,
+ * shows up as a stamp overwritten by the other owner.  The rounds cover:
+ *  - kmem_cache_alloc_bulk(), which must return all objects or none, and
+ *    must zero them for __GFP_ZERO even when they were just used;
+ *  - kmem_cache_free_bulk() of objects from many slabs in mixed order;
+ *  - objects allocated on one cpu and freed one by one on another, which
+ *    SLUB batches per cpu.  With CONFIG_SLUB_STATS each of these frees
+ *    must have gone through the batch.
+ * A lost object is reported by kmem_cache_destroy() at the end.  The
+ * cycles per object of the bulk and remote frees are printed as well.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/timex.h>
+
+#define NR_OBJS		256
+/* coprime with NR_OBJS, to free neighbours from different slabs */
+#define MIX_STEP	7
+
+static unsigned int obj_size = 256;
+module_param(obj_size, uint, 0444);
+MODULE_PARM_DESC(obj_size, "size of the objects allocated");
+
+static unsigned int rounds = 1000;
+module_param(rounds, uint, 0444);
+MODULE_PARM_DESC(rounds, "number of rounds of each test");
+
+static struct kmem_cache *test_cache;
+static void *objs[NR_OBJS];
+static void *mixed[NR_OBJS];
+static unsigned long test_seq;
+static unsigned int test_errors;
+
+static void stamp_objs(unsigned int nr)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr; i++)
+		*(unsigned long *)objs[i] = test_seq + i;
+}
+
+static bool check_objs(const char *test, unsigned int nr)
+{
+	unsigned int i;
+	bool ok = true;
+
+	for (i = 0; i < nr; i++) {
+		if (*(unsigned long *)objs[i] != test_seq + i) {
+			pr_err("%s: object %p handed out twice\n", test,
+			       objs[i]);
+			ok = false;
+			break;
+		}
+	}
+	test_seq += nr;
+	if (!ok)
+		test_errors++;
+	return ok;
+}
+
+static bool test_alloc_bulk(unsigned int nr, gfp_t gfp)
+{
+	unsigned int i;
+
+	if (kmem_cache_alloc_bulk(test_cache, gfp, nr, objs) != nr) {
+		pr_err("alloc_bulk: %u objects failed\n", nr);
+		test_errors++;
+		return false;
+	}
+	if (gfp & __GFP_ZERO) {
+		for (i = 0; i < nr; i++) {
+			if (memchr_inv(objs[i], 0, obj_size)) {
+				pr_err("alloc_bulk: object %p not zeroed\n",
+				       objs[i]);
+				test_errors++;
+				break;
+			}
+		}
+	}
+	stamp_objs(nr);
+	check_objs("alloc_bulk", nr);
+	return true;
+}
+
+static void test_bulk(void)
+{
+	unsigned long freed = 0;
+	cycles_t free = 0, t;
+	unsigned int i, j, nr;
+
+	for (i = 0; i < rounds; i++) {
+		nr = i % NR_OBJS + 1;
+		if (!test_alloc_bulk(nr, i & 1 ? __GFP_ZERO | GFP_KERNEL :
+					  GFP_KERNEL))
+			break;
+		for (j = 0; j < nr; j++)
+			mixed[j] = objs[(j * MIX_STEP) % nr];
+
+		t = get_cycles();
+		kmem_cache_free_bulk(test_cache, nr, mixed);
+		free += get_cycles() - t;
+		freed += nr;
+		cond_resched();
+	}
+	pr_info("bulk: %lu objects, free_bulk %llu cycles/object\n", freed,
+		(unsigned long long)div64_u64(free, freed ? : 1));
+}
+
+/*
+ * The thread bound to another cpu frees each batch the test hands it
+ * with kmem_cache_free(), while the test allocates the next one.
+ */
+static DECLARE_COMPLETION(remote_ready);
+static DECLARE_COMPLETION(remote_done);
+static void *remote_objs[NR_OBJS];
+static unsigned int remote_nr;
+static bool remote_exit;
+static cycles_t remote_cycles;
+
+static int remote_free_thread(void *unused)
+{
+	unsigned int i;
+	cycles_t t;
+
+	for (;;) {
+		wait_for_completion(&remote_ready);
+		if (remote_exit)
+			break;
+
+		t = get_cycles();
+		for (i = 0; i < remote_nr; i++)
+			kmem_cache_free(test_cache, remote_objs[i]);
+		remote_cycles += get_cycles() - t;
+		complete(&remote_done);
+	}
+
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+#ifdef CONFIG_SLUB_STATS
+static unsigned long remote_batched(unsigned int cpu)
+{
+	return per_cpu_ptr(test_cache->cpu_slab, cpu)->stat[FREE_REMOTE_BATCH];
+}
+#else
+static unsigned long remote_batched(unsigned int cpu)
+{
+	return 0;
+}
+#endif
+
+static void test_remote(void)
+{
+	struct task_struct *tsk;
+	cpumask_var_t saved_mask;
+	unsigned long frees = 0, batched;
+	unsigned int i, j, cpu;
+
+	if (!alloc_cpumask_var(&saved_mask, GFP_KERNEL)) {
+		test_errors++;
+		return;
+	}
+	/* stay on this cpu, so that every free on the other one is remote */
+	cpumask_copy(saved_mask, tsk_cpus_allowed(current));
+	set_cpus_allowed_ptr(current, cpumask_of(raw_smp_processor_id()));
+
+	for_each_online_cpu(cpu)
+		if (cpu != raw_smp_processor_id())
+			break;
+	if (cpu >= nr_cpu_ids) {
+		pr_info("remote: needs a second online cpu, skipped\n");
+		goto out;
+	}
+	tsk = kthread_create(remote_free_thread, NULL, "test-slab/%u", cpu);
+	if (IS_ERR(tsk)) {
+		test_errors++;
+		goto out;
+	}
+	kthread_bind(tsk, cpu);
+	remote_exit = false;
+	wake_up_process(tsk);
+	batched = remote_batched(cpu);
+
+	for (i = 0; i < rounds; i++) {
+		for (j = 0; j < NR_OBJS; j++) {
+			objs[j] = kmem_cache_alloc(test_cache, GFP_KERNEL);
+			if (!objs[j])
+				break;
+		}
+		stamp_objs(j);
+		check_objs("remote", j);
+		/* the previous batch is freed while this one is checked */
+		if (i)
+			wait_for_completion(&remote_done);
+		memcpy(remote_objs, objs, j * sizeof(void *));
+		remote_nr = j;
+		frees += j;
+		complete(&remote_ready);
+	}
+	if (i)
+		wait_for_completion(&remote_done);
+	remote_exit = true;
+	complete(&remote_ready);
+	kthread_stop(tsk);
+
+	pr_info("remote: %lu frees on cpu %u, %llu cycles/object\n", frees,
+		cpu, (unsigned long long)div64_u64(remote_cycles, frees ? : 1));
+
+	batched = remote_batched(cpu) - batched;
+	if (IS_ENABLED(CONFIG_SLUB_STATS) &&
+	    !(test_cache->flags & (SLAB_RED_ZONE | SLAB_POISON |
+				   SLAB_STORE_USER | SLAB_TRACE |
+				   SLAB_DEBUG_FREE)) &&
+	    batched != frees) {
+		pr_err("remote: %lu of %lu frees batched\n", batched, frees);
+		test_errors++;
+	}
+out:
+	set_cpus_allowed_ptr(current, saved_mask);
+	free_cpumask_var(saved_mask);
+}
+
+static int __init test_slab_bulk_init(void)
+{
+	if (obj_size < sizeof(unsigned long))
+		return -EINVAL;
+
+	test_cache = kmem_cache_create("test-slab-bulk", obj_size, 0, 0, NULL);
+	if (!test_cache)
+		return -ENOMEM;
+
+	test_bulk();
+	test_remote();
+	kmem_cache_destroy(test_cache);
+
+	if (test_errors)
+		pr_err("%u errors\n", test_errors);
+	else
+		pr_info("all tests passed\n");
+
+	return -EINVAL;
+}
+module_init(test_slab_bulk_init);
+
+MODULE_LICENSE("GPL");
@@ -100,6 +100,10 @@ static int bdi_debug_stats_show(struct seq_file *m, void *v)
 		   "BdiDirtied:         %10lu kB\n"
 		   "BdiWritten:         %10lu kB\n"
 		   "BdiWriteBandwidth:  %10lu kBps\n"
+		   "BdiReadHits:        %10lu\n"
+		   "BdiReadMisses:      %10lu\n"
+		   "BdiReadahead:       %10lu kB\n"
+		   "BdiStrideReadahead: %10lu\n"
 		   "b_dirty:            %10lu\n"
 		   "b_io:               %10lu\n"
 		   "b_more_io:          %10lu\n"
@@ -113,6 +117,10 @@ static int bdi_debug_stats_show(struct seq_file *m, void *v)
 		   (unsigned long) K(bdi_stat(bdi, BDI_DIRTIED)),
 		   (unsigned long) K(bdi_stat(bdi, BDI_WRITTEN)),
 		   (unsigned long) K(bdi->write_bandwidth),
+		   (unsigned long) bdi_stat(bdi, BDI_READ_HIT),
+		   (unsigned long) bdi_stat(bdi, BDI_READ_MISS),
+		   (unsigned long) K(bdi_stat(bdi, BDI_READAHEAD)),
+		   (unsigned long) bdi_stat(bdi, BDI_READAHEAD_STRIDE),
 		   nr_dirty,
 		   nr_io,
 		   nr_more_io,
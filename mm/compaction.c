@@ -54,7 +54,10 @@ static unsigned long release_freepages(struct list_head *freelist)
 	return count;
 }
 
-/* Isolate free pages onto a private freelist. Must hold zone->lock */
+/*
+ * Isolate free pages onto a private freelist. Must hold the lock of the
+ * zone shard the pageblock belongs to.
+ */
 static unsigned long isolate_freepages_block(struct zone *zone,
 				unsigned long blockpfn,
 				struct list_head *freelist)
@@ -135,6 +138,7 @@ static void isolate_freepages(struct zone *zone,
 				struct compact_control *cc)
 {
 	struct page *page;
+	struct zone_shard *shard;
 	unsigned long high_pfn, low_pfn, pfn;
 	unsigned long flags;
 	int nr_freepages = cc->nr_freepages;
@@ -189,12 +193,13 @@ static void isolate_freepages(struct zone *zone,
 		 * are disabled
 		 */
 		isolated = 0;
-		spin_lock_irqsave(&zone->lock, flags);
+		shard = zone_pfn_shard(zone, pfn);
+		spin_lock_irqsave(&shard->lock, flags);
 		if (suitable_migration_target(page)) {
 			isolated = isolate_freepages_block(zone, pfn, freelist);
 			nr_freepages += isolated;
 		}
-		spin_unlock_irqrestore(&zone->lock, flags);
+		spin_unlock_irqrestore(&shard->lock, flags);
 
 		/*
 		 * Record the highest PFN we isolated pages from. When next
@@ -478,12 +483,18 @@ static int compact_finished(struct zone *zone,
 
 	/* Direct compactor: Is a suitable page free? */
 	for (order = cc->order; order < MAX_ORDER; order++) {
+		struct zone_shard *shard;
+
 		/* Job done if page is free of the right migratetype */
-		if (!list_empty(&zone->free_area[order].free_list[cc->migratetype]))
-			return COMPACT_PARTIAL;
+		for_each_zone_shard(shard, zone) {
+			struct free_area *area = &shard->free_area[order];
+
+			if (!list_empty(&area->free_list[cc->migratetype]))
+				return COMPACT_PARTIAL;
+		}
 
 		/* Job done if allocation would set block type */
-		if (order >= pageblock_order && zone->free_area[order].nr_free)
+		if (order >= pageblock_order && zone_free_area_nr(zone, order))
 			return COMPACT_PARTIAL;
 	}
 
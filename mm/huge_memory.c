@@ -17,6 +17,7 @@
 #include <linux/khugepaged.h>
 #include <linux/freezer.h>
 #include <linux/mman.h>
+#include <linux/userfaultfd_k.h>
 #include <asm/tlb.h>
 #include <asm/pgalloc.h>
 #include "internal.h"
@@ -709,6 +710,9 @@ int do_huge_pmd_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	pte_t *pte;
 
 	if (haddr >= vma->vm_start && haddr + HPAGE_PMD_SIZE <= vma->vm_end) {
+		/* Missing pages are resolved by userland one pte at a time */
+		if (userfaultfd_missing(vma))
+			goto out;
 		if (unlikely(anon_vma_prepare(vma)))
 			return VM_FAULT_OOM;
 		if (unlikely(khugepaged_enter(vma)))
@@ -1902,6 +1906,9 @@ static void collapse_huge_page(struct mm_struct *mm,
 
 	if (!vma->anon_vma || vma->vm_ops)
 		goto out;
+	/* Collapsing would fill in the holes userland wants to hear about */
+	if (userfaultfd_missing(vma))
+		goto out;
 	if (is_vma_temporary_stack(vma))
 		goto out;
 	/*
@@ -2144,6 +2151,8 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 		}
 		if (!vma->anon_vma || vma->vm_ops)
 			goto skip;
+		if (userfaultfd_missing(vma))
+			goto skip;
 		if (is_vma_temporary_stack(vma))
 			goto skip;
 		/*
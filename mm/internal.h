@@ -85,6 +85,18 @@ static inline void get_page_foll(struct page *page)
 
 extern unsigned long highest_memmap_pfn;
 
+/*
+ * in mm/memory.c:
+ */
+#ifndef my_zero_pfn
+extern unsigned long zero_pfn;
+
+static inline unsigned long my_zero_pfn(unsigned long addr)
+{
+	return zero_pfn;
+}
+#endif
+
 /*
  * in mm/vmscan.c:
  */
@@ -103,7 +115,7 @@ extern bool is_free_buddy_page(struct page *page);
 
 /*
  * function for dealing with page's order in buddy system.
- * zone->lock is already acquired when we use these.
+ * the zone shard lock is already acquired when we use these.
  * So, we don't need atomic page->flags operations here.
  */
 static inline unsigned long page_order(struct page *page)
@@ -112,6 +124,11 @@ static inline unsigned long page_order(struct page *page)
 	return page_private(page);
 }
 
+/* mm/readahead.c */
+int page_cache_stride_readahead(struct address_space *mapping,
+				struct file_ra_state *ra, struct file *filp,
+				pgoff_t offset);
+
 /* mm/util.c */
 void __vma_link_list(struct mm_struct *mm, struct vm_area_struct *vma,
 		struct vm_area_struct *prev, struct rb_node *rb_parent);
@@ -309,3 +326,15 @@ extern u64 hwpoison_filter_flags_mask;
 extern u64 hwpoison_filter_flags_value;
 extern u64 hwpoison_filter_memcg;
 extern u32 hwpoison_filter_enable;
+
+#ifdef CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH
+void try_to_unmap_flush(void);
+void try_to_unmap_flush_dirty(void);
+#else
+static inline void try_to_unmap_flush(void)
+{
+}
+static inline void try_to_unmap_flush_dirty(void)
+{
+}
+#endif /* CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH */
@@ -78,6 +78,19 @@
  *    take 10 attempts to find a page in the unstable tree, once it is found,
  *    it is secured in the stable tree.  (When we scan a new page, we first
  *    compare it against the stable tree, and then against the unstable tree.)
+ *
+ * To spend its effort where merging pays off, KSM also tracks how volatile
+ * each page and each mm is:
+ *
+ * 1) A page whose checksum changed on two scans in a row is skipped for the
+ *    next scan, then for 2, 4, ... up to max_page_skip scans while it keeps
+ *    changing.  A page that was seen unchanged starts from scratch.
+ * 2) An mm that yielded no merges in a whole scan of its areas is skipped
+ *    for the next full scan, then for 2, 4, ... up to max_slot_skip full
+ *    scans.  Any merge brings it back to being scanned on every pass.
+ *
+ * With merge_across_nodes disabled, there is one stable and one unstable
+ * tree per NUMA node, and pages are only merged with pages on their node.
  */
 
 /**
@@ -86,12 +99,20 @@
  * @mm_list: link into the mm_slots list, rooted in ksm_mm_head
  * @rmap_list: head for this mm_slot's singly-linked list of rmap_items
  * @mm: the mm that this information is valid for
+ * @pass_merged: merges made with this mm's pages during that scan
+ * @full_scans: completed scans of this mm, saturating at 3
+ * @backoff: full scans to skip after the next unproductive scan
+ * @skip_scans: full scans still to be skipped
  */
 struct mm_slot {
 	struct hlist_node link;
 	struct list_head mm_list;
 	struct rmap_item *rmap_list;
 	struct mm_struct *mm;
+	unsigned long pass_merged;
+	unsigned char full_scans;
+	unsigned char backoff;
+	unsigned char skip_scans;
 };
 
 /**
@@ -115,30 +136,44 @@ struct ksm_scan {
  * @node: rb node of this ksm page in the stable tree
  * @hlist: hlist head of rmap_items using this ksm page
  * @kpfn: page frame number of this ksm page
+ * @nid: NUMA node id of the stable tree this node is linked in
  */
 struct stable_node {
 	struct rb_node node;
 	struct hlist_head hlist;
 	unsigned long kpfn;
+#ifdef CONFIG_NUMA
+	int nid;
+#endif
 };
 
 /**
  * struct rmap_item - reverse mapping item for virtual addresses
  * @rmap_list: next rmap_item in mm_slot's singly-linked rmap_list
  * @anon_vma: pointer to anon_vma for this mm,address, when in stable tree
+ * @nid: NUMA node id of unstable tree in which linked (may not match page)
  * @mm: the memory structure this rmap_item is pointing into
  * @address: the virtual address this rmap_item tracks (+ flags in low bits)
  * @oldchecksum: previous checksum of the page at that virtual address
+ * @volatility: number of consecutive scans which saw the checksum change
+ * @skip_scans: number of scans still to skip this page for
  * @node: rb node of this rmap_item in the unstable tree
  * @head: pointer to stable_node heading this list in the stable tree
  * @hlist: link into hlist of rmap_items hanging off that stable_node
  */
 struct rmap_item {
 	struct rmap_item *rmap_list;
-	struct anon_vma *anon_vma;	/* when stable */
+	union {
+		struct anon_vma *anon_vma;	/* when stable */
+#ifdef CONFIG_NUMA
+		int nid;		/* when node of unstable tree */
+#endif
+	};
 	struct mm_struct *mm;
 	unsigned long address;		/* + low bits used for flags below */
 	unsigned int oldchecksum;	/* when unstable */
+	unsigned char volatility;
+	unsigned char skip_scans;
 	union {
 		struct rb_node node;	/* when node of unstable tree */
 		struct {		/* when listed from stable tree */
@@ -152,9 +187,20 @@ struct rmap_item {
 #define UNSTABLE_FLAG	0x100	/* is a node of the unstable tree */
 #define STABLE_FLAG	0x200	/* is listed from the stable tree */
 
-/* The stable and unstable tree heads */
-static struct rb_root root_stable_tree = RB_ROOT;
-static struct rb_root root_unstable_tree = RB_ROOT;
+/*
+ * The stable and unstable tree heads: only the first of each is used while
+ * merge_across_nodes is set, otherwise there is one per NUMA node.
+ */
+static struct rb_root root_stable_tree[MAX_NUMNODES];
+static struct rb_root root_unstable_tree[MAX_NUMNODES];
+
+#ifdef CONFIG_NUMA
+#define NUMA(x)		(x)
+#define DO_NUMA(x)	do { (x); } while (0)
+#else
+#define NUMA(x)		(0)
+#define DO_NUMA(x)	do { } while (0)
+#endif
 
 #define MM_SLOTS_HASH_SHIFT 10
 #define MM_SLOTS_HASH_HEADS (1 << MM_SLOTS_HASH_SHIFT)
@@ -183,6 +229,40 @@ static unsigned long ksm_pages_unshared;
 /* The number of rmap_items in use: to calculate pages_volatile */
 static unsigned long ksm_rmap_items;
 
+/* The number of pages compared against the trees, since boot */
+static unsigned long ksm_pages_scanned;
+
+/* The number of pages skipped for being volatile, since boot */
+static unsigned long ksm_pages_skipped;
+
+/* The number of pages merged into the stable tree, since boot */
+static unsigned long ksm_pages_merged;
+
+/* The number of times an unproductive mm was skipped for a full scan */
+static unsigned long ksm_slots_skipped;
+
+/* Whether to back off from volatile pages and unproductive mms */
+static unsigned int ksm_smart_scan = 1;
+
+/* Most scans a volatile page is skipped for */
+static unsigned int ksm_max_page_skip = 8;
+
+/* Most full scans an unproductive mm is skipped for */
+static unsigned int ksm_max_slot_skip = 4;
+
+/* Volatility saturates here, far above what max_page_skip can express */
+#define KSM_MAX_VOLATILITY	16
+
+/* Limit for max_page_skip and max_slot_skip: skip_scans is a char */
+#define KSM_MAX_SKIP		255
+
+#ifdef CONFIG_NUMA
+/* Zero to merge only pages on the same NUMA node */
+static unsigned int ksm_merge_across_nodes = 1;
+#else
+#define ksm_merge_across_nodes	1U
+#endif
+
 /* Number of pages ksmd should scan in one batch */
 static unsigned int ksm_thread_pages_to_scan = 100;
 
@@ -302,6 +382,12 @@ static inline int in_stable_tree(struct rmap_item *rmap_item)
 	return rmap_item->address & STABLE_FLAG;
 }
 
+/* The node whose trees a page belongs in */
+static inline int get_kpfn_nid(unsigned long kpfn)
+{
+	return ksm_merge_across_nodes ? 0 : pfn_to_nid(kpfn);
+}
+
 /*
  * ksmd, and unmerge_and_remove_all_rmap_items(), must not touch an mm's
  * page tables after it has passed through ksm_exit() - which, if necessary,
@@ -462,7 +548,8 @@ static void remove_node_from_stable_tree(struct stable_node *stable_node)
 		cond_resched();
 	}
 
-	rb_erase(&stable_node->node, &root_stable_tree);
+	rb_erase(&stable_node->node,
+		 root_stable_tree + NUMA(stable_node->nid));
 	free_stable_node(stable_node);
 }
 
@@ -560,7 +647,8 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 		age = (unsigned char)(ksm_scan.seqnr - rmap_item->address);
 		BUG_ON(age > 1);
 		if (!age)
-			rb_erase(&rmap_item->node, &root_unstable_tree);
+			rb_erase(&rmap_item->node,
+				 root_unstable_tree + NUMA(rmap_item->nid));
 
 		ksm_pages_unshared--;
 		rmap_item->address &= PAGE_MASK;
@@ -939,6 +1027,9 @@ static int try_to_merge_with_ksm_page(struct rmap_item *rmap_item,
 	if (err)
 		goto out;
 
+	/* Unstable nid is in union with stable anon_vma: remove first */
+	remove_rmap_item_from_tree(rmap_item);
+
 	/* Must get reference to anon_vma while still holding mmap_sem */
 	rmap_item->anon_vma = vma->anon_vma;
 	get_anon_vma(vma->anon_vma);
@@ -978,6 +1069,52 @@ static struct page *try_to_merge_two_pages(struct rmap_item *rmap_item,
 	return err ? NULL : page;
 }
 
+/*
+ * stable_tree_move - relink the stable node of a ksm page which migration
+ * moved to another NUMA node into the stable tree of its new node, so that
+ * it is only merged with pages on that node.  ksm_migrate_page() cannot do
+ * it itself: the trees are only modified under ksm_thread_mutex.
+ *
+ * The page may be identical to one already in that tree: both are kept,
+ * the existing one to the left, and both remain valid merge targets.
+ */
+static void stable_tree_move(struct stable_node *stable_node,
+			     struct page *kpage)
+{
+	int nid = get_kpfn_nid(stable_node->kpfn);
+	struct rb_node **new;
+	struct rb_node *parent;
+
+	rb_erase(&stable_node->node, root_stable_tree + NUMA(stable_node->nid));
+again:
+	new = &root_stable_tree[nid].rb_node;
+	parent = NULL;
+	while (*new) {
+		struct stable_node *tree_node;
+		struct page *tree_page;
+		int ret;
+
+		cond_resched();
+		tree_node = rb_entry(*new, struct stable_node, node);
+		tree_page = get_ksm_page(tree_node);
+		if (!tree_page)		/* stale node was erased: start over */
+			goto again;
+
+		ret = memcmp_pages(kpage, tree_page);
+		put_page(tree_page);
+
+		parent = *new;
+		if (ret < 0)
+			new = &parent->rb_left;
+		else
+			new = &parent->rb_right;
+	}
+
+	rb_link_node(&stable_node->node, parent, new);
+	rb_insert_color(&stable_node->node, &root_stable_tree[nid]);
+	DO_NUMA(stable_node->nid = nid);
+}
+
 /*
  * stable_tree_search - search for page inside the stable tree
  *
@@ -989,15 +1126,21 @@ static struct page *try_to_merge_two_pages(struct rmap_item *rmap_item,
  */
 static struct page *stable_tree_search(struct page *page)
 {
-	struct rb_node *node = root_stable_tree.rb_node;
+	struct rb_node *node;
 	struct stable_node *stable_node;
+	int nid;
 
 	stable_node = page_stable_node(page);
 	if (stable_node) {			/* ksm page forked */
+		if (NUMA(stable_node->nid) != get_kpfn_nid(stable_node->kpfn))
+			stable_tree_move(stable_node, page);
 		get_page(page);
 		return page;
 	}
 
+	nid = get_kpfn_nid(page_to_pfn(page));
+	node = root_stable_tree[nid].rb_node;
+
 	while (node) {
 		struct page *tree_page;
 		int ret;
@@ -1032,7 +1175,8 @@ static struct page *stable_tree_search(struct page *page)
  */
 static struct stable_node *stable_tree_insert(struct page *kpage)
 {
-	struct rb_node **new = &root_stable_tree.rb_node;
+	int nid = get_kpfn_nid(page_to_pfn(kpage));
+	struct rb_node **new = &root_stable_tree[nid].rb_node;
 	struct rb_node *parent = NULL;
 	struct stable_node *stable_node;
 
@@ -1069,11 +1213,12 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
 		return NULL;
 
 	rb_link_node(&stable_node->node, parent, new);
-	rb_insert_color(&stable_node->node, &root_stable_tree);
+	rb_insert_color(&stable_node->node, &root_stable_tree[nid]);
 
 	INIT_HLIST_HEAD(&stable_node->hlist);
 
 	stable_node->kpfn = page_to_pfn(kpage);
+	DO_NUMA(stable_node->nid = nid);
 	set_page_stable_node(kpage, stable_node);
 
 	return stable_node;
@@ -1099,8 +1244,12 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 					      struct page **tree_pagep)
 
 {
-	struct rb_node **new = &root_unstable_tree.rb_node;
+	struct rb_node **new;
 	struct rb_node *parent = NULL;
+	int nid;
+
+	nid = get_kpfn_nid(page_to_pfn(page));
+	new = &root_unstable_tree[nid].rb_node;
 
 	while (*new) {
 		struct rmap_item *tree_rmap_item;
@@ -1121,6 +1270,16 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 			return NULL;
 		}
 
+		/*
+		 * The tree page may have been migrated to another node
+		 * since it was inserted: don't merge across nodes for it.
+		 */
+		if (!ksm_merge_across_nodes &&
+		    page_to_nid(tree_page) != nid) {
+			put_page(tree_page);
+			return NULL;
+		}
+
 		ret = memcmp_pages(page, tree_page);
 
 		parent = *new;
@@ -1138,8 +1297,9 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 
 	rmap_item->address |= UNSTABLE_FLAG;
 	rmap_item->address |= (ksm_scan.seqnr & SEQNR_MASK);
+	DO_NUMA(rmap_item->nid = nid);
 	rb_link_node(&rmap_item->node, parent, new);
-	rb_insert_color(&rmap_item->node, &root_unstable_tree);
+	rb_insert_color(&rmap_item->node, &root_unstable_tree[nid]);
 
 	ksm_pages_unshared++;
 	return NULL;
@@ -1195,6 +1355,8 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			lock_page(kpage);
 			stable_tree_append(rmap_item, page_stable_node(kpage));
 			unlock_page(kpage);
+			ksm_pages_merged++;
+			ksm_scan.mm_slot->pass_merged++;
 		}
 		put_page(kpage);
 		return;
@@ -1205,12 +1367,19 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	 * we calculated it, this page is changing frequently: therefore we
 	 * don't want to insert it in the unstable tree, and we don't want
 	 * to waste our time searching for something identical to it there.
+	 * If it keeps changing, skip it for a growing number of scans.
 	 */
 	checksum = calc_checksum(page);
 	if (rmap_item->oldchecksum != checksum) {
 		rmap_item->oldchecksum = checksum;
+		if (rmap_item->volatility < KSM_MAX_VOLATILITY)
+			rmap_item->volatility++;
+		if (rmap_item->volatility > 1)
+			rmap_item->skip_scans = min(1U << (rmap_item->volatility - 2),
+						    ksm_max_page_skip);
 		return;
 	}
+	rmap_item->volatility = 0;
 
 	tree_rmap_item =
 		unstable_tree_search_insert(rmap_item, page, &tree_page);
@@ -1219,18 +1388,19 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 						tree_rmap_item, tree_page);
 		put_page(tree_page);
 		/*
-		 * As soon as we merge this page, we want to remove the
-		 * rmap_item of the page we have merged with from the unstable
-		 * tree, and insert it instead as new node in the stable tree.
+		 * As soon as we merge this page, we want to insert it as new
+		 * node in the stable tree, with the rmap_item of the page we
+		 * have merged with: try_to_merge_with_ksm_page() has already
+		 * removed that from the unstable tree.
 		 */
 		if (kpage) {
-			remove_rmap_item_from_tree(tree_rmap_item);
-
 			lock_page(kpage);
 			stable_node = stable_tree_insert(kpage);
 			if (stable_node) {
 				stable_tree_append(tree_rmap_item, stable_node);
 				stable_tree_append(rmap_item, stable_node);
+				ksm_pages_merged += 2;
+				ksm_scan.mm_slot->pass_merged++;
 			}
 			unlock_page(kpage);
 
@@ -1276,12 +1446,80 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 	return rmap_item;
 }
 
+/*
+ * A page whose contents kept changing is left alone for a few scans:
+ * and while it is, it is taken out of the unstable tree, so that other
+ * pages are not compared with contents that are probably stale already.
+ */
+static bool should_skip_rmap_item(struct page *page,
+				  struct rmap_item *rmap_item)
+{
+	if (!ksm_smart_scan)
+		return false;
+	if (PageKsm(page) || in_stable_tree(rmap_item))
+		return false;
+	if (!rmap_item->skip_scans)
+		return false;
+
+	rmap_item->skip_scans--;
+	remove_rmap_item_from_tree(rmap_item);
+	ksm_pages_skipped++;
+	return true;
+}
+
+/*
+ * Called at the end of each scan of an mm: one which merged nothing is
+ * skipped for twice as many full scans as last time, up to max_slot_skip.
+ * Pages need two scans to get into the unstable tree, so an mm is given
+ * two scans before it can be judged.
+ */
+static void update_slot_backoff(struct mm_slot *slot)
+{
+	if (slot->full_scans <= 2)
+		slot->full_scans++;
+
+	if (!ksm_smart_scan || slot->pass_merged || slot->full_scans <= 2)
+		slot->backoff = 0;
+	else if (!slot->backoff)
+		slot->backoff = 1;
+	else
+		slot->backoff = min(slot->backoff * 2U, ksm_max_slot_skip);
+
+	slot->skip_scans = slot->backoff;
+	slot->pass_merged = 0;
+}
+
+/*
+ * Skip an mm for this full scan, if it was unproductive last time:
+ * its pages are taken out of the unstable tree, as they might be stale
+ * by the time it is scanned again.
+ */
+static bool should_skip_slot(struct mm_slot *slot)
+{
+	struct rmap_item *rmap_item;
+
+	if (!slot->skip_scans || !ksm_smart_scan)
+		return false;
+	if (ksm_test_exit(slot->mm))
+		return false;
+
+	slot->skip_scans--;
+	for (rmap_item = slot->rmap_list; rmap_item;
+	     rmap_item = rmap_item->rmap_list) {
+		if (!in_stable_tree(rmap_item))
+			remove_rmap_item_from_tree(rmap_item);
+	}
+	ksm_slots_skipped++;
+	return true;
+}
+
 static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 {
 	struct mm_struct *mm;
 	struct mm_slot *slot;
 	struct vm_area_struct *vma;
 	struct rmap_item *rmap_item;
+	int nid;
 
 	if (list_empty(&ksm_mm_head.mm_list))
 		return NULL;
@@ -1300,7 +1538,8 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 		 */
 		lru_add_drain_all();
 
-		root_unstable_tree = RB_ROOT;
+		for (nid = 0; nid < nr_node_ids; nid++)
+			root_unstable_tree[nid] = RB_ROOT;
 
 		spin_lock(&ksm_mmlist_lock);
 		slot = list_entry(slot->mm_list.next, struct mm_slot, mm_list);
@@ -1315,6 +1554,18 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 next_mm:
 		ksm_scan.address = 0;
 		ksm_scan.rmap_list = &slot->rmap_list;
+
+		if (should_skip_slot(slot)) {
+			spin_lock(&ksm_mmlist_lock);
+			slot = list_entry(slot->mm_list.next,
+					  struct mm_slot, mm_list);
+			ksm_scan.mm_slot = slot;
+			spin_unlock(&ksm_mmlist_lock);
+			if (slot != &ksm_mm_head)
+				goto next_mm;
+			ksm_scan.seqnr++;
+			return NULL;
+		}
 	}
 
 	mm = slot->mm;
@@ -1351,6 +1602,12 @@ next_mm:
 					ksm_scan.rmap_list =
 							&rmap_item->rmap_list;
 					ksm_scan.address += PAGE_SIZE;
+					if (should_skip_rmap_item(*page,
+								  rmap_item)) {
+						put_page(*page);
+						cond_resched();
+						continue;
+					}
 				} else
 					put_page(*page);
 				up_read(&mm->mmap_sem);
@@ -1371,6 +1628,7 @@ next_mm:
 	 * because there were no VM_MERGEABLE vmas with such addresses.
 	 */
 	remove_trailing_rmap_items(slot, ksm_scan.rmap_list);
+	update_slot_backoff(slot);
 
 	spin_lock(&ksm_mmlist_lock);
 	ksm_scan.mm_slot = list_entry(slot->mm_list.next,
@@ -1421,8 +1679,10 @@ static void ksm_do_scan(unsigned int scan_npages)
 		rmap_item = scan_get_next_rmap_item(&page);
 		if (!rmap_item)
 			return;
-		if (!PageKsm(page) || !in_stable_tree(rmap_item))
+		if (!PageKsm(page) || !in_stable_tree(rmap_item)) {
 			cmp_and_merge_page(page, rmap_item);
+			ksm_pages_scanned++;
+		}
 		put_page(page);
 	}
 }
@@ -1758,6 +2018,7 @@ void ksm_migrate_page(struct page *newpage, struct page *oldpage)
 	stable_node = page_stable_node(newpage);
 	if (stable_node) {
 		VM_BUG_ON(stable_node->kpfn != page_to_pfn(oldpage));
+		/* stable_tree_search() moves it if it changed NUMA node */
 		stable_node->kpfn = page_to_pfn(newpage);
 	}
 }
@@ -1768,14 +2029,18 @@ static struct stable_node *ksm_check_stable_tree(unsigned long start_pfn,
 						 unsigned long end_pfn)
 {
 	struct rb_node *node;
+	int nid;
 
-	for (node = rb_first(&root_stable_tree); node; node = rb_next(node)) {
-		struct stable_node *stable_node;
+	for (nid = 0; nid < nr_node_ids; nid++) {
+		for (node = rb_first(root_stable_tree + nid); node;
+		     node = rb_next(node)) {
+			struct stable_node *stable_node;
 
-		stable_node = rb_entry(node, struct stable_node, node);
-		if (stable_node->kpfn >= start_pfn &&
-		    stable_node->kpfn < end_pfn)
-			return stable_node;
+			stable_node = rb_entry(node, struct stable_node, node);
+			if (stable_node->kpfn >= start_pfn &&
+			    stable_node->kpfn < end_pfn)
+				return stable_node;
+		}
 	}
 	return NULL;
 }
@@ -1926,6 +2191,137 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 }
 KSM_ATTR(run);
 
+static ssize_t smart_scan_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_smart_scan);
+}
+
+static ssize_t smart_scan_store(struct kobject *kobj,
+				struct kobj_attribute *attr,
+				const char *buf, size_t count)
+{
+	int err;
+	unsigned long enable;
+
+	err = strict_strtoul(buf, 10, &enable);
+	if (err || enable > 1)
+		return -EINVAL;
+
+	ksm_smart_scan = enable;
+
+	return count;
+}
+KSM_ATTR(smart_scan);
+
+static ssize_t max_page_skip_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_max_page_skip);
+}
+
+static ssize_t max_page_skip_store(struct kobject *kobj,
+				   struct kobj_attribute *attr,
+				   const char *buf, size_t count)
+{
+	int err;
+	unsigned long nr_scans;
+
+	err = strict_strtoul(buf, 10, &nr_scans);
+	if (err || !nr_scans || nr_scans > KSM_MAX_SKIP)
+		return -EINVAL;
+
+	ksm_max_page_skip = nr_scans;
+
+	return count;
+}
+KSM_ATTR(max_page_skip);
+
+static ssize_t max_slot_skip_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_max_slot_skip);
+}
+
+static ssize_t max_slot_skip_store(struct kobject *kobj,
+				   struct kobj_attribute *attr,
+				   const char *buf, size_t count)
+{
+	int err;
+	unsigned long nr_scans;
+
+	err = strict_strtoul(buf, 10, &nr_scans);
+	if (err || !nr_scans || nr_scans > KSM_MAX_SKIP)
+		return -EINVAL;
+
+	ksm_max_slot_skip = nr_scans;
+
+	return count;
+}
+KSM_ATTR(max_slot_skip);
+
+#ifdef CONFIG_NUMA
+/*
+ * Stale stable nodes stay in the trees until ksmd comes across them:
+ * prune them, and tell if any node is still in use.
+ */
+static bool stable_nodes_in_use(void)
+{
+	struct stable_node *stable_node;
+	struct page *page;
+	int nid;
+
+	for (nid = 0; nid < nr_node_ids; nid++) {
+		while (root_stable_tree[nid].rb_node) {
+			stable_node = rb_entry(root_stable_tree[nid].rb_node,
+					       struct stable_node, node);
+			page = get_ksm_page(stable_node);
+			if (page) {
+				put_page(page);
+				return true;
+			}
+			cond_resched();
+		}
+	}
+	return false;
+}
+
+static ssize_t merge_across_nodes_show(struct kobject *kobj,
+				       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_merge_across_nodes);
+}
+
+static ssize_t merge_across_nodes_store(struct kobject *kobj,
+					struct kobj_attribute *attr,
+					const char *buf, size_t count)
+{
+	int err;
+	unsigned long knob;
+
+	err = strict_strtoul(buf, 10, &knob);
+	if (err || knob > 1)
+		return -EINVAL;
+
+	/*
+	 * Stable and unstable nodes would be looked for in the wrong trees
+	 * after a switch: only allow it once everything has been unmerged.
+	 */
+	mutex_lock(&ksm_thread_mutex);
+	if (ksm_merge_across_nodes != knob) {
+		if (ksm_pages_shared || ksm_pages_unshared ||
+		    stable_nodes_in_use())
+			err = -EBUSY;
+		else
+			ksm_merge_across_nodes = knob;
+	}
+	mutex_unlock(&ksm_thread_mutex);
+
+	return err ? err : count;
+}
+KSM_ATTR(merge_across_nodes);
+#endif
+
 static ssize_t pages_shared_show(struct kobject *kobj,
 				 struct kobj_attribute *attr, char *buf)
 {
@@ -1971,6 +2367,34 @@ static ssize_t full_scans_show(struct kobject *kobj,
 }
 KSM_ATTR_RO(full_scans);
 
+static ssize_t pages_scanned_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_pages_scanned);
+}
+KSM_ATTR_RO(pages_scanned);
+
+static ssize_t pages_skipped_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_pages_skipped);
+}
+KSM_ATTR_RO(pages_skipped);
+
+static ssize_t pages_merged_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_pages_merged);
+}
+KSM_ATTR_RO(pages_merged);
+
+static ssize_t slots_skipped_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_slots_skipped);
+}
+KSM_ATTR_RO(slots_skipped);
+
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
@@ -1980,6 +2404,16 @@ static struct attribute *ksm_attrs[] = {
 	&pages_unshared_attr.attr,
 	&pages_volatile_attr.attr,
 	&full_scans_attr.attr,
+	&smart_scan_attr.attr,
+	&max_page_skip_attr.attr,
+	&max_slot_skip_attr.attr,
+#ifdef CONFIG_NUMA
+	&merge_across_nodes_attr.attr,
+#endif
+	&pages_scanned_attr.attr,
+	&pages_skipped_attr.attr,
+	&pages_merged_attr.attr,
+	&slots_skipped_attr.attr,
 	NULL,
 };
 
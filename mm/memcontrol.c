@@ -21,7 +21,7 @@
  * GNU General Public License for more details.
  */
 
-#include <linux/res_counter.h>
+#include <linux/page_counter.h>
 #include <linux/memcontrol.h>
 #include <linux/cgroup.h>
 #include <linux/mm.h>
@@ -39,6 +39,7 @@
 #include <linux/slab.h>
 #include <linux/swap.h>
 #include <linux/swapops.h>
+#include <linux/shmem_fs.h>
 #include <linux/spinlock.h>
 #include <linux/eventfd.h>
 #include <linux/sort.h>
@@ -49,6 +50,7 @@
 #include <linux/page_cgroup.h>
 #include <linux/cpu.h>
 #include <linux/oom.h>
+#include <linux/list_lru.h>
 #include "internal.h"
 #include <net/sock.h>
 #include <net/tcp_memcontrol.h>
@@ -98,6 +100,9 @@ enum mem_cgroup_events_index {
 	MEM_CGROUP_EVENTS_COUNT,	/* # of pages paged in/out */
 	MEM_CGROUP_EVENTS_PGFAULT,	/* # of page-faults */
 	MEM_CGROUP_EVENTS_PGMAJFAULT,	/* # of major page-faults */
+	MEM_CGROUP_EVENTS_PGSCAN,	/* # of pages scanned by reclaim */
+	MEM_CGROUP_EVENTS_PGSTEAL,	/* # of pages reclaimed */
+	MEM_CGROUP_EVENTS_LOW,		/* # of reclaims below low limit */
 	MEM_CGROUP_EVENTS_NSTATS,
 };
 /*
@@ -140,7 +145,7 @@ struct mem_cgroup_per_zone {
 
 	struct zone_reclaim_stat reclaim_stat;
 	struct rb_node		tree_node;	/* RB tree node */
-	unsigned long long	usage_in_excess;/* Set to the value by which */
+	unsigned long		usage_in_excess;/* Set to the value by which */
 						/* the soft limit is exceeded*/
 	bool			on_tree;
 	struct mem_cgroup	*memcg;		/* Back pointer, we cannot */
@@ -223,22 +228,20 @@ static void mem_cgroup_oom_notify(struct mem_cgroup *memcg);
  */
 struct mem_cgroup {
 	struct cgroup_subsys_state css;
-	/*
-	 * the counter to account for memory usage
-	 */
-	struct res_counter res;
+	/* Accounted resources */
+	struct page_counter memory;
 
 	union {
 		/*
 		 * the counter to account for mem+swap usage.
 		 */
-		struct res_counter memsw;
+		struct page_counter memsw;
 
 		/*
 		 * rcu_freeing is used only when freeing struct mem_cgroup,
 		 * so put it into a union to avoid wasting more memory.
 		 * It must be disjoint from the css field.  It could be
-		 * in a union with the res field, but res plays a much
+		 * in a union with the memory field, but memory plays a much
 		 * larger part in mem_cgroup life than memsw, and might
 		 * be of interest, even at time of free, when debugging.
 		 * So share rcu_head with the less interesting memsw.
@@ -272,11 +275,26 @@ struct mem_cgroup {
 
 	atomic_t	refcnt;
 
+	/* in pages, like the counters */
+	unsigned long soft_limit;
+	/* pages charged in one go to refill the per-cpu stock */
+	unsigned int charge_batch;
+
 	int	swappiness;
+
+	/*
+	 * Reclaim leaves the group alone while its usage is below the
+	 * low limit.  low_usage is min(usage, low) in pages, as last
+	 * accounted in the parent's children_low_usage.
+	 */
+	unsigned long low;
+	atomic_long_t	low_usage;
+	atomic_long_t	children_low_usage;
+
 	/* OOM-Killer disable */
 	int		oom_kill_disable;
 
-	/* set when res.limit == memsw.limit */
+	/* set when memory.limit == memsw.limit */
 	bool		memsw_is_minimum;
 
 	/* protect arrays of thresholds */
@@ -316,6 +334,25 @@ struct mem_cgroup {
 #ifdef CONFIG_INET
 	struct tcp_memcontrol tcp_mem;
 #endif
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+	/*
+	 * the counter to account for kernel memory usage.
+	 */
+	struct page_counter kmem;
+	/* set once a kmem limit is configured here or on an ancestor */
+	bool kmem_account_active;
+	/* index into the root caches' memcg_caches arrays, or -1 */
+	int kmemcg_id;
+	/* per-memcg copies of SLAB_ACCOUNT caches, protected by memcg_cache_mutex */
+	struct list_head memcg_slab_caches;
+	/*
+	 * Set once the memcg is destroyed: from then on, its leftover kmem
+	 * objects are listed with those of kmem_reparent, or on the global
+	 * lists if that is NULL.
+	 */
+	bool kmem_dead;
+	struct mem_cgroup *kmem_reparent;
+#endif
 };
 
 /* Stuffs for move charges at task migration. */
@@ -377,6 +414,7 @@ enum charge_type {
 #define _MEM			(0)
 #define _MEMSWAP		(1)
 #define _OOM_TYPE		(2)
+#define _KMEM			(3)
 #define MEMFILE_PRIVATE(x, val)	(((x) << 16) | (val))
 #define MEMFILE_TYPE(val)	(((val) >> 16) & 0xffff)
 #define MEMFILE_ATTR(val)	((val) & 0xffff)
@@ -495,7 +533,7 @@ static void
 __mem_cgroup_insert_exceeded(struct mem_cgroup *memcg,
 				struct mem_cgroup_per_zone *mz,
 				struct mem_cgroup_tree_per_zone *mctz,
-				unsigned long long new_usage_in_excess)
+				unsigned long new_usage_in_excess)
 {
 	struct rb_node **p = &mctz->rb_root.rb_node;
 	struct rb_node *parent = NULL;
@@ -547,9 +585,21 @@ mem_cgroup_remove_exceeded(struct mem_cgroup *memcg,
 }
 
 
+static unsigned long soft_limit_excess(struct mem_cgroup *memcg)
+{
+	unsigned long nr_pages = page_counter_read(&memcg->memory);
+	unsigned long soft_limit = ACCESS_ONCE(memcg->soft_limit);
+	unsigned long excess = 0;
+
+	if (nr_pages > soft_limit)
+		excess = nr_pages - soft_limit;
+
+	return excess;
+}
+
 static void mem_cgroup_update_tree(struct mem_cgroup *memcg, struct page *page)
 {
-	unsigned long long excess;
+	unsigned long excess;
 	struct mem_cgroup_per_zone *mz;
 	struct mem_cgroup_tree_per_zone *mctz;
 	int nid = page_to_nid(page);
@@ -562,7 +612,7 @@ static void mem_cgroup_update_tree(struct mem_cgroup *memcg, struct page *page)
 	 */
 	for (; memcg; memcg = parent_mem_cgroup(memcg)) {
 		mz = mem_cgroup_zoneinfo(memcg, nid, zid);
-		excess = res_counter_soft_limit_excess(&memcg->res);
+		excess = soft_limit_excess(memcg);
 		/*
 		 * We have to update the tree if mz is on RB-tree or
 		 * mem is over its softlimit.
@@ -616,7 +666,7 @@ retry:
 	 * position in the tree.
 	 */
 	__mem_cgroup_remove_exceeded(mz->memcg, mz, mctz);
-	if (!res_counter_soft_limit_excess(&mz->memcg->res) ||
+	if (!soft_limit_excess(mz->memcg) ||
 		!css_tryget(&mz->memcg->css))
 		goto retry;
 done:
@@ -963,6 +1013,84 @@ void mem_cgroup_iter_break(struct mem_cgroup *root,
 		css_put(&prev->css);
 }
 
+static void mem_cgroup_propagate_low_usage(struct mem_cgroup *memcg)
+{
+	struct mem_cgroup *parent = parent_mem_cgroup(memcg);
+	unsigned long usage, low_usage;
+	long delta;
+
+	usage = page_counter_read(&memcg->memory);
+	low_usage = min(usage, ACCESS_ONCE(memcg->low));
+	delta = low_usage - atomic_long_xchg(&memcg->low_usage, low_usage);
+	if (parent && delta)
+		atomic_long_add(delta, &parent->children_low_usage);
+}
+
+/*
+ * The low limit a group effectively gets below @root: no more than the
+ * effective low limit of its parent, and if the siblings together claim
+ * more than that, a share of it proportional to the protected usage.
+ */
+static unsigned long mem_cgroup_effective_low(struct mem_cgroup *root,
+					      struct mem_cgroup *memcg)
+{
+	struct mem_cgroup *parent = parent_mem_cgroup(memcg);
+	unsigned long low, parent_low, low_usage, siblings;
+
+	low = ACCESS_ONCE(memcg->low);
+	if (!parent || parent == root)
+		return low;
+
+	parent_low = mem_cgroup_effective_low(root, parent);
+	low = min(low, parent_low);
+
+	low_usage = atomic_long_read(&memcg->low_usage);
+	siblings = atomic_long_read(&parent->children_low_usage);
+	if (low_usage && siblings > parent_low)
+		low = min_t(u64, low,
+			    div64_u64((u64)parent_low * low_usage, siblings));
+	return low;
+}
+
+/**
+ * mem_cgroup_low - check if memory consumption is below the low limit
+ * @root: the highest ancestor to consider
+ * @memcg: the memory cgroup to check
+ *
+ * Returns %true if the usage of @memcg is below its effective low limit
+ * within the hierarchy rooted at @root, in which case reclaim should
+ * skip it as long as there are other groups to reclaim from.  Limits
+ * set on @root and its ancestors are ignored: protection is only
+ * relative to the groups sharing the pressure.
+ */
+bool mem_cgroup_low(struct mem_cgroup *root, struct mem_cgroup *memcg)
+{
+	unsigned long usage, low;
+
+	if (mem_cgroup_disabled())
+		return false;
+	if (!root)
+		root = root_mem_cgroup;
+	if (memcg == root)
+		return false;
+
+	mem_cgroup_propagate_low_usage(memcg);
+	usage = page_counter_read(&memcg->memory);
+	low = mem_cgroup_effective_low(root, memcg);
+	return low && usage <= low;
+}
+
+void mem_cgroup_count_reclaim(struct mem_cgroup *memcg, unsigned long scanned,
+			      unsigned long reclaimed, bool low)
+{
+	if (mem_cgroup_disabled() || !memcg)
+		return;
+	this_cpu_add(memcg->stat->events[MEM_CGROUP_EVENTS_PGSCAN], scanned);
+	this_cpu_add(memcg->stat->events[MEM_CGROUP_EVENTS_PGSTEAL], reclaimed);
+	if (low)
+		this_cpu_inc(memcg->stat->events[MEM_CGROUP_EVENTS_LOW]);
+}
+
 /*
  * Iteration constructs for visiting all cgroups (under a tree).  If
  * loops are exited prematurely (break), mem_cgroup_iter_break() must
@@ -1261,7 +1389,7 @@ mem_cgroup_get_reclaim_stat_from_page(struct page *page)
 	return &mz->reclaim_stat;
 }
 
-#define mem_cgroup_from_res_counter(counter, member)	\
+#define mem_cgroup_from_counter(counter, member)	\
 	container_of(counter, struct mem_cgroup, member)
 
 /**
@@ -1273,12 +1401,25 @@ mem_cgroup_get_reclaim_stat_from_page(struct page *page)
  */
 static unsigned long mem_cgroup_margin(struct mem_cgroup *memcg)
 {
-	unsigned long long margin;
+	unsigned long margin = 0;
+	unsigned long count;
+	unsigned long limit;
 
-	margin = res_counter_margin(&memcg->res);
-	if (do_swap_account)
-		margin = min(margin, res_counter_margin(&memcg->memsw));
-	return margin >> PAGE_SHIFT;
+	count = page_counter_read(&memcg->memory);
+	limit = ACCESS_ONCE(memcg->memory.limit);
+	if (count < limit)
+		margin = limit - count;
+
+	if (do_swap_account) {
+		count = page_counter_read(&memcg->memsw);
+		limit = ACCESS_ONCE(memcg->memsw.limit);
+		if (count <= limit)
+			margin = min(margin, limit - count);
+		else
+			margin = 0;
+	}
+
+	return margin;
 }
 
 int mem_cgroup_swappiness(struct mem_cgroup *memcg)
@@ -1458,15 +1599,15 @@ void mem_cgroup_print_oom_info(struct mem_cgroup *memcg, struct task_struct *p)
 	printk(KERN_CONT " as a result of limit of %s\n", memcg_name);
 done:
 
-	printk(KERN_INFO "memory: usage %llukB, limit %llukB, failcnt %llu\n",
-		res_counter_read_u64(&memcg->res, RES_USAGE) >> 10,
-		res_counter_read_u64(&memcg->res, RES_LIMIT) >> 10,
-		res_counter_read_u64(&memcg->res, RES_FAILCNT));
+	printk(KERN_INFO "memory: usage %llukB, limit %llukB, failcnt %lu\n",
+		(u64)page_counter_read(&memcg->memory) << (PAGE_SHIFT - 10),
+		(u64)memcg->memory.limit << (PAGE_SHIFT - 10),
+		memcg->memory.failcnt);
 	printk(KERN_INFO "memory+swap: usage %llukB, limit %llukB, "
-		"failcnt %llu\n",
-		res_counter_read_u64(&memcg->memsw, RES_USAGE) >> 10,
-		res_counter_read_u64(&memcg->memsw, RES_LIMIT) >> 10,
-		res_counter_read_u64(&memcg->memsw, RES_FAILCNT));
+		"failcnt %lu\n",
+		(u64)page_counter_read(&memcg->memsw) << (PAGE_SHIFT - 10),
+		(u64)memcg->memsw.limit << (PAGE_SHIFT - 10),
+		memcg->memsw.failcnt);
 }
 
 /*
@@ -1491,15 +1632,15 @@ u64 mem_cgroup_get_limit(struct mem_cgroup *memcg)
 	u64 limit;
 	u64 memsw;
 
-	limit = res_counter_read_u64(&memcg->res, RES_LIMIT);
-	limit += total_swap_pages << PAGE_SHIFT;
+	limit = memcg->memory.limit;
+	limit += total_swap_pages;
 
-	memsw = res_counter_read_u64(&memcg->memsw, RES_LIMIT);
+	memsw = memcg->memsw.limit;
 	/*
 	 * If memsw is finite and limits the amount of swap space available
 	 * to this memcg, return that limit.
 	 */
-	return min(limit, memsw);
+	return min(limit, memsw) << PAGE_SHIFT;
 }
 
 static unsigned long mem_cgroup_reclaim(struct mem_cgroup *memcg,
@@ -1690,7 +1831,7 @@ static int mem_cgroup_soft_reclaim(struct mem_cgroup *root_memcg,
 		.priority = 0,
 	};
 
-	excess = res_counter_soft_limit_excess(&root_memcg->res) >> PAGE_SHIFT;
+	excess = soft_limit_excess(root_memcg);
 
 	while (1) {
 		victim = mem_cgroup_iter(root_memcg, victim, &reclaim);
@@ -1721,7 +1862,7 @@ static int mem_cgroup_soft_reclaim(struct mem_cgroup *root_memcg,
 		total += mem_cgroup_shrink_node_zone(victim, gfp_mask, false,
 						     zone, &nr_scanned);
 		*total_scanned += nr_scanned;
-		if (!res_counter_soft_limit_excess(&root_memcg->res))
+		if (!soft_limit_excess(root_memcg))
 			break;
 	}
 	mem_cgroup_iter_break(root_memcg, victim);
@@ -1984,9 +2125,11 @@ void mem_cgroup_update_page_stat(struct page *page,
 
 /*
  * size of first charge trial. "32" comes from vmscan.c's magic value.
- * TODO: maybe necessary to use big numbers in big irons.
+ * Groups with room to spare charge up to CHARGE_BATCH_MAX at a time,
+ * see mem_cgroup_update_charge_batch().
  */
-#define CHARGE_BATCH	32U
+#define CHARGE_BATCH		32U
+#define CHARGE_BATCH_MAX	256U
 struct memcg_stock_pcp {
 	struct mem_cgroup *cached; /* this never be root cgroup */
 	unsigned int nr_pages;
@@ -1998,38 +2141,40 @@ static DEFINE_PER_CPU(struct memcg_stock_pcp, memcg_stock);
 static DEFINE_MUTEX(percpu_charge_mutex);
 
 /*
- * Try to consume stocked charge on this cpu. If success, one page is consumed
- * from local stock and true is returned. If the stock is 0 or charges from a
- * cgroup which is not current target, returns false. This stock will be
- * refilled.
+ * Try to consume stocked charge on this cpu. If success, @nr_pages are
+ * consumed from local stock and true is returned. If the stock is too
+ * small or charges from a cgroup which is not current target, returns
+ * false. This stock will be refilled.
  */
-static bool consume_stock(struct mem_cgroup *memcg)
+static bool consume_stock(struct mem_cgroup *memcg, unsigned int nr_pages)
 {
 	struct memcg_stock_pcp *stock;
 	bool ret = true;
 
+	if (nr_pages > CHARGE_BATCH_MAX)
+		return false;
+
 	stock = &get_cpu_var(memcg_stock);
-	if (memcg == stock->cached && stock->nr_pages)
-		stock->nr_pages--;
-	else /* need to call res_counter_charge */
+	if (memcg == stock->cached && stock->nr_pages >= nr_pages)
+		stock->nr_pages -= nr_pages;
+	else /* need to charge the page counters */
 		ret = false;
 	put_cpu_var(memcg_stock);
 	return ret;
 }
 
 /*
- * Returns stocks cached in percpu to res_counter and reset cached information.
+ * Returns stocks cached in percpu to the page counters and reset cached
+ * information.
  */
 static void drain_stock(struct memcg_stock_pcp *stock)
 {
 	struct mem_cgroup *old = stock->cached;
 
 	if (stock->nr_pages) {
-		unsigned long bytes = stock->nr_pages * PAGE_SIZE;
-
-		res_counter_uncharge(&old->res, bytes);
+		page_counter_uncharge(&old->memory, stock->nr_pages);
 		if (do_swap_account)
-			res_counter_uncharge(&old->memsw, bytes);
+			page_counter_uncharge(&old->memsw, stock->nr_pages);
 		stock->nr_pages = 0;
 	}
 	stock->cached = NULL;
@@ -2047,7 +2192,7 @@ static void drain_local_stock(struct work_struct *dummy)
 }
 
 /*
- * Cache charges(val) which is from res_counter, to local per_cpu area.
+ * Cache charges(val) taken from the page counters, to local per_cpu area.
  * This will be consumed by consume_stock() function, later.
  */
 static void refill_stock(struct mem_cgroup *memcg, unsigned int nr_pages)
@@ -2062,6 +2207,27 @@ static void refill_stock(struct mem_cgroup *memcg, unsigned int nr_pages)
 	put_cpu_var(memcg_stock);
 }
 
+/*
+ * Size the charge batch of @memcg after the smallest limit it is charged
+ * against, its own or an ancestor's: stocks stranded on the other cpus
+ * can add up to the batch times the number of cpus, and should never
+ * hold more than a sixteenth of that limit.  Small groups keep the
+ * CHARGE_BATCH floor and fall back to exact charges near the limit, see
+ * mem_cgroup_do_charge().
+ */
+static void mem_cgroup_update_charge_batch(struct mem_cgroup *memcg)
+{
+	struct page_counter *counter;
+	unsigned long limit = PAGE_COUNTER_MAX, batch;
+
+	for (counter = &memcg->memory; counter; counter = counter->parent)
+		limit = min(limit, ACCESS_ONCE(counter->limit));
+
+	batch = limit / (num_possible_cpus() * 16);
+	memcg->charge_batch = clamp_t(unsigned long, batch,
+				      CHARGE_BATCH, CHARGE_BATCH_MAX);
+}
+
 /*
  * Drains all per-CPU charge caches for given root_memcg resp. subtree
  * of the hierarchy under it. sync flag says whether we should block
@@ -2107,8 +2273,8 @@ out:
 /*
  * Tries to drain stocked charges in other cpus. This function is asynchronous
  * and just put a work per cpu for draining localy on each cpu. Caller can
- * expects some charges will be back to res_counter later but cannot wait for
- * it.
+ * expects some charges will be back to the page counters later but cannot
+ * wait for it.
  */
 static void drain_all_stock_async(struct mem_cgroup *root_memcg)
 {
@@ -2187,36 +2353,38 @@ enum {
 };
 
 static int mem_cgroup_do_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
-				unsigned int nr_pages, bool oom_check)
+				unsigned int nr_pages, unsigned int min_pages,
+				bool oom_check)
 {
 	unsigned long csize = nr_pages * PAGE_SIZE;
 	struct mem_cgroup *mem_over_limit;
-	struct res_counter *fail_res;
+	struct page_counter *counter;
 	unsigned long flags = 0;
 	int ret;
 
-	ret = res_counter_charge(&memcg->res, csize, &fail_res);
+	ret = page_counter_try_charge(&memcg->memory, nr_pages, &counter);
 
 	if (likely(!ret)) {
 		if (!do_swap_account)
 			return CHARGE_OK;
-		ret = res_counter_charge(&memcg->memsw, csize, &fail_res);
+		ret = page_counter_try_charge(&memcg->memsw, nr_pages, &counter);
 		if (likely(!ret))
 			return CHARGE_OK;
 
-		res_counter_uncharge(&memcg->res, csize);
-		mem_over_limit = mem_cgroup_from_res_counter(fail_res, memsw);
+		page_counter_uncharge(&memcg->memory, nr_pages);
+		mem_over_limit = mem_cgroup_from_counter(counter, memsw);
 		flags |= MEM_CGROUP_RECLAIM_NOSWAP;
 	} else
-		mem_over_limit = mem_cgroup_from_res_counter(fail_res, res);
+		mem_over_limit = mem_cgroup_from_counter(counter, memory);
 	/*
 	 * nr_pages can be either a huge page (HPAGE_PMD_NR), a batch
-	 * of regular pages (CHARGE_BATCH), or a single regular page (1).
+	 * of regular pages (the group's charge_batch), or the
+	 * @min_pages actually requested.
 	 *
-	 * Never reclaim on behalf of optional batching, retry with a
-	 * single page instead.
+	 * Never reclaim on behalf of optional batching, retry with the
+	 * requested pages instead.
 	 */
-	if (nr_pages == CHARGE_BATCH)
+	if (nr_pages > min_pages)
 		return CHARGE_RETRY;
 
 	if (!(gfp_mask & __GFP_WAIT))
@@ -2257,7 +2425,7 @@ static int mem_cgroup_do_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
 /*
  * __mem_cgroup_try_charge() does
  * 1. detect memcg to be charged against from passed *mm and *ptr,
- * 2. update res_counter
+ * 2. update the page counters
  * 3. call memory reclaim if necessary.
  *
  * In some special case, if the task is fatal, fatal_signal_pending() or
@@ -2281,7 +2449,7 @@ static int __mem_cgroup_try_charge(struct mm_struct *mm,
 				   struct mem_cgroup **ptr,
 				   bool oom)
 {
-	unsigned int batch = max(CHARGE_BATCH, nr_pages);
+	unsigned int batch = 0;
 	int nr_oom_retries = MEM_CGROUP_RECLAIM_RETRIES;
 	struct mem_cgroup *memcg = NULL;
 	int ret;
@@ -2309,7 +2477,7 @@ again:
 		VM_BUG_ON(css_is_removed(&memcg->css));
 		if (mem_cgroup_is_root(memcg))
 			goto done;
-		if (nr_pages == 1 && consume_stock(memcg))
+		if (consume_stock(memcg, nr_pages))
 			goto done;
 		css_get(&memcg->css);
 	} else {
@@ -2334,7 +2502,7 @@ again:
 			rcu_read_unlock();
 			goto done;
 		}
-		if (nr_pages == 1 && consume_stock(memcg)) {
+		if (consume_stock(memcg, nr_pages)) {
 			/*
 			 * It seems dagerous to access memcg without css_get().
 			 * But considering how consume_stok works, it's not
@@ -2354,6 +2522,9 @@ again:
 		rcu_read_unlock();
 	}
 
+	if (!batch)
+		batch = max(ACCESS_ONCE(memcg->charge_batch), nr_pages);
+
 	do {
 		bool oom_check;
 
@@ -2369,7 +2540,8 @@ again:
 			nr_oom_retries = MEM_CGROUP_RECLAIM_RETRIES;
 		}
 
-		ret = mem_cgroup_do_charge(memcg, gfp_mask, batch, oom_check);
+		ret = mem_cgroup_do_charge(memcg, gfp_mask, batch, nr_pages,
+					   oom_check);
 		switch (ret) {
 		case CHARGE_OK:
 			break;
@@ -2418,11 +2590,9 @@ static void __mem_cgroup_cancel_charge(struct mem_cgroup *memcg,
 				       unsigned int nr_pages)
 {
 	if (!mem_cgroup_is_root(memcg)) {
-		unsigned long bytes = nr_pages * PAGE_SIZE;
-
-		res_counter_uncharge(&memcg->res, bytes);
+		page_counter_uncharge(&memcg->memory, nr_pages);
 		if (do_swap_account)
-			res_counter_uncharge(&memcg->memsw, bytes);
+			page_counter_uncharge(&memcg->memsw, nr_pages);
 	}
 }
 
@@ -2445,106 +2615,872 @@ static struct mem_cgroup *mem_cgroup_lookup(unsigned short id)
 	return container_of(css, struct mem_cgroup, css);
 }
 
-struct mem_cgroup *try_get_mem_cgroup_from_page(struct page *page)
+struct mem_cgroup *try_get_mem_cgroup_from_page(struct page *page)
+{
+	struct mem_cgroup *memcg = NULL;
+	struct page_cgroup *pc;
+	unsigned short id;
+	swp_entry_t ent;
+
+	VM_BUG_ON(!PageLocked(page));
+
+	pc = lookup_page_cgroup(page);
+	lock_page_cgroup(pc);
+	if (PageCgroupUsed(pc)) {
+		memcg = pc->mem_cgroup;
+		if (memcg && !css_tryget(&memcg->css))
+			memcg = NULL;
+	} else if (PageSwapCache(page)) {
+		ent.val = page_private(page);
+		id = lookup_swap_cgroup_id(ent);
+		rcu_read_lock();
+		memcg = mem_cgroup_lookup(id);
+		if (memcg && !css_tryget(&memcg->css))
+			memcg = NULL;
+		rcu_read_unlock();
+	}
+	unlock_page_cgroup(pc);
+	return memcg;
+}
+
+static void __mem_cgroup_commit_charge(struct mem_cgroup *memcg,
+				       struct page *page,
+				       unsigned int nr_pages,
+				       struct page_cgroup *pc,
+				       enum charge_type ctype,
+				       bool lrucare)
+{
+	struct zone *uninitialized_var(zone);
+	bool was_on_lru = false;
+	bool anon;
+
+	lock_page_cgroup(pc);
+	if (unlikely(PageCgroupUsed(pc))) {
+		unlock_page_cgroup(pc);
+		__mem_cgroup_cancel_charge(memcg, nr_pages);
+		return;
+	}
+	/*
+	 * we don't need page_cgroup_lock about tail pages, becase they are not
+	 * accessed by any other context at this point.
+	 */
+
+	/*
+	 * In some cases, SwapCache and FUSE(splice_buf->radixtree), the page
+	 * may already be on some other mem_cgroup's LRU.  Take care of it.
+	 */
+	if (lrucare) {
+		zone = page_zone(page);
+		spin_lock_irq(&zone->lru_lock);
+		if (PageLRU(page)) {
+			ClearPageLRU(page);
+			del_page_from_lru_list(zone, page, page_lru(page));
+			was_on_lru = true;
+		}
+	}
+
+	pc->mem_cgroup = memcg;
+	/*
+	 * We access a page_cgroup asynchronously without lock_page_cgroup().
+	 * Especially when a page_cgroup is taken from a page, pc->mem_cgroup
+	 * is accessed after testing USED bit. To make pc->mem_cgroup visible
+	 * before USED bit, we need memory barrier here.
+	 * See mem_cgroup_add_lru_list(), etc.
+ 	 */
+	smp_wmb();
+	SetPageCgroupUsed(pc);
+
+	if (lrucare) {
+		if (was_on_lru) {
+			VM_BUG_ON(PageLRU(page));
+			SetPageLRU(page);
+			add_page_to_lru_list(zone, page, page_lru(page));
+		}
+		spin_unlock_irq(&zone->lru_lock);
+	}
+
+	if (ctype == MEM_CGROUP_CHARGE_TYPE_MAPPED)
+		anon = true;
+	else
+		anon = false;
+
+	mem_cgroup_charge_statistics(memcg, anon, nr_pages);
+	unlock_page_cgroup(pc);
+
+	/*
+	 * "charge_statistics" updated event counter. Then, check it.
+	 * Insert ancestor (and ancestor's ancestors), to softlimit RB-tree.
+	 * if they exceeds softlimit.
+	 */
+	memcg_check_events(memcg, page);
+}
+
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+/*
+ * Kernel memory accounting.
+ *
+ * Once a kmem limit is set on a memcg, kernel stacks allocated with
+ * __GFP_KMEMCG and objects of SLAB_ACCOUNT slab caches are charged to
+ * it. Charges go to memcg->kmem and also to memcg->memory (and memsw), so
+ * kernel memory counts against the ordinary limit as well.
+ *
+ * Slab objects are accounted per slab page: every accounting memcg gets
+ * its own copy of each SLAB_ACCOUNT cache, created lazily from a work
+ * item on first use, and all slab pages of that copy are charged to it.
+ */
+struct static_key memcg_kmem_enabled_key;
+
+/* protects the memcg_caches arrays and the per-memcg cache lists */
+static DEFINE_MUTEX(memcg_cache_mutex);
+static LIST_HEAD(memcg_root_caches);
+static DEFINE_IDA(kmem_limited_groups);
+/* size of the memcg_caches array of every root cache */
+static int memcg_limited_groups_array_size;
+
+#define MEMCG_CACHES_MIN_SIZE	4
+#define MEMCG_CACHES_MAX_SIZE	65535
+
+static inline bool memcg_can_account_kmem(struct mem_cgroup *memcg)
+{
+	if (!memcg || mem_cgroup_is_root(memcg))
+		return false;
+	if (!ACCESS_ONCE(memcg->kmem_account_active))
+		return false;
+	/* pairs with the smp_wmb() in memcg_activate_kmem() */
+	smp_rmb();
+	return true;
+}
+
+static unsigned long memcg_kmem_usage(struct mem_cgroup *memcg)
+{
+	return page_counter_read(&memcg->kmem);
+}
+
+#ifdef CONFIG_SLUB
+bool memcg_kmem_is_active(struct mem_cgroup *memcg)
+{
+	return memcg_can_account_kmem(memcg);
+}
+
+/*
+ * Memory charged to @memcg's hierarchy, in pages. Used by reclaim to
+ * weigh the slab objects of the hierarchy against its other memory.
+ */
+unsigned long mem_cgroup_usage_pages(struct mem_cgroup *memcg)
+{
+	return page_counter_read(&memcg->memory);
+}
+
+/*
+ * Returns the index of @memcg in the per-memcg arrays, or -1 if objects
+ * of @memcg belong on the global lists. Objects of a destroyed memcg are
+ * looked up on behalf of the memcg that inherited them.
+ */
+int memcg_cache_id(struct mem_cgroup *memcg)
+{
+	while (memcg && ACCESS_ONCE(memcg->kmem_dead)) {
+		/* pairs with the smp_wmb() in memcg_reparent_kmem() */
+		smp_rmb();
+		memcg = memcg->kmem_reparent;
+	}
+	if (!memcg_can_account_kmem(memcg))
+		return -1;
+	return memcg->kmemcg_id;
+}
+
+int memcg_nr_cache_ids(void)
+{
+	return memcg_limited_groups_array_size;
+}
+
+/*
+ * Stabilize the set and number of memcg cache ids: they do not change
+ * until memcg_put_cache_ids().
+ */
+void memcg_get_cache_ids(void)
+{
+	mutex_lock(&memcg_cache_mutex);
+}
+
+void memcg_put_cache_ids(void)
+{
+	mutex_unlock(&memcg_cache_mutex);
+}
+
+/*
+ * Returns the memcg that the slab object @ptr is charged to, if any.
+ */
+struct mem_cgroup *mem_cgroup_from_kmem(void *ptr)
+{
+	struct memcg_cache_params *params;
+	struct mem_cgroup *memcg = NULL;
+	struct page *page;
+
+	if (!memcg_kmem_enabled())
+		return NULL;
+
+	page = virt_to_head_page(ptr);
+	if (!PageSlab(page))
+		return NULL;
+
+	/* root params may be replaced by memcg_update_all_caches() */
+	rcu_read_lock();
+	params = rcu_dereference(page->slab->memcg_params);
+	if (params && !params->is_root_cache)
+		memcg = params->memcg;
+	rcu_read_unlock();
+	return memcg;
+}
+#endif
+
+static int memcg_charge_kmem(struct mem_cgroup *memcg, gfp_t gfp, u64 size)
+{
+	unsigned int nr_pages = size >> PAGE_SHIFT;
+	struct page_counter *counter;
+	struct mem_cgroup *_memcg;
+	bool may_oom;
+	int ret;
+
+	ret = page_counter_try_charge(&memcg->kmem, nr_pages, &counter);
+	if (ret)
+		return ret;
+
+	/*
+	 * Conditions under which we can wait for the oom_killer. Those are
+	 * the same conditions tested by the core page allocator
+	 */
+	may_oom = (gfp & __GFP_FS) && !(gfp & __GFP_NORETRY);
+
+	_memcg = memcg;
+	ret = __mem_cgroup_try_charge(NULL, gfp, nr_pages, &_memcg, may_oom);
+	if (ret == -EINTR) {
+		/*
+		 * __mem_cgroup_try_charge() chose to bypass to root due to
+		 * OOM kill or fatal signal. Since our only options are to
+		 * either fail the allocation or charge it to this cgroup, do
+		 * it as a temporary condition. But we can't fail. From a
+		 * kmem/slab perspective, the cache has already been selected
+		 * and the uncharge will use this memcg.
+		 */
+		page_counter_charge(&memcg->memory, nr_pages);
+		if (do_swap_account)
+			page_counter_charge(&memcg->memsw, nr_pages);
+		ret = 0;
+	} else if (ret)
+		page_counter_uncharge(&memcg->kmem, nr_pages);
+
+	return ret;
+}
+
+static void memcg_uncharge_kmem(struct mem_cgroup *memcg, u64 size)
+{
+	unsigned int nr_pages = size >> PAGE_SHIFT;
+
+	page_counter_uncharge(&memcg->memory, nr_pages);
+	if (do_swap_account)
+		page_counter_uncharge(&memcg->memsw, nr_pages);
+	page_counter_uncharge(&memcg->kmem, nr_pages);
+}
+
+/*
+ * We need to verify if the allocation against current->mm->owner's memcg
+ * is possible for the given order. But the page is not allocated yet, so
+ * we'll need a further commit step to do the final arrangements.
+ *
+ * It is possible for the task to switch cgroups in this mean time, so at
+ * commit time, we can't rely on task conversion any longer.  We'll then
+ * use the handle argument to return to the caller which cgroup we should
+ * commit against. We could also return the memcg directly and avoid the
+ * pointer passing, but a boolean return value gives better semantics
+ * considering the compiled-out case as well.
+ *
+ * Returning true means the allocation is possible.
+ */
+bool __memcg_kmem_newpage_charge(gfp_t gfp, struct mem_cgroup **_memcg,
+				 int order)
+{
+	struct mem_cgroup *memcg;
+	int ret;
+
+	/*
+	 * Disabling accounting is only relevant for some specific memcg
+	 * internal allocations. Therefore we would initially not have such
+	 * check here, since direct calls to the page allocator that are
+	 * marked with GFP_KMEMCG only happen outside memcg core. We are
+	 * mostly concerned with cache allocations, and by having this test
+	 * at memcg_kmem_get_cache, we are already able to relay the
+	 * allocation to the root cache and bypass the memcg cache altogether.
+	 */
+	if (in_interrupt() || !current->mm || (current->flags & PF_KTHREAD))
+		return true;
+
+	memcg = try_get_mem_cgroup_from_mm(current->mm);
+	if (!memcg)
+		return true;
+
+	if (!memcg_can_account_kmem(memcg)) {
+		css_put(&memcg->css);
+		return true;
+	}
+
+	ret = memcg_charge_kmem(memcg, gfp, PAGE_SIZE << order);
+	if (!ret) {
+		/* dropped by __memcg_kmem_uncharge_pages() */
+		mem_cgroup_get(memcg);
+		*_memcg = memcg;
+	}
+
+	css_put(&memcg->css);
+	return (ret == 0);
+}
+
+void __memcg_kmem_commit_charge(struct page *page, struct mem_cgroup *memcg,
+				int order)
+{
+	struct page_cgroup *pc;
+
+	/* The page allocation failed. Revert */
+	if (!page) {
+		memcg_uncharge_kmem(memcg, PAGE_SIZE << order);
+		mem_cgroup_put(memcg);
+		return;
+	}
+
+	pc = lookup_page_cgroup(page);
+	lock_page_cgroup(pc);
+	pc->mem_cgroup = memcg;
+	SetPageCgroupUsed(pc);
+	unlock_page_cgroup(pc);
+}
+
+void __memcg_kmem_uncharge_pages(struct page *page, int order)
+{
+	struct mem_cgroup *memcg = NULL;
+	struct page_cgroup *pc;
+
+	pc = lookup_page_cgroup(page);
+	/*
+	 * Fast unlocked return. Theoretically might have changed, have to
+	 * check again after locking.
+	 */
+	if (!PageCgroupUsed(pc))
+		return;
+
+	lock_page_cgroup(pc);
+	if (PageCgroupUsed(pc)) {
+		memcg = pc->mem_cgroup;
+		ClearPageCgroupUsed(pc);
+	}
+	unlock_page_cgroup(pc);
+
+	/*
+	 * We trust that only if there is a memcg associated with the page, it
+	 * is a valid allocation
+	 */
+	if (!memcg)
+		return;
+
+	VM_BUG_ON(mem_cgroup_is_root(memcg));
+	memcg_uncharge_kmem(memcg, PAGE_SIZE << order);
+	mem_cgroup_put(memcg);
+}
+
+#ifdef CONFIG_SLUB
+static inline struct memcg_cache_params *
+root_cache_params(struct kmem_cache *s)
+{
+	return rcu_dereference_protected(s->memcg_params,
+				lockdep_is_held(&memcg_cache_mutex));
+}
+
+static size_t memcg_root_params_size(int nr)
+{
+	return offsetof(struct memcg_cache_params, memcg_caches) +
+		nr * sizeof(struct kmem_cache *);
+}
+
+/*
+ * Called from kmem_cache_create() for SLAB_ACCOUNT caches, with no lock
+ * held. Child caches get their params from kmem_cache_create_memcg().
+ */
+int memcg_register_cache(struct kmem_cache *s)
+{
+	struct memcg_cache_params *params;
+
+	if (s->memcg_params)
+		return 0;
+
+	mutex_lock(&memcg_cache_mutex);
+	params = kzalloc(memcg_root_params_size(memcg_limited_groups_array_size),
+			 GFP_KERNEL);
+	if (!params) {
+		mutex_unlock(&memcg_cache_mutex);
+		return -ENOMEM;
+	}
+	params->is_root_cache = true;
+	params->cachep = s;
+	INIT_LIST_HEAD(&params->children);
+	list_add(&params->list, &memcg_root_caches);
+	rcu_assign_pointer(s->memcg_params, params);
+	mutex_unlock(&memcg_cache_mutex);
+	return 0;
+}
+
+/*
+ * Grow the memcg_caches array of every root cache so that it can hold
+ * @num entries. Lookups dereference the arrays under rcu_read_lock(), so
+ * the old copies are freed after a grace period.
+ */
+static int memcg_update_all_caches(int num)
+{
+	struct memcg_cache_params *old, *new, *tmp;
+	int new_size;
+
+	lockdep_assert_held(&memcg_cache_mutex);
+
+	if (num <= memcg_limited_groups_array_size)
+		return 0;
+
+	new_size = clamp(2 * num, MEMCG_CACHES_MIN_SIZE, MEMCG_CACHES_MAX_SIZE);
+
+	list_for_each_entry_safe(old, tmp, &memcg_root_caches, list) {
+		new = kzalloc(memcg_root_params_size(new_size), GFP_KERNEL);
+		if (!new)
+			return -ENOMEM;
+
+		new->is_root_cache = true;
+		new->cachep = old->cachep;
+		memcpy(new->memcg_caches, old->memcg_caches,
+		       memcg_limited_groups_array_size *
+		       sizeof(struct kmem_cache *));
+		INIT_LIST_HEAD(&new->children);
+		list_splice_init(&old->children, &new->children);
+		list_replace(&old->list, &new->list);
+		rcu_assign_pointer(new->cachep->memcg_params, new);
+		kfree_rcu(old, rcu_head);
+	}
+
+	if (memcg_update_all_list_lrus(new_size))
+		return -ENOMEM;
+
+	memcg_limited_groups_array_size = new_size;
+	return 0;
+}
+
+
+/* runs cache creation and destruction; flushed when a root cache goes away */
+static struct workqueue_struct *memcg_kmem_wq;
+
+static void memcg_cache_destroy_work_func(struct work_struct *w)
+{
+	struct memcg_cache_params *params;
+	struct kmem_cache *cachep;
+
+	params = container_of(w, struct memcg_cache_params, destroy);
+	cachep = params->cachep;
+
+	/*
+	 * Shrinking releases the empty slabs; if that takes the page count
+	 * to zero, memcg_uncharge_slab() requeues us and the next run
+	 * destroys the cache. Otherwise the last slab free will.
+	 */
+	if (atomic_read(&params->nr_pages) != 0) {
+		kmem_cache_shrink(cachep);
+		return;
+	}
+	kmem_cache_destroy(cachep);
+}
+
+static void memcg_create_kmem_cache(struct mem_cgroup *memcg,
+				    struct kmem_cache *cachep)
+{
+	struct memcg_cache_params *params;
+	struct kmem_cache *new;
+	int idx = memcg->kmemcg_id;
+
+	mutex_lock(&memcg_cache_mutex);
+	params = root_cache_params(cachep);
+	/* someone else may have created it while we were queued */
+	if (!params || params->memcg_caches[idx])
+		goto out;
+
+	new = kmem_cache_create_memcg(memcg, cachep, idx);
+	if (!new)
+		goto out;
+
+	/* dropped by memcg_release_cache() */
+	mem_cgroup_get(memcg);
+	INIT_WORK(&new->memcg_params->destroy, memcg_cache_destroy_work_func);
+	list_add(&new->memcg_params->list, &params->children);
+	list_add(&new->memcg_params->memcg_list, &memcg->memcg_slab_caches);
+	rcu_assign_pointer(params->memcg_caches[idx], new);
+out:
+	mutex_unlock(&memcg_cache_mutex);
+}
+
+struct create_work {
+	struct mem_cgroup *memcg;
+	struct kmem_cache *cachep;
+	struct list_head list;
+	struct work_struct work;
+};
+
+/*
+ * Creations queued and not done yet. Every allocation from a cache that
+ * has no child for its memcg asks for one, so each (memcg, cache) pair
+ * is queued only once until its work has run.
+ */
+static LIST_HEAD(memcg_create_list);
+static DEFINE_SPINLOCK(memcg_create_lock);
+
+static void memcg_create_cache_work_func(struct work_struct *w)
+{
+	struct create_work *cw = container_of(w, struct create_work, work);
+
+	memcg_create_kmem_cache(cw->memcg, cw->cachep);
+
+	spin_lock(&memcg_create_lock);
+	list_del(&cw->list);
+	spin_unlock(&memcg_create_lock);
+
+	css_put(&cw->memcg->css);
+	kfree(cw);
+}
+
+/*
+ * Enqueue the creation of a per-memcg kmem_cache. Called with
+ * rcu_read_lock() held, from within the slab allocator.
+ */
+static void memcg_create_cache_enqueue(struct mem_cgroup *memcg,
+				       struct kmem_cache *cachep)
+{
+	struct create_work *cw;
+
+	spin_lock(&memcg_create_lock);
+	list_for_each_entry(cw, &memcg_create_list, list) {
+		if (cw->memcg == memcg && cw->cachep == cachep)
+			goto out;
+	}
+
+	cw = kmalloc(sizeof(struct create_work), GFP_NOWAIT | __GFP_NOWARN);
+	if (!cw)
+		goto out;
+
+	/* The corresponding put will be done in the workqueue. */
+	if (!css_tryget(&memcg->css)) {
+		kfree(cw);
+		goto out;
+	}
+
+	cw->memcg = memcg;
+	cw->cachep = cachep;
+	list_add(&cw->list, &memcg_create_list);
+	INIT_WORK(&cw->work, memcg_create_cache_work_func);
+	queue_work(memcg_kmem_wq, &cw->work);
+out:
+	spin_unlock(&memcg_create_lock);
+}
+
+/*
+ * Return the kmem_cache we're supposed to use for a slab allocation.
+ * We try to use the current memcg's version of the cache.
+ *
+ * If the cache does not exist yet, if we are the first user of it,
+ * we either create it immediately, if possible, or create it asynchronously
+ * in a workqueue.
+ * In the latter case, we will let the current allocation go through with
+ * the original cache.
+ */
+struct kmem_cache *__memcg_kmem_get_cache(struct kmem_cache *cachep,
+					  gfp_t gfp)
+{
+	struct memcg_cache_params *params;
+	struct kmem_cache *memcg_cachep;
+	struct mem_cgroup *memcg;
+
+	if (in_interrupt() || !current->mm || (current->flags & PF_KTHREAD))
+		return cachep;
+	/* If the task is dying, just let it go. */
+	if (unlikely(fatal_signal_pending(current)))
+		return cachep;
+
+	rcu_read_lock();
+	memcg = mem_cgroup_from_task(rcu_dereference(current->mm->owner));
+	if (!memcg_can_account_kmem(memcg))
+		goto out;
+
+	params = rcu_dereference(cachep->memcg_params);
+	memcg_cachep = rcu_dereference(params->memcg_caches[memcg->kmemcg_id]);
+	if (likely(memcg_cachep)) {
+		cachep = memcg_cachep;
+		goto out;
+	}
+
+	memcg_create_cache_enqueue(memcg, cachep);
+out:
+	rcu_read_unlock();
+	return cachep;
+}
+
+/*
+ * Give the empty slabs of @memcg's caches back to the page allocator.
+ * Used when a slab charge hits the kmem limit.
+ */
+static void memcg_shrink_slab_caches(struct mem_cgroup *memcg)
+{
+	struct memcg_cache_params *params;
+
+	if (!mutex_trylock(&memcg_cache_mutex))
+		return;
+	list_for_each_entry(params, &memcg->memcg_slab_caches, memcg_list)
+		kmem_cache_shrink(params->cachep);
+	mutex_unlock(&memcg_cache_mutex);
+}
+
+int memcg_charge_slab(struct kmem_cache *s, gfp_t gfp, int order)
+{
+	struct memcg_cache_params *params = s->memcg_params;
+	int ret;
+
+	ret = memcg_charge_kmem(params->memcg, gfp, PAGE_SIZE << order);
+	/*
+	 * Shrinking can block and free objects that call back into the
+	 * filesystem, so only do it where reclaim could have done that too.
+	 */
+	if (ret && (gfp & __GFP_WAIT) && (gfp & __GFP_FS)) {
+		memcg_shrink_slab_caches(params->memcg);
+		ret = memcg_charge_kmem(params->memcg, gfp, PAGE_SIZE << order);
+	}
+	if (!ret)
+		atomic_add(1 << order, &params->nr_pages);
+	return ret;
+}
+
+void memcg_uncharge_slab(struct kmem_cache *s, int order)
+{
+	struct memcg_cache_params *params = s->memcg_params;
+
+	memcg_uncharge_kmem(params->memcg, PAGE_SIZE << order);
+	if (atomic_sub_and_test(1 << order, &params->nr_pages) && params->dead)
+		queue_work(memcg_kmem_wq, &params->destroy);
+}
+
+/*
+ * Stop new allocations from a child cache and schedule its destruction
+ * once its last slab page is gone. Called with memcg_cache_mutex held.
+ *
+ * The destroy work is queued only once here: after that it is requeued
+ * by memcg_uncharge_slab(), so a cache that is already being destroyed
+ * is never queued again.
+ */
+static void memcg_kill_cache(struct memcg_cache_params *params)
+{
+	struct memcg_cache_params *root_params;
+
+	if (params->dead)
+		return;
+
+	root_params = root_cache_params(params->root_cache);
+	rcu_assign_pointer(root_params->memcg_caches[params->memcg->kmemcg_id],
+			   NULL);
+	params->dead = true;
+	kmem_cache_mark_dead(params->cachep);
+	queue_work(memcg_kmem_wq, &params->destroy);
+}
+
+/*
+ * Called by kmem_cache_destroy() once the cache has been emptied.
+ */
+void memcg_release_cache(struct kmem_cache *s)
+{
+	struct memcg_cache_params *params = s->memcg_params;
+	struct memcg_cache_params *child;
+	int pass;
+
+	if (!params)
+		return;
+
+	if (!params->is_root_cache) {
+		mutex_lock(&memcg_cache_mutex);
+		if (!params->dead) {
+			struct memcg_cache_params *root_params;
+
+			root_params = root_cache_params(params->root_cache);
+			rcu_assign_pointer(
+				root_params->memcg_caches[params->memcg->kmemcg_id],
+				NULL);
+		}
+		list_del(&params->list);
+		list_del(&params->memcg_list);
+		mutex_unlock(&memcg_cache_mutex);
+
+		mem_cgroup_put(params->memcg);
+		s->memcg_params = NULL;
+		kfree(params);
+		return;
+	}
+
+	/*
+	 * The owner of a root cache has freed all its objects, including
+	 * those in the per-memcg copies. Kill the copies and let the destroy
+	 * work tear them down; a few flushes may be needed since shrinking
+	 * requeues the work.
+	 */
+	for (pass = 0; pass < 3; pass++) {
+		bool empty;
+
+		flush_workqueue(memcg_kmem_wq);
+		mutex_lock(&memcg_cache_mutex);
+		params = root_cache_params(s);
+		empty = list_empty(&params->children);
+		list_for_each_entry(child, &params->children, list)
+			memcg_kill_cache(child);
+		mutex_unlock(&memcg_cache_mutex);
+		if (empty)
+			break;
+	}
+
+	mutex_lock(&memcg_cache_mutex);
+	params = root_cache_params(s);
+	WARN(!list_empty(&params->children),
+	     "%s: memcg caches of %s still have objects\n", __func__, s->name);
+	list_del(&params->list);
+	rcu_assign_pointer(s->memcg_params, NULL);
+	mutex_unlock(&memcg_cache_mutex);
+	kfree_rcu(params, rcu_head);
+}
+
+static void memcg_destroy_all_caches(struct mem_cgroup *memcg)
 {
-	struct mem_cgroup *memcg = NULL;
-	struct page_cgroup *pc;
-	unsigned short id;
-	swp_entry_t ent;
-
-	VM_BUG_ON(!PageLocked(page));
+	struct memcg_cache_params *params;
 
-	pc = lookup_page_cgroup(page);
-	lock_page_cgroup(pc);
-	if (PageCgroupUsed(pc)) {
-		memcg = pc->mem_cgroup;
-		if (memcg && !css_tryget(&memcg->css))
-			memcg = NULL;
-	} else if (PageSwapCache(page)) {
-		ent.val = page_private(page);
-		id = lookup_swap_cgroup_id(ent);
-		rcu_read_lock();
-		memcg = mem_cgroup_lookup(id);
-		if (memcg && !css_tryget(&memcg->css))
-			memcg = NULL;
-		rcu_read_unlock();
-	}
-	unlock_page_cgroup(pc);
-	return memcg;
+	mutex_lock(&memcg_cache_mutex);
+	list_for_each_entry(params, &memcg->memcg_slab_caches, memcg_list)
+		memcg_kill_cache(params);
+	mutex_unlock(&memcg_cache_mutex);
 }
 
-static void __mem_cgroup_commit_charge(struct mem_cgroup *memcg,
-				       struct page *page,
-				       unsigned int nr_pages,
-				       struct page_cgroup *pc,
-				       enum charge_type ctype,
-				       bool lrucare)
+/*
+ * Hand the objects that @memcg still has on list_lrus over to its parent,
+ * or to the global lists if the parent does not account kmem, so that
+ * reclaim keeps finding them once @memcg is gone. Objects added later
+ * follow the same way through memcg_cache_id().
+ */
+static void memcg_reparent_kmem(struct mem_cgroup *memcg)
 {
-	struct zone *uninitialized_var(zone);
-	bool was_on_lru = false;
-	bool anon;
+	struct mem_cgroup *parent = parent_mem_cgroup(memcg);
 
-	lock_page_cgroup(pc);
-	if (unlikely(PageCgroupUsed(pc))) {
-		unlock_page_cgroup(pc);
-		__mem_cgroup_cancel_charge(memcg, nr_pages);
+	if (!memcg->kmem_account_active)
 		return;
-	}
-	/*
-	 * we don't need page_cgroup_lock about tail pages, becase they are not
-	 * accessed by any other context at this point.
-	 */
 
+	if (!memcg_can_account_kmem(parent))
+		parent = NULL;
+
+	mutex_lock(&memcg_cache_mutex);
+	memcg->kmem_reparent = parent;
+	/* pairs with the smp_rmb() in memcg_cache_id() */
+	smp_wmb();
+	memcg->kmem_dead = true;
 	/*
-	 * In some cases, SwapCache and FUSE(splice_buf->radixtree), the page
-	 * may already be on some other mem_cgroup's LRU.  Take care of it.
+	 * list_lru_add() looks the id up under the list lock, so nothing can
+	 * be added to our lists once they have been drained.
 	 */
-	if (lrucare) {
-		zone = page_zone(page);
-		spin_lock_irq(&zone->lru_lock);
-		if (PageLRU(page)) {
-			ClearPageLRU(page);
-			del_page_from_lru_list(zone, page, page_lru(page));
-			was_on_lru = true;
-		}
+	memcg_drain_all_list_lrus(memcg->kmemcg_id, memcg_cache_id(parent));
+	mutex_unlock(&memcg_cache_mutex);
+}
+#else
+static inline void memcg_destroy_all_caches(struct mem_cgroup *memcg)
+{
+}
+
+static inline void memcg_reparent_kmem(struct mem_cgroup *memcg)
+{
+}
+
+static inline int memcg_update_all_caches(int num)
+{
+	return 0;
+}
+#endif /* CONFIG_SLUB */
+
+static int memcg_activate_kmem(struct mem_cgroup *memcg)
+{
+	int id, ret;
+
+	if (memcg->kmem_account_active)
+		return 0;
+
+	id = ida_simple_get(&kmem_limited_groups, 0, MEMCG_CACHES_MAX_SIZE,
+			    GFP_KERNEL);
+	if (id < 0)
+		return id;
+
+	mutex_lock(&memcg_cache_mutex);
+	ret = memcg_update_all_caches(id + 1);
+	mutex_unlock(&memcg_cache_mutex);
+	if (ret) {
+		ida_simple_remove(&kmem_limited_groups, id);
+		return ret;
 	}
 
-	pc->mem_cgroup = memcg;
+	memcg->kmemcg_id = id;
 	/*
-	 * We access a page_cgroup asynchronously without lock_page_cgroup().
-	 * Especially when a page_cgroup is taken from a page, pc->mem_cgroup
-	 * is accessed after testing USED bit. To make pc->mem_cgroup visible
-	 * before USED bit, we need memory barrier here.
-	 * See mem_cgroup_add_lru_list(), etc.
- 	 */
+	 * The key is never disabled again: objects of per-memcg caches must
+	 * keep being freed through memcg_kmem_get_cache()'s counterpart.
+	 */
+	static_key_slow_inc(&memcg_kmem_enabled_key);
+	/* pairs with the smp_rmb() in memcg_can_account_kmem() */
 	smp_wmb();
-	SetPageCgroupUsed(pc);
+	memcg->kmem_account_active = true;
+	return 0;
+}
 
-	if (lrucare) {
-		if (was_on_lru) {
-			VM_BUG_ON(PageLRU(page));
-			SetPageLRU(page);
-			add_page_to_lru_list(zone, page, page_lru(page));
-		}
-		spin_unlock_irq(&zone->lru_lock);
-	}
+/*
+ * Children of an accounting memcg are accounted too, so that their kernel
+ * memory counts towards the parent's kmem limit.
+ */
+static int memcg_init_kmem(struct mem_cgroup *memcg, struct mem_cgroup *parent)
+{
+	memcg->kmemcg_id = -1;
+	INIT_LIST_HEAD(&memcg->memcg_slab_caches);
+	if (parent && parent->use_hierarchy) {
+		page_counter_init(&memcg->kmem, &parent->kmem);
+		if (parent->kmem_account_active)
+			return memcg_activate_kmem(memcg);
+	} else
+		page_counter_init(&memcg->kmem, NULL);
+	return 0;
+}
 
-	if (ctype == MEM_CGROUP_CHARGE_TYPE_MAPPED)
-		anon = true;
-	else
-		anon = false;
+static void memcg_free_kmem(struct mem_cgroup *memcg)
+{
+	if (memcg->kmem_account_active)
+		ida_simple_remove(&kmem_limited_groups, memcg->kmemcg_id);
+}
 
-	mem_cgroup_charge_statistics(memcg, anon, nr_pages);
-	unlock_page_cgroup(pc);
+static int __init memcg_kmem_init(void)
+{
+	memcg_kmem_wq = alloc_workqueue("memcg_kmem", WQ_NON_REENTRANT, 0);
+	BUG_ON(!memcg_kmem_wq);
+	return 0;
+}
+__initcall(memcg_kmem_init);
+#else
+static inline int memcg_init_kmem(struct mem_cgroup *memcg,
+				  struct mem_cgroup *parent)
+{
+	return 0;
+}
 
-	/*
-	 * "charge_statistics" updated event counter. Then, check it.
-	 * Insert ancestor (and ancestor's ancestors), to softlimit RB-tree.
-	 * if they exceeds softlimit.
-	 */
-	memcg_check_events(memcg, page);
+static inline void memcg_free_kmem(struct mem_cgroup *memcg)
+{
 }
 
+static inline unsigned long memcg_kmem_usage(struct mem_cgroup *memcg)
+{
+	return 0;
+}
+#endif /* CONFIG_CGROUP_MEM_RES_CTLR_KMEM */
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
 
 #define PCGF_NOCOPY_AT_SPLIT ((1 << PCG_LOCK) | (1 << PCG_MIGRATION))
@@ -2862,8 +3798,7 @@ __mem_cgroup_commit_charge_swapin(struct page *page, struct mem_cgroup *memcg,
 			 * calling css_tryget
 			 */
 			if (!mem_cgroup_is_root(swap_memcg))
-				res_counter_uncharge(&swap_memcg->memsw,
-						     PAGE_SIZE);
+				page_counter_uncharge(&swap_memcg->memsw, 1);
 			mem_cgroup_swap_statistics(swap_memcg, false);
 			mem_cgroup_put(swap_memcg);
 		}
@@ -2893,6 +3828,22 @@ void mem_cgroup_cancel_charge_swapin(struct mem_cgroup *memcg)
 	__mem_cgroup_cancel_charge(memcg, 1);
 }
 
+static void mem_cgroup_flush_uncharge_batch(struct memcg_batch_info *batch)
+{
+	/*
+	 * This "batch->memcg" is valid without any css_get/put etc...
+	 * bacause we hide charges behind us.
+	 */
+	if (batch->nr_pages)
+		page_counter_uncharge(&batch->memcg->memory, batch->nr_pages);
+	if (batch->memsw_nr_pages)
+		page_counter_uncharge(&batch->memcg->memsw,
+				      batch->memsw_nr_pages);
+	memcg_oom_recover(batch->memcg);
+	batch->nr_pages = 0;
+	batch->memsw_nr_pages = 0;
+}
+
 static void mem_cgroup_do_uncharge(struct mem_cgroup *memcg,
 				   unsigned int nr_pages,
 				   const enum charge_type ctype)
@@ -2907,8 +3858,8 @@ static void mem_cgroup_do_uncharge(struct mem_cgroup *memcg,
 	batch = &current->memcg_batch;
 	/*
 	 * In usual, we do css_get() when we remember memcg pointer.
-	 * But in this case, we keep res->usage until end of a series of
-	 * uncharges. Then, it's ok to ignore memcg's refcnt.
+	 * But in this case, we keep the counted usage until end of a
+	 * series of uncharges. Then, it's ok to ignore memcg's refcnt.
 	 */
 	if (!batch->memcg)
 		batch->memcg = memcg;
@@ -2928,20 +3879,24 @@ static void mem_cgroup_do_uncharge(struct mem_cgroup *memcg,
 
 	/*
 	 * In typical case, batch->memcg == mem. This means we can
-	 * merge a series of uncharges to an uncharge of res_counter.
-	 * If not, we uncharge res_counter ony by one.
+	 * merge a series of uncharges to an uncharge of the counters.
+	 * When the pages switch to another memcg, or the hidden charges
+	 * grow large enough to matter to the limit, flush what we have
+	 * and start batching again.
 	 */
-	if (batch->memcg != memcg)
-		goto direct_uncharge;
+	if (batch->memcg != memcg || batch->nr_pages >= CHARGE_BATCH_MAX) {
+		mem_cgroup_flush_uncharge_batch(batch);
+		batch->memcg = memcg;
+	}
 	/* remember freed charge and uncharge it later */
 	batch->nr_pages++;
 	if (uncharge_memsw)
 		batch->memsw_nr_pages++;
 	return;
 direct_uncharge:
-	res_counter_uncharge(&memcg->res, nr_pages * PAGE_SIZE);
+	page_counter_uncharge(&memcg->memory, nr_pages);
 	if (uncharge_memsw)
-		res_counter_uncharge(&memcg->memsw, nr_pages * PAGE_SIZE);
+		page_counter_uncharge(&memcg->memsw, nr_pages);
 	if (unlikely(batch->memcg != memcg))
 		memcg_oom_recover(memcg);
 }
@@ -3020,7 +3975,7 @@ __mem_cgroup_uncharge_common(struct page *page, enum charge_type ctype)
 
 	unlock_page_cgroup(pc);
 	/*
-	 * even after unlock, we have memcg->res.usage here and this memcg
+	 * even after unlock, we have memcg->memory.count here and this memcg
 	 * will never be freed.
 	 */
 	memcg_check_events(memcg, page);
@@ -3055,10 +4010,11 @@ void mem_cgroup_uncharge_cache_page(struct page *page)
 }
 
 /*
- * Batch_start/batch_end is called in unmap_page_range/invlidate/trucate.
- * In that cases, pages are freed continuously and we can expect pages
- * are in the same memcg. All these calls itself limits the number of
- * pages freed at once, then uncharge_start/end() is called properly.
+ * Batch_start/batch_end brackets whole unmap_vmas/invalidate/truncate
+ * operations. In that cases, pages are freed continuously and we can
+ * expect pages are in the same memcg. mem_cgroup_do_uncharge() flushes
+ * the batch every CHARGE_BATCH_MAX pages and whenever the memcg changes,
+ * so the hidden charges stay bounded however large the operation is.
  * This may be called prural(2) times in a context,
  */
 
@@ -3086,17 +4042,7 @@ void mem_cgroup_uncharge_end(void)
 
 	if (!batch->memcg)
 		return;
-	/*
-	 * This "batch->memcg" is valid without any css_get/put etc...
-	 * bacause we hide charges behind us.
-	 */
-	if (batch->nr_pages)
-		res_counter_uncharge(&batch->memcg->res,
-				     batch->nr_pages * PAGE_SIZE);
-	if (batch->memsw_nr_pages)
-		res_counter_uncharge(&batch->memcg->memsw,
-				     batch->memsw_nr_pages * PAGE_SIZE);
-	memcg_oom_recover(batch->memcg);
+	mem_cgroup_flush_uncharge_batch(batch);
 	/* forget this pointer (for sanity check) */
 	batch->memcg = NULL;
 }
@@ -3148,7 +4094,7 @@ void mem_cgroup_uncharge_swap(swp_entry_t ent)
 		 * This memcg can be obsolete one. We avoid calling css_tryget
 		 */
 		if (!mem_cgroup_is_root(memcg))
-			res_counter_uncharge(&memcg->memsw, PAGE_SIZE);
+			page_counter_uncharge(&memcg->memsw, 1);
 		mem_cgroup_swap_statistics(memcg, false);
 		mem_cgroup_put(memcg);
 	}
@@ -3160,15 +4106,15 @@ void mem_cgroup_uncharge_swap(swp_entry_t ent)
  * @entry: swap entry to be moved
  * @from:  mem_cgroup which the entry is moved from
  * @to:  mem_cgroup which the entry is moved to
- * @need_fixup: whether we should fixup res_counters and refcounts.
+ * @need_fixup: whether we should fixup page counters and refcounts.
  *
  * It succeeds only when the swap_cgroup's record for this entry is the same
  * as the mem_cgroup's id of @from.
  *
  * Returns 0 on success, -EINVAL on failure.
  *
- * The caller must have charged to @to, IOW, called res_counter_charge() about
- * both res and memsw, and called css_get().
+ * The caller must have charged to @to, IOW, called page_counter_charge() about
+ * both memory and memsw, and called css_get().
  */
 static int mem_cgroup_move_swap_account(swp_entry_t entry,
 		struct mem_cgroup *from, struct mem_cgroup *to, bool need_fixup)
@@ -3183,7 +4129,7 @@ static int mem_cgroup_move_swap_account(swp_entry_t entry,
 		mem_cgroup_swap_statistics(to, true);
 		/*
 		 * This function is only called from task migration context now.
-		 * It postpones res_counter and refcount handling till the end
+		 * It postpones page counter and refcount handling till the end
 		 * of task migration(mem_cgroup_clear_mc()) for performance
 		 * improvement. But we cannot postpone mem_cgroup_get(to)
 		 * because if the process that has been moved to @to does
@@ -3192,14 +4138,14 @@ static int mem_cgroup_move_swap_account(swp_entry_t entry,
 		mem_cgroup_get(to);
 		if (need_fixup) {
 			if (!mem_cgroup_is_root(from))
-				res_counter_uncharge(&from->memsw, PAGE_SIZE);
+				page_counter_uncharge(&from->memsw, 1);
 			mem_cgroup_put(from);
 			/*
-			 * we charged both to->res and to->memsw, so we should
-			 * uncharge to->res.
+			 * we charged both to->memory and to->memsw, so we
+			 * should uncharge to->memory.
 			 */
 			if (!mem_cgroup_is_root(to))
-				res_counter_uncharge(&to->res, PAGE_SIZE);
+				page_counter_uncharge(&to->memory, 1);
 		}
 		return 0;
 	}
@@ -3363,7 +4309,7 @@ void mem_cgroup_end_migration(struct mem_cgroup *memcg,
 
 /*
  * At replace page cache, newpage is not under any memcg but it's on
- * LRU. So, this function doesn't touch res_counter but handles LRU
+ * LRU. So, this function doesn't touch page counters but handles LRU
  * in correct way. Both pages are locked so we cannot race with uncharge.
  */
 void mem_cgroup_replace_page_cache(struct page *oldpage,
@@ -3434,13 +4380,13 @@ void mem_cgroup_print_bad_page(struct page *page)
 static DEFINE_MUTEX(set_limit_mutex);
 
 static int mem_cgroup_resize_limit(struct mem_cgroup *memcg,
-				unsigned long long val)
+				   unsigned long limit)
 {
 	int retry_count;
-	u64 memswlimit, memlimit;
+	unsigned long memswlimit, memlimit;
 	int ret = 0;
 	int children = mem_cgroup_count_children(memcg);
-	u64 curusage, oldusage;
+	unsigned long curusage, oldusage;
 	int enlarge;
 
 	/*
@@ -3450,7 +4396,7 @@ static int mem_cgroup_resize_limit(struct mem_cgroup *memcg,
 	 */
 	retry_count = MEM_CGROUP_RECLAIM_RETRIES * children;
 
-	oldusage = res_counter_read_u64(&memcg->res, RES_USAGE);
+	oldusage = page_counter_read(&memcg->memory);
 
 	enlarge = 0;
 	while (retry_count) {
@@ -3461,23 +4407,28 @@ static int mem_cgroup_resize_limit(struct mem_cgroup *memcg,
 		/*
 		 * Rather than hide all in some function, I do this in
 		 * open coded manner. You see what this really does.
-		 * We have to guarantee memcg->res.limit < memcg->memsw.limit.
+		 * We have to guarantee memcg->memory.limit < memcg->memsw.limit.
 		 */
 		mutex_lock(&set_limit_mutex);
-		memswlimit = res_counter_read_u64(&memcg->memsw, RES_LIMIT);
-		if (memswlimit < val) {
+		memswlimit = memcg->memsw.limit;
+		if (memswlimit < limit) {
 			ret = -EINVAL;
 			mutex_unlock(&set_limit_mutex);
 			break;
 		}
 
-		memlimit = res_counter_read_u64(&memcg->res, RES_LIMIT);
-		if (memlimit < val)
+		memlimit = memcg->memory.limit;
+		if (memlimit < limit)
 			enlarge = 1;
 
-		ret = res_counter_set_limit(&memcg->res, val);
+		ret = page_counter_limit(&memcg->memory, limit);
 		if (!ret) {
-			if (memswlimit == val)
+			struct mem_cgroup *iter;
+
+			/* the descendants are bound by the new limit too */
+			for_each_mem_cgroup_tree(iter, memcg)
+				mem_cgroup_update_charge_batch(iter);
+			if (memswlimit == limit)
 				memcg->memsw_is_minimum = true;
 			else
 				memcg->memsw_is_minimum = false;
@@ -3489,7 +4440,7 @@ static int mem_cgroup_resize_limit(struct mem_cgroup *memcg,
 
 		mem_cgroup_reclaim(memcg, GFP_KERNEL,
 				   MEM_CGROUP_RECLAIM_SHRINK);
-		curusage = res_counter_read_u64(&memcg->res, RES_USAGE);
+		curusage = page_counter_read(&memcg->memory);
 		/* Usage is reduced ? */
   		if (curusage >= oldusage)
 			retry_count--;
@@ -3503,17 +4454,17 @@ static int mem_cgroup_resize_limit(struct mem_cgroup *memcg,
 }
 
 static int mem_cgroup_resize_memsw_limit(struct mem_cgroup *memcg,
-					unsigned long long val)
+					 unsigned long limit)
 {
 	int retry_count;
-	u64 memlimit, memswlimit, oldusage, curusage;
+	unsigned long memlimit, memswlimit, oldusage, curusage;
 	int children = mem_cgroup_count_children(memcg);
 	int ret = -EBUSY;
 	int enlarge = 0;
 
 	/* see mem_cgroup_resize_res_limit */
  	retry_count = children * MEM_CGROUP_RECLAIM_RETRIES;
-	oldusage = res_counter_read_u64(&memcg->memsw, RES_USAGE);
+	oldusage = page_counter_read(&memcg->memsw);
 	while (retry_count) {
 		if (signal_pending(current)) {
 			ret = -EINTR;
@@ -3522,21 +4473,21 @@ static int mem_cgroup_resize_memsw_limit(struct mem_cgroup *memcg,
 		/*
 		 * Rather than hide all in some function, I do this in
 		 * open coded manner. You see what this really does.
-		 * We have to guarantee memcg->res.limit < memcg->memsw.limit.
+		 * We have to guarantee memcg->memory.limit < memcg->memsw.limit.
 		 */
 		mutex_lock(&set_limit_mutex);
-		memlimit = res_counter_read_u64(&memcg->res, RES_LIMIT);
-		if (memlimit > val) {
+		memlimit = memcg->memory.limit;
+		if (memlimit > limit) {
 			ret = -EINVAL;
 			mutex_unlock(&set_limit_mutex);
 			break;
 		}
-		memswlimit = res_counter_read_u64(&memcg->memsw, RES_LIMIT);
-		if (memswlimit < val)
+		memswlimit = memcg->memsw.limit;
+		if (memswlimit < limit)
 			enlarge = 1;
-		ret = res_counter_set_limit(&memcg->memsw, val);
+		ret = page_counter_limit(&memcg->memsw, limit);
 		if (!ret) {
-			if (memlimit == val)
+			if (memlimit == limit)
 				memcg->memsw_is_minimum = true;
 			else
 				memcg->memsw_is_minimum = false;
@@ -3549,7 +4500,7 @@ static int mem_cgroup_resize_memsw_limit(struct mem_cgroup *memcg,
 		mem_cgroup_reclaim(memcg, GFP_KERNEL,
 				   MEM_CGROUP_RECLAIM_NOSWAP |
 				   MEM_CGROUP_RECLAIM_SHRINK);
-		curusage = res_counter_read_u64(&memcg->memsw, RES_USAGE);
+		curusage = page_counter_read(&memcg->memsw);
 		/* Usage is reduced ? */
 		if (curusage >= oldusage)
 			retry_count--;
@@ -3570,7 +4521,7 @@ unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
 	unsigned long reclaimed;
 	int loop = 0;
 	struct mem_cgroup_tree_per_zone *mctz;
-	unsigned long long excess;
+	unsigned long excess;
 	unsigned long nr_scanned;
 
 	if (order > 0)
@@ -3624,7 +4575,7 @@ unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
 			} while (1);
 		}
 		__mem_cgroup_remove_exceeded(mz->memcg, mz, mctz);
-		excess = res_counter_soft_limit_excess(&mz->memcg->res);
+		excess = soft_limit_excess(mz->memcg);
 		/*
 		 * One school of thought says that we should not add
 		 * back the node to the tree if reclaim returns 0.
@@ -3762,8 +4713,13 @@ move_account:
 		if (ret == -ENOMEM)
 			goto try_to_free;
 		cond_resched();
-	/* "ret" should also be checked to ensure all lists are empty. */
-	} while (memcg->res.usage > 0 || ret);
+	/*
+	 * "ret" should also be checked to ensure all lists are empty.
+	 * Kernel memory charges cannot be moved to the parent; they stay
+	 * with this memcg until the objects are freed.
+	 */
+	} while (page_counter_read(&memcg->memory) > memcg_kmem_usage(memcg) ||
+		 ret);
 out:
 	css_put(&memcg->css);
 	return ret;
@@ -3778,7 +4734,8 @@ try_to_free:
 	lru_add_drain_all();
 	/* try to free all pages in this cgroup */
 	shrink = 1;
-	while (nr_retries && memcg->res.usage > 0) {
+	while (nr_retries &&
+	       page_counter_read(&memcg->memory) > memcg_kmem_usage(memcg)) {
 		int progress;
 
 		if (signal_pending(current)) {
@@ -3865,9 +4822,10 @@ static inline u64 mem_cgroup_usage(struct mem_cgroup *memcg, bool swap)
 
 	if (!mem_cgroup_is_root(memcg)) {
 		if (!swap)
-			return res_counter_read_u64(&memcg->res, RES_USAGE);
+			val = page_counter_read(&memcg->memory);
 		else
-			return res_counter_read_u64(&memcg->memsw, RES_USAGE);
+			val = page_counter_read(&memcg->memsw);
+		return val << PAGE_SHIFT;
 	}
 
 	val = mem_cgroup_recursive_stat(memcg, MEM_CGROUP_STAT_CACHE);
@@ -3882,29 +4840,73 @@ static inline u64 mem_cgroup_usage(struct mem_cgroup *memcg, bool swap)
 static u64 mem_cgroup_read(struct cgroup *cont, struct cftype *cft)
 {
 	struct mem_cgroup *memcg = mem_cgroup_from_cont(cont);
-	u64 val;
+	struct page_counter *counter;
 	int type, name;
 
 	type = MEMFILE_TYPE(cft->private);
 	name = MEMFILE_ATTR(cft->private);
 	switch (type) {
 	case _MEM:
-		if (name == RES_USAGE)
-			val = mem_cgroup_usage(memcg, false);
-		else
-			val = res_counter_read_u64(&memcg->res, name);
+		counter = &memcg->memory;
 		break;
 	case _MEMSWAP:
-		if (name == RES_USAGE)
-			val = mem_cgroup_usage(memcg, true);
-		else
-			val = res_counter_read_u64(&memcg->memsw, name);
+		counter = &memcg->memsw;
+		break;
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+	case _KMEM:
+		counter = &memcg->kmem;
 		break;
+#endif
 	default:
 		BUG();
 	}
-	return val;
+
+	switch (name) {
+	case RES_USAGE:
+		if (type == _MEM)
+			return mem_cgroup_usage(memcg, false);
+		if (type == _MEMSWAP)
+			return mem_cgroup_usage(memcg, true);
+		return (u64)page_counter_read(counter) * PAGE_SIZE;
+	case RES_LIMIT:
+		return (u64)counter->limit * PAGE_SIZE;
+	case RES_MAX_USAGE:
+		return (u64)counter->watermark * PAGE_SIZE;
+	case RES_FAILCNT:
+		return counter->failcnt;
+	case RES_SOFT_LIMIT:
+		return (u64)memcg->soft_limit * PAGE_SIZE;
+	default:
+		BUG();
+	}
+}
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+/*
+ * Setting a kmem limit turns on kernel memory accounting for the group;
+ * accounting stays on for its lifetime. Writing "unlimited" to a group
+ * that never had a limit leaves it unaccounted.
+ */
+static int memcg_update_kmem_limit(struct mem_cgroup *memcg,
+				   unsigned long limit)
+{
+	int ret = 0;
+
+	mutex_lock(&set_limit_mutex);
+	if (limit != PAGE_COUNTER_MAX)
+		ret = memcg_activate_kmem(memcg);
+	if (!ret)
+		ret = page_counter_limit(&memcg->kmem, limit);
+	mutex_unlock(&set_limit_mutex);
+	return ret;
+}
+#else
+static int memcg_update_kmem_limit(struct mem_cgroup *memcg,
+				   unsigned long limit)
+{
+	return -EINVAL;
 }
+#endif
+
 /*
  * The user of this function is...
  * RES_LIMIT.
@@ -3914,7 +4916,7 @@ static int mem_cgroup_write(struct cgroup *cont, struct cftype *cft,
 {
 	struct mem_cgroup *memcg = mem_cgroup_from_cont(cont);
 	int type, name;
-	unsigned long long val;
+	unsigned long nr_pages;
 	int ret;
 
 	type = MEMFILE_TYPE(cft->private);
@@ -3926,16 +4928,18 @@ static int mem_cgroup_write(struct cgroup *cont, struct cftype *cft,
 			break;
 		}
 		/* This function does all necessary parse...reuse it */
-		ret = res_counter_memparse_write_strategy(buffer, &val);
+		ret = page_counter_memparse(buffer, &nr_pages);
 		if (ret)
 			break;
 		if (type == _MEM)
-			ret = mem_cgroup_resize_limit(memcg, val);
+			ret = mem_cgroup_resize_limit(memcg, nr_pages);
+		else if (type == _MEMSWAP)
+			ret = mem_cgroup_resize_memsw_limit(memcg, nr_pages);
 		else
-			ret = mem_cgroup_resize_memsw_limit(memcg, val);
+			ret = memcg_update_kmem_limit(memcg, nr_pages);
 		break;
 	case RES_SOFT_LIMIT:
-		ret = res_counter_memparse_write_strategy(buffer, &val);
+		ret = page_counter_memparse(buffer, &nr_pages);
 		if (ret)
 			break;
 		/*
@@ -3944,7 +4948,7 @@ static int mem_cgroup_write(struct cgroup *cont, struct cftype *cft,
 		 * control without swap
 		 */
 		if (type == _MEM)
-			ret = res_counter_set_soft_limit(&memcg->res, val);
+			memcg->soft_limit = nr_pages;
 		else
 			ret = -EINVAL;
 		break;
@@ -3961,8 +4965,8 @@ static void memcg_get_hierarchical_limit(struct mem_cgroup *memcg,
 	struct cgroup *cgroup;
 	unsigned long long min_limit, min_memsw_limit, tmp;
 
-	min_limit = res_counter_read_u64(&memcg->res, RES_LIMIT);
-	min_memsw_limit = res_counter_read_u64(&memcg->memsw, RES_LIMIT);
+	min_limit = memcg->memory.limit;
+	min_memsw_limit = memcg->memsw.limit;
 	cgroup = memcg->css.cgroup;
 	if (!memcg->use_hierarchy)
 		goto out;
@@ -3972,36 +4976,47 @@ static void memcg_get_hierarchical_limit(struct mem_cgroup *memcg,
 		memcg = mem_cgroup_from_cont(cgroup);
 		if (!memcg->use_hierarchy)
 			break;
-		tmp = res_counter_read_u64(&memcg->res, RES_LIMIT);
+		tmp = memcg->memory.limit;
 		min_limit = min(min_limit, tmp);
-		tmp = res_counter_read_u64(&memcg->memsw, RES_LIMIT);
+		tmp = memcg->memsw.limit;
 		min_memsw_limit = min(min_memsw_limit, tmp);
 	}
 out:
-	*mem_limit = min_limit;
-	*memsw_limit = min_memsw_limit;
+	*mem_limit = min_limit << PAGE_SHIFT;
+	*memsw_limit = min_memsw_limit << PAGE_SHIFT;
 }
 
 static int mem_cgroup_reset(struct cgroup *cont, unsigned int event)
 {
 	struct mem_cgroup *memcg;
+	struct page_counter *counter;
 	int type, name;
 
 	memcg = mem_cgroup_from_cont(cont);
 	type = MEMFILE_TYPE(event);
 	name = MEMFILE_ATTR(event);
+	switch (type) {
+	case _MEM:
+		counter = &memcg->memory;
+		break;
+	case _MEMSWAP:
+		counter = &memcg->memsw;
+		break;
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+	case _KMEM:
+		counter = &memcg->kmem;
+		break;
+#endif
+	default:
+		BUG();
+	}
+
 	switch (name) {
 	case RES_MAX_USAGE:
-		if (type == _MEM)
-			res_counter_reset_max(&memcg->res);
-		else
-			res_counter_reset_max(&memcg->memsw);
+		page_counter_reset_watermark(counter);
 		break;
 	case RES_FAILCNT:
-		if (type == _MEM)
-			res_counter_reset_failcnt(&memcg->res);
-		else
-			res_counter_reset_failcnt(&memcg->memsw);
+		counter->failcnt = 0;
 		break;
 	}
 
@@ -4052,6 +5067,9 @@ enum {
 	MCS_SWAP,
 	MCS_PGFAULT,
 	MCS_PGMAJFAULT,
+	MCS_PGSCAN,
+	MCS_PGSTEAL,
+	MCS_LOW_BREACH,
 	MCS_INACTIVE_ANON,
 	MCS_ACTIVE_ANON,
 	MCS_INACTIVE_FILE,
@@ -4076,6 +5094,9 @@ struct {
 	{"swap", "total_swap"},
 	{"pgfault", "total_pgfault"},
 	{"pgmajfault", "total_pgmajfault"},
+	{"pgscan", "total_pgscan"},
+	{"pgsteal", "total_pgsteal"},
+	{"low_breach", "total_low_breach"},
 	{"inactive_anon", "total_inactive_anon"},
 	{"active_anon", "total_active_anon"},
 	{"inactive_file", "total_inactive_file"},
@@ -4108,6 +5129,12 @@ mem_cgroup_get_local_stat(struct mem_cgroup *memcg, struct mcs_total_stat *s)
 	s->stat[MCS_PGFAULT] += val;
 	val = mem_cgroup_read_events(memcg, MEM_CGROUP_EVENTS_PGMAJFAULT);
 	s->stat[MCS_PGMAJFAULT] += val;
+	val = mem_cgroup_read_events(memcg, MEM_CGROUP_EVENTS_PGSCAN);
+	s->stat[MCS_PGSCAN] += val;
+	val = mem_cgroup_read_events(memcg, MEM_CGROUP_EVENTS_PGSTEAL);
+	s->stat[MCS_PGSTEAL] += val;
+	val = mem_cgroup_read_events(memcg, MEM_CGROUP_EVENTS_LOW);
+	s->stat[MCS_LOW_BREACH] += val;
 
 	/* per zone stat */
 	val = mem_cgroup_nr_lru_pages(memcg, BIT(LRU_INACTIVE_ANON));
@@ -4279,6 +5306,32 @@ static int mem_cgroup_swappiness_write(struct cgroup *cgrp, struct cftype *cft,
 	return 0;
 }
 
+static u64 mem_cgroup_low_read(struct cgroup *cgrp, struct cftype *cft)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_cont(cgrp);
+
+	return (u64)memcg->low * PAGE_SIZE;
+}
+
+static int mem_cgroup_low_write(struct cgroup *cgrp, struct cftype *cft,
+				const char *buffer)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_cont(cgrp);
+	unsigned long low;
+	int ret;
+
+	if (mem_cgroup_is_root(memcg))
+		return -EINVAL;
+
+	ret = page_counter_memparse(buffer, &low);
+	if (ret)
+		return ret;
+
+	memcg->low = low;
+	mem_cgroup_propagate_low_usage(memcg);
+	return 0;
+}
+
 static void __mem_cgroup_threshold(struct mem_cgroup *memcg, bool swap)
 {
 	struct mem_cgroup_threshold_ary *t;
@@ -4373,12 +5426,14 @@ static int mem_cgroup_usage_register_event(struct cgroup *cgrp,
 	struct mem_cgroup_thresholds *thresholds;
 	struct mem_cgroup_threshold_ary *new;
 	int type = MEMFILE_TYPE(cft->private);
+	unsigned long nr_pages;
 	u64 threshold, usage;
 	int i, size, ret;
 
-	ret = res_counter_memparse_write_strategy(args, &threshold);
+	ret = page_counter_memparse(args, &nr_pages);
 	if (ret)
 		return ret;
+	threshold = (u64)nr_pages << PAGE_SHIFT;
 
 	mutex_lock(&memcg->thresholds_lock);
 
@@ -4624,8 +5679,39 @@ static int mem_control_numa_stat_open(struct inode *unused, struct file *file)
 #endif /* CONFIG_NUMA */
 
 #ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+static struct cftype kmem_cgroup_files[] = {
+	{
+		.name = "kmem.limit_in_bytes",
+		.private = MEMFILE_PRIVATE(_KMEM, RES_LIMIT),
+		.write_string = mem_cgroup_write,
+		.read_u64 = mem_cgroup_read,
+	},
+	{
+		.name = "kmem.usage_in_bytes",
+		.private = MEMFILE_PRIVATE(_KMEM, RES_USAGE),
+		.read_u64 = mem_cgroup_read,
+	},
+	{
+		.name = "kmem.failcnt",
+		.private = MEMFILE_PRIVATE(_KMEM, RES_FAILCNT),
+		.trigger = mem_cgroup_reset,
+		.read_u64 = mem_cgroup_read,
+	},
+	{
+		.name = "kmem.max_usage_in_bytes",
+		.private = MEMFILE_PRIVATE(_KMEM, RES_MAX_USAGE),
+		.trigger = mem_cgroup_reset,
+		.read_u64 = mem_cgroup_read,
+	},
+};
+
 static int register_kmem_files(struct cgroup *cont, struct cgroup_subsys *ss)
 {
+	int ret = 0;
+
+	if (!mem_cgroup_is_root(mem_cgroup_from_cont(cont)))
+		ret = cgroup_add_files(cont, ss, kmem_cgroup_files,
+				       ARRAY_SIZE(kmem_cgroup_files));
 	/*
 	 * Part of this would be better living in a separate allocation
 	 * function, leaving us with just the cgroup tree population work.
@@ -4633,11 +5719,17 @@ static int register_kmem_files(struct cgroup *cont, struct cgroup_subsys *ss)
 	 * is only initialized after cgroup creation. I found the less
 	 * cumbersome way to deal with it to defer it all to populate time
 	 */
-	return mem_cgroup_sockets_init(cont, ss);
+	if (!ret)
+		ret = mem_cgroup_sockets_init(cont, ss);
+	return ret;
 };
 
 static void kmem_cgroup_destroy(struct cgroup *cont)
 {
+	struct mem_cgroup *memcg = mem_cgroup_from_cont(cont);
+
+	memcg_destroy_all_caches(memcg);
+	memcg_reparent_kmem(memcg);
 	mem_cgroup_sockets_destroy(cont);
 }
 #else
@@ -4677,6 +5769,11 @@ static struct cftype mem_cgroup_files[] = {
 		.write_string = mem_cgroup_write,
 		.read_u64 = mem_cgroup_read,
 	},
+	{
+		.name = "low_limit_in_bytes",
+		.write_string = mem_cgroup_low_write,
+		.read_u64 = mem_cgroup_low_read,
+	},
 	{
 		.name = "failcnt",
 		.private = MEMFILE_PRIVATE(_MEM, RES_FAILCNT),
@@ -4869,6 +5966,7 @@ static void __mem_cgroup_free(struct mem_cgroup *memcg)
 
 	mem_cgroup_remove_from_trees(memcg);
 	free_css_id(&mem_cgroup_subsys, &memcg->css);
+	memcg_free_kmem(memcg);
 
 	for_each_node(node)
 		free_mem_cgroup_per_zone_info(memcg, node);
@@ -4905,9 +6003,9 @@ static void mem_cgroup_put(struct mem_cgroup *memcg)
  */
 struct mem_cgroup *parent_mem_cgroup(struct mem_cgroup *memcg)
 {
-	if (!memcg->res.parent)
+	if (!memcg->memory.parent)
 		return NULL;
-	return mem_cgroup_from_res_counter(memcg->res.parent, res);
+	return mem_cgroup_from_counter(memcg->memory.parent, memory);
 }
 EXPORT_SYMBOL(parent_mem_cgroup);
 
@@ -4993,20 +6091,25 @@ mem_cgroup_create(struct cgroup *cont)
 		memcg->oom_kill_disable = parent->oom_kill_disable;
 	}
 
+	if (memcg_init_kmem(memcg, parent))
+		goto free_out;
+
 	if (parent && parent->use_hierarchy) {
-		res_counter_init(&memcg->res, &parent->res);
-		res_counter_init(&memcg->memsw, &parent->memsw);
+		page_counter_init(&memcg->memory, &parent->memory);
+		page_counter_init(&memcg->memsw, &parent->memsw);
 		/*
 		 * We increment refcnt of the parent to ensure that we can
-		 * safely access it on res_counter_charge/uncharge.
+		 * safely access it on page_counter_charge/uncharge.
 		 * This refcnt will be decremented when freeing this
 		 * mem_cgroup(see mem_cgroup_put).
 		 */
 		mem_cgroup_get(parent);
 	} else {
-		res_counter_init(&memcg->res, NULL);
-		res_counter_init(&memcg->memsw, NULL);
+		page_counter_init(&memcg->memory, NULL);
+		page_counter_init(&memcg->memsw, NULL);
 	}
+	memcg->soft_limit = PAGE_COUNTER_MAX;
+	mem_cgroup_update_charge_batch(memcg);
 	memcg->last_scanned_node = MAX_NUMNODES;
 	INIT_LIST_HEAD(&memcg->oom_notify);
 
@@ -5032,6 +6135,13 @@ static int mem_cgroup_pre_destroy(struct cgroup *cont)
 static void mem_cgroup_destroy(struct cgroup *cont)
 {
 	struct mem_cgroup *memcg = mem_cgroup_from_cont(cont);
+	struct mem_cgroup *parent = parent_mem_cgroup(memcg);
+	long low_usage;
+
+	/* Stop claiming a share of the parent's protection */
+	low_usage = atomic_long_xchg(&memcg->low_usage, 0);
+	if (parent && low_usage)
+		atomic_long_sub(low_usage, &parent->children_low_usage);
 
 	kmem_cgroup_destroy(cont);
 
@@ -5071,18 +6181,18 @@ static int mem_cgroup_do_precharge(unsigned long count)
 	}
 	/* try to charge at once */
 	if (count > 1) {
-		struct res_counter *dummy;
+		struct page_counter *dummy;
 		/*
 		 * "memcg" cannot be under rmdir() because we've already checked
 		 * by cgroup_lock_live_cgroup() that it is not removed and we
 		 * are still under the same cgroup_mutex. So we can postpone
 		 * css_get().
 		 */
-		if (res_counter_charge(&memcg->res, PAGE_SIZE * count, &dummy))
+		if (page_counter_try_charge(&memcg->memory, count, &dummy))
 			goto one_by_one;
-		if (do_swap_account && res_counter_charge(&memcg->memsw,
-						PAGE_SIZE * count, &dummy)) {
-			res_counter_uncharge(&memcg->res, PAGE_SIZE * count);
+		if (do_swap_account &&
+		    page_counter_try_charge(&memcg->memsw, count, &dummy)) {
+			page_counter_uncharge(&memcg->memory, count);
 			goto one_by_one;
 		}
 		mc.precharge += count;
@@ -5200,16 +6310,20 @@ static struct page *mc_handle_file_pte(struct vm_area_struct *vma,
 		pgoff = pte_to_pgoff(ptent);
 
 	/* page is moved even if it's not RSS of this task(page-faulted). */
-	page = find_get_page(mapping, pgoff);
-
 #ifdef CONFIG_SWAP
 	/* shmem/tmpfs may report page out on swap: account for that too. */
-	if (radix_tree_exceptional_entry(page)) {
-		swp_entry_t swap = radix_to_swp_entry(page);
-		if (do_swap_account)
-			*entry = swap;
-		page = find_get_page(&swapper_space, swap.val);
-	}
+	if (shmem_mapping(mapping)) {
+		page = find_get_entry(mapping, pgoff);
+		if (radix_tree_exceptional_entry(page)) {
+			swp_entry_t swap = radix_to_swp_entry(page);
+			if (do_swap_account)
+				*entry = swap;
+			page = find_get_page(&swapper_space, swap.val);
+		}
+	} else
+		page = find_get_page(mapping, pgoff);
+#else
+	page = find_get_page(mapping, pgoff);
 #endif
 	return page;
 }
@@ -5375,17 +6489,15 @@ static void __mem_cgroup_clear_mc(void)
 	if (mc.moved_swap) {
 		/* uncharge swap account from the old cgroup */
 		if (!mem_cgroup_is_root(mc.from))
-			res_counter_uncharge(&mc.from->memsw,
-						PAGE_SIZE * mc.moved_swap);
+			page_counter_uncharge(&mc.from->memsw, mc.moved_swap);
 		__mem_cgroup_put(mc.from, mc.moved_swap);
 
 		if (!mem_cgroup_is_root(mc.to)) {
 			/*
-			 * we charged both to->res and to->memsw, so we should
-			 * uncharge to->res.
+			 * we charged both to->memory and to->memsw, so we
+			 * should uncharge to->memory.
 			 */
-			res_counter_uncharge(&mc.to->res,
-						PAGE_SIZE * mc.moved_swap);
+			page_counter_uncharge(&mc.to->memory, mc.moved_swap);
 		}
 		/* we've already done mem_cgroup_get(mc.to) */
 		mc.moved_swap = 0;
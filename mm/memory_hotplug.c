@@ -793,8 +793,8 @@ do_migrate_range(unsigned long start_pfn, unsigned long end_pfn)
 			dump_page(page);
 #endif
 			put_page(page);
-			/* Because we don't have big zone->lock. we should
-			   check this again here. */
+			/* Because we don't hold the zone shard locks. we
+			   should check this again here. */
 			if (page_count(page)) {
 				not_managed++;
 				ret = -EBUSY;
@@ -472,7 +472,8 @@ __find_buddy_index(unsigned long page_idx, unsigned int order)
  * (d) a page and its buddy are in the same zone.
  *
  * For recording whether a page is in the buddy system, we set ->_mapcount -2.
- * Setting, clearing, and testing _mapcount -2 is serialized by zone->lock.
+ * Setting, clearing, and testing _mapcount -2 is serialized by the lock of
+ * the zone shard the page belongs to.
  *
  * For recording page's order, we use page_private(page).
  */
@@ -522,8 +523,8 @@ static inline int page_is_buddy(struct page *page, struct page *buddy,
  */
 
 static inline void __free_one_page(struct page *page,
-		struct zone *zone, unsigned int order,
-		int migratetype)
+		struct zone *zone, struct zone_shard *shard,
+		unsigned int order, int migratetype)
 {
 	unsigned long page_idx;
 	unsigned long combined_idx;
@@ -556,7 +557,7 @@ static inline void __free_one_page(struct page *page,
 			__mod_zone_page_state(zone, NR_FREE_PAGES, 1 << order);
 		} else {
 			list_del(&buddy->lru);
-			zone->free_area[order].nr_free--;
+			shard->free_area[order].nr_free--;
 			rmv_page_order(buddy);
 		}
 		combined_idx = buddy_idx & page_idx;
@@ -582,14 +583,14 @@ static inline void __free_one_page(struct page *page,
 		higher_buddy = page + (buddy_idx - combined_idx);
 		if (page_is_buddy(higher_page, higher_buddy, order + 1)) {
 			list_add_tail(&page->lru,
-				&zone->free_area[order].free_list[migratetype]);
+				&shard->free_area[order].free_list[migratetype]);
 			goto out;
 		}
 	}
 
-	list_add(&page->lru, &zone->free_area[order].free_list[migratetype]);
+	list_add(&page->lru, &shard->free_area[order].free_list[migratetype]);
 out:
-	zone->free_area[order].nr_free++;
+	shard->free_area[order].nr_free++;
 }
 
 /*
@@ -618,10 +619,31 @@ static inline int free_pages_check(struct page *page)
 	return 0;
 }
 
+/*
+ * The pcp lists are indexed by order and migratetype.  The order of a
+ * page on a pcp list is kept in page->index, its migratetype in
+ * page_private.
+ */
+static inline int order_to_pindex(int migratetype, int order)
+{
+	return order * MIGRATE_PCPTYPES + migratetype;
+}
+
+static inline void set_pcppage_order(struct page *page, int order)
+{
+	page->index = order;
+}
+
+static inline int get_pcppage_order(struct page *page)
+{
+	return page->index;
+}
+
 /*
  * Frees a number of pages from the PCP lists
- * Assumes all pages on list are in same zone, and of same order.
- * count is the number of pages to free.
+ * Assumes all pages on list are in same zone.
+ * count is the number of base pages to free, and pcp->count is
+ * updated to match what was actually freed.
  *
  * If the zone was previously in an "all pages pinned" state then look to
  * see if this freeing clears that state.
@@ -632,15 +654,25 @@ static inline int free_pages_check(struct page *page)
 static void free_pcppages_bulk(struct zone *zone, int count,
 					struct per_cpu_pages *pcp)
 {
-	int migratetype = 0;
+	struct list_head shard_lists[ZONE_MAX_SHARDS];
+	int shard_pages[ZONE_MAX_SHARDS];
+	int pindex = 0;
 	int batch_free = 0;
-	int to_free = count;
+	int to_free;
+	int i;
 
-	spin_lock(&zone->lock);
-	zone->all_unreclaimable = 0;
-	zone->pages_scanned = 0;
+	count = min(count, pcp->count);
+	to_free = count;
+	for (i = 0; i < zone->nr_shards; i++) {
+		INIT_LIST_HEAD(&shard_lists[i]);
+		shard_pages[i] = 0;
+	}
 
-	while (to_free) {
+	/*
+	 * Sort the pages by shard first, so that each shard lock is taken
+	 * once and only for as long as its own pages need merging.
+	 */
+	while (to_free > 0) {
 		struct page *page;
 		struct list_head *list;
 
@@ -653,38 +685,67 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 		 */
 		do {
 			batch_free++;
-			if (++migratetype == MIGRATE_PCPTYPES)
-				migratetype = 0;
-			list = &pcp->lists[migratetype];
+			if (++pindex == NR_PCP_LISTS)
+				pindex = 0;
+			list = &pcp->lists[pindex];
 		} while (list_empty(list));
 
 		/* This is the only non-empty list. Free them all. */
-		if (batch_free == MIGRATE_PCPTYPES)
+		if (batch_free == NR_PCP_LISTS)
 			batch_free = to_free;
 
 		do {
+			int nr_pages;
+
 			page = list_entry(list->prev, struct page, lru);
+			i = zone_pfn_shard(zone, page_to_pfn(page)) - zone->shards;
+			nr_pages = 1 << get_pcppage_order(page);
+			list_move(&page->lru, &shard_lists[i]);
+			shard_pages[i] += nr_pages;
+			pcp->count -= nr_pages;
+			to_free -= nr_pages;
+		} while (to_free > 0 && --batch_free && !list_empty(list));
+	}
+
+	zone->all_unreclaimable = 0;
+	zone->pages_scanned = 0;
+
+	for (i = 0; i < zone->nr_shards; i++) {
+		struct zone_shard *shard = &zone->shards[i];
+		struct page *page, *next;
+
+		if (list_empty(&shard_lists[i]))
+			continue;
+
+		spin_lock(&shard->lock);
+		list_for_each_entry_safe(page, next, &shard_lists[i], lru) {
+			int order = get_pcppage_order(page);
+
 			/* must delete as __free_one_page list manipulates */
 			list_del(&page->lru);
 			/* MIGRATE_MOVABLE list may include MIGRATE_RESERVEs */
-			__free_one_page(page, zone, 0, page_private(page));
-			trace_mm_page_pcpu_drain(page, 0, page_private(page));
-		} while (--to_free && --batch_free && !list_empty(list));
+			__free_one_page(page, zone, shard, order,
+					page_private(page));
+			trace_mm_page_pcpu_drain(page, order,
+						 page_private(page));
+		}
+		__mod_zone_page_state(zone, NR_FREE_PAGES, shard_pages[i]);
+		spin_unlock(&shard->lock);
 	}
-	__mod_zone_page_state(zone, NR_FREE_PAGES, count);
-	spin_unlock(&zone->lock);
 }
 
 static void free_one_page(struct zone *zone, struct page *page, int order,
 				int migratetype)
 {
-	spin_lock(&zone->lock);
+	struct zone_shard *shard = zone_pfn_shard(zone, page_to_pfn(page));
+
+	spin_lock(&shard->lock);
 	zone->all_unreclaimable = 0;
 	zone->pages_scanned = 0;
 
-	__free_one_page(page, zone, order, migratetype);
+	__free_one_page(page, zone, shard, order, migratetype);
 	__mod_zone_page_state(zone, NR_FREE_PAGES, 1 << order);
-	spin_unlock(&zone->lock);
+	spin_unlock(&shard->lock);
 }
 
 static bool free_pages_prepare(struct page *page, unsigned int order)
@@ -713,11 +774,20 @@ static bool free_pages_prepare(struct page *page, unsigned int order)
 	return true;
 }
 
+static void free_hot_cold_pages(struct page *page, unsigned int order,
+				int cold);
+
 static void __free_pages_ok(struct page *page, unsigned int order)
 {
 	unsigned long flags;
-	int wasMlocked = __TestClearPageMlocked(page);
+	int wasMlocked;
+
+	if (order <= PAGE_ALLOC_COSTLY_ORDER) {
+		free_hot_cold_pages(page, order, 0);
+		return;
+	}
 
+	wasMlocked = __TestClearPageMlocked(page);
 	if (!free_pages_prepare(page, order))
 		return;
 
@@ -844,8 +914,8 @@ static int prep_new_page(struct page *page, int order, gfp_t gfp_flags)
  * the smallest available page from the freelists
  */
 static inline
-struct page *__rmqueue_smallest(struct zone *zone, unsigned int order,
-						int migratetype)
+struct page *__rmqueue_smallest(struct zone *zone, struct zone_shard *shard,
+				unsigned int order, int migratetype)
 {
 	unsigned int current_order;
 	struct free_area * area;
@@ -853,7 +923,7 @@ struct page *__rmqueue_smallest(struct zone *zone, unsigned int order,
 
 	/* Find a page of the appropriate size in the preferred list */
 	for (current_order = order; current_order < MAX_ORDER; ++current_order) {
-		area = &(zone->free_area[current_order]);
+		area = &(shard->free_area[current_order]);
 		if (list_empty(&area->free_list[migratetype]))
 			continue;
 
@@ -890,6 +960,7 @@ static int move_freepages(struct zone *zone,
 			  struct page *start_page, struct page *end_page,
 			  int migratetype)
 {
+	struct zone_shard *shard;
 	struct page *page;
 	unsigned long order;
 	int pages_moved = 0;
@@ -904,6 +975,8 @@ static int move_freepages(struct zone *zone,
 	 */
 	BUG_ON(page_zone(start_page) != page_zone(end_page));
 #endif
+	/* the range never crosses a MAX_ORDER block, so it is in one shard */
+	shard = zone_pfn_shard(zone, page_to_pfn(start_page));
 
 	for (page = start_page; page <= end_page;) {
 		/* Make sure we are not inadvertently changing nodes */
@@ -921,7 +994,7 @@ static int move_freepages(struct zone *zone,
 
 		order = page_order(page);
 		list_move(&page->lru,
-			  &zone->free_area[order].free_list[migratetype]);
+			  &shard->free_area[order].free_list[migratetype]);
 		page += 1 << order;
 		pages_moved += 1 << order;
 	}
@@ -963,7 +1036,8 @@ static void change_pageblock_range(struct page *pageblock_page,
 
 /* Remove an element from the buddy allocator from the fallback list */
 static inline struct page *
-__rmqueue_fallback(struct zone *zone, int order, int start_migratetype)
+__rmqueue_fallback(struct zone *zone, struct zone_shard *shard, int order,
+		   int start_migratetype)
 {
 	struct free_area * area;
 	int current_order;
@@ -980,7 +1054,7 @@ __rmqueue_fallback(struct zone *zone, int order, int start_migratetype)
 			if (migratetype == MIGRATE_RESERVE)
 				continue;
 
-			area = &(zone->free_area[current_order]);
+			area = &(shard->free_area[current_order]);
 			if (list_empty(&area->free_list[migratetype]))
 				continue;
 
@@ -1033,18 +1107,19 @@ __rmqueue_fallback(struct zone *zone, int order, int start_migratetype)
 
 /*
  * Do the hard work of removing an element from the buddy allocator.
- * Call me with the zone->lock already held.
+ * Call me with the shard lock already held.  Without @fallback only the
+ * free lists of @migratetype are tried.
  */
-static struct page *__rmqueue(struct zone *zone, unsigned int order,
-						int migratetype)
+static struct page *__rmqueue(struct zone *zone, struct zone_shard *shard,
+			unsigned int order, int migratetype, bool fallback)
 {
 	struct page *page;
 
 retry_reserve:
-	page = __rmqueue_smallest(zone, order, migratetype);
+	page = __rmqueue_smallest(zone, shard, order, migratetype);
 
-	if (unlikely(!page) && migratetype != MIGRATE_RESERVE) {
-		page = __rmqueue_fallback(zone, order, migratetype);
+	if (unlikely(!page) && fallback && migratetype != MIGRATE_RESERVE) {
+		page = __rmqueue_fallback(zone, shard, order, migratetype);
 
 		/*
 		 * Use MIGRATE_RESERVE rather than fail an allocation. goto
@@ -1057,48 +1132,108 @@ retry_reserve:
 		}
 	}
 
-	trace_mm_page_alloc_zone_locked(page, order, migratetype);
+	if (page)
+		trace_mm_page_alloc_zone_locked(page, order, migratetype);
 	return page;
 }
 
-/* 
- * Obtain a specified number of elements from the buddy allocator, all under
- * a single hold of the lock, for efficiency.  Add them to the supplied list.
+/*
+ * The shard an allocation on this CPU looks at first.  Spreading CPUs
+ * over the shards is what keeps them off each other's locks.
+ */
+static inline unsigned int home_shard(struct zone *zone)
+{
+	return smp_processor_id() & (zone->nr_shards - 1);
+}
+
+/*
+ * Obtain a specified number of elements from the buddy allocator, holding
+ * each shard lock once for efficiency.  Add them to the supplied list.
  * Returns the number of new pages which were placed at *list.
+ *
+ * Every shard is tried for the requested migratetype before any of them
+ * falls back to stealing from another migratetype, so sharding does not
+ * make fragmentation worse.
  */
 static int rmqueue_bulk(struct zone *zone, unsigned int order, 
 			unsigned long count, struct list_head *list,
 			int migratetype, int cold)
 {
-	int i;
-	
-	spin_lock(&zone->lock);
-	for (i = 0; i < count; ++i) {
-		struct page *page = __rmqueue(zone, order, migratetype);
-		if (unlikely(page == NULL))
-			break;
+	unsigned int start = home_shard(zone);
+	int i = 0, pass, n;
 
-		/*
-		 * Split buddy pages returned by expand() are received here
-		 * in physical page order. The page is added to the callers and
-		 * list and the list head then moves forward. From the callers
-		 * perspective, the linked list is ordered by page number in
-		 * some conditions. This is useful for IO devices that can
-		 * merge IO requests if the physical pages are ordered
-		 * properly.
-		 */
-		if (likely(cold == 0))
-			list_add(&page->lru, list);
-		else
-			list_add_tail(&page->lru, list);
-		set_page_private(page, migratetype);
-		list = &page->lru;
+	for (pass = 0; pass < 2; pass++) {
+		for (n = 0; n < zone->nr_shards; n++) {
+			struct zone_shard *shard;
+			int alloced = 0;
+
+			shard = &zone->shards[(start + n) & (zone->nr_shards - 1)];
+			spin_lock(&shard->lock);
+			for (; i < count; ++i) {
+				struct page *page = __rmqueue(zone, shard, order,
+							migratetype, pass);
+				if (unlikely(page == NULL))
+					break;
+
+				/*
+				 * Split buddy pages returned by expand() are
+				 * received here in physical page order. The
+				 * page is added to the callers and list and
+				 * the list head then moves forward. From the
+				 * callers perspective, the linked list is
+				 * ordered by page number in some conditions.
+				 * This is useful for IO devices that can merge
+				 * IO requests if the physical pages are
+				 * ordered properly.
+				 */
+				if (likely(cold == 0))
+					list_add(&page->lru, list);
+				else
+					list_add_tail(&page->lru, list);
+				set_page_private(page, migratetype);
+				set_pcppage_order(page, order);
+				list = &page->lru;
+				alloced++;
+			}
+			__mod_zone_page_state(zone, NR_FREE_PAGES,
+					      -(alloced << order));
+			spin_unlock(&shard->lock);
+			if (i == count)
+				return i;
+		}
 	}
-	__mod_zone_page_state(zone, NR_FREE_PAGES, -(i << order));
-	spin_unlock(&zone->lock);
 	return i;
 }
 
+/*
+ * Take a single block of @order straight from the buddy lists, trying
+ * all shards in the same order as rmqueue_bulk().
+ */
+static struct page *rmqueue_shards(struct zone *zone, unsigned int order,
+				   int migratetype)
+{
+	unsigned int start = home_shard(zone);
+	struct page *page;
+	int pass, n;
+
+	for (pass = 0; pass < 2; pass++) {
+		for (n = 0; n < zone->nr_shards; n++) {
+			struct zone_shard *shard;
+
+			shard = &zone->shards[(start + n) & (zone->nr_shards - 1)];
+			spin_lock(&shard->lock);
+			page = __rmqueue(zone, shard, order, migratetype, pass);
+			spin_unlock(&shard->lock);
+			if (page) {
+				__mod_zone_page_state(zone, NR_FREE_PAGES,
+						      -(1 << order));
+				return page;
+			}
+		}
+	}
+	return NULL;
+}
+
 #ifdef CONFIG_NUMA
 /*
  * Called from the vmstat counter updater to drain pagesets of this
@@ -1119,11 +1254,32 @@ void drain_zone_pages(struct zone *zone, struct per_cpu_pages *pcp)
 	else
 		to_drain = pcp->count;
 	free_pcppages_bulk(zone, to_drain, pcp);
-	pcp->count -= to_drain;
 	local_irq_restore(flags);
 }
 #endif
 
+/*
+ * Called from the vmstat counter updater: a pcp high mark raised by
+ * refill misses decays back towards high_min, and whatever the smaller
+ * list cannot hold goes back to the buddy allocator.
+ *
+ * Note that this function must be called with the thread pinned to
+ * a single processor.
+ */
+void decay_pcp_high(struct zone *zone, struct per_cpu_pages *pcp)
+{
+	unsigned long flags;
+
+	if (pcp->high <= pcp->high_min)
+		return;
+
+	local_irq_save(flags);
+	pcp->high = max(pcp->high - (pcp->high >> 3), pcp->high_min);
+	if (pcp->count > pcp->high)
+		free_pcppages_bulk(zone, pcp->count - pcp->high, pcp);
+	local_irq_restore(flags);
+}
+
 /*
  * Drain pages of the indicated processor.
  *
@@ -1144,10 +1300,8 @@ static void drain_pages(unsigned int cpu)
 		pset = per_cpu_ptr(zone->pageset, cpu);
 
 		pcp = &pset->pcp;
-		if (pcp->count) {
+		if (pcp->count)
 			free_pcppages_bulk(zone, pcp->count, pcp);
-			pcp->count = 0;
-		}
 		local_irq_restore(flags);
 	}
 }
@@ -1212,11 +1366,12 @@ void mark_free_pages(struct zone *zone)
 	unsigned long flags;
 	int order, t;
 	struct list_head *curr;
+	struct zone_shard *shard;
 
 	if (!zone->spanned_pages)
 		return;
 
-	spin_lock_irqsave(&zone->lock, flags);
+	zone_lock_shards_irqsave(zone, flags);
 
 	max_zone_pfn = zone->zone_start_pfn + zone->spanned_pages;
 	for (pfn = zone->zone_start_pfn; pfn < max_zone_pfn; pfn++)
@@ -1227,24 +1382,29 @@ void mark_free_pages(struct zone *zone)
 				swsusp_unset_page_free(page);
 		}
 
-	for_each_migratetype_order(order, t) {
-		list_for_each(curr, &zone->free_area[order].free_list[t]) {
-			unsigned long i;
+	for_each_zone_shard(shard, zone) {
+		for_each_migratetype_order(order, t) {
+			list_for_each(curr,
+				      &shard->free_area[order].free_list[t]) {
+				unsigned long i;
 
-			pfn = page_to_pfn(list_entry(curr, struct page, lru));
-			for (i = 0; i < (1UL << order); i++)
-				swsusp_set_page_free(pfn_to_page(pfn + i));
+				pfn = page_to_pfn(list_entry(curr, struct page,
+							     lru));
+				for (i = 0; i < (1UL << order); i++)
+					swsusp_set_page_free(pfn_to_page(pfn + i));
+			}
 		}
 	}
-	spin_unlock_irqrestore(&zone->lock, flags);
+	zone_unlock_shards_irqrestore(zone, flags);
 }
 #endif /* CONFIG_PM */
 
 /*
- * Free a 0-order page
+ * Free a page of up to PAGE_ALLOC_COSTLY_ORDER to the per-cpu lists
  * cold == 1 ? free a cold page : free a hot page
  */
-void free_hot_cold_page(struct page *page, int cold)
+static void free_hot_cold_pages(struct page *page, unsigned int order,
+				int cold)
 {
 	struct zone *zone = page_zone(page);
 	struct per_cpu_pages *pcp;
@@ -1252,15 +1412,21 @@ void free_hot_cold_page(struct page *page, int cold)
 	int migratetype;
 	int wasMlocked = __TestClearPageMlocked(page);
 
-	if (!free_pages_prepare(page, 0))
+	/* the pcp lists only hold plain blocks, like the buddy lists */
+	if (unlikely(PageCompound(page)))
+		if (unlikely(destroy_compound_page(page, order)))
+			return;
+
+	if (!free_pages_prepare(page, order))
 		return;
 
 	migratetype = get_pageblock_migratetype(page);
 	set_page_private(page, migratetype);
+	set_pcppage_order(page, order);
 	local_irq_save(flags);
 	if (unlikely(wasMlocked))
 		free_page_mlock(page);
-	__count_vm_event(PGFREE);
+	__count_vm_events(PGFREE, 1 << order);
 
 	/*
 	 * We only track unmovable, reclaimable and movable on pcp lists.
@@ -1271,7 +1437,7 @@ void free_hot_cold_page(struct page *page, int cold)
 	 */
 	if (migratetype >= MIGRATE_PCPTYPES) {
 		if (unlikely(migratetype == MIGRATE_ISOLATE)) {
-			free_one_page(zone, page, 0, migratetype);
+			free_one_page(zone, page, order, migratetype);
 			goto out;
 		}
 		migratetype = MIGRATE_MOVABLE;
@@ -1279,19 +1445,28 @@ void free_hot_cold_page(struct page *page, int cold)
 
 	pcp = &this_cpu_ptr(zone->pageset)->pcp;
 	if (cold)
-		list_add_tail(&page->lru, &pcp->lists[migratetype]);
+		list_add_tail(&page->lru,
+			      &pcp->lists[order_to_pindex(migratetype, order)]);
 	else
-		list_add(&page->lru, &pcp->lists[migratetype]);
-	pcp->count++;
-	if (pcp->count >= pcp->high) {
+		list_add(&page->lru,
+			 &pcp->lists[order_to_pindex(migratetype, order)]);
+	pcp->count += 1 << order;
+	if (pcp->count >= pcp->high)
 		free_pcppages_bulk(zone, pcp->batch, pcp);
-		pcp->count -= pcp->batch;
-	}
 
 out:
 	local_irq_restore(flags);
 }
 
+/*
+ * Free a 0-order page
+ * cold == 1 ? free a cold page : free a hot page
+ */
+void free_hot_cold_page(struct page *page, int cold)
+{
+	free_hot_cold_pages(page, 0, cold);
+}
+
 /*
  * Free a list of 0-order pages
  */
@@ -1361,7 +1536,7 @@ int split_free_page(struct page *page)
 
 	/* Remove page from free list */
 	list_del(&page->lru);
-	zone->free_area[order].nr_free--;
+	zone_pfn_shard(zone, page_to_pfn(page))->free_area[order].nr_free--;
 	rmv_page_order(page);
 	__mod_zone_page_state(zone, NR_FREE_PAGES, -(1UL << order));
 
@@ -1393,17 +1568,25 @@ struct page *buffered_rmqueue(struct zone *preferred_zone,
 	int cold = !!(gfp_flags & __GFP_COLD);
 
 again:
-	if (likely(order == 0)) {
+	if (likely(order <= PAGE_ALLOC_COSTLY_ORDER)) {
 		struct per_cpu_pages *pcp;
 		struct list_head *list;
 
 		local_irq_save(flags);
 		pcp = &this_cpu_ptr(zone->pageset)->pcp;
-		list = &pcp->lists[migratetype];
+		list = &pcp->lists[order_to_pindex(migratetype, order)];
 		if (list_empty(list)) {
-			pcp->count += rmqueue_bulk(zone, 0,
-					pcp->batch, list,
-					migratetype, cold);
+			/*
+			 * Each refill is a trip to the shard locks: let a
+			 * CPU that keeps running dry cache more pages.  The
+			 * vmstat worker shrinks high again once it idles.
+			 */
+			if (pcp->high < pcp->high_max)
+				pcp->high = min(pcp->high + pcp->batch,
+						pcp->high_max);
+			pcp->count += rmqueue_bulk(zone, order,
+					max(pcp->batch >> order, 2), list,
+					migratetype, cold) << order;
 			if (unlikely(list_empty(list)))
 				goto failed;
 		}
@@ -1414,7 +1597,7 @@ again:
 			page = list_entry(list->next, struct page, lru);
 
 		list_del(&page->lru);
-		pcp->count--;
+		pcp->count -= 1 << order;
 	} else {
 		if (unlikely(gfp_flags & __GFP_NOFAIL)) {
 			/*
@@ -1429,12 +1612,10 @@ again:
 			 */
 			WARN_ON_ONCE(order > 1);
 		}
-		spin_lock_irqsave(&zone->lock, flags);
-		page = __rmqueue(zone, order, migratetype);
-		spin_unlock(&zone->lock);
+		local_irq_save(flags);
+		page = rmqueue_shards(zone, order, migratetype);
 		if (!page)
 			goto failed;
-		__mod_zone_page_state(zone, NR_FREE_PAGES, -(1 << order));
 	}
 
 	__count_zone_vm_events(PGALLOC, zone, 1 << order);
@@ -1562,7 +1743,7 @@ static bool __zone_watermark_ok(struct zone *z, int order, unsigned long mark,
 		return false;
 	for (o = 0; o < order; o++) {
 		/* At the next order, this order's pages become unavailable */
-		free_pages -= z->free_area[o].nr_free << o;
+		free_pages -= zone_free_area_nr(z, o) << o;
 
 		/* Require fewer higher order pages to be free */
 		min >>= 1;
@@ -2423,6 +2604,7 @@ __alloc_pages_nodemask(gfp_t gfp_mask, unsigned int order,
 	struct page *page = NULL;
 	int migratetype = allocflags_to_migratetype(gfp_mask);
 	unsigned int cpuset_mems_cookie;
+	struct mem_cgroup *memcg = NULL;
 
 	gfp_mask &= gfp_allowed_mask;
 
@@ -2441,6 +2623,13 @@ __alloc_pages_nodemask(gfp_t gfp_mask, unsigned int order,
 	if (unlikely(!zonelist->_zonerefs->zone))
 		return NULL;
 
+	/*
+	 * Will only have any effect when __GFP_KMEMCG is set.  This is
+	 * verified in the (always inline) callee
+	 */
+	if (!memcg_kmem_newpage_charge(gfp_mask, &memcg, order))
+		return NULL;
+
 retry_cpuset:
 	cpuset_mems_cookie = get_mems_allowed();
 
@@ -2472,6 +2661,8 @@ out:
 	if (unlikely(!put_mems_allowed(cpuset_mems_cookie) && !page))
 		goto retry_cpuset;
 
+	memcg_kmem_commit_charge(page, memcg, order);
+
 	return page;
 }
 EXPORT_SYMBOL(__alloc_pages_nodemask);
@@ -2524,6 +2715,31 @@ void free_pages(unsigned long addr, unsigned int order)
 
 EXPORT_SYMBOL(free_pages);
 
+/*
+ * __free_memcg_kmem_pages and free_memcg_kmem_pages will free
+ * pages allocated with __GFP_KMEMCG.
+ *
+ * Those pages are accounted to a particular memcg, embedded in the
+ * corresponding page_cgroup. To avoid adding a hit in the allocator to search
+ * for that information only to find out that it is NULL for users who have no
+ * interest in that whatsoever, we provide these functions.
+ *
+ * The caller knows better which flags it relies on.
+ */
+void __free_memcg_kmem_pages(struct page *page, unsigned int order)
+{
+	memcg_kmem_uncharge_pages(page, order);
+	__free_pages(page, order);
+}
+
+void free_memcg_kmem_pages(unsigned long addr, unsigned int order)
+{
+	if (addr != 0) {
+		VM_BUG_ON(!virt_addr_valid((void *)addr));
+		__free_memcg_kmem_pages(virt_to_page((void *)addr), order);
+	}
+}
+
 static void *make_alloc_exact(unsigned long addr, unsigned order, size_t size)
 {
 	if (addr) {
@@ -2830,12 +3046,12 @@ void show_free_areas(unsigned int filter)
 		show_node(zone);
 		printk("%s: ", zone->name);
 
-		spin_lock_irqsave(&zone->lock, flags);
+		zone_lock_shards_irqsave(zone, flags);
 		for (order = 0; order < MAX_ORDER; order++) {
-			nr[order] = zone->free_area[order].nr_free;
+			nr[order] = zone_free_area_nr(zone, order);
 			total += nr[order] << order;
 		}
-		spin_unlock_irqrestore(&zone->lock, flags);
+		zone_unlock_shards_irqrestore(zone, flags);
 		for (order = 0; order < MAX_ORDER; order++)
 			printk("%lu*%lukB ", nr[order], K(1UL) << order);
 		printk("= %lukB\n", K(total));
@@ -3678,13 +3894,34 @@ void __meminit memmap_init_zone(unsigned long size, int nid, unsigned long zone,
 
 static void __meminit zone_init_free_lists(struct zone *zone)
 {
+	struct zone_shard *shard;
 	int order, t;
-	for_each_migratetype_order(order, t) {
-		INIT_LIST_HEAD(&zone->free_area[order].free_list[t]);
-		zone->free_area[order].nr_free = 0;
+
+	for_each_zone_shard(shard, zone) {
+		for_each_migratetype_order(order, t) {
+			INIT_LIST_HEAD(&shard->free_area[order].free_list[t]);
+			shard->free_area[order].nr_free = 0;
+		}
 	}
 }
 
+/*
+ * Large zones get their free lists split into several shards, but no more
+ * than the kernel supports CPUs.  This is only called while the zone is
+ * still empty, and at boot that is before the architecture has settled
+ * nr_cpu_ids, so only the compile time limit can be relied on.
+ */
+static unsigned int __meminit zone_nr_shards(unsigned long size)
+{
+	unsigned long nr;
+
+	nr = min_t(unsigned long, size / ZONE_SHARD_PAGES, NR_CPUS);
+	nr = min_t(unsigned long, nr, ZONE_MAX_SHARDS);
+	if (!nr)
+		return 1;
+	return rounddown_pow_of_two(nr);
+}
+
 #ifndef __HAVE_ARCH_MEMMAP_INIT
 #define memmap_init(size, nid, zone, start_pfn) \
 	memmap_init_zone((size), (nid), (zone), (start_pfn), MEMMAP_EARLY)
@@ -3697,13 +3934,14 @@ static int zone_batchsize(struct zone *zone)
 
 	/*
 	 * The per-cpu-pages pools are set to around 1000th of the
-	 * size of the zone.  But no more than 1/2 of a meg.
+	 * size of the zone.  But no more than a meg: larger batches mean
+	 * fewer trips to the free list locks on big machines.
 	 *
 	 * OK, so we don't know how big the cache is.  So guess.
 	 */
 	batch = zone->present_pages / 1024;
-	if (batch * PAGE_SIZE > 512 * 1024)
-		batch = (512 * 1024) / PAGE_SIZE;
+	if (batch * PAGE_SIZE > 1024 * 1024)
+		batch = (1024 * 1024) / PAGE_SIZE;
 	batch /= 4;		/* We effectively *= 4 below */
 	if (batch < 1)
 		batch = 1;
@@ -3743,16 +3981,18 @@ static int zone_batchsize(struct zone *zone)
 static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 {
 	struct per_cpu_pages *pcp;
-	int migratetype;
+	int pindex;
 
 	memset(p, 0, sizeof(*p));
 
 	pcp = &p->pcp;
 	pcp->count = 0;
 	pcp->high = 6 * batch;
+	pcp->high_min = pcp->high;
+	pcp->high_max = 4 * pcp->high;
 	pcp->batch = max(1UL, 1 * batch);
-	for (migratetype = 0; migratetype < MIGRATE_PCPTYPES; migratetype++)
-		INIT_LIST_HEAD(&pcp->lists[migratetype]);
+	for (pindex = 0; pindex < NR_PCP_LISTS; pindex++)
+		INIT_LIST_HEAD(&pcp->lists[pindex]);
 }
 
 /*
@@ -3767,6 +4007,9 @@ static void setup_pagelist_highmark(struct per_cpu_pageset *p,
 
 	pcp = &p->pcp;
 	pcp->high = high;
+	/* an explicit high mark is not adapted at runtime */
+	pcp->high_min = high;
+	pcp->high_max = high;
 	pcp->batch = max(1UL, high/4);
 	if ((high/4) > (PAGE_SHIFT * 8))
 		pcp->batch = PAGE_SHIFT * 8;
@@ -3899,6 +4142,7 @@ __meminit int init_currently_empty_zone(struct zone *zone,
 	pgdat->nr_zones = zone_idx(zone) + 1;
 
 	zone->zone_start_pfn = zone_start_pfn;
+	zone->nr_shards = zone_nr_shards(size);
 
 	mminit_dprintk(MMINIT_TRACE, "memmap_init",
 			"Initialising map node %d zone %lu pfns %lu -> %lu\n",
@@ -4294,7 +4538,7 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 	enum zone_type j;
 	int nid = pgdat->node_id;
 	unsigned long zone_start_pfn = pgdat->node_start_pfn;
-	int ret;
+	int ret, i;
 
 	pgdat_resize_init(pgdat);
 	pgdat->nr_zones = 0;
@@ -4349,7 +4593,9 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 		zone->min_slab_pages = (realsize * sysctl_min_slab_ratio) / 100;
 #endif
 		zone->name = zone_names[j];
-		spin_lock_init(&zone->lock);
+		zone->nr_shards = 1;
+		for (i = 0; i < ZONE_MAX_SHARDS; i++)
+			spin_lock_init(&zone->shards[i].lock);
 		spin_lock_init(&zone->lru_lock);
 		zone_seqlock_init(zone);
 		zone->zone_pgdat = pgdat;
@@ -4999,7 +5245,7 @@ void setup_per_zone_wmarks(void)
 	for_each_zone(zone) {
 		u64 tmp;
 
-		spin_lock_irqsave(&zone->lock, flags);
+		zone_lock_shards_irqsave(zone, flags);
 		tmp = (u64)pages_min * zone->present_pages;
 		do_div(tmp, lowmem_pages);
 		if (is_highmem(zone)) {
@@ -5031,7 +5277,7 @@ void setup_per_zone_wmarks(void)
 		zone->watermark[WMARK_LOW]  = min_wmark_pages(zone) + (tmp >> 2);
 		zone->watermark[WMARK_HIGH] = min_wmark_pages(zone) + (tmp >> 1);
 		setup_zone_migrate_reserve(zone);
-		spin_unlock_irqrestore(&zone->lock, flags);
+		zone_unlock_shards_irqrestore(zone, flags);
 	}
 
 	/* update totalreserve_pages */
@@ -5484,15 +5730,17 @@ int set_migratetype_isolate(struct page *page)
 {
 	struct zone *zone;
 	unsigned long flags, pfn;
+	struct zone_shard *shard;
 	struct memory_isolate_notify arg;
 	int notifier_ret;
 	int ret = -EBUSY;
 
 	zone = page_zone(page);
+	pfn = page_to_pfn(page);
+	shard = zone_pfn_shard(zone, pfn);
 
-	spin_lock_irqsave(&zone->lock, flags);
+	spin_lock_irqsave(&shard->lock, flags);
 
-	pfn = page_to_pfn(page);
 	arg.start_pfn = pfn;
 	arg.nr_pages = pageblock_nr_pages;
 	arg.pages_found = 0;
@@ -5530,7 +5778,7 @@ out:
 		move_freepages_block(zone, page, MIGRATE_ISOLATE);
 	}
 
-	spin_unlock_irqrestore(&zone->lock, flags);
+	spin_unlock_irqrestore(&shard->lock, flags);
 	if (!ret)
 		drain_all_pages();
 	return ret;
@@ -5539,15 +5787,17 @@ out:
 void unset_migratetype_isolate(struct page *page)
 {
 	struct zone *zone;
+	struct zone_shard *shard;
 	unsigned long flags;
 	zone = page_zone(page);
-	spin_lock_irqsave(&zone->lock, flags);
+	shard = zone_pfn_shard(zone, page_to_pfn(page));
+	spin_lock_irqsave(&shard->lock, flags);
 	if (get_pageblock_migratetype(page) != MIGRATE_ISOLATE)
 		goto out;
 	set_pageblock_migratetype(page, MIGRATE_MOVABLE);
 	move_freepages_block(zone, page, MIGRATE_MOVABLE);
 out:
-	spin_unlock_irqrestore(&zone->lock, flags);
+	spin_unlock_irqrestore(&shard->lock, flags);
 }
 
 #ifdef CONFIG_MEMORY_HOTREMOVE
@@ -5569,7 +5819,7 @@ __offline_isolated_pages(unsigned long start_pfn, unsigned long end_pfn)
 	if (pfn == end_pfn)
 		return;
 	zone = page_zone(pfn_to_page(pfn));
-	spin_lock_irqsave(&zone->lock, flags);
+	zone_lock_shards_irqsave(zone, flags);
 	pfn = start_pfn;
 	while (pfn < end_pfn) {
 		if (!pfn_valid(pfn)) {
@@ -5586,14 +5836,14 @@ __offline_isolated_pages(unsigned long start_pfn, unsigned long end_pfn)
 #endif
 		list_del(&page->lru);
 		rmv_page_order(page);
-		zone->free_area[order].nr_free--;
+		zone_pfn_shard(zone, pfn)->free_area[order].nr_free--;
 		__mod_zone_page_state(zone, NR_FREE_PAGES,
 				      - (1UL << order));
 		for (i = 0; i < (1 << order); i++)
 			SetPageReserved((page+i));
 		pfn += (1 << order);
 	}
-	spin_unlock_irqrestore(&zone->lock, flags);
+	zone_unlock_shards_irqrestore(zone, flags);
 }
 #endif
 
@@ -5602,17 +5852,18 @@ bool is_free_buddy_page(struct page *page)
 {
 	struct zone *zone = page_zone(page);
 	unsigned long pfn = page_to_pfn(page);
+	struct zone_shard *shard = zone_pfn_shard(zone, pfn);
 	unsigned long flags;
 	int order;
 
-	spin_lock_irqsave(&zone->lock, flags);
+	spin_lock_irqsave(&shard->lock, flags);
 	for (order = 0; order < MAX_ORDER; order++) {
 		struct page *page_head = page - (pfn & ((1 << order) - 1));
 
 		if (PageBuddy(page_head) && page_order(page_head) >= order)
 			break;
 	}
-	spin_unlock_irqrestore(&zone->lock, flags);
+	spin_unlock_irqrestore(&shard->lock, flags);
 
 	return order < MAX_ORDER;
 }
@@ -84,7 +84,7 @@ undo_isolate_page_range(unsigned long start_pfn, unsigned long end_pfn)
 /*
  * Test all pages in the range is free(means isolated) or not.
  * all pages in [start_pfn...end_pfn) must be in the same zone.
- * zone->lock must be held before call this.
+ * All shard locks of the zone must be held before call this.
  *
  * Returns 1 if all pages in the range is isolated.
  */
@@ -134,8 +134,8 @@ int test_pages_isolated(unsigned long start_pfn, unsigned long end_pfn)
 		return -EBUSY;
 	/* Check all pages are free or Marked as ISOLATED */
 	zone = page_zone(page);
-	spin_lock_irqsave(&zone->lock, flags);
+	zone_lock_shards_irqsave(zone, flags);
 	ret = __test_page_isolated_in_pageblock(start_pfn, end_pfn);
-	spin_unlock_irqrestore(&zone->lock, flags);
+	zone_unlock_shards_irqrestore(zone, flags);
 	return ret ? 0 : -EBUSY;
 }
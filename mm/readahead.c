@@ -18,6 +18,8 @@
 #include <linux/pagevec.h>
 #include <linux/pagemap.h>
 
+#include "internal.h"
+
 /*
  * Initialise a struct file's readahead state.  Assumes that the caller has
  * memset *ra to zero.
@@ -177,7 +179,7 @@ __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 		rcu_read_lock();
 		page = radix_tree_lookup(&mapping->page_tree, page_offset);
 		rcu_read_unlock();
-		if (page)
+		if (page && !radix_tree_exceptional_entry(page))
 			continue;
 
 		page = page_cache_alloc_readahead(mapping);
@@ -195,8 +197,10 @@ __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 	 * uptodate then the caller will launch readpage again, and
 	 * will then handle the error.
 	 */
-	if (ret)
+	if (ret) {
 		read_pages(mapping, filp, &page_pool, ret);
+		__add_bdi_stat(mapping->backing_dev_info, BDI_READAHEAD, ret);
+	}
 	BUG_ON(!list_empty(&page_pool));
 out:
 	return ret;
@@ -259,6 +263,24 @@ unsigned long ra_submit(struct file_ra_state *ra,
 	return actual;
 }
 
+/*
+ * The reader waits for the first window of a stream.  Cap it to what the
+ * device transfers in RA_SYNC_MSECS, so that a slow device does not stall
+ * the reader on a full-size window; the windows read asynchronously later
+ * still ramp up to the full size.  The bandwidth estimated by writeback is
+ * the only one the bdi keeps, and starts out at 100MB/s.
+ */
+#define RA_SYNC_MSECS	20
+
+static unsigned long ra_sync_max(struct address_space *mapping,
+				 unsigned long max)
+{
+	unsigned long bw = mapping->backing_dev_info->avg_write_bandwidth;
+	unsigned long min_pages = VM_MIN_READAHEAD * 1024 / PAGE_CACHE_SIZE;
+
+	return clamp(bw * RA_SYNC_MSECS / MSEC_PER_SEC, min(min_pages, max), max);
+}
+
 /*
  * Set the initial window size, round to next power of 2 and square
  * for small size, x 4 for medium, and x 2 for large
@@ -349,7 +371,7 @@ static pgoff_t count_history_pages(struct address_space *mapping,
 	pgoff_t head;
 
 	rcu_read_lock();
-	head = radix_tree_prev_hole(&mapping->page_tree, offset - 1, max);
+	head = page_cache_prev_hole(mapping, offset - 1, max);
 	rcu_read_unlock();
 
 	return offset - 1 - head;
@@ -383,12 +405,90 @@ static int try_context_readahead(struct address_space *mapping,
 		size *= 2;
 
 	ra->start = offset;
-	ra->size = get_init_ra_size(size + req_size, max);
+	ra->size = get_init_ra_size(size + req_size, ra_sync_max(mapping, max));
 	ra->async_size = ra->size;
 
 	return 1;
 }
 
+/*
+ * Strided reads: a reader skipping the same distance between misses
+ * leaves no history pages behind, and would be served one random read
+ * at a time.  Once RA_STRIDE_HITS misses in a row have been the same
+ * distance apart, read the next RA_STRIDE_MAX requests along the stride
+ * too, each on its own so that the reader only waits for the first.
+ * stride_prev then points at the last one read, where the next miss of
+ * the stream is expected to continue.
+ *
+ * Misses no further than @min_stride from the previous one belong to the
+ * same request and leave the stride alone.  Returns the number of pages
+ * read.
+ */
+#define RA_STRIDE_HITS	2
+#define RA_STRIDE_MAX	8
+
+static int try_stride_readahead(struct address_space *mapping,
+				struct file_ra_state *ra, struct file *filp,
+				pgoff_t offset, unsigned long req_size,
+				unsigned long min_stride, unsigned long max)
+{
+	long stride = (long)(offset - ra->stride_prev);
+	unsigned long i, nr;
+	int ret = 0;
+
+	if ((unsigned long)abs(stride) <= min_stride)
+		return 0;
+
+	if (stride == ra->stride) {
+		if (ra->stride_hits < RA_STRIDE_HITS)
+			ra->stride_hits++;
+	} else {
+		ra->stride = stride;
+		ra->stride_hits = 0;
+	}
+	ra->stride_prev = offset;
+
+	nr = min(max / req_size, (unsigned long)RA_STRIDE_MAX);
+	if (ra->stride_hits < RA_STRIDE_HITS || nr < 2)
+		return 0;
+
+	for (i = 0; i < nr; i++) {
+		pgoff_t index = offset + i * stride;
+
+		/* stop where the stream would wrap around */
+		if (stride < 0 ? index > offset : index < offset)
+			break;
+		ret += __do_page_cache_readahead(mapping, filp, index,
+						 req_size, 0);
+		ra->stride_prev = index;
+	}
+	__inc_bdi_stat(mapping->backing_dev_info, BDI_READAHEAD_STRIDE);
+
+	return ret;
+}
+
+/**
+ * page_cache_stride_readahead - readahead for strided page faults
+ * @mapping: address_space which holds the pagecache and I/O vectors
+ * @ra: file_ra_state which holds the readahead state
+ * @filp: passed on to ->readpage() and ->readpages()
+ * @offset: start offset into @mapping, in pagecache page-sized units
+ *
+ * Feeds a major fault to the stride detection, and returns the number of
+ * pages it read ahead along a stride, if any.  Faults within half a
+ * readaround window of each other are left to mmap readaround.
+ */
+int page_cache_stride_readahead(struct address_space *mapping,
+				struct file_ra_state *ra, struct file *filp,
+				pgoff_t offset)
+{
+	unsigned long max = max_sane_readahead(ra->ra_pages);
+
+	if (!max)
+		return 0;
+	return try_stride_readahead(mapping, ra, filp, offset, 1, max / 2, max);
+}
+
 /*
  * A minimal readahead algorithm for trivial sequential/random reads.
  */
@@ -399,6 +499,7 @@ ondemand_readahead(struct address_space *mapping,
 		   unsigned long req_size)
 {
 	unsigned long max = max_sane_readahead(ra->ra_pages);
+	int ret;
 
 	/*
 	 * start of file
@@ -428,7 +529,7 @@ ondemand_readahead(struct address_space *mapping,
 		pgoff_t start;
 
 		rcu_read_lock();
-		start = radix_tree_next_hole(&mapping->page_tree, offset+1,max);
+		start = page_cache_next_hole(mapping, offset + 1, max);
 		rcu_read_unlock();
 
 		if (!start || start - offset > max)
@@ -461,6 +562,15 @@ ondemand_readahead(struct address_space *mapping,
 	if (try_context_readahead(mapping, ra, offset, req_size, max))
 		goto readit;
 
+	/*
+	 * Random reads at a constant distance from each other: they do not
+	 * touch the sequential readahead state either.
+	 */
+	ret = try_stride_readahead(mapping, ra, filp, offset, req_size,
+				   req_size, max);
+	if (ret)
+		return ret;
+
 	/*
 	 * standalone, small random read
 	 * Read as is, and do not pollute the readahead state.
@@ -469,7 +579,7 @@ ondemand_readahead(struct address_space *mapping,
 
 initial_readahead:
 	ra->start = offset;
-	ra->size = get_init_ra_size(req_size, max);
+	ra->size = get_init_ra_size(req_size, ra_sync_max(mapping, max));
 	ra->async_size = ra->size > req_size ? ra->size - req_size : ra->size;
 
 readit:
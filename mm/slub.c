@@ -30,6 +30,7 @@
 #include <linux/fault-inject.h>
 #include <linux/stacktrace.h>
 #include <linux/prefetch.h>
+#include <linux/memcontrol.h>
 
 #include <trace/events/kmem.h>
 
@@ -121,6 +122,16 @@ static inline int kmem_cache_debug(struct kmem_cache *s)
 #endif
 }
 
+/* Is this the per-memcg copy of a SLAB_ACCOUNT cache? */
+static inline bool is_memcg_cache(struct kmem_cache *s)
+{
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR_KMEM
+	return s->memcg_params && !s->memcg_params->is_root_cache;
+#else
+	return false;
+#endif
+}
+
 /*
  * Issues still to be resolved:
  *
@@ -163,7 +174,7 @@ static inline int kmem_cache_debug(struct kmem_cache *s)
  */
 #define SLUB_NEVER_MERGE (SLAB_RED_ZONE | SLAB_POISON | SLAB_STORE_USER | \
 		SLAB_TRACE | SLAB_DESTROY_BY_RCU | SLAB_NOLEAKTRACE | \
-		SLAB_FAILSLAB)
+		SLAB_FAILSLAB | SLAB_ACCOUNT)
 
 #define SLUB_MERGE_SAME (SLAB_DEBUG_FREE | SLAB_RECLAIM_ACCOUNT | \
 		SLAB_CACHE_DMA | SLAB_NOTRACK)
@@ -1314,6 +1325,12 @@ static struct page *allocate_slab(struct kmem_cache *s, gfp_t flags, int node)
 			stat(s, ORDER_FALLBACK);
 	}
 
+	if (page && is_memcg_cache(s) &&
+	    memcg_charge_slab(s, flags, oo_order(oo))) {
+		__free_pages(page, oo_order(oo));
+		page = NULL;
+	}
+
 	if (flags & __GFP_WAIT)
 		local_irq_disable();
 
@@ -1417,6 +1434,8 @@ static void __free_slab(struct kmem_cache *s, struct page *page)
 	reset_page_mapcount(page);
 	if (current->reclaim_state)
 		current->reclaim_state->reclaimed_slab += pages;
+	if (is_memcg_cache(s))
+		memcg_uncharge_slab(s, order);
 	__free_pages(page, order);
 }
 
@@ -2005,6 +2024,8 @@ int put_cpu_partial(struct kmem_cache *s, struct page *page, int drain)
 	return pobjects;
 }
 
+static void flush_remote_frees(struct kmem_cache *s, struct kmem_cache_cpu *c);
+
 static inline void flush_slab(struct kmem_cache *s, struct kmem_cache_cpu *c)
 {
 	stat(s, CPUSLAB_FLUSH);
@@ -2021,6 +2042,9 @@ static inline void __flush_cpu_slab(struct kmem_cache *s, int cpu)
 	struct kmem_cache_cpu *c = per_cpu_ptr(s->cpu_slab, cpu);
 
 	if (likely(c)) {
+		if (c->remote_nr)
+			flush_remote_frees(s, c);
+
 		if (c->page)
 			flush_slab(s, c);
 
@@ -2040,7 +2064,7 @@ static bool has_cpu_slab(int cpu, void *info)
 	struct kmem_cache *s = info;
 	struct kmem_cache_cpu *c = per_cpu_ptr(s->cpu_slab, cpu);
 
-	return !!(c->page);
+	return c->page || c->remote_nr;
 }
 
 static void flush_all(struct kmem_cache *s)
@@ -2200,21 +2224,10 @@ static inline void *get_freelist(struct kmem_cache *s, struct page *page)
  * we need to allocate a new slab. This is the slowest path since it involves
  * a call to the page allocator and the setup of a new slab.
  */
-static void *__slab_alloc(struct kmem_cache *s, gfp_t gfpflags, int node,
-			  unsigned long addr, struct kmem_cache_cpu *c)
+static void *___slab_alloc(struct kmem_cache *s, gfp_t gfpflags, int node,
+			   unsigned long addr, struct kmem_cache_cpu *c)
 {
 	void **object;
-	unsigned long flags;
-
-	local_irq_save(flags);
-#ifdef CONFIG_PREEMPT
-	/*
-	 * We may have been preempted and rescheduled on a different
-	 * cpu before disabling interrupts. Need to reload cpu area
-	 * pointer.
-	 */
-	c = this_cpu_ptr(s->cpu_slab);
-#endif
 
 	if (!c->page)
 		goto new_slab;
@@ -2245,7 +2258,6 @@ redo:
 load_freelist:
 	c->freelist = get_freepointer(s, object);
 	c->tid = next_tid(c->tid);
-	local_irq_restore(flags);
 	return object;
 
 new_slab:
@@ -2270,7 +2282,6 @@ new_slab:
 			if (!(gfpflags & __GFP_NOWARN) && printk_ratelimit())
 				slab_out_of_memory(s, gfpflags, node);
 
-			local_irq_restore(flags);
 			return NULL;
 		}
 	}
@@ -2285,10 +2296,34 @@ new_slab:
 	c->freelist = get_freepointer(s, object);
 	deactivate_slab(s, c);
 	c->node = NUMA_NO_NODE;
-	local_irq_restore(flags);
 	return object;
 }
 
+/*
+ * Another one that disabled interrupt and compensates for possible
+ * cpu changes by refetching the per cpu area pointer.
+ */
+static void *__slab_alloc(struct kmem_cache *s, gfp_t gfpflags, int node,
+			  unsigned long addr, struct kmem_cache_cpu *c)
+{
+	void *p;
+	unsigned long flags;
+
+	local_irq_save(flags);
+#ifdef CONFIG_PREEMPT
+	/*
+	 * We may have been preempted and rescheduled on a different
+	 * cpu before disabling interrupts. Need to reload cpu area
+	 * pointer.
+	 */
+	c = this_cpu_ptr(s->cpu_slab);
+#endif
+
+	p = ___slab_alloc(s, gfpflags, node, addr, c);
+	local_irq_restore(flags);
+	return p;
+}
+
 /*
  * Inlined fastpath so that allocation functions (kmalloc, kmem_cache_alloc)
  * have the fastpath folded into their functions. So no function call
@@ -2309,6 +2344,8 @@ static __always_inline void *slab_alloc(struct kmem_cache *s,
 	if (slab_pre_alloc_hook(s, gfpflags))
 		return NULL;
 
+	if (s->flags & SLAB_ACCOUNT)
+		s = memcg_kmem_get_cache(s, gfpflags);
 redo:
 
 	/*
@@ -2432,10 +2469,9 @@ EXPORT_SYMBOL(kmem_cache_alloc_node_trace);
  * handling required then we can return immediately.
  */
 static void __slab_free(struct kmem_cache *s, struct page *page,
-			void *x, unsigned long addr)
+			void *head, void *tail, int cnt, unsigned long addr)
 {
 	void *prior;
-	void **object = (void *)x;
 	int was_frozen;
 	int inuse;
 	struct page new;
@@ -2445,19 +2481,20 @@ static void __slab_free(struct kmem_cache *s, struct page *page,
 
 	stat(s, FREE_SLOWPATH);
 
-	if (kmem_cache_debug(s) && !free_debug_processing(s, page, x, addr))
+	/* Debug caches never free more than one object at a time */
+	if (kmem_cache_debug(s) && !free_debug_processing(s, page, head, addr))
 		return;
 
 	do {
 		prior = page->freelist;
 		counters = page->counters;
-		set_freepointer(s, object, prior);
+		set_freepointer(s, tail, prior);
 		new.counters = counters;
 		was_frozen = new.frozen;
-		new.inuse--;
+		new.inuse -= cnt;
 		if ((!new.inuse || !prior) && !was_frozen && !n) {
 
-			if (!kmem_cache_debug(s) && !prior)
+			if (!kmem_cache_debug(s) && !prior && s->cpu_partial)
 
 				/*
 				 * Slab was on no list before and will be partially empty
@@ -2484,7 +2521,7 @@ static void __slab_free(struct kmem_cache *s, struct page *page,
 
 	} while (!cmpxchg_double_slab(s, page,
 		prior, counters,
-		object, new.counters,
+		head, new.counters,
 		"__slab_free"));
 
 	if (likely(!n)) {
@@ -2545,6 +2582,75 @@ slab_empty:
 	discard_slab(s, page);
 }
 
+/*
+ * Return the objects batched in c->remote to their slabs. Objects freed
+ * on a consumer cpu tend to arrive in runs from the same few slabs, so
+ * they are chained up per slab first and every slab is then updated
+ * with a single cmpxchg, taking its node's list_lock at most once.
+ *
+ * Must be called with interrupts disabled.
+ */
+static void flush_remote_frees(struct kmem_cache *s, struct kmem_cache_cpu *c)
+{
+	size_t size = c->remote_nr;
+	void **p = c->remote;
+
+	c->remote_nr = 0;
+	stat(s, FREE_REMOTE_FLUSH);
+
+	while (size) {
+		struct page *page = virt_to_head_page(p[--size]);
+		void *head = p[size];
+		void *tail = head;
+		int cnt = 1;
+		size_t i, j;
+
+		set_freepointer(s, tail, NULL);
+		for (i = 0, j = 0; i < size; i++) {
+			if (virt_to_head_page(p[i]) == page) {
+				set_freepointer(s, p[i], head);
+				head = p[i];
+				cnt++;
+			} else
+				p[j++] = p[i];
+		}
+		size = j;
+
+		__slab_free(s, page, head, tail, cnt, _RET_IP_);
+	}
+}
+
+/*
+ * Defer a free to a slab other than the cpu slab. Such frees are common
+ * when objects are allocated on one cpu and released on another, and each
+ * of them would otherwise cost a cmpxchg on a cacheline shared with the
+ * allocating cpu, plus a trip through the node list_lock whenever the
+ * slab changes from full to partial or becomes empty.
+ */
+static void slab_free_remote(struct kmem_cache *s, void *x)
+{
+	struct kmem_cache_cpu *c;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	c = __this_cpu_ptr(s->cpu_slab);
+	c->remote[c->remote_nr++] = x;
+	stat(s, FREE_REMOTE_BATCH);
+	if (c->remote_nr == SLUB_REMOTE_BATCH)
+		flush_remote_frees(s, c);
+	local_irq_restore(flags);
+}
+
+static inline void slab_free_freelist_hook(struct kmem_cache *s,
+					   void *head, void *tail)
+{
+	void *object = head;
+
+	do {
+		slab_free_hook(s, object);
+	} while (object != tail && (object = get_freepointer(s, object)));
+}
+
 /*
  * Fastpath with forced inlining to produce a kfree and kmem_cache_free that
  * can perform fastpath freeing without additional function calls.
@@ -2553,17 +2659,22 @@ slab_empty:
  * of this processor. This typically the case if we have just allocated
  * the item before.
  *
- * If fastpath is not possible then fall back to __slab_free where we deal
- * with all sorts of special processing.
+ * Single objects freed to any other slab are batched per cpu. Detached
+ * freelists built by bulk freeing, and objects of debug caches, fall back
+ * to __slab_free where we deal with all sorts of special processing.
+ *
+ * If @tail is NULL, @head is a single object. Otherwise @head to @tail is
+ * a freelist of @cnt objects, all belonging to @page.
  */
 static __always_inline void slab_free(struct kmem_cache *s,
-			struct page *page, void *x, unsigned long addr)
+			struct page *page, void *head, void *tail, int cnt,
+			unsigned long addr)
 {
-	void **object = (void *)x;
+	void *tail_obj = tail ? : head;
 	struct kmem_cache_cpu *c;
 	unsigned long tid;
 
-	slab_free_hook(s, x);
+	slab_free_freelist_hook(s, head, tail_obj);
 
 redo:
 	/*
@@ -2578,19 +2689,21 @@ redo:
 	barrier();
 
 	if (likely(page == c->page)) {
-		set_freepointer(s, object, c->freelist);
+		set_freepointer(s, tail_obj, c->freelist);
 
 		if (unlikely(!this_cpu_cmpxchg_double(
 				s->cpu_slab->freelist, s->cpu_slab->tid,
 				c->freelist, tid,
-				object, next_tid(tid)))) {
+				head, next_tid(tid)))) {
 
 			note_cmpxchg_failure("slab_free", s, tid);
 			goto redo;
 		}
 		stat(s, FREE_FASTPATH);
-	} else
-		__slab_free(s, page, x, addr);
+	} else if (!tail && !kmem_cache_debug(s))
+		slab_free_remote(s, head);
+	else
+		__slab_free(s, page, head, tail_obj, cnt, addr);
 
 }
 
@@ -2600,12 +2713,176 @@ void kmem_cache_free(struct kmem_cache *s, void *x)
 
 	page = virt_to_head_page(x);
 
-	slab_free(s, page, x, _RET_IP_);
+	/* the object may have come from a per-memcg copy of the cache */
+	if (memcg_kmem_enabled() && (s->flags & SLAB_ACCOUNT))
+		s = page->slab;
+
+	slab_free(s, page, x, NULL, 1, _RET_IP_);
 
 	trace_kmem_cache_free(_RET_IP_, x);
 }
 EXPORT_SYMBOL(kmem_cache_free);
 
+struct detached_freelist {
+	struct kmem_cache *s;
+	struct page *page;
+	void *tail;
+	void *freelist;
+	int cnt;
+};
+
+/*
+ * This function progressively scans the array with free objects (with
+ * a limited look ahead) and extracts objects belonging to the same
+ * slab. It builds a detached freelist directly within the given slab
+ * objects and returns the index to restart the scan from, or 0 once
+ * the array has been consumed. Processed objects are NULLed out.
+ */
+static size_t build_detached_freelist(struct kmem_cache *s, size_t size,
+				      void **p, struct detached_freelist *df)
+{
+	size_t first_skipped_index = 0;
+	int lookahead = 3;
+	void *object;
+
+	df->page = NULL;
+
+	do {
+		object = p[--size];
+	} while (!object && size);
+
+	if (!object)
+		return 0;
+
+	df->page = virt_to_head_page(object);
+	/* the object may have come from a per-memcg copy of the cache */
+	df->s = s;
+	if (memcg_kmem_enabled() && (s->flags & SLAB_ACCOUNT))
+		df->s = df->page->slab;
+
+	/* Start new detached freelist */
+	set_freepointer(df->s, object, NULL);
+	df->tail = object;
+	df->freelist = object;
+	p[size] = NULL;
+	df->cnt = 1;
+
+	while (size) {
+		object = p[--size];
+		if (!object)
+			continue;
+
+		if (df->page == virt_to_head_page(object)) {
+			set_freepointer(df->s, object, df->freelist);
+			df->freelist = object;
+			df->cnt++;
+			p[size] = NULL;
+			continue;
+		}
+
+		/* Limit look ahead search */
+		if (!--lookahead)
+			break;
+
+		if (!first_skipped_index)
+			first_skipped_index = size + 1;
+	}
+
+	return first_skipped_index;
+}
+
+/*
+ * Free an array of objects. Objects from the same slab are chained into a
+ * freelist and returned with a single operation on that slab.
+ */
+void kmem_cache_free_bulk(struct kmem_cache *s, size_t size, void **p)
+{
+	if (WARN_ON(!size))
+		return;
+
+	if (kmem_cache_debug(s)) {
+		while (size)
+			kmem_cache_free(s, p[--size]);
+		return;
+	}
+
+	do {
+		struct detached_freelist df;
+
+		size = build_detached_freelist(s, size, p, &df);
+		if (unlikely(!df.page))
+			continue;
+
+		slab_free(df.s, df.page, df.freelist, df.tail, df.cnt,
+			  _RET_IP_);
+	} while (likely(size));
+}
+EXPORT_SYMBOL(kmem_cache_free_bulk);
+
+/*
+ * Allocate an array of objects. The cpu freelist is drained with
+ * interrupts disabled, which saves the cmpxchg per object of the
+ * regular fastpath.
+ */
+int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
+			  void **p)
+{
+	struct kmem_cache_cpu *c;
+	size_t i;
+
+	if (slab_pre_alloc_hook(s, flags))
+		return 0;
+
+	if (s->flags & SLAB_ACCOUNT)
+		s = memcg_kmem_get_cache(s, flags);
+
+	local_irq_disable();
+	c = this_cpu_ptr(s->cpu_slab);
+
+	for (i = 0; i < size; i++) {
+		void *object = c->freelist;
+
+		if (unlikely(!object)) {
+			/*
+			 * Objects may have been taken off c->freelist in
+			 * earlier iterations without bumping the tid, and
+			 * ___slab_alloc() may reenable interrupts while
+			 * allocating a new slab. Bump it now so that a
+			 * preempted fastpath cannot succeed on stale state.
+			 */
+			c->tid = next_tid(c->tid);
+
+			p[i] = ___slab_alloc(s, flags, NUMA_NO_NODE,
+					     _RET_IP_, c);
+			if (unlikely(!p[i]))
+				goto error;
+
+			c = this_cpu_ptr(s->cpu_slab);
+			continue;
+		}
+		c->freelist = get_freepointer(s, object);
+		p[i] = object;
+	}
+	c->tid = next_tid(c->tid);
+	local_irq_enable();
+
+	for (i = 0; i < size; i++) {
+		if (unlikely(flags & __GFP_ZERO))
+			memset(p[i], 0, s->objsize);
+		slab_post_alloc_hook(s, flags, p[i]);
+	}
+	return i;
+
+error:
+	local_irq_enable();
+	for (i = 0; i < size && p[i]; i++)
+		slab_post_alloc_hook(s, flags, p[i]);
+	if (i)
+		kmem_cache_free_bulk(s, i, p);
+	return 0;
+}
+EXPORT_SYMBOL(kmem_cache_alloc_bulk);
+
 /*
  * Object placement in a slab is made very easy because we always start at
  * offset 0. If we tune the size of the object to the alignment then we can
@@ -3201,6 +3478,7 @@ void kmem_cache_destroy(struct kmem_cache *s)
 		}
 		if (s->flags & SLAB_DESTROY_BY_RCU)
 			rcu_barrier();
+		memcg_release_cache(s);
 		sysfs_slab_remove(s);
 	} else
 		up_write(&slub_lock);
@@ -3473,7 +3751,7 @@ void kfree(const void *x)
 		put_page(page);
 		return;
 	}
-	slab_free(page->slab, page, object, _RET_IP_);
+	slab_free(page->slab, page, object, NULL, 1, _RET_IP_);
 }
 EXPORT_SYMBOL(kfree);
 
@@ -3966,6 +4244,11 @@ struct kmem_cache *kmem_cache_create(const char *name, size_t size,
 				kfree(s);
 				goto err;
 			}
+			if ((flags & SLAB_ACCOUNT) && memcg_register_cache(s)) {
+				kmem_cache_destroy(s);
+				s = NULL;
+				goto out;
+			}
 			return s;
 		}
 		kfree(n);
@@ -3973,7 +4256,7 @@ struct kmem_cache *kmem_cache_create(const char *name, size_t size,
 	}
 err:
 	up_write(&slub_lock);
-
+out:
 	if (flags & SLAB_PANIC)
 		panic("Cannot create slabcache %s\n", name);
 	else
@@ -3982,6 +4265,76 @@ err:
 }
 EXPORT_SYMBOL(kmem_cache_create);
 
+#if defined(CONFIG_CGROUP_MEM_RES_CTLR_KMEM)
+/*
+ * Create the copy of @root that holds the objects of @memcg. Called by
+ * the memcg code with its cache mutex held; the copy is never merged
+ * and is named after its root and the memcg's kmem cache id.
+ */
+struct kmem_cache *kmem_cache_create_memcg(struct mem_cgroup *memcg,
+					   struct kmem_cache *root, int id)
+{
+	struct memcg_cache_params *params;
+	struct kmem_cache *s;
+	char *n;
+
+	n = kasprintf(GFP_KERNEL, "%s(%d)", root->name, id);
+	if (!n)
+		return NULL;
+
+	params = kzalloc(sizeof(*params), GFP_KERNEL);
+	if (!params)
+		goto err_name;
+
+	s = kmalloc(kmem_size, GFP_KERNEL);
+	if (!s)
+		goto err_params;
+
+	params->cachep = s;
+	params->memcg = memcg;
+	params->root_cache = root;
+	atomic_set(&params->nr_pages, 0);
+
+	down_write(&slub_lock);
+	if (!kmem_cache_open(s, n, root->objsize, root->align, root->flags,
+			     root->ctor)) {
+		up_write(&slub_lock);
+		goto err_cache;
+	}
+	s->memcg_params = params;
+	list_add(&s->list, &slab_caches);
+	up_write(&slub_lock);
+
+	if (sysfs_slab_add(s)) {
+		down_write(&slub_lock);
+		list_del(&s->list);
+		up_write(&slub_lock);
+		kmem_cache_close(s);
+		goto err_cache;
+	}
+	return s;
+
+err_cache:
+	kfree(s);
+err_params:
+	kfree(params);
+err_name:
+	kfree(n);
+	return NULL;
+}
+
+/*
+ * A per-memcg cache whose memcg is going away gets no new allocations.
+ * Make it give back slabs as soon as they become empty, so that the
+ * last free can release the cache.
+ */
+void kmem_cache_mark_dead(struct kmem_cache *s)
+{
+	s->min_partial = 0;
+	s->cpu_partial = 0;
+}
+#endif
+
 #ifdef CONFIG_SMP
 /*
  * Use the cpu notifier to insure that the cpu slabs are flushed when
@@ -5091,6 +5444,8 @@ STAT_ATTR(CPU_PARTIAL_ALLOC, cpu_partial_alloc);
 STAT_ATTR(CPU_PARTIAL_FREE, cpu_partial_free);
 STAT_ATTR(CPU_PARTIAL_NODE, cpu_partial_node);
 STAT_ATTR(CPU_PARTIAL_DRAIN, cpu_partial_drain);
+STAT_ATTR(FREE_REMOTE_BATCH, free_remote_batch);
+STAT_ATTR(FREE_REMOTE_FLUSH, free_remote_flush);
 #endif
 
 static struct attribute *slab_attrs[] = {
@@ -5158,6 +5513,8 @@ static struct attribute *slab_attrs[] = {
 	&cpu_partial_free_attr.attr,
 	&cpu_partial_node_attr.attr,
 	&cpu_partial_drain_attr.attr,
+	&free_remote_batch_attr.attr,
+	&free_remote_flush_attr.attr,
 #endif
 #ifdef CONFIG_FAILSLAB
 	&failslab_attr.attr,
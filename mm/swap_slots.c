@@ -0,0 +1,188 @@
+/*
+ *  linux/mm/swap_slots.c
+ *
+ *  Per-cpu caches of swap slots.
+ *
+ *  Every swap slot allocated or freed used to take swap_lock, which made
+ *  that lock the bottleneck of swapping to fast devices.  Each cpu now
+ *  keeps a cache of up to SWAP_SLOTS_CACHE_SIZE slots ready for
+ *  get_swap_page(), refilled by get_swap_pages() under one hold of the
+ *  lock, and collects the slots going free in another cache, handed back
+ *  by swapcache_free_entries() once it is full.
+ *
+ *  Slots waiting in the return cache still have SWAP_HAS_CACHE set in
+ *  their swap_map, so nobody can reuse them before they are really freed.
+ *
+ *  The caches are drained and disabled while a device is swapped off, so
+ *  that none of its slots hides in them.
+ */
+#include <linux/swap.h>
+#include <linux/percpu.h>
+#include <linux/cpu.h>
+#include <linux/notifier.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/init.h>
+
+struct swap_slots_cache {
+	struct mutex	alloc_lock;	/* protects slots, nr, cur */
+	swp_entry_t	slots[SWAP_SLOTS_CACHE_SIZE];
+	int		nr;
+	int		cur;
+	spinlock_t	free_lock;	/* protects slots_ret, n_ret */
+	swp_entry_t	slots_ret[SWAP_SLOTS_CACHE_SIZE];
+	int		n_ret;
+};
+
+static DEFINE_PER_CPU(struct swap_slots_cache, swp_slots);
+
+/* Serializes enabling and disabling of the caches */
+static DEFINE_MUTEX(swap_slots_cache_enable_mutex);
+static bool swap_slot_cache_enabled;
+
+#define SLOTS_CACHE	0x1
+#define SLOTS_CACHE_RET	0x2
+
+static void drain_slots_cache_cpu(unsigned int cpu, unsigned int type)
+{
+	struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+
+	if (type & SLOTS_CACHE) {
+		mutex_lock(&cache->alloc_lock);
+		/* unused slots are SWAP_HAS_CACHE, just like returned ones */
+		swapcache_free_entries(cache->slots + cache->cur, cache->nr);
+		cache->cur = 0;
+		cache->nr = 0;
+		mutex_unlock(&cache->alloc_lock);
+	}
+	if (type & SLOTS_CACHE_RET) {
+		spin_lock(&cache->free_lock);
+		swapcache_free_entries(cache->slots_ret, cache->n_ret);
+		cache->n_ret = 0;
+		spin_unlock(&cache->free_lock);
+	}
+}
+
+static void drain_slots_cache(unsigned int type)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu)
+		drain_slots_cache_cpu(cpu, type);
+}
+
+void enable_swap_slots_cache(void)
+{
+	mutex_lock(&swap_slots_cache_enable_mutex);
+	swap_slot_cache_enabled = true;
+	mutex_unlock(&swap_slots_cache_enable_mutex);
+}
+
+/*
+ * Called before swapoff empties a device: the caches stay disabled until
+ * reenable_swap_slots_cache_unlock(), and no slot is left in them.
+ */
+void disable_swap_slots_cache_lock(void)
+{
+	mutex_lock(&swap_slots_cache_enable_mutex);
+	swap_slot_cache_enabled = false;
+	drain_slots_cache(SLOTS_CACHE | SLOTS_CACHE_RET);
+}
+
+void reenable_swap_slots_cache_unlock(void)
+{
+	if (total_swap_pages)
+		swap_slot_cache_enabled = true;
+	mutex_unlock(&swap_slots_cache_enable_mutex);
+}
+
+/* Called with the cache's alloc_lock held */
+static int refill_swap_slots_cache(struct swap_slots_cache *cache)
+{
+	if (!swap_slot_cache_enabled || cache->nr)
+		return 0;
+
+	cache->cur = 0;
+	cache->nr = get_swap_pages(SWAP_SLOTS_CACHE_SIZE, cache->slots);
+
+	return cache->nr;
+}
+
+swp_entry_t get_swap_page(void)
+{
+	struct swap_slots_cache *cache;
+	swp_entry_t entry;
+
+	/*
+	 * The task may move to another cpu once the cache is picked:
+	 * alloc_lock, not preemption, keeps the cache consistent.
+	 */
+	if (swap_slot_cache_enabled) {
+		cache = __this_cpu_ptr(&swp_slots);
+
+		entry.val = 0;
+		mutex_lock(&cache->alloc_lock);
+		if (cache->nr || refill_swap_slots_cache(cache)) {
+			entry = cache->slots[cache->cur++];
+			cache->nr--;
+		}
+		mutex_unlock(&cache->alloc_lock);
+		if (entry.val)
+			return entry;
+	}
+
+	if (!get_swap_pages(1, &entry))
+		entry.val = 0;
+	return entry;
+}
+
+/*
+ * Free a slot whose last reference is gone, as left by swap_entry_put()
+ * with only SWAP_HAS_CACHE set.
+ */
+void free_swap_slot(swp_entry_t entry)
+{
+	struct swap_slots_cache *cache;
+
+	cache = __this_cpu_ptr(&swp_slots);
+	spin_lock(&cache->free_lock);
+	/* Recheck under the lock: a drain may have started meanwhile */
+	if (!swap_slot_cache_enabled) {
+		spin_unlock(&cache->free_lock);
+		swapcache_free_entries(&entry, 1);
+		return;
+	}
+	if (cache->n_ret >= SWAP_SLOTS_CACHE_SIZE) {
+		/*
+		 * Return slots to the global pool.  Freeing them under
+		 * free_lock is fine: swap_lock is never held when taking it.
+		 */
+		swapcache_free_entries(cache->slots_ret, cache->n_ret);
+		cache->n_ret = 0;
+	}
+	cache->slots_ret[cache->n_ret++] = entry;
+	spin_unlock(&cache->free_lock);
+}
+
+static int __cpuinit swap_slots_cpu_callback(struct notifier_block *nfb,
+					     unsigned long action, void *hcpu)
+{
+	if (action == CPU_DEAD || action == CPU_DEAD_FROZEN)
+		drain_slots_cache_cpu((long)hcpu, SLOTS_CACHE | SLOTS_CACHE_RET);
+	return NOTIFY_OK;
+}
+
+static int __init swap_slots_cache_init(void)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+
+		mutex_init(&cache->alloc_lock);
+		spin_lock_init(&cache->free_lock);
+	}
+	hotcpu_notifier(swap_slots_cpu_callback, 0);
+	return 0;
+}
+subsys_initcall(swap_slots_cache_init);
@@ -315,6 +315,13 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 		err = swapcache_prepare(entry);
 		if (err == -EEXIST) {	/* seems racy */
 			radix_tree_preload_end();
+			/*
+			 * A slot with no swap count is not coming into the
+			 * swap cache: it is only waiting in a swap slots
+			 * cache to be freed, so do not spin on it.
+			 */
+			if (!__swap_count(entry))
+				break;
 			continue;
 		}
 		if (err) {		/* swp entry is obsolete ? */
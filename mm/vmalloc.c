@@ -248,6 +248,7 @@ EXPORT_SYMBOL(vmalloc_to_pfn);
 #define VM_LAZY_FREE	0x01
 #define VM_LAZY_FREEING	0x02
 #define VM_VM_AREA	0x04
+#define VM_CACHED	0x08
 
 struct vmap_area {
 	unsigned long va_start;
@@ -257,38 +258,67 @@ struct vmap_area {
 	struct list_head list;		/* address sorted list */
 	struct list_head purge_list;	/* "lazy purge" list */
 	struct vm_struct *vm;
+	unsigned long subtree_max_size;	/* in the free space tree */
 	struct rcu_head rcu_head;
 };
 
 static DEFINE_SPINLOCK(vmap_area_lock);
 static LIST_HEAD(vmap_area_list);
 static struct rb_root vmap_area_root = RB_ROOT;
+/* Lets find_vmap_area() walk vmap_area_root without vmap_area_lock */
+static seqcount_t vmap_area_seq = SEQCNT_ZERO;
 
-/* The vmap cache globals are protected by vmap_area_lock */
-static struct rb_node *free_vmap_cache;
-static unsigned long cached_hole_size;
-static unsigned long cached_vstart;
-static unsigned long cached_align;
+/*
+ * The free space between the areas in vmap_area_root, kept in vmap_areas
+ * of its own sorted by address, also under vmap_area_lock.  Each node is
+ * augmented with the size of the largest free area in its subtree, so
+ * that the lowest fit for a request is found in O(log n) steps instead of
+ * by walking the allocated areas from the bottom.
+ */
+static struct rb_root free_vmap_area_root = RB_ROOT;
+
+/* Cutting a free area in two needs a spare, allocated outside the lock */
+static struct vmap_area *free_vmap_spare;
 
 static unsigned long vmap_area_pcpu_hole;
 
-static struct vmap_area *__find_vmap_area(unsigned long addr)
+/*
+ * Look up the area starting at addr without vmap_area_lock: vmap_areas
+ * are only freed after an RCU grace period, and vmap_area_seq tells us
+ * if the tree changed under the walk.  A rebalance racing with the walk
+ * could lead it anywhere, so bound it by the depth an rbtree can reach.
+ * The caller must know that the area cannot go away under it.
+ */
+static struct vmap_area *find_vmap_area(unsigned long addr)
 {
-	struct rb_node *n = vmap_area_root.rb_node;
-
-	while (n) {
-		struct vmap_area *va;
+	struct vmap_area *va;
+	struct rb_node *n;
+	unsigned int seq;
+	int depth;
 
-		va = rb_entry(n, struct vmap_area, rb_node);
-		if (addr < va->va_start)
-			n = n->rb_left;
-		else if (addr > va->va_start)
-			n = n->rb_right;
-		else
-			return va;
-	}
+	rcu_read_lock();
+	do {
+		seq = read_seqcount_begin(&vmap_area_seq);
+		n = ACCESS_ONCE(vmap_area_root.rb_node);
+		va = NULL;
+
+		for (depth = 0; n && depth < 2 * BITS_PER_LONG; depth++) {
+			struct vmap_area *tmp_va;
+
+			tmp_va = rb_entry(n, struct vmap_area, rb_node);
+			if (addr < tmp_va->va_start)
+				n = ACCESS_ONCE(n->rb_left);
+			else if (addr > tmp_va->va_start)
+				n = ACCESS_ONCE(n->rb_right);
+			else {
+				va = tmp_va;
+				break;
+			}
+		}
+	} while (read_seqcount_retry(&vmap_area_seq, seq));
+	rcu_read_unlock();
 
-	return NULL;
+	return va;
 }
 
 static void __insert_vmap_area(struct vmap_area *va)
@@ -310,8 +340,10 @@ static void __insert_vmap_area(struct vmap_area *va)
 			BUG();
 	}
 
+	write_seqcount_begin(&vmap_area_seq);
 	rb_link_node(&va->rb_node, parent, p);
 	rb_insert_color(&va->rb_node, &vmap_area_root);
+	write_seqcount_end(&vmap_area_seq);
 
 	/* address-sort this list so it is usable like the vmlist */
 	tmp = rb_prev(&va->rb_node);
@@ -323,6 +355,320 @@ static void __insert_vmap_area(struct vmap_area *va)
 		list_add_rcu(&va->list, &vmap_area_list);
 }
 
+static inline unsigned long va_size(struct vmap_area *va)
+{
+	return va->va_end - va->va_start;
+}
+
+static inline unsigned long subtree_max_size(struct rb_node *node)
+{
+	if (!node)
+		return 0;
+	return rb_entry(node, struct vmap_area, rb_node)->subtree_max_size;
+}
+
+static void free_vmap_area_augment_cb(struct rb_node *node, void *unused)
+{
+	struct vmap_area *va = rb_entry(node, struct vmap_area, rb_node);
+
+	va->subtree_max_size = max3(va_size(va),
+				    subtree_max_size(node->rb_left),
+				    subtree_max_size(node->rb_right));
+}
+
+/* A free area changed size in place: update it and its ancestors */
+static void free_vmap_area_propagate(struct vmap_area *va)
+{
+	struct rb_node *node;
+
+	for (node = &va->rb_node; node; node = rb_parent(node))
+		free_vmap_area_augment_cb(node, NULL);
+}
+
+static void insert_free_vmap_area(struct vmap_area *va)
+{
+	struct rb_node **p = &free_vmap_area_root.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*p) {
+		struct vmap_area *tmp_va;
+
+		parent = *p;
+		tmp_va = rb_entry(parent, struct vmap_area, rb_node);
+		if (va->va_end <= tmp_va->va_start)
+			p = &(*p)->rb_left;
+		else if (va->va_start >= tmp_va->va_end)
+			p = &(*p)->rb_right;
+		else
+			BUG();
+	}
+
+	va->subtree_max_size = va_size(va);
+	rb_link_node(&va->rb_node, parent, p);
+	rb_insert_color(&va->rb_node, &free_vmap_area_root);
+	rb_augment_insert(&va->rb_node, free_vmap_area_augment_cb, NULL);
+}
+
+static void erase_free_vmap_area(struct vmap_area *va)
+{
+	struct rb_node *deepest;
+
+	deepest = rb_augment_erase_begin(&va->rb_node);
+	rb_erase(&va->rb_node, &free_vmap_area_root);
+	RB_CLEAR_NODE(&va->rb_node);
+	rb_augment_erase_end(deepest, free_vmap_area_augment_cb, NULL);
+}
+
+/*
+ * Give the space of a freed area back, merging it with the free areas
+ * on either side.  The vmap_area itself becomes the free area if it
+ * cannot be merged into the one below it.
+ */
+static void merge_free_vmap_area(struct vmap_area *va)
+{
+	struct vmap_area *sibling;
+	struct rb_node *n;
+
+	insert_free_vmap_area(va);
+
+	n = rb_next(&va->rb_node);
+	if (n) {
+		sibling = rb_entry(n, struct vmap_area, rb_node);
+		if (sibling->va_start == va->va_end) {
+			va->va_end = sibling->va_end;
+			erase_free_vmap_area(sibling);
+			kfree_rcu(sibling, rcu_head);
+		}
+	}
+
+	n = rb_prev(&va->rb_node);
+	if (n) {
+		sibling = rb_entry(n, struct vmap_area, rb_node);
+		if (sibling->va_end == va->va_start) {
+			sibling->va_end = va->va_end;
+			erase_free_vmap_area(va);
+			kfree_rcu(va, rcu_head);
+			va = sibling;
+		}
+	}
+
+	free_vmap_area_propagate(va);
+}
+
+static bool free_vmap_area_fits(struct vmap_area *va, unsigned long size,
+				unsigned long align, unsigned long vstart)
+{
+	unsigned long addr = ALIGN(max(va->va_start, vstart), align);
+
+	/* ALIGN() and the addition can wrap at the top of the space */
+	if (addr < vstart || addr + size < addr)
+		return false;
+
+	return addr + size <= va->va_end;
+}
+
+/*
+ * Find the lowest free area at or above vstart which is sure to hold size
+ * bytes at align: any of size + align - 1 bytes is, wherever it starts.
+ * Descend to the left while that subtree has one and may reach above
+ * vstart, otherwise try this area, then the right.  When a subtree fails
+ * us, its big enough areas all straddle vstart: climb back to the first
+ * ancestor above which there is still hope.
+ */
+static struct vmap_area *find_vmap_lowest_match(unsigned long size,
+				unsigned long align, unsigned long vstart)
+{
+	struct rb_node *node = free_vmap_area_root.rb_node;
+	unsigned long length = size + align - 1;
+	struct vmap_area *va;
+
+	while (node) {
+		va = rb_entry(node, struct vmap_area, rb_node);
+
+		if (subtree_max_size(node->rb_left) >= length &&
+		    vstart < va->va_start) {
+			node = node->rb_left;
+			continue;
+		}
+
+		if (free_vmap_area_fits(va, size, align, vstart))
+			return va;
+
+		if (subtree_max_size(node->rb_right) >= length) {
+			node = node->rb_right;
+			continue;
+		}
+
+		while ((node = rb_parent(node))) {
+			va = rb_entry(node, struct vmap_area, rb_node);
+			if (free_vmap_area_fits(va, size, align, vstart))
+				return va;
+
+			if (subtree_max_size(node->rb_right) >= length &&
+			    vstart <= va->va_start) {
+				node = node->rb_right;
+				break;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Cut [addr, addr + size) out of the free area va, which contains it.
+ * Cutting it out of the middle takes *spare for the part below.
+ */
+static int clip_free_vmap_area(struct vmap_area *va, unsigned long addr,
+			       unsigned long size, struct vmap_area **spare)
+{
+	unsigned long end = addr + size;
+	struct vmap_area *lva;
+
+	if (va->va_start == addr && va->va_end == end) {
+		erase_free_vmap_area(va);
+		kfree_rcu(va, rcu_head);
+		return 0;
+	}
+
+	if (va->va_start == addr) {
+		va->va_start = end;
+	} else if (va->va_end == end) {
+		va->va_end = addr;
+	} else {
+		lva = *spare;
+		if (!lva)
+			return -ENOMEM;
+		*spare = NULL;
+
+		lva->va_start = va->va_start;
+		lva->va_end = addr;
+		va->va_start = end;
+		free_vmap_area_propagate(va);
+		insert_free_vmap_area(lva);
+		return 0;
+	}
+
+	free_vmap_area_propagate(va);
+	return 0;
+}
+
+/* The free area containing addr */
+static struct vmap_area *find_free_vmap_area(unsigned long addr)
+{
+	struct rb_node *n = free_vmap_area_root.rb_node;
+
+	while (n) {
+		struct vmap_area *va;
+
+		va = rb_entry(n, struct vmap_area, rb_node);
+		if (addr < va->va_start)
+			n = n->rb_left;
+		else if (addr >= va->va_end)
+			n = n->rb_right;
+		else
+			return va;
+	}
+
+	return NULL;
+}
+
+/*
+ * Small areas freed by the lazy purge, their TLB entries flushed already,
+ * are kept on per-cpu lists instead of going back to the free space tree.
+ * They stay reserved in vmap_area_root meanwhile, marked VM_CACHED, so
+ * reusing one takes neither vmap_area_lock nor a new vmap_area.
+ */
+#define VMAP_CACHE_PAGES	16	/* largest area cached, in pages */
+#define VMAP_CACHE_DEPTH	8	/* areas cached per size and cpu */
+
+struct vmap_area_cache {
+	spinlock_t lock;
+	unsigned int nr[VMAP_CACHE_PAGES];
+	struct list_head free[VMAP_CACHE_PAGES];
+};
+
+static DEFINE_PER_CPU(struct vmap_area_cache, vmap_area_cache);
+
+static struct vmap_area *vmap_cache_get(unsigned long size,
+				unsigned long align,
+				unsigned long vstart, unsigned long vend)
+{
+	unsigned long idx = (size >> PAGE_SHIFT) - 1;
+	struct vmap_area_cache *vc;
+	struct vmap_area *va;
+
+	if (idx >= VMAP_CACHE_PAGES)
+		return NULL;
+
+	vc = &get_cpu_var(vmap_area_cache);
+	spin_lock(&vc->lock);
+	list_for_each_entry(va, &vc->free[idx], purge_list) {
+		if (va->va_start >= vstart && va->va_end <= vend &&
+		    IS_ALIGNED(va->va_start, align)) {
+			list_del(&va->purge_list);
+			vc->nr[idx]--;
+			va->flags = 0;
+			goto out;
+		}
+	}
+	va = NULL;
+out:
+	spin_unlock(&vc->lock);
+	put_cpu_var(vmap_area_cache);
+
+	return va;
+}
+
+/* Called from the purge: takes va off the purge list if it is cached */
+static void vmap_cache_put(struct vmap_area *va)
+{
+	unsigned long idx = (va_size(va) >> PAGE_SHIFT) - 1;
+	struct vmap_area_cache *vc;
+
+	if (idx >= VMAP_CACHE_PAGES)
+		return;
+
+	vc = &get_cpu_var(vmap_area_cache);
+	spin_lock(&vc->lock);
+	if (vc->nr[idx] < VMAP_CACHE_DEPTH) {
+		va->flags = VM_CACHED;
+		list_move(&va->purge_list, &vc->free[idx]);
+		vc->nr[idx]++;
+	}
+	spin_unlock(&vc->lock);
+	put_cpu_var(vmap_area_cache);
+}
+
+static void __free_vmap_area(struct vmap_area *va);
+
+/* Give all cached areas back to the free space tree */
+static void vmap_cache_drain(void)
+{
+	struct vmap_area *va, *n_va;
+	LIST_HEAD(valist);
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		struct vmap_area_cache *vc = &per_cpu(vmap_area_cache, cpu);
+
+		spin_lock(&vc->lock);
+		for (i = 0; i < VMAP_CACHE_PAGES; i++) {
+			list_splice_init(&vc->free[i], &valist);
+			vc->nr[i] = 0;
+		}
+		spin_unlock(&vc->lock);
+	}
+
+	if (list_empty(&valist))
+		return;
+
+	spin_lock(&vmap_area_lock);
+	list_for_each_entry_safe(va, n_va, &valist, purge_list)
+		__free_vmap_area(va);
+	spin_unlock(&vmap_area_lock);
+}
+
 static void purge_vmap_area_lazy(void);
 
 /*
@@ -334,102 +680,51 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 				unsigned long vstart, unsigned long vend,
 				int node, gfp_t gfp_mask)
 {
-	struct vmap_area *va;
-	struct rb_node *n;
+	struct vmap_area *va, *free_va, *spare = NULL;
 	unsigned long addr;
 	int purged = 0;
-	struct vmap_area *first;
 
 	BUG_ON(!size);
 	BUG_ON(size & ~PAGE_MASK);
 	BUG_ON(!is_power_of_2(align));
 
+	va = vmap_cache_get(size, align, vstart, vend);
+	if (va)
+		return va;
+
 	va = kmalloc_node(sizeof(struct vmap_area),
 			gfp_mask & GFP_RECLAIM_MASK, node);
 	if (unlikely(!va))
 		return ERR_PTR(-ENOMEM);
 
 retry:
-	spin_lock(&vmap_area_lock);
-	/*
-	 * Invalidate cache if we have more permissive parameters.
-	 * cached_hole_size notes the largest hole noticed _below_
-	 * the vmap_area cached in free_vmap_cache: if size fits
-	 * into that hole, we want to scan from vstart to reuse
-	 * the hole instead of allocating above free_vmap_cache.
-	 * Note that __free_vmap_area may update free_vmap_cache
-	 * without updating cached_hole_size or cached_align.
-	 */
-	if (!free_vmap_cache ||
-			size < cached_hole_size ||
-			vstart < cached_vstart ||
-			align < cached_align) {
-nocache:
-		cached_hole_size = 0;
-		free_vmap_cache = NULL;
-	}
-	/* record if we encounter less permissive parameters */
-	cached_vstart = vstart;
-	cached_align = align;
-
-	/* find starting point for our search */
-	if (free_vmap_cache) {
-		first = rb_entry(free_vmap_cache, struct vmap_area, rb_node);
-		addr = ALIGN(first->va_end, align);
-		if (addr < vstart)
-			goto nocache;
-		if (addr + size - 1 < addr)
-			goto overflow;
+	/* Unlocked peek: at worst we allocate a spare for nothing */
+	if (!spare && !free_vmap_spare)
+		spare = kmalloc_node(sizeof(struct vmap_area),
+				gfp_mask & GFP_RECLAIM_MASK, node);
 
-	} else {
-		addr = ALIGN(vstart, align);
-		if (addr + size - 1 < addr)
-			goto overflow;
-
-		n = vmap_area_root.rb_node;
-		first = NULL;
-
-		while (n) {
-			struct vmap_area *tmp;
-			tmp = rb_entry(n, struct vmap_area, rb_node);
-			if (tmp->va_end >= addr) {
-				first = tmp;
-				if (tmp->va_start <= addr)
-					break;
-				n = n->rb_left;
-			} else
-				n = n->rb_right;
-		}
-
-		if (!first)
-			goto found;
+	spin_lock(&vmap_area_lock);
+	if (!free_vmap_spare) {
+		free_vmap_spare = spare;
+		spare = NULL;
 	}
 
-	/* from the starting point, walk areas until a suitable hole is found */
-	while (addr + size > first->va_start && addr + size <= vend) {
-		if (addr + cached_hole_size < first->va_start)
-			cached_hole_size = first->va_start - addr;
-		addr = ALIGN(first->va_end, align);
-		if (addr + size - 1 < addr)
-			goto overflow;
-
-		n = rb_next(&first->rb_node);
-		if (n)
-			first = rb_entry(n, struct vmap_area, rb_node);
-		else
-			goto found;
-	}
+	free_va = find_vmap_lowest_match(size, align, vstart);
+	if (!free_va)
+		goto overflow;
 
-found:
+	addr = ALIGN(max(free_va->va_start, vstart), align);
 	if (addr + size > vend)
 		goto overflow;
+	if (clip_free_vmap_area(free_va, addr, size, &free_vmap_spare))
+		goto overflow;
 
 	va->va_start = addr;
 	va->va_end = addr + size;
 	va->flags = 0;
 	__insert_vmap_area(va);
-	free_vmap_cache = &va->rb_node;
 	spin_unlock(&vmap_area_lock);
+	kfree(spare);
 
 	BUG_ON(va->va_start & (align-1));
 	BUG_ON(va->va_start < vstart);
@@ -441,6 +736,7 @@ overflow:
 	spin_unlock(&vmap_area_lock);
 	if (!purged) {
 		purge_vmap_area_lazy();
+		vmap_cache_drain();
 		purged = 1;
 		goto retry;
 	}
@@ -448,6 +744,7 @@ overflow:
 		printk(KERN_WARNING
 			"vmap allocation for size %lu failed: "
 			"use vmalloc=<size> to increase size.\n", size);
+	kfree(spare);
 	kfree(va);
 	return ERR_PTR(-EBUSY);
 }
@@ -456,22 +753,9 @@ static void __free_vmap_area(struct vmap_area *va)
 {
 	BUG_ON(RB_EMPTY_NODE(&va->rb_node));
 
-	if (free_vmap_cache) {
-		if (va->va_end < cached_vstart) {
-			free_vmap_cache = NULL;
-		} else {
-			struct vmap_area *cache;
-			cache = rb_entry(free_vmap_cache, struct vmap_area, rb_node);
-			if (va->va_start <= cache->va_start) {
-				free_vmap_cache = rb_prev(&va->rb_node);
-				/*
-				 * We don't try to update cached_hole_size or
-				 * cached_align, but it won't go very wrong.
-				 */
-			}
-		}
-	}
+	write_seqcount_begin(&vmap_area_seq);
 	rb_erase(&va->rb_node, &vmap_area_root);
+	write_seqcount_end(&vmap_area_seq);
 	RB_CLEAR_NODE(&va->rb_node);
 	list_del_rcu(&va->list);
 
@@ -484,7 +768,12 @@ static void __free_vmap_area(struct vmap_area *va)
 	if (va->va_end > VMALLOC_START && va->va_end <= VMALLOC_END)
 		vmap_area_pcpu_hole = max(vmap_area_pcpu_hole, va->va_end);
 
-	kfree_rcu(va, rcu_head);
+	/*
+	 * Lockless walkers of vmap_area_root or vmap_area_list may still
+	 * be looking at va: it is only ever kfree_rcu()ed from here on,
+	 * and its list linkage is left alone.
+	 */
+	merge_free_vmap_area(va);
 }
 
 /*
@@ -620,6 +909,10 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 		flush_tlb_kernel_range(*start, *end);
 
 	if (nr) {
+		/* Keep small areas for reuse on this cpu, free the rest */
+		list_for_each_entry_safe(va, n_va, &valist, purge_list)
+			vmap_cache_put(va);
+
 		spin_lock(&vmap_area_lock);
 		list_for_each_entry_safe(va, n_va, &valist, purge_list)
 			__free_vmap_area(va);
@@ -681,17 +974,6 @@ static void free_unmap_vmap_area(struct vmap_area *va)
 	free_unmap_vmap_area_noflush(va);
 }
 
-static struct vmap_area *find_vmap_area(unsigned long addr)
-{
-	struct vmap_area *va;
-
-	spin_lock(&vmap_area_lock);
-	va = __find_vmap_area(addr);
-	spin_unlock(&vmap_area_lock);
-
-	return va;
-}
-
 static void free_unmap_vmap_area_addr(unsigned long addr)
 {
 	struct vmap_area *va;
@@ -1168,18 +1450,55 @@ void __init vm_area_register_early(struct vm_struct *vm, size_t align)
 	vm_area_add_early(vm);
 }
 
+/*
+ * Everything from the bottom to the top of the address space that is not
+ * taken by an early area is free: vstart and vend confine allocations.
+ */
+static void __init vmap_init_free_space(void)
+{
+	unsigned long vmap_start = 1;
+	struct vmap_area *busy, *free;
+
+	list_for_each_entry(busy, &vmap_area_list, list) {
+		if (busy->va_start > vmap_start) {
+			free = kzalloc(sizeof(struct vmap_area), GFP_NOWAIT);
+			if (WARN_ON_ONCE(!free))
+				return;
+			free->va_start = vmap_start;
+			free->va_end = busy->va_start;
+			insert_free_vmap_area(free);
+		}
+		vmap_start = busy->va_end;
+	}
+
+	if (vmap_start < ULONG_MAX) {
+		free = kzalloc(sizeof(struct vmap_area), GFP_NOWAIT);
+		if (WARN_ON_ONCE(!free))
+			return;
+		free->va_start = vmap_start;
+		free->va_end = ULONG_MAX;
+		insert_free_vmap_area(free);
+	}
+}
+
 void __init vmalloc_init(void)
 {
 	struct vmap_area *va;
 	struct vm_struct *tmp;
-	int i;
+	int i, j;
 
 	for_each_possible_cpu(i) {
 		struct vmap_block_queue *vbq;
+		struct vmap_area_cache *vc;
 
 		vbq = &per_cpu(vmap_block_queue, i);
 		spin_lock_init(&vbq->lock);
 		INIT_LIST_HEAD(&vbq->free);
+
+		vc = &per_cpu(vmap_area_cache, i);
+		spin_lock_init(&vc->lock);
+		for (j = 0; j < VMAP_CACHE_PAGES; j++)
+			INIT_LIST_HEAD(&vc->free[j]);
 	}
 
 	/* Import existing vmlist entries. */
@@ -1190,6 +1509,7 @@ void __init vmalloc_init(void)
 		va->va_end = va->va_start + tmp->size;
 		__insert_vmap_area(va);
 	}
+	vmap_init_free_space();
 
 	vmap_area_pcpu_hole = VMALLOC_END;
 
@@ -2337,7 +2657,7 @@ struct vm_struct **pcpu_get_vm_areas(const unsigned long *offsets,
 {
 	const unsigned long vmalloc_start = ALIGN(VMALLOC_START, align);
 	const unsigned long vmalloc_end = VMALLOC_END & ~(align - 1);
-	struct vmap_area **vas, *prev, *next;
+	struct vmap_area **vas, **spares, *prev, *next;
 	struct vm_struct **vms;
 	int area, area2, last_area, term_area;
 	unsigned long base, start, end, last_end;
@@ -2377,13 +2697,16 @@ struct vm_struct **pcpu_get_vm_areas(const unsigned long *offsets,
 
 	vms = kzalloc(sizeof(vms[0]) * nr_vms, GFP_KERNEL);
 	vas = kzalloc(sizeof(vas[0]) * nr_vms, GFP_KERNEL);
-	if (!vas || !vms)
+	spares = kzalloc(sizeof(spares[0]) * nr_vms, GFP_KERNEL);
+	if (!vas || !vms || !spares)
 		goto err_free2;
 
+	/* each area may cut a free area in two */
 	for (area = 0; area < nr_vms; area++) {
 		vas[area] = kzalloc(sizeof(struct vmap_area), GFP_KERNEL);
 		vms[area] = kzalloc(sizeof(struct vm_struct), GFP_KERNEL);
-		if (!vas[area] || !vms[area])
+		spares[area] = kzalloc(sizeof(struct vmap_area), GFP_KERNEL);
+		if (!vas[area] || !vms[area] || !spares[area])
 			goto err_free;
 	}
 retry:
@@ -2412,6 +2735,7 @@ retry:
 			spin_unlock(&vmap_area_lock);
 			if (!purged) {
 				purge_vmap_area_lazy();
+				vmap_cache_drain();
 				purged = true;
 				goto retry;
 			}
@@ -2456,9 +2780,15 @@ found:
 	/* we've found a fitting base, insert all va's */
 	for (area = 0; area < nr_vms; area++) {
 		struct vmap_area *va = vas[area];
+		struct vmap_area *free_va;
 
 		va->va_start = base + offsets[area];
 		va->va_end = va->va_start + sizes[area];
+
+		free_va = find_free_vmap_area(va->va_start);
+		BUG_ON(!free_va || free_va->va_end < va->va_end);
+		clip_free_vmap_area(free_va, va->va_start, sizes[area],
+				    &spares[area]);
 		__insert_vmap_area(va);
 	}
 
@@ -2466,6 +2796,10 @@ found:
 
 	spin_unlock(&vmap_area_lock);
 
+	for (area = 0; area < nr_vms; area++)
+		kfree(spares[area]);
+	kfree(spares);
+
 	/* insert all vm's */
 	for (area = 0; area < nr_vms; area++)
 		insert_vmalloc_vm(vms[area], vas[area], VM_ALLOC,
@@ -2478,8 +2812,10 @@ err_free:
 	for (area = 0; area < nr_vms; area++) {
 		kfree(vas[area]);
 		kfree(vms[area]);
+		kfree(spares[area]);
 	}
 err_free2:
+	kfree(spares);
 	kfree(vas);
 	kfree(vms);
 	return NULL;
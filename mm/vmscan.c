@@ -28,6 +28,7 @@
 #include <linux/mm_inline.h>
 #include <linux/backing-dev.h>
 #include <linux/rmap.h>
+#include <linux/ksm.h>
 #include <linux/topology.h>
 #include <linux/cpu.h>
 #include <linux/cpuset.h>
@@ -94,6 +95,9 @@ struct scan_control {
 	/* Can pages be swapped as part of reclaim? */
 	int may_swap;
 
+	/* Can memory below the groups' low limits be reclaimed? */
+	int may_thrash;
+
 	int order;
 
 	/*
@@ -234,6 +238,103 @@ static inline int do_shrinker_shrink(struct shrinker *shrinker,
 }
 
 #define SHRINK_BATCH 128
+
+static unsigned long shrink_slab_one(struct shrinker *shrinker,
+				     struct shrink_control *shrink,
+				     unsigned long nr_pages_scanned,
+				     unsigned long lru_pages)
+{
+	unsigned long long delta;
+	unsigned long ret = 0;
+	long total_scan;
+	long max_pass;
+	int shrink_ret = 0;
+	long nr;
+	long new_nr;
+	long batch_size = shrinker->batch ? shrinker->batch
+					  : SHRINK_BATCH;
+
+	max_pass = do_shrinker_shrink(shrinker, shrink, 0);
+	if (max_pass <= 0)
+		return 0;
+
+	/*
+	 * copy the current shrinker scan count into a local variable
+	 * and zero it so that other concurrent shrinker invocations
+	 * don't also do this scanning work.
+	 */
+	nr = atomic_long_xchg(&shrinker->nr_in_batch, 0);
+
+	total_scan = nr;
+	delta = (4 * nr_pages_scanned) / shrinker->seeks;
+	delta *= max_pass;
+	do_div(delta, lru_pages + 1);
+	total_scan += delta;
+	if (total_scan < 0) {
+		printk(KERN_ERR "shrink_slab: %pF negative objects to "
+		       "delete nr=%ld\n",
+		       shrinker->shrink, total_scan);
+		total_scan = max_pass;
+	}
+
+	/*
+	 * We need to avoid excessive windup on filesystem shrinkers
+	 * due to large numbers of GFP_NOFS allocations causing the
+	 * shrinkers to return -1 all the time. This results in a large
+	 * nr being built up so when a shrink that can do some work
+	 * comes along it empties the entire cache due to nr >>>
+	 * max_pass.  This is bad for sustaining a working set in
+	 * memory.
+	 *
+	 * Hence only allow the shrinker to scan the entire cache when
+	 * a large delta change is calculated directly.
+	 */
+	if (delta < max_pass / 4)
+		total_scan = min(total_scan, max_pass / 2);
+
+	/*
+	 * Avoid risking looping forever due to too large nr value:
+	 * never try to free more than twice the estimate number of
+	 * freeable entries.
+	 */
+	if (total_scan > max_pass * 2)
+		total_scan = max_pass * 2;
+
+	trace_mm_shrink_slab_start(shrinker, shrink, nr,
+				nr_pages_scanned, lru_pages,
+				max_pass, delta, total_scan);
+
+	while (total_scan >= batch_size) {
+		int nr_before;
+
+		nr_before = do_shrinker_shrink(shrinker, shrink, 0);
+		shrink_ret = do_shrinker_shrink(shrinker, shrink,
+						batch_size);
+		if (shrink_ret == -1)
+			break;
+		if (shrink_ret < nr_before)
+			ret += nr_before - shrink_ret;
+		count_vm_events(SLABS_SCANNED, batch_size);
+		total_scan -= batch_size;
+
+		cond_resched();
+	}
+
+	/*
+	 * move the unused scan count back into the shrinker in a
+	 * manner that handles concurrent updates. If we exhausted the
+	 * scan, there is no need to do an update.
+	 */
+	if (total_scan > 0)
+		new_nr = atomic_long_add_return(total_scan,
+				&shrinker->nr_in_batch);
+	else
+		new_nr = atomic_long_read(&shrinker->nr_in_batch);
+
+	trace_mm_shrink_slab_end(shrinker, shrink_ret, nr, new_nr);
+	return ret;
+}
+
 /*
  * Call the shrink functions to age shrinkable caches
  *
@@ -251,6 +352,10 @@ static inline int do_shrinker_shrink(struct shrinker *shrinker,
  * are eligible for the caller's allocation attempt.  It is used for balancing
  * slab reclaim versus page reclaim.
  *
+ * NUMA aware shrinkers are called for each node in shrink->nodes_to_scan.
+ * If shrink->memcg is set, only memcg aware shrinkers are called, to
+ * reclaim the objects charged to that memcg.
+ *
  * Returns the number of slab objects which we shrunk.
  */
 unsigned long shrink_slab(struct shrink_control *shrink,
@@ -269,98 +374,62 @@ unsigned long shrink_slab(struct shrink_control *shrink,
 		goto out;
 	}
 
+	nodes_and(shrink->nodes_to_scan, shrink->nodes_to_scan,
+		  node_online_map);
+
 	list_for_each_entry(shrinker, &shrinker_list, list) {
-		unsigned long long delta;
-		long total_scan;
-		long max_pass;
-		int shrink_ret = 0;
-		long nr;
-		long new_nr;
-		long batch_size = shrinker->batch ? shrinker->batch
-						  : SHRINK_BATCH;
-
-		max_pass = do_shrinker_shrink(shrinker, shrink, 0);
-		if (max_pass <= 0)
+		if (shrink->memcg && !(shrinker->flags & SHRINKER_MEMCG_AWARE))
 			continue;
 
-		/*
-		 * copy the current shrinker scan count into a local variable
-		 * and zero it so that other concurrent shrinker invocations
-		 * don't also do this scanning work.
-		 */
-		nr = atomic_long_xchg(&shrinker->nr_in_batch, 0);
-
-		total_scan = nr;
-		delta = (4 * nr_pages_scanned) / shrinker->seeks;
-		delta *= max_pass;
-		do_div(delta, lru_pages + 1);
-		total_scan += delta;
-		if (total_scan < 0) {
-			printk(KERN_ERR "shrink_slab: %pF negative objects to "
-			       "delete nr=%ld\n",
-			       shrinker->shrink, total_scan);
-			total_scan = max_pass;
+		if (!(shrinker->flags & SHRINKER_NUMA_AWARE)) {
+			shrink->nid = 0;
+			ret += shrink_slab_one(shrinker, shrink,
+					       nr_pages_scanned, lru_pages);
+			continue;
 		}
 
-		/*
-		 * We need to avoid excessive windup on filesystem shrinkers
-		 * due to large numbers of GFP_NOFS allocations causing the
-		 * shrinkers to return -1 all the time. This results in a large
-		 * nr being built up so when a shrink that can do some work
-		 * comes along it empties the entire cache due to nr >>>
-		 * max_pass.  This is bad for sustaining a working set in
-		 * memory.
-		 *
-		 * Hence only allow the shrinker to scan the entire cache when
-		 * a large delta change is calculated directly.
-		 */
-		if (delta < max_pass / 4)
-			total_scan = min(total_scan, max_pass / 2);
-
-		/*
-		 * Avoid risking looping forever due to too large nr value:
-		 * never try to free more than twice the estimate number of
-		 * freeable entries.
-		 */
-		if (total_scan > max_pass * 2)
-			total_scan = max_pass * 2;
+		for_each_node_mask(shrink->nid, shrink->nodes_to_scan)
+			ret += shrink_slab_one(shrinker, shrink,
+					       nr_pages_scanned, lru_pages);
+	}
+	up_read(&shrinker_rwsem);
+out:
+	cond_resched();
+	return ret;
+}
 
-		trace_mm_shrink_slab_start(shrinker, shrink, nr,
-					nr_pages_scanned, lru_pages,
-					max_pass, delta, total_scan);
+/*
+ * Shrink the slab caches on behalf of reclaim in @root's hierarchy, or of
+ * global reclaim if @root is NULL. Global reclaim also shrinks the global
+ * lists and the caches that do not know about memcgs; then the objects
+ * of every memcg that accounts kernel memory are shrunk in turn.
+ */
+unsigned long shrink_slab_memcg(struct shrink_control *shrink,
+				struct mem_cgroup *root,
+				unsigned long nr_pages_scanned,
+				unsigned long lru_pages)
+{
+	struct mem_cgroup *memcg;
+	unsigned long ret = 0;
 
-		while (total_scan >= batch_size) {
-			int nr_before;
+	if (!root) {
+		shrink->memcg = NULL;
+		ret += shrink_slab(shrink, nr_pages_scanned, lru_pages);
+	}
 
-			nr_before = do_shrinker_shrink(shrinker, shrink, 0);
-			shrink_ret = do_shrinker_shrink(shrinker, shrink,
-							batch_size);
-			if (shrink_ret == -1)
-				break;
-			if (shrink_ret < nr_before)
-				ret += nr_before - shrink_ret;
-			count_vm_events(SLABS_SCANNED, batch_size);
-			total_scan -= batch_size;
+	if (!memcg_kmem_enabled())
+		return ret;
 
-			cond_resched();
+	memcg = mem_cgroup_iter(root, NULL, NULL);
+	do {
+		if (memcg_kmem_is_active(memcg)) {
+			shrink->memcg = memcg;
+			ret += shrink_slab(shrink, nr_pages_scanned, lru_pages);
 		}
+		memcg = mem_cgroup_iter(root, memcg, NULL);
+	} while (memcg);
+	shrink->memcg = NULL;
 
-		/*
-		 * move the unused scan count back into the shrinker in a
-		 * manner that handles concurrent updates. If we exhausted the
-		 * scan, there is no need to do an update.
-		 */
-		if (total_scan > 0)
-			new_nr = atomic_long_add_return(total_scan,
-					&shrinker->nr_in_batch);
-		else
-			new_nr = atomic_long_read(&shrinker->nr_in_batch);
-
-		trace_mm_shrink_slab_end(shrinker, shrink_ret, nr, new_nr);
-	}
-	up_read(&shrinker_rwsem);
-out:
-	cond_resched();
 	return ret;
 }
 
@@ -536,7 +605,8 @@ static pageout_t pageout(struct page *page, struct address_space *mapping,
  * Same as remove_mapping, but if the page is removed from the mapping, it
  * gets returned with a refcount of 0.
  */
-static int __remove_mapping(struct address_space *mapping, struct page *page)
+static int __remove_mapping(struct address_space *mapping, struct page *page,
+			    bool reclaimed)
 {
 	BUG_ON(!PageLocked(page));
 	BUG_ON(mapping != page_mapping(page));
@@ -582,10 +652,23 @@ static int __remove_mapping(struct address_space *mapping, struct page *page)
 		swapcache_free(swap, page);
 	} else {
 		void (*freepage)(struct page *);
+		void *shadow = NULL;
 
 		freepage = mapping->a_ops->freepage;
-
-		__delete_from_page_cache(page);
+		/*
+		 * Remember a shadow entry for reclaimed file cache in
+		 * order to detect refaults, thus thrashing, later on.
+		 *
+		 * But don't store shadows in an address space that is
+		 * already exiting.  This is not just an optimization,
+		 * inode reclaim needs to empty out the radix tree or
+		 * the nodes are lost.  Don't plant shadows behind its
+		 * back.
+		 */
+		if (reclaimed && page_is_file_cache(page) &&
+		    !mapping_exiting(mapping))
+			shadow = workingset_eviction(mapping, page);
+		__delete_from_page_cache(page, shadow);
 		spin_unlock_irq(&mapping->tree_lock);
 		mem_cgroup_uncharge_cache_page(page);
 
@@ -608,7 +691,7 @@ cannot_free:
  */
 int remove_mapping(struct address_space *mapping, struct page *page)
 {
-	if (__remove_mapping(mapping, page)) {
+	if (__remove_mapping(mapping, page, false)) {
 		/*
 		 * Unfreezing the refcount with 1 rather than 2 effectively
 		 * drops the pagecache ref for us without requiring another
@@ -839,6 +922,37 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			; /* try to reclaim the page below */
 		}
 
+		/*
+		 * MADV_FREE clears PG_swapbacked of the anonymous pages it
+		 * cleans.  One that was not written to since can be thrown
+		 * away without any I/O; one that was is in use again, and
+		 * goes back to the anon lists to be swapped out later.
+		 */
+		if (PageAnon(page) && !PageSwapBacked(page)) {
+			int ret = SWAP_DIRTY;
+
+			if (!PageDirty(page) && !PageKsm(page))
+				ret = try_to_unmap(page, TTU_UNMAP|TTU_LAZYFREE);
+			switch (ret) {
+			case SWAP_FAIL:
+				goto activate_locked;
+			case SWAP_AGAIN:
+				goto keep_locked;
+			case SWAP_MLOCK:
+				goto cull_mlocked;
+			case SWAP_SUCCESS:
+				/* Only a speculative reference can be left */
+				if (!page_freeze_refs(page, 1))
+					goto keep_locked;
+				count_vm_event(PGLAZYFREED);
+				__clear_page_locked(page);
+				goto free_it;
+			case SWAP_DIRTY:
+				SetPageSwapBacked(page);
+				goto activate_locked;
+			}
+		}
+
 		/*
 		 * Anonymous process memory has backing store?
 		 * Try to allocate it some swap space here.
@@ -858,7 +972,7 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		 * processes. Try to unmap it here.
 		 */
 		if (page_mapped(page) && mapping) {
-			switch (try_to_unmap(page, TTU_UNMAP)) {
+			switch (try_to_unmap(page, TTU_UNMAP|TTU_BATCH_FLUSH)) {
 			case SWAP_FAIL:
 				goto activate_locked;
 			case SWAP_AGAIN:
@@ -899,7 +1013,12 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			if (!sc->may_writepage)
 				goto keep_locked;
 
-			/* Page is dirty, try to write it out here */
+			/*
+			 * Page is dirty. Flush the TLB if a writable entry
+			 * potentially exists to avoid CPU writes after IO
+			 * starts and then write it out here.
+			 */
+			try_to_unmap_flush_dirty();
 			switch (pageout(page, mapping, sc)) {
 			case PAGE_KEEP:
 				nr_congested++;
@@ -968,7 +1087,7 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			}
 		}
 
-		if (!mapping || !__remove_mapping(mapping, page))
+		if (!mapping || !__remove_mapping(mapping, page, true))
 			goto keep_locked;
 
 		/*
@@ -1022,6 +1141,7 @@ keep_lumpy:
 	if (nr_dirty && nr_dirty == nr_congested && global_reclaim(sc))
 		zone_set_flag(mz->zone, ZONE_CONGESTED);
 
+	try_to_unmap_flush();
 	free_hot_cold_page_list(&free_pages, 1);
 
 	list_splice(&ret_pages, page_list);
@@ -2149,8 +2269,20 @@ static void shrink_zone(int priority, struct zone *zone,
 			.mem_cgroup = memcg,
 			.zone = zone,
 		};
+		unsigned long scanned = sc->nr_scanned;
+		unsigned long reclaimed = sc->nr_reclaimed;
+		bool low = mem_cgroup_low(root, memcg);
+
+		/*
+		 * Memory below the low limits is left alone for as long
+		 * as there is anything else to reclaim.
+		 */
+		if (low && !sc->may_thrash)
+			goto next;
 
 		shrink_mem_cgroup_zone(priority, &mz, sc);
+		mem_cgroup_count_reclaim(memcg, sc->nr_scanned - scanned,
+					 sc->nr_reclaimed - reclaimed, low);
 		/*
 		 * Limit reclaim has historically picked one memcg and
 		 * scanned it with decreasing priority levels until
@@ -2165,6 +2297,7 @@ static void shrink_zone(int priority, struct zone *zone,
 			mem_cgroup_iter_break(root, memcg);
 			break;
 		}
+next:
 		memcg = mem_cgroup_iter(root, memcg, &reclaim);
 	} while (memcg);
 }
@@ -2349,7 +2482,7 @@ static unsigned long do_try_to_free_pages(struct zonelist *zonelist,
 
 	if (global_reclaim(sc))
 		count_vm_event(ALLOCSTALL);
-
+retry:
 	for (priority = DEF_PRIORITY; priority >= 0; priority--) {
 		sc->nr_scanned = 0;
 		if (!priority)
@@ -2357,20 +2490,33 @@ static unsigned long do_try_to_free_pages(struct zonelist *zonelist,
 		aborted_reclaim = shrink_zones(priority, zonelist, sc);
 
 		/*
-		 * Don't shrink slabs when reclaiming memory from
-		 * over limit cgroups
+		 * Over limit cgroups only shrink the slab objects charged to
+		 * them, and only if they account kernel memory.
 		 */
 		if (global_reclaim(sc)) {
 			unsigned long lru_pages = 0;
+
+			nodes_clear(shrink->nodes_to_scan);
 			for_each_zone_zonelist(zone, z, zonelist,
 					gfp_zone(sc->gfp_mask)) {
 				if (!cpuset_zone_allowed_hardwall(zone, GFP_KERNEL))
 					continue;
 
 				lru_pages += zone_reclaimable_pages(zone);
+				node_set(zone_to_nid(zone), shrink->nodes_to_scan);
 			}
 
-			shrink_slab(shrink, sc->nr_scanned, lru_pages);
+			shrink_slab_memcg(shrink, NULL, sc->nr_scanned, lru_pages);
+			if (reclaim_state) {
+				sc->nr_reclaimed += reclaim_state->reclaimed_slab;
+				reclaim_state->reclaimed_slab = 0;
+			}
+		} else if (memcg_kmem_is_active(sc->target_mem_cgroup)) {
+			struct mem_cgroup *memcg = sc->target_mem_cgroup;
+
+			shrink->nodes_to_scan = node_states[N_HIGH_MEMORY];
+			shrink_slab_memcg(shrink, memcg, sc->nr_scanned,
+					  mem_cgroup_usage_pages(memcg));
 			if (reclaim_state) {
 				sc->nr_reclaimed += reclaim_state->reclaimed_slab;
 				reclaim_state->reclaimed_slab = 0;
@@ -2406,6 +2552,12 @@ static unsigned long do_try_to_free_pages(struct zonelist *zonelist,
 		}
 	}
 
+	/* Only memory under low limits left?  Reclaim it rather than OOM */
+	if (!sc->nr_reclaimed && !aborted_reclaim && !sc->may_thrash) {
+		sc->may_thrash = 1;
+		goto retry;
+	}
+
 out:
 	delayacct_freepages_end();
 
@@ -2694,6 +2846,8 @@ static unsigned long balance_pgdat(pg_data_t *pgdat, int order,
 	struct shrink_control shrink = {
 		.gfp_mask = sc.gfp_mask,
 	};
+
+	node_set(pgdat->node_id, shrink.nodes_to_scan);
 loop_again:
 	total_scanned = 0;
 	sc.nr_reclaimed = 0;
@@ -2823,7 +2977,8 @@ loop_again:
 				shrink_zone(priority, zone, &sc);
 
 				reclaim_state->reclaimed_slab = 0;
-				nr_slab = shrink_slab(&shrink, sc.nr_scanned, lru_pages);
+				nr_slab = shrink_slab_memcg(&shrink, NULL,
+						sc.nr_scanned, lru_pages);
 				sc.nr_reclaimed += reclaim_state->reclaimed_slab;
 				total_scanned += sc.nr_scanned;
 
@@ -2893,6 +3048,16 @@ loop_again:
 		if (sc.nr_reclaimed >= SWAP_CLUSTER_MAX)
 			break;
 	}
+
+	/*
+	 * Only memory under low limits left?  Reclaim it too rather than
+	 * going around forever: skipped memcgs don't count as scanned, so
+	 * the zones would never be found all_unreclaimable.
+	 */
+	if (priority < 0 && !sc.nr_reclaimed && !sc.may_thrash) {
+		sc.may_thrash = 1;
+		goto loop_again;
+	}
 out:
 
 	/*
@@ -3401,6 +3566,7 @@ static int __zone_reclaim(struct zone *zone, gfp_t gfp_mask, unsigned int order)
 	};
 	unsigned long nr_slab_pages0, nr_slab_pages1;
 
+	node_set(zone_to_nid(zone), shrink.nodes_to_scan);
 	cond_resched();
 	/*
 	 * We need to be able to allocate from the reserves for RECLAIM_SWAP
@@ -3440,7 +3606,8 @@ static int __zone_reclaim(struct zone *zone, gfp_t gfp_mask, unsigned int order)
 			unsigned long lru_pages = zone_reclaimable_pages(zone);
 
 			/* No reclaimable slab or very low memory pressure */
-			if (!shrink_slab(&shrink, sc.nr_scanned, lru_pages))
+			if (!shrink_slab_memcg(&shrink, NULL, sc.nr_scanned,
+					       lru_pages))
 				break;
 
 			/* Freed enough memory */
@@ -462,6 +462,7 @@ void refresh_cpu_vm_stats(int cpu)
 #endif
 			}
 		cond_resched();
+		decay_pcp_high(zone, &p->pcp);
 #ifdef CONFIG_NUMA
 		/*
 		 * Deal with draining the remote pageset of this
@@ -554,7 +555,7 @@ static void fill_contig_page_info(struct zone *zone,
 		unsigned long blocks;
 
 		/* Count number of free blocks */
-		blocks = zone->free_area[order].nr_free;
+		blocks = zone_free_area_nr(zone, order);
 		info->free_blocks_total += blocks;
 
 		/* Count free base pages */
@@ -652,9 +653,9 @@ static void walk_zones_in_node(struct seq_file *m, pg_data_t *pgdat,
 		if (!populated_zone(zone))
 			continue;
 
-		spin_lock_irqsave(&zone->lock, flags);
+		zone_lock_shards_irqsave(zone, flags);
 		print(m, pgdat, zone);
-		spin_unlock_irqrestore(&zone->lock, flags);
+		zone_unlock_shards_irqrestore(zone, flags);
 	}
 }
 #endif
@@ -718,6 +719,9 @@ const char * const vmstat_text[] = {
 	"numa_local",
 	"numa_other",
 #endif
+	"workingset_refault",
+	"workingset_activate",
+	"workingset_nodereclaim",
 	"nr_anon_transparent_hugepages",
 	"nr_dirty_threshold",
 	"nr_dirty_background_threshold",
@@ -756,6 +760,20 @@ const char * const vmstat_text[] = {
 	"allocstall",
 
 	"pgrotated",
+	"pglazyfree",
+	"pglazyfreed",
+
+#ifdef CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH
+	"tlb_unmap_deferred",
+	"tlb_unmap_batch_flush",
+#endif
+
+#ifdef CONFIG_SWAP
+	"swap_alloc_lock",
+	"swap_alloc_lock_ns",
+	"swap_free_lock",
+	"swap_free_lock_ns",
+#endif
 
 #ifdef CONFIG_COMPACTION
 	"compact_blocks_moved",
@@ -800,7 +818,7 @@ static void frag_show_print(struct seq_file *m, pg_data_t *pgdat,
 
 	seq_printf(m, "Node %d, zone %8s ", pgdat->node_id, zone->name);
 	for (order = 0; order < MAX_ORDER; ++order)
-		seq_printf(m, "%6lu ", zone->free_area[order].nr_free);
+		seq_printf(m, "%6lu ", zone_free_area_nr(zone, order));
 	seq_putc(m, '\n');
 }
 
@@ -826,13 +844,13 @@ static void pagetypeinfo_showfree_print(struct seq_file *m,
 					migratetype_names[mtype]);
 		for (order = 0; order < MAX_ORDER; ++order) {
 			unsigned long freecount = 0;
-			struct free_area *area;
+			struct zone_shard *shard;
 			struct list_head *curr;
 
-			area = &(zone->free_area[order]);
-
-			list_for_each(curr, &area->free_list[mtype])
-				freecount++;
+			for_each_zone_shard(shard, zone)
+				list_for_each(curr,
+				    &shard->free_area[order].free_list[mtype])
+					freecount++;
 			seq_printf(m, "%6lu ", freecount);
 		}
 		seq_putc(m, '\n');
@@ -1004,11 +1022,13 @@ static void zoneinfo_show_print(struct seq_file *m, pg_data_t *pgdat,
 		seq_printf(m,
 			   "\n    cpu: %i"
 			   "\n              count: %i"
-			   "\n              high:  %i"
+			   "\n              high:  %i (%i-%i)"
 			   "\n              batch: %i",
 			   i,
 			   pageset->pcp.count,
 			   pageset->pcp.high,
+			   pageset->pcp.high_min,
+			   pageset->pcp.high_max,
 			   pageset->pcp.batch);
 #ifdef CONFIG_SMP
 		seq_printf(m, "\n  vm stats threshold: %d",
@@ -1018,10 +1038,12 @@ static void zoneinfo_show_print(struct seq_file *m, pg_data_t *pgdat,
 	seq_printf(m,
 		   "\n  all_unreclaimable: %u"
 		   "\n  start_pfn:         %lu"
-		   "\n  inactive_ratio:    %u",
+		   "\n  inactive_ratio:    %u"
+		   "\n  free list shards:  %u",
 		   zone->all_unreclaimable,
 		   zone->zone_start_pfn,
-		   zone->inactive_ratio);
+		   zone->inactive_ratio,
+		   zone->nr_shards);
 	seq_putc(m, '\n');
 }
 
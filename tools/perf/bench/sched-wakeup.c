@@ -0,0 +1,193 @@
+/*
+ *
+ * sched-wakeup.c
+ *
+ * wakeup: Benchmark for the latency of waking up sleeping tasks
+ *
+ * A waker thread wakes up a number of sleeping threads at once, each
+ * through its own pipe, and waits for all of them to have run before
+ * the next round.  Every woken thread measures the time between the
+ * write of the waker and its return from read(), so the placement of
+ * the wakees on idle cpus is part of what is measured.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+
+static int nr_threads = 4;
+static int loops = 100000;
+
+static const struct option options[] = {
+	OPT_INTEGER('t', "threads", &nr_threads,
+		    "Specify number of threads woken up at once"),
+	OPT_INTEGER('l', "loop", &loops,
+		    "Specify number of loops"),
+	OPT_END()
+};
+
+static const char * const bench_sched_wakeup_usage[] = {
+	"perf bench sched wakeup <options>",
+	NULL
+};
+
+struct wakee {
+	pthread_t thread;
+	int wake_fds[2];
+	int done_fd;
+	u64 total_nsec;
+	u64 max_nsec;
+};
+
+static void barf(const char *msg)
+{
+	fprintf(stderr, "%s (error: %s)\n", msg, strerror(errno));
+	exit(1);
+}
+
+static u64 now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *wakee_thread(void *arg)
+{
+	struct wakee *w = arg;
+	u64 sent, delta;
+	char dummy = 0;
+	int i;
+
+	for (i = 0; i < loops; i++) {
+		if (read(w->wake_fds[0], &sent, sizeof(sent)) != sizeof(sent))
+			barf("wakee: read");
+
+		delta = now_nsec() - sent;
+		w->total_nsec += delta;
+		if (delta > w->max_nsec)
+			w->max_nsec = delta;
+
+		if (write(w->done_fd, &dummy, 1) != 1)
+			barf("wakee: write");
+	}
+	return NULL;
+}
+
+int bench_sched_wakeup(int argc, const char **argv,
+		       const char *prefix __used)
+{
+	struct timeval start, stop, diff;
+	struct wakee *wakees;
+	u64 total_nsec = 0, max_nsec = 0, nr_wakeups;
+	unsigned long long result_usec;
+	int done_fds[2];
+	char dummy;
+	int i, j;
+
+	argc = parse_options(argc, argv, options,
+			     bench_sched_wakeup_usage, 0);
+
+	if (nr_threads <= 0 || loops <= 0) {
+		usage_with_options(bench_sched_wakeup_usage, options);
+		exit(1);
+	}
+
+	wakees = calloc(nr_threads, sizeof(*wakees));
+	if (!wakees)
+		barf("calloc");
+
+	if (pipe(done_fds))
+		barf("pipe()");
+
+	for (i = 0; i < nr_threads; i++) {
+		struct wakee *w = &wakees[i];
+
+		if (pipe(w->wake_fds))
+			barf("pipe()");
+		w->done_fd = done_fds[1];
+		if (pthread_create(&w->thread, NULL, wakee_thread, w))
+			barf("pthread_create");
+	}
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < loops; i++) {
+		for (j = 0; j < nr_threads; j++) {
+			u64 sent = now_nsec();
+
+			if (write(wakees[j].wake_fds[1], &sent,
+				  sizeof(sent)) != sizeof(sent))
+				barf("waker: write");
+		}
+		for (j = 0; j < nr_threads; j++) {
+			if (read(done_fds[0], &dummy, 1) != 1)
+				barf("waker: read");
+		}
+	}
+
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	for (i = 0; i < nr_threads; i++) {
+		struct wakee *w = &wakees[i];
+
+		if (pthread_join(w->thread, NULL))
+			barf("pthread_join");
+		total_nsec += w->total_nsec;
+		if (w->max_nsec > max_nsec)
+			max_nsec = w->max_nsec;
+		close(w->wake_fds[0]);
+		close(w->wake_fds[1]);
+	}
+	close(done_fds[0]);
+	close(done_fds[1]);
+	free(wakees);
+
+	nr_wakeups = (u64)loops * nr_threads;
+	result_usec = diff.tv_sec * 1000000ULL + diff.tv_usec;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# Executed %" PRIu64 " wakeups of %d threads\n\n",
+		       nr_wakeups, nr_threads);
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec/1000));
+
+		printf(" %14lf usecs/wakeup (average latency)\n",
+		       (double)total_nsec / (double)nr_wakeups / 1000.0);
+		printf(" %14lf usecs/wakeup (maximum latency)\n",
+		       (double)max_nsec / 1000.0);
+		printf(" %14d wakeups/sec\n",
+		       (int)((double)nr_wakeups /
+			     ((double)result_usec / (double)1000000)));
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lf\n", (double)total_nsec / (double)nr_wakeups / 1000.0);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
@@ -42,6 +42,9 @@ static struct bench_suite sched_suites[] = {
 	{ "pipe",
 	  "Flood of communication over pipe() between two processes",
 	  bench_sched_pipe      },
+	{ "wakeup",
+	  "Latency of waking up several sleeping threads at once",
+	  bench_sched_wakeup    },
 	suite_all,
 	{ NULL,
 	  NULL,
@@ -0,0 +1,319 @@
+/*
+ * Tests for SCHED_DEADLINE and the sched_setattr(2)/sched_getattr(2)
+ * system calls.
+ *
+ * Checks the validation of the parameters, that -deadline tasks cannot
+ * fork unless they ask for their children to be reset, that the
+ * admission control refuses more bandwidth than the cpus can give and
+ * that a task is throttled once it has used up its runtime.
+ *
+ * Everything but the parameter checks needs CAP_SYS_NICE.
+ *
+ * This program is released under the GPL, version 2.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+/* Not in the libc headers yet */
+#ifdef __x86_64__
+#define NR_sched_setattr 313
+#define NR_sched_getattr 314
+#elif defined(__i386__)
+#define NR_sched_setattr 350
+#define NR_sched_getattr 351
+#else
+#error "missing NR_sched_setattr definition"
+#endif
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE		6
+#endif
+#define SCHED_FLAG_RESET_ON_FORK	0x01
+
+struct sched_attr {
+	uint32_t size;
+	uint32_t sched_policy;
+	uint64_t sched_flags;
+	int32_t sched_nice;
+	uint32_t sched_priority;
+	uint64_t sched_runtime;
+	uint64_t sched_deadline;
+	uint64_t sched_period;
+};
+
+#define MSEC	1000000ULL
+
+static int sched_setattr(pid_t pid, struct sched_attr *attr)
+{
+	return syscall(NR_sched_setattr, pid, attr, 0);
+}
+
+static int sched_getattr(pid_t pid, struct sched_attr *attr)
+{
+	return syscall(NR_sched_getattr, pid, attr, sizeof(*attr), 0);
+}
+
+static void dl_attr(struct sched_attr *attr, uint64_t runtime,
+		    uint64_t deadline, uint64_t period)
+{
+	memset(attr, 0, sizeof(*attr));
+	attr->size = sizeof(*attr);
+	attr->sched_policy = SCHED_DEADLINE;
+	attr->sched_runtime = runtime;
+	attr->sched_deadline = deadline;
+	attr->sched_period = period;
+}
+
+static int expect_error(const char *what, int ret, int err)
+{
+	if (ret == -1 && errno == err)
+		return 0;
+	fprintf(stderr, "%s: returned %d (%s), expected %s\n", what, ret,
+		ret ? strerror(errno) : "success", strerror(err));
+	return 1;
+}
+
+static int test_params(void)
+{
+	struct sched_param param = { .sched_priority = 0 };
+	struct sched_attr attr;
+	int err = 0;
+
+	memset(&attr, 0, sizeof(attr));
+	if (sched_getattr(0, &attr)) {
+		perror("sched_getattr");
+		return 1;
+	}
+	if (attr.size != sizeof(attr) || attr.sched_policy != SCHED_OTHER) {
+		fprintf(stderr, "sched_getattr: size %u policy %u\n",
+			attr.size, attr.sched_policy);
+		err = 1;
+	}
+
+	/* runtime > deadline */
+	dl_attr(&attr, 20 * MSEC, 10 * MSEC, 30 * MSEC);
+	err |= expect_error("runtime > deadline", sched_setattr(0, &attr),
+			    EINVAL);
+
+	/* deadline > period */
+	dl_attr(&attr, 10 * MSEC, 40 * MSEC, 30 * MSEC);
+	err |= expect_error("deadline > period", sched_setattr(0, &attr),
+			    EINVAL);
+
+	/* below the 1us resolution */
+	dl_attr(&attr, 100, 10 * MSEC, 30 * MSEC);
+	err |= expect_error("runtime < 1us", sched_setattr(0, &attr), EINVAL);
+
+	dl_attr(&attr, 10 * MSEC, 30 * MSEC, 30 * MSEC);
+	err |= expect_error("flags", syscall(NR_sched_setattr, 0, &attr, 1),
+			    EINVAL);
+
+	/* the old interface has no room for the parameters */
+	err |= expect_error("sched_setscheduler",
+			    sched_setscheduler(0, SCHED_DEADLINE, &param),
+			    EINVAL);
+
+	return err;
+}
+
+static int test_fork(void)
+{
+	struct sched_attr attr;
+	pid_t pid;
+	int err = 0, status;
+
+	dl_attr(&attr, 10 * MSEC, 30 * MSEC, 30 * MSEC);
+	if (sched_setattr(0, &attr)) {
+		perror("sched_setattr");
+		return 1;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	if (sched_getattr(0, &attr)) {
+		perror("sched_getattr");
+		return 1;
+	}
+	if (attr.sched_policy != SCHED_DEADLINE ||
+	    attr.sched_runtime != 10 * MSEC ||
+	    attr.sched_deadline != 30 * MSEC ||
+	    attr.sched_period != 30 * MSEC) {
+		fprintf(stderr, "sched_getattr: policy %u %llu/%llu/%llu\n",
+			attr.sched_policy,
+			(unsigned long long)attr.sched_runtime,
+			(unsigned long long)attr.sched_deadline,
+			(unsigned long long)attr.sched_period);
+		err = 1;
+	}
+
+	pid = fork();
+	if (!pid)
+		_exit(0);
+	if (pid > 0)
+		waitpid(pid, NULL, 0);
+	err |= expect_error("fork", pid, EAGAIN);
+
+	attr.sched_flags = SCHED_FLAG_RESET_ON_FORK;
+	if (sched_setattr(0, &attr)) {
+		perror("sched_setattr");
+		return 1;
+	}
+	pid = fork();
+	if (!pid)
+		_exit(sched_getscheduler(0) != SCHED_OTHER);
+	if (pid < 0) {
+		perror("fork with reset-on-fork");
+		return 1;
+	}
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+	    WEXITSTATUS(status)) {
+		fprintf(stderr, "child was not reset to SCHED_OTHER\n");
+		err = 1;
+	}
+
+	return err;
+}
+
+static uint64_t clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Spin for a second with a 10% reservation; being throttled at the end
+ * of each runtime, we must get far less than the whole cpu.
+ */
+static int test_throttle(void)
+{
+	struct sched_attr attr;
+	uint64_t start, cpu_start, wall, cpu;
+
+	dl_attr(&attr, 10 * MSEC, 100 * MSEC, 100 * MSEC);
+	if (sched_setattr(0, &attr)) {
+		perror("sched_setattr");
+		return 1;
+	}
+
+	start = clock_ns(CLOCK_MONOTONIC);
+	cpu_start = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+	do {
+		wall = clock_ns(CLOCK_MONOTONIC) - start;
+	} while (wall < 1000 * MSEC);
+	cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+
+	if (cpu > wall / 5) {
+		fprintf(stderr, "ran %llu ms out of %llu ms with a 10%% "
+			"reservation\n", (unsigned long long)(cpu / MSEC),
+			(unsigned long long)(wall / MSEC));
+		return 1;
+	}
+	return 0;
+}
+
+static long read_rt_runtime(void)
+{
+	FILE *f = fopen("/proc/sys/kernel/sched_rt_runtime_us", "r");
+	long runtime = -1;
+
+	if (f) {
+		if (fscanf(f, "%ld", &runtime) != 1)
+			runtime = -1;
+		fclose(f);
+	}
+	return runtime;
+}
+
+/*
+ * Make sleeping children -deadline tasks with half a cpu each until the
+ * admission control says no; it must do so before twice as many as
+ * there are cpus have been admitted.
+ */
+static int test_admission(void)
+{
+	long i, nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	long max = 2 * nr_cpus + 1;
+	struct sched_attr attr;
+	pid_t *pids;
+	int err = 1, ret = 0;
+
+	if (read_rt_runtime() < 0) {
+		printf("admission control disabled, skipped\n");
+		return 0;
+	}
+
+	pids = calloc(max, sizeof(*pids));
+	if (!pids) {
+		perror("calloc");
+		return 1;
+	}
+
+	dl_attr(&attr, 50 * MSEC, 100 * MSEC, 100 * MSEC);
+	for (i = 0; i < max; i++) {
+		pids[i] = fork();
+		if (!pids[i]) {
+			pause();
+			_exit(0);
+		}
+		if (pids[i] < 0) {
+			perror("fork");
+			break;
+		}
+		ret = sched_setattr(pids[i], &attr);
+		if (ret)
+			break;
+	}
+
+	if (ret)
+		err = expect_error("admission control", ret, EBUSY);
+	else
+		fprintf(stderr, "admitted %ld tasks with half a cpu each on "
+			"%ld cpus\n", i, nr_cpus);
+
+	if (i == max)
+		i--;
+	for (; i >= 0; i--) {
+		if (pids[i] <= 0)
+			continue;
+		kill(pids[i], SIGKILL);
+		waitpid(pids[i], NULL, 0);
+	}
+	free(pids);
+
+	return err;
+}
+
+int main(void)
+{
+	int err = 0;
+
+	err |= test_params();
+
+	if (geteuid()) {
+		printf("not root, skipping the SCHED_DEADLINE tests\n");
+		return err;
+	}
+
+	/* Before becoming a -deadline task ourselves */
+	err |= test_admission();
+	err |= test_fork();
+	err |= test_throttle();
+
+	if (err)
+		printf("[FAIL]\n");
+	else
+		printf("[PASS]\n");
+	return err;
+}
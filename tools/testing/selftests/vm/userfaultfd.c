@@ -0,0 +1,184 @@
+/*
+ * Stress test for userfaultfd(2).
+ *
+ * A private anonymous area is registered on a userfaultfd and every
+ * page of it is touched by the main thread, while a second thread
+ * reads the faults from the userfaultfd and resolves them with
+ * UFFDIO_COPY, filling each page with its own page number, or with
+ * UFFDIO_ZEROPAGE for every other page.  The test then checks that
+ * each page holds what userland put there and that every page faulted
+ * exactly once.
+ *
+ * This program is released under the GPL, version 2.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include "../../../../include/linux/userfaultfd.h"
+
+/* Not in the libc headers yet */
+#ifdef __x86_64__
+#define NR_userfaultfd 312
+#elif defined(__i386__)
+#define NR_userfaultfd 349
+#else
+#error "missing NR_userfaultfd definition"
+#endif
+
+#define NR_PAGES	1024
+
+static unsigned long page_size;
+static char *area, *src_page;
+static int uffd;
+static unsigned long nr_faults;
+
+static int resolve_fault(unsigned long address)
+{
+	unsigned long nr = (address - (unsigned long)area) / page_size;
+
+	if (nr & 1) {
+		struct uffdio_zeropage zp;
+
+		zp.range.start = address & ~(page_size - 1);
+		zp.range.len = page_size;
+		zp.mode = 0;
+		if (ioctl(uffd, UFFDIO_ZEROPAGE, &zp) ||
+		    zp.zeropage != (__s64)page_size) {
+			perror("UFFDIO_ZEROPAGE");
+			return 1;
+		}
+	} else {
+		struct uffdio_copy copy;
+
+		memset(src_page, 0, page_size);
+		*(unsigned long *)src_page = nr;
+		copy.dst = address & ~(page_size - 1);
+		copy.src = (unsigned long)src_page;
+		copy.len = page_size;
+		copy.mode = 0;
+		if (ioctl(uffd, UFFDIO_COPY, &copy) ||
+		    copy.copy != (__s64)page_size) {
+			perror("UFFDIO_COPY");
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void *uffd_thread(void *arg __attribute__((unused)))
+{
+	struct uffd_msg msg;
+	struct pollfd pfd;
+
+	pfd.fd = uffd;
+	pfd.events = POLLIN;
+	while (nr_faults < NR_PAGES) {
+		if (poll(&pfd, 1, -1) < 0) {
+			perror("poll");
+			exit(1);
+		}
+		if (read(uffd, &msg, sizeof(msg)) != sizeof(msg)) {
+			if (errno == EAGAIN)
+				continue;
+			perror("read");
+			exit(1);
+		}
+		if (msg.event != UFFD_EVENT_PAGEFAULT) {
+			fprintf(stderr, "unexpected event %u\n", msg.event);
+			exit(1);
+		}
+		if (resolve_fault(msg.arg.pagefault.address))
+			exit(1);
+		nr_faults++;
+	}
+	return NULL;
+}
+
+int main(void)
+{
+	struct uffdio_api api;
+	struct uffdio_register reg;
+	struct uffdio_range range;
+	pthread_t thread;
+	unsigned long nr;
+	int err = 0;
+
+	page_size = sysconf(_SC_PAGE_SIZE);
+
+	uffd = syscall(NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+	if (uffd < 0) {
+		perror("userfaultfd");
+		return 1;
+	}
+	api.api = UFFD_API;
+	api.features = 0;
+	if (ioctl(uffd, UFFDIO_API, &api)) {
+		perror("UFFDIO_API");
+		return 1;
+	}
+
+	area = mmap(NULL, NR_PAGES * page_size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	src_page = malloc(page_size);
+	if (area == MAP_FAILED || !src_page) {
+		perror("mmap");
+		return 1;
+	}
+
+	reg.range.start = (unsigned long)area;
+	reg.range.len = NR_PAGES * page_size;
+	reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+	if (ioctl(uffd, UFFDIO_REGISTER, &reg)) {
+		perror("UFFDIO_REGISTER");
+		return 1;
+	}
+	if ((reg.ioctls & UFFD_API_RANGE_IOCTLS) != UFFD_API_RANGE_IOCTLS) {
+		fprintf(stderr, "unexpected range ioctls %llx\n",
+			(unsigned long long)reg.ioctls);
+		return 1;
+	}
+
+	if (pthread_create(&thread, NULL, uffd_thread, NULL)) {
+		perror("pthread_create");
+		return 1;
+	}
+
+	for (nr = 0; nr < NR_PAGES; nr++) {
+		unsigned long expect = nr & 1 ? 0 : nr;
+
+		if (*(unsigned long *)(area + nr * page_size) != expect) {
+			fprintf(stderr, "page %lu has wrong contents\n", nr);
+			err = 1;
+		}
+	}
+
+	if (pthread_join(thread, NULL)) {
+		perror("pthread_join");
+		return 1;
+	}
+	if (nr_faults != NR_PAGES) {
+		fprintf(stderr, "%lu faults for %d pages\n",
+			nr_faults, NR_PAGES);
+		err = 1;
+	}
+
+	range.start = (unsigned long)area;
+	range.len = NR_PAGES * page_size;
+	if (ioctl(uffd, UFFDIO_UNREGISTER, &range)) {
+		perror("UFFDIO_UNREGISTER");
+		err = 1;
+	}
+
+	printf("%lu userfaults resolved\n", nr_faults);
+	return err;
+}